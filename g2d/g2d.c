@@ -15,10 +15,16 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/time.h>
 #include <pthread.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
 #include <linux/pxp_device.h>
 #include "g2d.h"
+#include "g2d_cpu.h"
 
 #define PXP_DEV_NAME "/dev/pxp_device"
 #define g2d_printf printf
@@ -26,27 +32,293 @@
 static int fd = -1;
 static int open_count;
 static pthread_spinlock_t lock;
+static pthread_once_t lock_once = PTHREAD_ONCE_INIT;
+/* serializes g2d_open and g2d_close, guards fd, open_count and the channels */
+static pthread_mutex_t open_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-#define g2d_config_chan(config)						       \
+#define g2d_config_chan(context, config)				       \
 do {									       \
-	int ret;							       \
-	ret = ioctl(fd, PXP_IOC_CONFIG_CHAN, config);			       \
-	if (ret < 0) {							       \
+	if (g2d_queue_config(context, config) < 0) {			       \
 		g2d_printf("%s: failed to config pxp channel\n", __func__);\
 		return -1;						       \
 	}								       \
 } while(0)
 
+/*
+ * dma-buf uapi, spelled out here since the kernel headers this is built
+ * against may predate linux/dma-buf.h. DMA_BUF_IOCTL_PHYS is the i.MX
+ * kernel extension that hands out the physical address of a contiguous
+ * dma-buf, the only kind the pxp can scan.
+ */
+#ifndef DMA_BUF_BASE
+#define DMA_BUF_BASE		'b'
+
+struct dma_buf_sync {
+	unsigned long long flags;
+};
+
+#define DMA_BUF_SYNC_READ	(1 << 0)
+#define DMA_BUF_SYNC_WRITE	(2 << 0)
+#define DMA_BUF_SYNC_RW		(DMA_BUF_SYNC_READ | DMA_BUF_SYNC_WRITE)
+#define DMA_BUF_SYNC_START	(0 << 2)
+#define DMA_BUF_SYNC_END	(1 << 2)
+#define DMA_BUF_IOCTL_SYNC	_IOW(DMA_BUF_BASE, 0, struct dma_buf_sync)
+#endif
+
+#ifndef DMA_BUF_IOCTL_PHYS
+struct dma_buf_phys {
+	unsigned long phys;
+};
+
+#define DMA_BUF_IOCTL_PHYS	_IOW(DMA_BUF_BASE, 10, struct dma_buf_phys)
+#endif
+
+#define G2D_CMD_LIST_INIT 16
+#define G2D_FENCE_MAX 16
+
+/*
+ * Every context gets a pxp channel of its own until G2D_CHANNELS (or
+ * G2D_CHANNELS_DEFAULT) channels are in use or the driver runs out, then
+ * new contexts share the channel with the fewest users. A shared channel
+ * is locked while one context configures and starts it.
+ */
+#define G2D_CHANNELS_MAX	16
+#define G2D_CHANNELS_DEFAULT	4
+
+struct g2d_chan {
+	int handle;
+	int users;
+	pthread_mutex_t mutex;
+};
+
+static struct g2d_chan chans[G2D_CHANNELS_MAX];
+static int chan_count;
+static int chan_limit;
+
 struct g2dContext {
 	int handle;          /* allocated dma channel handle from PXP*/
+	struct g2d_chan *chan;
 	unsigned int blending;
 	unsigned int global_alpha_enable;
 	unsigned int current_type;
-	bool dither;
+	int dither;          /* G2D_CPU_DITHER_*, for RGB565/BGR565 destinations */
+	bool blend_dim;
+	bool batch;          /* record configs and submit them on flush */
+	bool auto_dispatch;  /* let the cost model pick pxp or cpu per blit */
+	int scale_filter;    /* G2D_CPU_FILTER_*, scaled blits use it on the cpu */
+	struct pxp_config_data *cmd_list;
+	int cmd_count;
+	int cmd_size;
+	struct g2d_stats stats;
+	unsigned long long pending_us; /* first operation not finished yet, 0 if none */
+	bool busy;           /* started on flush, not waited for yet */
+
+	/* fences signalled by a thread waiting for pxp in submit order */
+	bool fence_running;
+	bool fence_exit;
+	pthread_t fence_thread;
+	pthread_mutex_t fence_mutex;
+	pthread_cond_t fence_cond;
+	int fence_queue[G2D_FENCE_MAX];
+	int fence_head;
+	int fence_count;
+};
+
+/* pxp will not take the operation, run it on the cpu instead */
+#define G2D_UNSUPPORTED (-2)
+
+/* pxp coordinate registers are 14 bits wide, pitches 16 bits in bytes */
+#ifndef G2D_PXP_MAX_SIZE
+#define G2D_PXP_MAX_SIZE	16384	/* tests build with less to get stripes */
+#endif
+#define G2D_PXP_MAX_PITCH	65535
+
+/*
+ * A blit resolved once by g2d_prepare_blit. Pxp programs keep the built
+ * config and where the plane addresses go, cpu programs keep the
+ * surfaces and the blending state of the context. Either way only the
+ * planes change on g2d_exec_blit.
+ */
+struct g2d_blit_prog {
+	struct g2dContext *context;
+	bool cpu;
+	struct pxp_config_data conf;
+	int src_layer;       /* 0 s0_param, 1 ol_param[0] */
+	int third_layer;     /* dst read back for blending, -1 if none */
+	int src_offset;
+	int dst_offset;
+	struct g2d_surface_ex src;
+	struct g2d_surface_ex dst;
+
+	/* context state at prepare time, swapped in for cpu blits */
+	unsigned int blending;
+	unsigned int global_alpha_enable;
+	int dither;
 	bool blend_dim;
+	int scale_filter;
+};
+
+/*
+ * Private part of a g2d_buf, kept on a list so the cpu backend can find
+ * the mapping of the physical addresses a g2d_surface refers to.
+ * handle must stay first, buf_handle is read as an unsigned int.
+ * Imported dma-bufs have no pxp handle; they keep their own fd and are
+ * shared by every import of the same buffer until the last g2d_free.
+ */
+struct g2d_buf_priv {
+	unsigned int handle;
+	int cacheable;
+	int pool_class;      /* -1 if the buffer is not pooled */
+	int map_size;        /* bytes mapped, buf_size is what was asked for */
+	int dmabuf;          /* dup of the imported fd, -1 for pxp memory */
+	dev_t dev;           /* dev, ino and buf_paddr identify an import */
+	ino_t ino;
+	int refs;            /* imports not yet freed */
+	struct g2d_buf *buf;
+	struct g2d_buf_priv *next;
+	struct g2d_buf_priv *pool_next;
 };
 
-static int g2d_has_alpha(enum g2d_format format)
+static struct g2d_buf_priv *buf_list;
+
+/*
+ * Freed buffers stay mapped in a pool per size class and cacheability,
+ * off buf_list until handed out again. Above the high watermark the
+ * pool is trimmed down to the low one.
+ */
+#define G2D_PAGE_SIZE		4096
+#define G2D_POOL_CLASSES	48	/* 4KB up to 16MB */
+#define G2D_POOL_HIGH_WATERMARK	(32 * 1024 * 1024)
+#define G2D_POOL_LOW_WATERMARK	(16 * 1024 * 1024)
+
+static struct g2d_buf_priv *pool[2][G2D_POOL_CLASSES];
+static struct g2d_pool_stats pool_stats;
+
+#define G2D_CACHE_RANGE_DEFAULT	(1024 * 1024)
+
+/*
+ * g2d_clear_rects fills rects of fewer pixels than G2D_CLEAR_CPU_PIXELS
+ * (or the default) on the cpu, below that a pxp config costs more than
+ * the fill itself.
+ */
+#define G2D_CLEAR_CPU_DEFAULT	(128 * 128)
+
+static struct g2d_cache_stats cache_stats;
+
+static struct g2d_buf_priv *g2d_pool_detach(int keep);
+static void g2d_pool_release(struct g2d_buf_priv *list);
+static void g2d_fence_stop(struct g2dContext *context);
+static void g2d_blit_calibrate_once(struct g2dContext *context);
+static void g2d_copy_calibrate_once(struct g2dContext *context);
+
+static unsigned long long g2d_time_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* work is outstanding from start on, until g2d_finish */
+static void g2d_pending(struct g2dContext *context, unsigned long long start)
+{
+	if (!context->pending_us)
+		context->pending_us = start;
+}
+
+static unsigned int g2d_rect_pixels(struct g2d_surface *s)
+{
+	return (s->right - s->left) * (s->bottom - s->top);
+}
+
+static int g2d_ioctl_config(struct g2dContext *context,
+			    struct pxp_config_data *config)
+{
+	context->stats.ioctls++;
+	return ioctl(fd, PXP_IOC_CONFIG_CHAN, config);
+}
+
+/*
+ * Record one validated pxp config in the context command list, or pass
+ * it to the driver right away when batching is disabled.
+ */
+static int g2d_queue_config(struct g2dContext *context,
+			    struct pxp_config_data *config)
+{
+	struct pxp_config_data *list;
+	unsigned long long start;
+	int size, ret;
+
+	context->stats.ops++;
+	g2d_pending(context, g2d_time_us());
+
+	/* a shared channel only takes whole submissions, see g2d_submit */
+	if (!context->batch) {
+		pthread_mutex_lock(&context->chan->mutex);
+		if (context->chan->users == 1) {
+			start = g2d_time_us();
+			ret = g2d_ioctl_config(context, config);
+			pthread_mutex_unlock(&context->chan->mutex);
+			context->stats.submit_us += g2d_time_us() - start;
+			return ret;
+		}
+		pthread_mutex_unlock(&context->chan->mutex);
+	}
+
+	if (context->cmd_count == context->cmd_size) {
+		size = context->cmd_size ? context->cmd_size * 2 : G2D_CMD_LIST_INIT;
+		list = realloc(context->cmd_list, size * sizeof(*list));
+		if (list == NULL) {
+			g2d_printf("%s: grow command list failed\n", __func__);
+			return -1;
+		}
+		context->cmd_list = list;
+		context->cmd_size = size;
+	}
+
+	memcpy(&context->cmd_list[context->cmd_count++], config,
+	       sizeof(struct pxp_config_data));
+	return 0;
+}
+
+/*
+ * Hand the recorded command list to the driver and start the channel.
+ * The driver takes one config per ioctl, so a batch saves the start and
+ * wait of every operation but still costs one config ioctl each.
+ */
+static int g2d_submit(struct g2dContext *context)
+{
+	unsigned long long start;
+	int i, ret = 0;
+
+	start = g2d_time_us();
+
+	pthread_mutex_lock(&context->chan->mutex);
+	for (i = 0; i < context->cmd_count; i++) {
+		ret = g2d_ioctl_config(context, &context->cmd_list[i]);
+		if (ret < 0) {
+			g2d_printf("%s: failed to config pxp channel, %d of %d commands dropped\n",
+				   __func__, context->cmd_count - i, context->cmd_count);
+			break;
+		}
+	}
+	context->cmd_count = 0;
+
+	if (ret >= 0) {
+		context->stats.ioctls++;
+		ret = ioctl(fd, PXP_IOC_START_CHAN, &context->handle);
+		if (ret < 0)
+			g2d_printf("%s: failed to commit pxp task\n", __func__);
+	}
+	pthread_mutex_unlock(&context->chan->mutex);
+
+	context->stats.submits++;
+	context->stats.submit_us += g2d_time_us() - start;
+
+	return ret < 0 ? -1 : 0;
+}
+
+int g2d_has_alpha(enum g2d_format format)
 {
 	return format == G2D_BGRA8888 ? 1 : 0;
 }
@@ -166,47 +438,135 @@ static int g2d_get_bpp(unsigned int format)
 	return 0;
 }
 
+/* called with open_mutex held, users also changes under the channel mutex */
+static struct g2d_chan *g2d_get_chan(void)
+{
+	struct g2d_chan *chan;
+	char *env;
+	int i, handle;
+
+	if (!chan_limit) {
+		env = getenv("G2D_CHANNELS");
+		chan_limit = env ? atoi(env) : G2D_CHANNELS_DEFAULT;
+		if (chan_limit < 1)
+			chan_limit = 1;
+		if (chan_limit > G2D_CHANNELS_MAX)
+			chan_limit = G2D_CHANNELS_MAX;
+	}
+
+	if (chan_count < chan_limit) {
+		if (ioctl(fd, PXP_IOC_GET_CHAN, &handle) == 0) {
+			for (i = 0; chans[i].users; i++)
+				;
+			chan = &chans[i];
+			chan->handle = handle;
+			chan->users = 1;
+			pthread_mutex_init(&chan->mutex, NULL);
+			chan_count++;
+			return chan;
+		}
+		if (!chan_count) {
+			g2d_printf("%s: failed to get pxp channel\n", __func__);
+			return NULL;
+		}
+	}
+
+	/* share the least used channel */
+	chan = NULL;
+	for (i = 0; i < G2D_CHANNELS_MAX; i++) {
+		if (chans[i].users && (!chan || chans[i].users < chan->users))
+			chan = &chans[i];
+	}
+	pthread_mutex_lock(&chan->mutex);
+	chan->users++;
+	pthread_mutex_unlock(&chan->mutex);
+
+	return chan;
+}
+
+/* called with open_mutex held */
+static int g2d_put_chan(struct g2d_chan *chan)
+{
+	int users;
+
+	pthread_mutex_lock(&chan->mutex);
+	users = --chan->users;
+	pthread_mutex_unlock(&chan->mutex);
+	if (users)
+		return 0;
+
+	chan_count--;
+	pthread_mutex_destroy(&chan->mutex);
+	if (ioctl(fd, PXP_IOC_PUT_CHAN, &chan->handle) < 0) {
+		g2d_printf("%s: failed to put pxp channel!\n", __func__);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* all zero bits is not an unlocked spinlock on every libc */
+static void g2d_lock_init(void)
+{
+	pthread_spin_init(&lock, PTHREAD_PROCESS_PRIVATE);
+}
+
 int g2d_open(void **handle)
 {
-	int ret;
-	static int channel;
 	struct g2dContext *context;
+	char *env;
 
 	if (handle == NULL) {
 		g2d_printf("%s: invalid handle\n", __func__);
 		return -1;
 	}
 
+	pthread_once(&lock_once, g2d_lock_init);
+
 	context = (struct g2dContext *)calloc(1, sizeof(struct g2dContext));
 	if (context == NULL) {
 		g2d_printf("malloc memory failed for g2dcontext!\n");
 		goto err2;
 	}
 
-	pthread_spin_lock(&lock);
+	pthread_mutex_lock(&open_mutex);
 	if (++open_count == 1) {
 		fd = open(PXP_DEV_NAME, O_RDWR);
 		if (fd < 0) {
 			g2d_printf("open pxp device failed!\n");
 			goto err1;
 		}
-		ret = ioctl(fd, PXP_IOC_GET_CHAN, &channel);
-		if (ret < 0) {
-			g2d_printf("%s: failed to get pxp channel\n",
-				    __func__);
-			goto err0;
-		}
 	}
-	context->handle = channel;
-	pthread_spin_unlock(&lock);
+	context->chan = g2d_get_chan();
+	if (context->chan == NULL)
+		goto err0;
+	context->handle = context->chan->handle;
+	pthread_mutex_unlock(&open_mutex);
+
+	context->batch = true;
+
+	/* opt-in, the cost model is timed here rather than on a first blit */
+	env = getenv("G2D_AUTO_DISPATCH");
+	if (env && atoi(env) > 0) {
+		context->auto_dispatch = true;
+		g2d_blit_calibrate_once(context);
+	}
+
+	/* opt-in too, copies keep the fixed threshold otherwise */
+	env = getenv("G2D_COPY_CALIBRATE");
+	if (env && atoi(env) > 0)
+		g2d_copy_calibrate_once(context);
 
 	*handle = (void*)context;
 	return 0;
 err0:
-	close(fd);
-	open_count--;
+	if (open_count == 1) {
+		close(fd);
+		fd = -1;
+	}
 err1:
-	pthread_spin_unlock(&lock);
+	open_count--;
+	pthread_mutex_unlock(&open_mutex);
 	free(context);
 err2:
 	*handle = NULL;
@@ -216,6 +576,7 @@ err2:
 int g2d_close(void *handle)
 {
 	int ret;
+	struct g2d_buf_priv *pooled = NULL;
 	struct g2dContext *context = (struct g2dContext *)handle;
 
 	if (context == NULL) {
@@ -223,30 +584,34 @@ int g2d_close(void *handle)
 		return -1;
 	}
 
-	pthread_spin_lock(&lock);
+	g2d_fence_stop(context);
+
+	pthread_mutex_lock(&open_mutex);
 	if (!open_count) {
-		pthread_spin_unlock(&lock);
+		pthread_mutex_unlock(&open_mutex);
 		return 0;
 	}
 
+	ret = g2d_put_chan(context->chan);
+
 	if (open_count == 1) {
-		ret = ioctl(fd, PXP_IOC_PUT_CHAN, &context->handle);
-		if (ret < 0) {
-			pthread_spin_unlock(&lock);
-			g2d_printf("%s: failed to put pxp channel!\n",
-				   __func__);
-			return -1;
-		}
+		/* pooled buffers are mappings of fd, detach them for release */
+		pthread_spin_lock(&lock);
+		pooled = g2d_pool_detach(0);
+		pthread_spin_unlock(&lock);
+
+		g2d_pool_release(pooled);
 		close(fd);
 		fd = -1;
 	}
 	open_count--;
-	pthread_spin_unlock(&lock);
+	pthread_mutex_unlock(&open_mutex);
 
+	free(context->cmd_list);
 	free(context);
 	handle = NULL;
 
-	return 0;
+	return ret;
 }
 
 int g2d_make_current(void *handle, enum g2d_hardware_type type)
@@ -263,6 +628,7 @@ int g2d_make_current(void *handle, enum g2d_hardware_type type)
 
 	switch(type) {
 	case G2D_HARDWARE_2D:
+	case G2D_HARDWARE_CPU:
 		context->current_type = type;
 		break;
 	default:
@@ -291,6 +657,30 @@ int g2d_query_cap(void *handle, enum g2d_cap_mode cap, int *enable)
 	case G2D_GLOBAL_ALPHA:
 		*enable = (context->global_alpha_enable == 1);
 		break;
+	case G2D_BLEND_DIM:
+		*enable = context->blend_dim;
+		break;
+	case G2D_DITHER:
+		*enable = context->dither == G2D_CPU_DITHER_ORDERED;
+		break;
+	case G2D_DITHER_DIFFUSION:
+		*enable = context->dither == G2D_CPU_DITHER_DIFFUSION;
+		break;
+	case G2D_BATCH:
+		*enable = context->batch;
+		break;
+	case G2D_AUTO_DISPATCH:
+		*enable = context->auto_dispatch;
+		break;
+	case G2D_SCALE_BILINEAR:
+		*enable = context->scale_filter == G2D_CPU_FILTER_BILINEAR;
+		break;
+	case G2D_SCALE_BICUBIC:
+		*enable = context->scale_filter == G2D_CPU_FILTER_BICUBIC;
+		break;
+	case G2D_SCALE_LANCZOS:
+		*enable = context->scale_filter == G2D_CPU_FILTER_LANCZOS;
+		break;
 	default:
 		g2d_printf("%s: unsupported capability %d\n", __func__, cap);
 		return -1;
@@ -299,6 +689,29 @@ int g2d_query_cap(void *handle, enum g2d_cap_mode cap, int *enable)
 	return 0;
 }
 
+/*
+ * Imported buffers are maintained by their exporter: ending cpu access
+ * writes the cpu's view back, starting it makes the device's visible.
+ */
+static int g2d_dmabuf_sync(struct g2d_buf *buf, enum g2d_cache_mode op)
+{
+	struct g2d_buf_priv *priv = (struct g2d_buf_priv *)buf->buf_handle;
+	struct dma_buf_sync sync;
+
+	if (op != G2D_CACHE_INVALIDATE) {
+		sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_RW;
+		if (ioctl(priv->dmabuf, DMA_BUF_IOCTL_SYNC, &sync) < 0)
+			return -1;
+	}
+	if (op != G2D_CACHE_CLEAN) {
+		sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_RW;
+		if (ioctl(priv->dmabuf, DMA_BUF_IOCTL_SYNC, &sync) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
 int g2d_cache_op(struct g2d_buf *buf, enum g2d_cache_mode op)
 {
 	int ret;
@@ -334,13 +747,165 @@ int g2d_cache_op(struct g2d_buf *buf, enum g2d_cache_mode op)
 		return -1;
 	}
 
-	flush.handle = *(unsigned int *)buf->buf_handle;
-	ret = ioctl(fd, PXP_IOC_FLUSH_PHYMEM, &flush);
+	if (((struct g2d_buf_priv *)buf->buf_handle)->dmabuf >= 0)
+		ret = g2d_dmabuf_sync(buf, op);
+	else {
+		flush.handle = *(unsigned int *)buf->buf_handle;
+		ret = ioctl(fd, PXP_IOC_FLUSH_PHYMEM, &flush);
+	}
 	if (ret < 0) {
 		g2d_printf("%s: flush dma buffer failed\n", __func__);
 		return -1;
 	}
 
+	pthread_spin_lock(&lock);
+	cache_stats.full_ops++;
+	cache_stats.full_bytes += Bytes;
+	pthread_spin_unlock(&lock);
+
+	return 0;
+}
+
+/*
+ * PXP_IOC_FLUSH_PHYMEM always covers the whole buffer. Where user space
+ * may maintain the data cache to the point of coherency itself (aarch64,
+ * dc cvac/civac), small ranges are done here instead; elsewhere ranges
+ * fall back to the whole buffer.
+ */
+#if defined(__aarch64__)
+static int g2d_cache_line(void)
+{
+	static int line;
+	unsigned long ctr;
+
+	if (!line) {
+		asm volatile("mrs %0, ctr_el0" : "=r" (ctr));
+		line = 4 << ((ctr >> 16) & 0xf);
+	}
+
+	return line;
+}
+
+static void g2d_cache_range(unsigned long start, unsigned long end,
+			    enum g2d_cache_mode op)
+{
+	unsigned long line = g2d_cache_line();
+
+	/* el0 can't invalidate only, clean+invalidate covers it */
+	for (start &= ~(line - 1); start < end; start += line) {
+		if (op == G2D_CACHE_CLEAN)
+			asm volatile("dc cvac, %0" : : "r" (start) : "memory");
+		else
+			asm volatile("dc civac, %0" : : "r" (start) : "memory");
+	}
+}
+
+static void g2d_cache_rect(unsigned long start, int width, int height,
+			   int stride, enum g2d_cache_mode op)
+{
+	int i;
+
+	/* rows closer than a cache line are one range */
+	if (stride - width < g2d_cache_line()) {
+		g2d_cache_range(start, start + (height - 1) * stride + width, op);
+	} else {
+		for (i = 0; i < height; i++, start += stride)
+			g2d_cache_range(start, start + width, op);
+	}
+
+	asm volatile("dsb sy" : : : "memory");
+}
+#define G2D_CACHE_RANGE_OPS 1
+#else
+#define G2D_CACHE_RANGE_OPS 0
+#endif
+
+/* ranges above G2D_CACHE_RANGE_LIMIT (or the default) take a full op */
+static int g2d_cache_range_limit(void)
+{
+	static int limit;
+	char *env;
+
+	if (!limit) {
+		env = getenv("G2D_CACHE_RANGE_LIMIT");
+		limit = env ? atoi(env) : G2D_CACHE_RANGE_DEFAULT;
+		if (limit <= 0)
+			limit = G2D_CACHE_RANGE_DEFAULT;
+	}
+
+	return limit;
+}
+
+/*
+ * Cache maintenance for height rows of width bytes, stride bytes apart,
+ * starting offset bytes into buf. A single range is one row.
+ */
+int g2d_cache_op_rect(struct g2d_buf *buf, int offset, int width, int height,
+		      int stride, enum g2d_cache_mode op)
+{
+	int bytes;
+
+	if (!buf || !buf->buf_vaddr) {
+		g2d_printf("%s: invalid buffer !\n", __func__);
+		return -1;
+	}
+
+	if (offset < 0 || width <= 0 || height <= 0 || stride < width ||
+	    offset + (height - 1) * stride + width > buf->buf_size) {
+		g2d_printf("%s: invalid range !\n", __func__);
+		return -1;
+	}
+
+	if (op != G2D_CACHE_CLEAN && op != G2D_CACHE_FLUSH &&
+	    op != G2D_CACHE_INVALIDATE) {
+		g2d_printf("%s: invalid cache op !\n", __func__);
+		return -1;
+	}
+
+	bytes = width * height;
+	if (!G2D_CACHE_RANGE_OPS || bytes > g2d_cache_range_limit() ||
+	    bytes >= buf->buf_size / 2)
+		return g2d_cache_op(buf, op);
+
+#if G2D_CACHE_RANGE_OPS
+	g2d_cache_rect((unsigned long)buf->buf_vaddr + offset, width, height,
+		       stride, op);
+#endif
+
+	pthread_spin_lock(&lock);
+	cache_stats.range_ops++;
+	cache_stats.range_bytes += bytes;
+	pthread_spin_unlock(&lock);
+
+	return 0;
+}
+
+int g2d_cache_op_range(struct g2d_buf *buf, int offset, int len,
+		       enum g2d_cache_mode op)
+{
+	return g2d_cache_op_rect(buf, offset, len, 1, len, op);
+}
+
+int g2d_query_cache_stats(struct g2d_cache_stats *stats)
+{
+	if (stats == NULL) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+
+	pthread_spin_lock(&lock);
+	*stats = cache_stats;
+	pthread_spin_unlock(&lock);
+
+	return 0;
+}
+
+int g2d_reset_cache_stats(void)
+{
+	pthread_spin_lock(&lock);
+	memset(&cache_stats, 0, sizeof(cache_stats));
+	pthread_spin_unlock(&lock);
+
 	return 0;
 }
 
@@ -360,7 +925,31 @@ int g2d_enable(void *handle, enum g2d_cap_mode cap)
 	case G2D_GLOBAL_ALPHA:
 		context->global_alpha_enable = 1;
 		break;
-	/*TODO PXP doesn't support dithering yet */
+	case G2D_BLEND_DIM:
+		/* done on the cpu, pxp has no constant color source */
+		context->blend_dim = true;
+		break;
+	case G2D_BATCH:
+		context->batch = true;
+		break;
+	case G2D_AUTO_DISPATCH:
+		context->auto_dispatch = true;
+		break;
+	case G2D_DITHER:
+		context->dither = G2D_CPU_DITHER_ORDERED;
+		break;
+	case G2D_DITHER_DIFFUSION:
+		context->dither = G2D_CPU_DITHER_DIFFUSION;
+		break;
+	case G2D_SCALE_BILINEAR:
+		context->scale_filter = G2D_CPU_FILTER_BILINEAR;
+		break;
+	case G2D_SCALE_BICUBIC:
+		context->scale_filter = G2D_CPU_FILTER_BICUBIC;
+		break;
+	case G2D_SCALE_LANCZOS:
+		context->scale_filter = G2D_CPU_FILTER_LANCZOS;
+		break;
 	default:
 		g2d_printf("%s: unknown cap %d request\n", __func__, cap);
 		return -1;
@@ -385,6 +974,36 @@ int g2d_disable(void *handle, enum g2d_cap_mode cap)
 	case G2D_GLOBAL_ALPHA:
 		context->global_alpha_enable = 0;
 		break;
+	case G2D_BLEND_DIM:
+		context->blend_dim = false;
+		break;
+	case G2D_BATCH:
+		/* commands already recorded go out on the next flush */
+		context->batch = false;
+		break;
+	case G2D_AUTO_DISPATCH:
+		context->auto_dispatch = false;
+		break;
+	case G2D_DITHER:
+		if (context->dither == G2D_CPU_DITHER_ORDERED)
+			context->dither = G2D_CPU_DITHER_NONE;
+		break;
+	case G2D_DITHER_DIFFUSION:
+		if (context->dither == G2D_CPU_DITHER_DIFFUSION)
+			context->dither = G2D_CPU_DITHER_NONE;
+		break;
+	case G2D_SCALE_BILINEAR:
+		if (context->scale_filter == G2D_CPU_FILTER_BILINEAR)
+			context->scale_filter = G2D_CPU_FILTER_NEAREST;
+		break;
+	case G2D_SCALE_BICUBIC:
+		if (context->scale_filter == G2D_CPU_FILTER_BICUBIC)
+			context->scale_filter = G2D_CPU_FILTER_NEAREST;
+		break;
+	case G2D_SCALE_LANCZOS:
+		if (context->scale_filter == G2D_CPU_FILTER_LANCZOS)
+			context->scale_filter = G2D_CPU_FILTER_NEAREST;
+		break;
 	default:
 		g2d_printf("%s: unknown cap %d request\n", __func__, cap);
 		return -1;
@@ -393,25 +1012,159 @@ int g2d_disable(void *handle, enum g2d_cap_mode cap)
 	return 0;
 }
 
-struct g2d_buf *g2d_alloc(int size, int cacheable)
+/*
+ * Size class of the pool for an allocation: whole pages up to 16 pages,
+ * then four steps per power of two, so at most a quarter is wasted.
+ * Returns -1 for sizes the pool does not keep.
+ */
+static int g2d_pool_class_size(int cls)
 {
-	int ret;
-	void *addr;
-	struct g2d_buf *buf = NULL;
-	struct pxp_mem_desc mem_desc;
+	if (cls < 16)
+		return (cls + 1) * G2D_PAGE_SIZE;
 
-	buf = (struct g2d_buf*)calloc(1, sizeof(struct g2d_buf));
-	if (buf ==  NULL) {
-		g2d_printf("%s: malloc g2d_buf failed\n", __func__);
-		return NULL;
-	}
+	cls -= 15;
+	return (4 + (cls & 3)) << (14 + (cls >> 2));
+}
 
-	buf->buf_handle = calloc(1, sizeof(unsigned int));
-	if (buf->buf_handle == NULL)
-		goto err;
+static int g2d_pool_class(int size)
+{
+	int cls;
+
+	for (cls = 0; cls < G2D_POOL_CLASSES; cls++) {
+		if (size <= g2d_pool_class_size(cls))
+			return cls;
+	}
+
+	return -1;
+}
+
+/* take a buffer off the lists, called with the lock held */
+static void g2d_unlink_buf(struct g2d_buf_priv *priv)
+{
+	struct g2d_buf_priv **pp;
+
+	for (pp = &buf_list; *pp; pp = &(*pp)->next) {
+		if (*pp == priv) {
+			*pp = priv->next;
+			break;
+		}
+	}
+}
+
+/* give a buffer back to the driver */
+static int g2d_unmap_buf(struct g2d_buf *buf)
+{
+	int ret;
+	struct pxp_mem_desc mem_desc;
+	struct g2d_buf_priv *priv = (struct g2d_buf_priv *)buf->buf_handle;
+
+	munmap(buf->buf_vaddr, priv->map_size);
+
+	if (priv->dmabuf >= 0) {
+		close(priv->dmabuf);
+		free(priv);
+		free(buf);
+		return 0;
+	}
+
+	memset(&mem_desc, 0, sizeof(struct pxp_mem_desc));
+	mem_desc.handle = *(unsigned int *)buf->buf_handle;
+	ret = ioctl(fd, PXP_IOC_PUT_PHYMEM, &mem_desc);
+
+	if (ret < 0) {
+		g2d_printf("%s: free pxp physical memory failed\n", __func__);
+		return -1;
+	}
+
+	free(buf->buf_handle);
+	free(buf);
+	return 0;
+}
+
+/*
+ * Detach pooled buffers, largest classes first, until no more than keep
+ * bytes are cached. Called with the lock held, the returned list is
+ * given back with g2d_pool_release() once it is dropped.
+ */
+static struct g2d_buf_priv *g2d_pool_detach(int keep)
+{
+	struct g2d_buf_priv *priv, *list = NULL;
+	int c, cls;
+
+	for (cls = G2D_POOL_CLASSES - 1; cls >= 0; cls--) {
+		for (c = 0; c < 2; c++) {
+			while (pool_stats.cached_bytes > (unsigned int)keep &&
+			       (priv = pool[c][cls]) != NULL) {
+				pool[c][cls] = priv->pool_next;
+				pool_stats.cached_bytes -= g2d_pool_class_size(cls);
+				pool_stats.cached_buffers--;
+				pool_stats.releases++;
+				priv->pool_next = list;
+				list = priv;
+			}
+		}
+	}
+
+	return list;
+}
+
+static void g2d_pool_release(struct g2d_buf_priv *list)
+{
+	struct g2d_buf_priv *next;
+
+	for (; list; list = next) {
+		next = list->pool_next;
+		g2d_unmap_buf(list->buf);
+	}
+}
+
+struct g2d_buf *g2d_alloc(int size, int cacheable)
+{
+	int ret, cls, map_size = size;
+	void *addr;
+	struct g2d_buf *buf = NULL;
+	struct g2d_buf_priv *priv;
+	struct pxp_mem_desc mem_desc;
+
+	cacheable = cacheable ? 1 : 0;
+	cls = g2d_pool_class(size);
+
+	/* a pooled buffer is still mapped, no syscall needed */
+	if (cls >= 0) {
+		pthread_spin_lock(&lock);
+		priv = pool[cacheable][cls];
+		if (priv) {
+			pool[cacheable][cls] = priv->pool_next;
+			pool_stats.cached_bytes -= g2d_pool_class_size(cls);
+			pool_stats.cached_buffers--;
+			pool_stats.hits++;
+			priv->buf->buf_size = size;
+			priv->next = buf_list;
+			buf_list = priv;
+		} else {
+			pool_stats.misses++;
+		}
+		pthread_spin_unlock(&lock);
+		if (priv)
+			return priv->buf;
+		/* mapped at the class size so any request of the class fits */
+		map_size = g2d_pool_class_size(cls);
+	}
+
+	buf = (struct g2d_buf*)calloc(1, sizeof(struct g2d_buf));
+	if (buf ==  NULL) {
+		g2d_printf("%s: malloc g2d_buf failed\n", __func__);
+		return NULL;
+	}
+
+	priv = (struct g2d_buf_priv *)calloc(1, sizeof(struct g2d_buf_priv));
+	if (priv == NULL)
+		goto err;
+	priv->dmabuf = -1;
+	buf->buf_handle = priv;
 
 	memset(&mem_desc, 0, sizeof(mem_desc));
-	mem_desc.size  = size;
+	mem_desc.size  = map_size;
 	mem_desc.mtype = cacheable ? MEMORY_TYPE_CACHED : MEMORY_TYPE_UNCACHED;
 
 	ret = ioctl(fd, PXP_IOC_GET_PHYMEM, &mem_desc);
@@ -433,7 +1186,16 @@ struct g2d_buf *g2d_alloc(int size, int cacheable)
 	*(unsigned int *)buf->buf_handle = mem_desc.handle;
 	buf->buf_vaddr = addr;
 	buf->buf_paddr = (int)mem_desc.phys_addr;
-	buf->buf_size  = mem_desc.size;
+	buf->buf_size  = cls >= 0 ? size : mem_desc.size;
+
+	priv->cacheable = cacheable;
+	priv->pool_class = cls;
+	priv->map_size = mem_desc.size;
+	priv->buf = buf;
+	pthread_spin_lock(&lock);
+	priv->next = buf_list;
+	buf_list = priv;
+	pthread_spin_unlock(&lock);
 
 	return buf;
 err0:
@@ -445,237 +1207,1058 @@ err:
 
 int g2d_free(struct g2d_buf *buf)
 {
-	int ret;
-	struct pxp_mem_desc mem_desc;
+	struct g2d_buf_priv *priv, *trim = NULL;
+	int cls, refs;
 
 	if (buf == NULL) {
 		g2d_printf("%s: Invalid g2d_buf to be freed\n", __func__);
 		return -1;
 	}
 
-	munmap(buf->buf_vaddr, buf->buf_size);
+	priv = (struct g2d_buf_priv *)buf->buf_handle;
+	cls = priv->pool_class;
 
-	memset(&mem_desc, 0, sizeof(struct pxp_mem_desc));
-	mem_desc.handle = *(unsigned int *)buf->buf_handle;
-	ret = ioctl(fd, PXP_IOC_PUT_PHYMEM, &mem_desc);
+	if (priv->dmabuf >= 0) {
+		pthread_spin_lock(&lock);
+		refs = --priv->refs;
+		if (!refs)
+			g2d_unlink_buf(priv);
+		pthread_spin_unlock(&lock);
+		return refs ? 0 : g2d_unmap_buf(buf);
+	}
 
-	if (ret < 0) {
-		g2d_printf("%s: free pxp physical memory failed\n", __func__);
-		return -1;
+	pthread_spin_lock(&lock);
+	g2d_unlink_buf(priv);
+	if (cls >= 0) {
+		/* keep it mapped for the next allocation of its class */
+		priv->pool_next = pool[priv->cacheable][cls];
+		pool[priv->cacheable][cls] = priv;
+		pool_stats.cached_bytes += g2d_pool_class_size(cls);
+		pool_stats.cached_buffers++;
+		if (pool_stats.cached_bytes > G2D_POOL_HIGH_WATERMARK)
+			trim = g2d_pool_detach(G2D_POOL_LOW_WATERMARK);
 	}
+	pthread_spin_unlock(&lock);
 
-	free(buf->buf_handle);
-	free(buf);
+	if (cls < 0)
+		return g2d_unmap_buf(buf);
+
+	g2d_pool_release(trim);
 	return 0;
 }
 
-#define PXP_COPY_THRESHOLD (16*16*4)
-int g2d_copy(void *handle, struct g2d_buf *d, struct g2d_buf* s, int size)
+/* a live import of the same dma-buf, with a reference taken; lock held */
+static struct g2d_buf_priv *g2d_find_import(struct stat *st, int paddr)
 {
-	unsigned int blit_size;
-	struct pxp_config_data pxp_conf;
-	struct pxp_layer_param *src_param = NULL, *out_param = NULL;
-
-	struct g2dContext *context = (struct g2dContext *)handle;
+	struct g2d_buf_priv *priv;
 
-	if (context == NULL || s == NULL || d == NULL) {
-		g2d_printf("%s: null pointer access\n", __func__);
-		return -1;
+	/* older kernels give all dma-bufs one inode, the address tells them apart */
+	for (priv = buf_list; priv; priv = priv->next) {
+		if (priv->dmabuf >= 0 && priv->dev == st->st_dev &&
+		    priv->ino == st->st_ino && priv->buf->buf_paddr == paddr) {
+			priv->refs++;
+			break;
+		}
 	}
 
-	memset(&pxp_conf, 0, sizeof(struct pxp_config_data));
+	return priv;
+}
 
-	src_param = &(pxp_conf.ol_param[0]);
-	out_param = &(pxp_conf.out_param);
+/*
+ * Wrap a physically contiguous dma-buf, e.g. a decoder frame or a drm
+ * scanout buffer, as a g2d_buf without copying; surfaces name it through
+ * buf_paddr like any other buffer. size 0 takes the size of the dma-buf.
+ * Importing a buffer that is already imported returns the same g2d_buf
+ * and only costs an fstat and an ioctl, so callers may import per frame.
+ * Each import is dropped with g2d_free; the caller keeps its own fd.
+ */
+struct g2d_buf *g2d_buf_import_fd(int dmabuf_fd, int size)
+{
+	struct dma_buf_phys phys;
+	struct stat st;
+	struct g2d_buf_priv *priv, *old;
+	struct g2d_buf *buf;
+	void *addr;
+	off_t end;
 
-	if (size < PXP_COPY_THRESHOLD) {
-		memcpy(d->buf_vaddr, s->buf_vaddr, size);
-		return 0;
-	}
-	else if (size <= PXP_COPY_THRESHOLD * 4096) {
-		src_param->width = PXP_COPY_THRESHOLD >> 2;
-	}
-	else {
-		src_param->width = PXP_COPY_THRESHOLD;
+	if (dmabuf_fd < 0 || size < 0) {
+		g2d_printf("%s: invalid dma-buf fd %d size %d\n", __func__,
+			   dmabuf_fd, size);
+		return NULL;
 	}
 
-	src_param->stride = src_param->width;
-	src_param->pixel_fmt = PXP_PIX_FMT_BGRA32;
-	src_param->height = size / (src_param->width << 2);
-	if (src_param->height > 16384)
-		src_param->height = 16384;
+	if (fstat(dmabuf_fd, &st) < 0 ||
+	    ioctl(dmabuf_fd, DMA_BUF_IOCTL_PHYS, &phys) < 0) {
+		g2d_printf("%s: fd %d is not a contiguous dma-buf\n", __func__,
+			   dmabuf_fd);
+		return NULL;
+	}
 
-	memcpy(out_param, src_param, sizeof(struct pxp_layer_param));
-	out_param->pixel_fmt = PXP_PIX_FMT_BGRA32;
-	src_param->paddr = s->buf_paddr;
-	out_param->paddr = d->buf_paddr;
+	pthread_spin_lock(&lock);
+	priv = g2d_find_import(&st, (int)phys.phys);
+	pthread_spin_unlock(&lock);
+	if (priv)
+		return priv->buf;
+
+	if (!size) {
+		end = lseek(dmabuf_fd, 0, SEEK_END);
+		lseek(dmabuf_fd, 0, SEEK_SET);
+		if (end <= 0) {
+			g2d_printf("%s: size of fd %d unknown\n", __func__,
+				   dmabuf_fd);
+			return NULL;
+		}
+		size = (int)end;
+	}
 
-	blit_size = src_param->width * src_param->height * 4;
-	pxp_conf.handle = context->handle;
-	pxp_conf.proc_data.drect.top = 0;
-	pxp_conf.proc_data.drect.left = 0;
-	pxp_conf.proc_data.drect.width = src_param->width;
-	pxp_conf.proc_data.drect.height = src_param->height;
+	buf = (struct g2d_buf *)calloc(1, sizeof(struct g2d_buf));
+	priv = (struct g2d_buf_priv *)calloc(1, sizeof(struct g2d_buf_priv));
+	if (!buf || !priv) {
+		g2d_printf("%s: malloc g2d_buf failed\n", __func__);
+		goto err;
+	}
 
-	g2d_config_chan(&pxp_conf);
+	priv->dmabuf = dup(dmabuf_fd);
+	if (priv->dmabuf < 0) {
+		g2d_printf("%s: dup fd %d failed\n", __func__, dmabuf_fd);
+		goto err;
+	}
 
-	if (blit_size == size)
-		return 0;
-	else if (size - blit_size > src_param->width * 4) {
-		struct g2d_buf subs, subd;
-		subs.buf_size = d->buf_size - blit_size;
-		subd.buf_paddr = d->buf_paddr + blit_size;
-		subd.buf_vaddr = (void*)(((int)d->buf_vaddr) + blit_size);
+	addr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    priv->dmabuf, 0);
+	if (addr == MAP_FAILED) {
+		g2d_printf("%s: map dma-buf failed\n", __func__);
+		close(priv->dmabuf);
+		goto err;
+	}
 
-		subs.buf_size = s->buf_size - blit_size;;
-		subs.buf_paddr = s->buf_paddr + blit_size;
-		subs.buf_vaddr = (void*)(((int)s->buf_vaddr) + blit_size);
-		return g2d_copy(handle, &subs, &subd, size - blit_size);
+	buf->buf_handle = priv;
+	buf->buf_vaddr = addr;
+	buf->buf_paddr = (int)phys.phys;
+	buf->buf_size = size;
+
+	/* the exporter decides, its sync ioctl is right either way */
+	priv->cacheable = 1;
+	priv->pool_class = -1;
+	priv->map_size = size;
+	priv->dev = st.st_dev;
+	priv->ino = st.st_ino;
+	priv->refs = 1;
+	priv->buf = buf;
+
+	/* another thread may have imported it while this one mapped it */
+	pthread_spin_lock(&lock);
+	old = g2d_find_import(&st, (int)phys.phys);
+	if (old == NULL) {
+		priv->next = buf_list;
+		buf_list = priv;
 	}
-	else {
-		size = size - blit_size;
-		memcpy(d->buf_vaddr + blit_size, s->buf_vaddr + blit_size, size);
-		return 0;
+	pthread_spin_unlock(&lock);
+	if (old) {
+		munmap(addr, size);
+		close(priv->dmabuf);
+		free(priv);
+		free(buf);
+		return old->buf;
 	}
+
+	return buf;
+err:
+	free(priv);
+	free(buf);
+	return NULL;
 }
 
-int g2d_clear(void *handle, struct g2d_surface *area)
+/*
+ * Hand out a dma-buf fd for buf, owned by the caller. Only imported
+ * buffers have one: the pxp driver cannot export its memory, so buffers
+ * to be shared are allocated by an exporter and imported instead.
+ */
+int g2d_buf_export_fd(struct g2d_buf *buf, int *dmabuf_fd)
 {
-	struct pxp_config_data pxp_conf;
-	struct pxp_layer_param *out_param;
-	struct g2dContext *context = (struct g2dContext *)handle;
+	struct g2d_buf_priv *priv;
 
-	if (context == NULL) {
-		g2d_printf("%s: invalid handle\n", __func__);
+	if (!buf || !dmabuf_fd) {
+		g2d_printf("%s: invalid parameter\n", __func__);
 		return -1;
 	}
 
-	if (area == NULL) {
-		g2d_printf("%s: invalid clear area\n", __func__);
+	priv = (struct g2d_buf_priv *)buf->buf_handle;
+	if (priv->dmabuf < 0) {
+		g2d_printf("%s: pxp memory cannot be exported\n", __func__);
 		return -1;
 	}
 
-	memset(&pxp_conf, 0, sizeof(struct pxp_config_data));
-	out_param = &(pxp_conf.out_param);
-	out_param->pixel_fmt = g2d_decide_out_support(area->format);
-	if (out_param->pixel_fmt < 0) {
-		g2d_printf("%s: unsupported output format\n", __func__);
+	*dmabuf_fd = fcntl(priv->dmabuf, F_DUPFD_CLOEXEC, 0);
+	if (*dmabuf_fd < 0) {
+		g2d_printf("%s: dup failed\n", __func__);
 		return -1;
 	}
 
-	out_param->width  = area->width;
-	out_param->height = area->height;
-	out_param->stride = area->stride;
-	out_param->paddr  = area->planes[0];
+	return 0;
+}
 
-	out_param->global_alpha_enable = 1;
-	out_param->global_alpha = (area->clrcolor >> 24) & 0xff;
-	pxp_conf.proc_data.bgcolor = area->clrcolor;
+int g2d_trim_pool(int keep_bytes)
+{
+	struct g2d_buf_priv *trim;
 
-	pxp_conf.handle = context->handle;
-	g2d_config_chan(&pxp_conf);
+	pthread_spin_lock(&lock);
+	trim = g2d_pool_detach(keep_bytes < 0 ? 0 : keep_bytes);
+	pthread_spin_unlock(&lock);
 
+	g2d_pool_release(trim);
 	return 0;
 }
 
-int g2d_blit(void *handle, struct g2d_surface *src, struct g2d_surface *dst)
+int g2d_query_pool_stats(struct g2d_pool_stats *stats)
 {
-	int dest_bpp;
-	int srcRotate, dstRotate;
-	struct pxp_config_data pxp_conf;
-	struct pxp_layer_param *src_param, *out_param, *third_param = NULL;
-	unsigned int srcWidth,srcHeight,dstWidth,dstHeight;
-	struct g2dContext *context = (struct g2dContext *)handle;
-
-	if (context == NULL) {
-		g2d_printf("%s: Invalid handle!\n", __func__);
+	if (stats == NULL) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
 		return -1;
 	}
 
-	if(!src || !dst)
-	{
-		g2d_printf("%s: Invalid src and dst parameters!\n", __func__);
-		return -1;
-	}
+	pthread_spin_lock(&lock);
+	memcpy(stats, &pool_stats, sizeof(struct g2d_pool_stats));
+	pthread_spin_unlock(&lock);
 
-	if (!context->blend_dim) {
-		srcWidth = src->right - src->left;
-		srcHeight = src->bottom - src->top;
+	return 0;
+}
 
-		if(srcWidth <=0 || srcHeight <= 0 || srcWidth > src->width || srcHeight > src->height || src->width > src->stride)
-		{
-			g2d_printf("%s: Invalid src rect, left %d, top %d, right %d, bottom %d, width %d, height %d, stride %d!\n",
-					__FUNCTION__, src->left, src->top, src->right, src->bottom, src->width, src->height, src->stride);
-			return -1;
+static struct g2d_buf *g2d_find_buf(int paddr, int size)
+{
+	struct g2d_buf_priv *priv;
+	struct g2d_buf *buf = NULL;
+	unsigned int off;
+
+	if (size < 0)
+		return NULL;
+
+	/* physical addresses may be above 2GB, compare them unsigned */
+	pthread_spin_lock(&lock);
+	for (priv = buf_list; priv; priv = priv->next) {
+		off = (unsigned int)paddr - (unsigned int)priv->buf->buf_paddr;
+		if ((unsigned int)paddr >= (unsigned int)priv->buf->buf_paddr &&
+		    off <= (unsigned int)priv->buf->buf_size &&
+		    (unsigned int)size <= (unsigned int)priv->buf->buf_size - off) {
+			buf = priv->buf;
+			break;
 		}
+	}
+	pthread_spin_unlock(&lock);
 
-		if(!src->planes[0])
-		{
-			g2d_printf("%s: Invalid src planes[0] pointer=0x%x !\n", __FUNCTION__, src->planes[0]);
+	return buf;
+}
+
+/* resolve the planes of a surface to the g2d buffers holding them */
+static int g2d_cpu_surface(struct g2d_surface *surf, struct g2d_cpu_surface *cs,
+			   struct g2d_buf **bufs)
+{
+	int i, paddr;
+
+	memset(cs, 0, sizeof(struct g2d_cpu_surface));
+	memset(bufs, 0, 3 * sizeof(struct g2d_buf *));
+	cs->surf = surf;
+
+	for (i = 0; i < g2d_cpu_planes(surf->format); i++) {
+		paddr = g2d_cpu_plane_addr(surf, i);
+		bufs[i] = g2d_find_buf(paddr, g2d_cpu_plane_size(surf, i));
+		if (bufs[i] == NULL) {
+			g2d_printf("%s: plane %d is not in a g2d buffer\n", __func__, i);
 			return -1;
 		}
-	} else {
-		g2d_printf("%s: dim blending is not supported yet!\n", __func__);
-		return -1;
+		cs->planes[i] = (unsigned char *)bufs[i]->buf_vaddr +
+				(paddr - bufs[i]->buf_paddr);
 	}
 
-	dstWidth = dst->right - dst->left;
-	dstHeight = dst->bottom - dst->top;
+	return 0;
+}
 
-	if(dstWidth <=0 || dstHeight <= 0 || dstWidth > dst->width || dstHeight > dst->height || dst->width > dst->stride)
-	{
-		g2d_printf("%s: Invalid dst rect, left %d, top %d, right %d, bottom %d, width %d, height %d, stride %d!\n",
-				__FUNCTION__, dst->left, dst->top, dst->right, dst->bottom, dst->width, dst->height, dst->stride);
-		return -1;
-	}
+/* bytes of a buffer the cpu touches: height rows of width bytes */
+struct g2d_cpu_span {
+	struct g2d_buf *buf;
+	int offset;
+	int width;
+	int height;
+	int stride;
+};
 
-	if(!dst->planes[0])
-	{
-		g2d_printf("%s: Invalid dst planes[0] pointer=0x%x !\n", __FUNCTION__, dst->planes[0]);
-		return -1;
+/* the bytes of each plane of surf under rect r, 3 spans, unused ones empty */
+static void g2d_cpu_spans(const struct g2d_surface *surf,
+			  const struct g2d_rect *r, struct g2d_buf **bufs,
+			  struct g2d_cpu_span *spans)
+{
+	int i, offset;
+
+	memset(spans, 0, 3 * sizeof(struct g2d_cpu_span));
+	for (i = 0; i < g2d_cpu_planes(surf->format); i++) {
+		if (bufs[i] == NULL)
+			continue;
+		g2d_cpu_plane_rect(surf, i, r, &offset, &spans[i].width,
+				   &spans[i].height, &spans[i].stride);
+		spans[i].buf = bufs[i];
+		spans[i].offset = g2d_cpu_plane_addr(surf, i) -
+				  bufs[i]->buf_paddr + offset;
 	}
+}
 
-	memset(&pxp_conf, 0, sizeof(struct pxp_config_data));
-
-	if (g2d_has_alpha(src->format) ||
-	    (context->blending && context->global_alpha_enable &&
-	     src->global_alpha < 0xff)) {
-		src_param = &(pxp_conf.ol_param[0]);
+/*
+ * Cache op on the spans of the cacheable buffers, range ops where they
+ * exist. A buffer whose spans add up to more than a range op is worth
+ * gets one whole buffer op, as do all of them elsewhere.
+ */
+static void g2d_cpu_cache(struct g2d_cpu_span *spans, int n,
+			  enum g2d_cache_mode op)
+{
+	struct g2d_buf *buf;
+	int i, j, bytes;
+
+	for (i = 0; i < n; i++) {
+		buf = spans[i].buf;
+		if (buf == NULL || spans[i].width <= 0 || spans[i].height <= 0 ||
+		    !((struct g2d_buf_priv *)buf->buf_handle)->cacheable)
+			continue;
+		/* each buffer once, at its first span */
+		for (j = 0; j < i && spans[j].buf != buf; j++)
+			;
+		if (j < i)
+			continue;
+
+		bytes = 0;
+		for (j = i; j < n; j++) {
+			if (spans[j].buf == buf)
+				bytes += spans[j].width * spans[j].height;
+		}
+		if (!G2D_CACHE_RANGE_OPS || bytes > g2d_cache_range_limit() ||
+		    bytes >= buf->buf_size / 2) {
+			g2d_cache_op(buf, op);
+			continue;
+		}
+
+		for (j = i; j < n; j++) {
+			if (spans[j].buf == buf && spans[j].width > 0 &&
+			    spans[j].height > 0)
+				g2d_cache_op_rect(buf, spans[j].offset,
+						  spans[j].width, spans[j].height,
+						  spans[j].stride, op);
+		}
+	}
+}
+
+/*
+ * Make memory written by pxp visible to the cpu: wait for the work this
+ * context has queued and clean+invalidate what the cpu will touch.
+ */
+static int g2d_cpu_begin(struct g2dContext *context,
+			 struct g2d_cpu_span *spans, int n)
+{
+	if ((context->cmd_count || context->busy || context->fence_count) &&
+	    g2d_finish(context) < 0)
+		return -1;
+
+	g2d_cpu_cache(spans, n, G2D_CACHE_FLUSH);
+	return 0;
+}
+
+/* write back what the cpu produced so pxp sees it */
+static void g2d_cpu_end(struct g2d_cpu_span *spans, int n)
+{
+	g2d_cpu_cache(spans, n, G2D_CACHE_CLEAN);
+}
+
+/*
+ * Whether a blit to a 16 bit dst is dithered. A plain copy of 16 bit
+ * pixels has no precision to spread and is left alone.
+ */
+static int g2d_dither_wanted(struct g2dContext *context,
+			     struct g2d_surface *src, struct g2d_surface *dst)
+{
+	int rot, hflip, vflip, sw, sh;
+
+	if (context->dither == G2D_CPU_DITHER_NONE ||
+	    (dst->format != G2D_RGB565 && dst->format != G2D_BGR565))
+		return 0;
+
+	if (context->blend_dim || context->blending ||
+	    (src->format != G2D_RGB565 && src->format != G2D_BGR565))
+		return 1;
+
+	rot = g2d_cpu_rotation(src, dst, &hflip, &vflip);
+	sw = (rot & 1) ? src->bottom - src->top : src->right - src->left;
+	sh = (rot & 1) ? src->right - src->left : src->bottom - src->top;
+
+	return sw != dst->right - dst->left || sh != dst->bottom - dst->top;
+}
+
+static int g2d_blit_cpu(struct g2dContext *context, struct g2d_surface *src,
+			struct g2d_surface *dst, const struct g2d_rect *clip)
+{
+	struct g2d_cpu_blit blit;
+	struct g2d_cpu_span spans[6];
+	struct g2d_buf *bufs[6];
+	struct g2d_rect r;
+	unsigned long long start = g2d_time_us(), t;
+	int ret;
+
+	if (dst->left < 0 || dst->top < 0 || dst->right > dst->width ||
+	    dst->bottom > dst->height || (!context->blend_dim &&
+	    (src->left < 0 || src->top < 0 || src->right > src->width ||
+	     src->bottom > src->height))) {
+		g2d_printf("%s: rect is out of the surface\n", __func__);
+		return -1;
+	}
+
+	memset(&blit, 0, sizeof(blit));
+	memset(bufs, 0, sizeof(bufs));
+
+	if (!context->blend_dim && g2d_cpu_surface(src, &blit.src, bufs) < 0)
+		return -1;
+	blit.src.surf = src;
+	if (g2d_cpu_surface(dst, &blit.dst, bufs + 3) < 0)
+		return -1;
+
+	blit.blending = context->blending;
+	blit.blend_dim = context->blend_dim;
+	blit.filter = context->scale_filter;
+	if (g2d_dither_wanted(context, src, dst))
+		blit.dither = context->dither;
+	if (clip)
+		blit.clip = *clip;
+	blit.global_alpha = 255;
+	blit.dst_global_alpha = 255;
+	if (context->global_alpha_enable) {
+		blit.global_alpha = src->global_alpha & 0xff;
+		blit.dst_global_alpha = dst->global_alpha & 0xff;
+	}
+
+	/* all of the src rect, the part of the dst rect the clip leaves */
+	memset(spans, 0, 3 * sizeof(struct g2d_cpu_span));
+	if (!context->blend_dim) {
+		r.left = src->left;
+		r.top = src->top;
+		r.right = src->right;
+		r.bottom = src->bottom;
+		g2d_cpu_spans(src, &r, bufs, spans);
+	}
+	r.left = dst->left;
+	r.top = dst->top;
+	r.right = dst->right;
+	r.bottom = dst->bottom;
+	if (clip && clip->right > clip->left && clip->bottom > clip->top) {
+		r.left = clip->left > r.left ? clip->left : r.left;
+		r.top = clip->top > r.top ? clip->top : r.top;
+		r.right = clip->right < r.right ? clip->right : r.right;
+		r.bottom = clip->bottom < r.bottom ? clip->bottom : r.bottom;
+		if (r.right <= r.left || r.bottom <= r.top)
+			r.right = r.left;
+	}
+	g2d_cpu_spans(dst, &r, bufs + 3, spans + 3);
+
+	if (g2d_cpu_begin(context, spans, 6) < 0)
+		return -1;
+	g2d_pending(context, start);
+	t = g2d_time_us();
+	ret = g2d_cpu_blit(&blit);
+	g2d_cpu_end(spans + 3, 3);
+	context->stats.cpu_us += g2d_time_us() - t;
+
+	return ret;
+}
+
+static int g2d_buf_cacheable(struct g2d_buf *buf)
+{
+	struct g2d_buf_priv *priv = (struct g2d_buf_priv *)buf->buf_handle;
+
+	return priv ? priv->cacheable : 0;
+}
+
+static int g2d_clear_cpu(struct g2dContext *context, struct g2d_surface *area)
+{
+	struct g2d_cpu_surface cs;
+	struct g2d_surface_ex ex;
+	struct g2d_surface *surf = &ex.base;
+	struct g2d_cpu_span spans[3];
+	struct g2d_buf *bufs[3];
+	struct g2d_rect r;
+	unsigned long long start = g2d_time_us(), t;
+	int ret;
+
+	/* pxp always clears the whole surface, do the same without a rect */
+	memcpy(&ex, g2d_cpu_ex(area), sizeof(struct g2d_surface_ex));
+	if (surf->right <= surf->left || surf->bottom <= surf->top) {
+		surf->left = surf->top = 0;
+		surf->right = surf->width;
+		surf->bottom = surf->height;
+	}
+
+	if (surf->left < 0 || surf->top < 0 || surf->right > surf->width ||
+	    surf->bottom > surf->height) {
+		g2d_printf("%s: rect is out of the surface\n", __func__);
+		return -1;
+	}
+
+	if (g2d_cpu_surface(surf, &cs, bufs) < 0)
+		return -1;
+	cs.nt = !g2d_buf_cacheable(bufs[0]);
+	r.left = surf->left;
+	r.top = surf->top;
+	r.right = surf->right;
+	r.bottom = surf->bottom;
+	g2d_cpu_spans(surf, &r, bufs, spans);
+
+	if (g2d_cpu_begin(context, spans, 3) < 0)
+		return -1;
+	g2d_pending(context, start);
+	t = g2d_time_us();
+	ret = g2d_cpu_clear(&cs);
+	g2d_cpu_end(spans, 3);
+	context->stats.cpu_us += g2d_time_us() - t;
+
+	return ret;
+}
+
+static int g2d_copy_cpu(struct g2dContext *context, struct g2d_buf *d,
+			struct g2d_buf *s, int size)
+{
+	struct g2d_cpu_span spans[2] = {
+		{ s, 0, size, 1, size },
+		{ d, 0, size, 1, size },
+	};
+
+	if (g2d_cpu_begin(context, spans, 2) < 0)
+		return -1;
+	g2d_cpu_copy(d->buf_vaddr, s->buf_vaddr, size, !g2d_buf_cacheable(d));
+	g2d_cpu_end(spans + 1, 1);
+
+	return 0;
+}
+
+#define PXP_COPY_THRESHOLD (16*16*4)
+
+/* copies of threshold[src cacheable][dst cacheable] bytes or more go to pxp */
+static struct g2d_copy_tuning copy_tuning = {
+	.threshold = {
+		{ PXP_COPY_THRESHOLD, PXP_COPY_THRESHOLD },
+		{ PXP_COPY_THRESHOLD, PXP_COPY_THRESHOLD },
+	},
+};
+static bool copy_tuning_tried;
+
+static int g2d_copy_pxp(struct g2dContext *context, struct g2d_buf *d,
+			struct g2d_buf *s, int size)
+{
+	unsigned int blit_size;
+	struct pxp_config_data pxp_conf;
+	struct pxp_layer_param *src_param = NULL, *out_param = NULL;
+
+	memset(&pxp_conf, 0, sizeof(struct pxp_config_data));
+
+	src_param = &(pxp_conf.ol_param[0]);
+	out_param = &(pxp_conf.out_param);
+
+	if (size < PXP_COPY_THRESHOLD) {
+		memcpy(d->buf_vaddr, s->buf_vaddr, size);
+		return 0;
+	}
+	else if (size <= PXP_COPY_THRESHOLD * 4096) {
+		src_param->width = PXP_COPY_THRESHOLD >> 2;
 	}
 	else {
-		src_param = &(pxp_conf.s0_param);
+		src_param->width = PXP_COPY_THRESHOLD;
+	}
+
+	src_param->stride = src_param->width;
+	src_param->pixel_fmt = PXP_PIX_FMT_BGRA32;
+	src_param->height = size / (src_param->width << 2);
+	if (src_param->height > G2D_PXP_MAX_SIZE)
+		src_param->height = G2D_PXP_MAX_SIZE;
+
+	memcpy(out_param, src_param, sizeof(struct pxp_layer_param));
+	out_param->pixel_fmt = PXP_PIX_FMT_BGRA32;
+	src_param->paddr = s->buf_paddr;
+	out_param->paddr = d->buf_paddr;
+
+	blit_size = src_param->width * src_param->height * 4;
+	pxp_conf.handle = context->handle;
+	pxp_conf.proc_data.drect.top = 0;
+	pxp_conf.proc_data.drect.left = 0;
+	pxp_conf.proc_data.drect.width = src_param->width;
+	pxp_conf.proc_data.drect.height = src_param->height;
+
+	g2d_config_chan(context, &pxp_conf);
+
+	if (blit_size == size)
+		return 0;
+	else if (size - blit_size > src_param->width * 4) {
+		struct g2d_buf subs, subd;
+		subd.buf_handle = d->buf_handle;
+		subd.buf_size = d->buf_size - blit_size;
+		subd.buf_paddr = d->buf_paddr + blit_size;
+		subd.buf_vaddr = (void*)(((int)d->buf_vaddr) + blit_size);
+
+		subs.buf_handle = s->buf_handle;
+		subs.buf_size = s->buf_size - blit_size;
+		subs.buf_paddr = s->buf_paddr + blit_size;
+		subs.buf_vaddr = (void*)(((int)s->buf_vaddr) + blit_size);
+		return g2d_copy(context, &subd, &subs, size - blit_size);
+	}
+	else {
+		size = size - blit_size;
+		memcpy(d->buf_vaddr + blit_size, s->buf_vaddr + blit_size, size);
+		return 0;
+	}
+}
+
+/*
+ * Time cpu and pxp copies of growing size between every combination of
+ * cacheable and uncached buffers, each the way g2d_copy would run it. Pxp takes over from the first size it
+ * is faster at, it never does if the cpu wins all of them.
+ */
+int g2d_copy_calibrate(void *handle)
+{
+	struct g2dContext *context = (struct g2dContext *)handle;
+	struct g2d_copy_tuning tuning;
+	struct g2d_stats stats;
+	struct g2d_buf *s, *d;
+	unsigned long long start, t;
+	int sc, dc, i, n, size, best_cpu, best_pxp;
+
+	if (context == NULL) {
+		g2d_printf("%s: Invalid handle!\n", __func__);
+		return -1;
+	}
+
+	pthread_spin_lock(&lock);
+	copy_tuning_tried = true;
+	pthread_spin_unlock(&lock);
+
+	if ((context->cmd_count || context->busy || context->fence_count) &&
+	    g2d_finish(context) < 0)
+		return -1;
+
+	memcpy(&stats, &context->stats, sizeof(struct g2d_stats));
+	memset(&tuning, 0, sizeof(tuning));
+
+	for (sc = 0; sc < 2; sc++) {
+		for (dc = 0; dc < 2; dc++) {
+			s = g2d_alloc(G2D_COPY_TUNING_MAX, sc);
+			d = g2d_alloc(G2D_COPY_TUNING_MAX, dc);
+			if (s == NULL || d == NULL) {
+				g2d_printf("%s: no memory for calibration\n", __func__);
+				if (s)
+					g2d_free(s);
+				if (d)
+					g2d_free(d);
+				return -1;
+			}
+
+			tuning.threshold[sc][dc] = -1;
+			for (i = 0; i < G2D_COPY_TUNING_SIZES; i++) {
+				size = G2D_COPY_TUNING_MIN << i;
+				best_cpu = best_pxp = 0x7fffffff;
+				for (n = 0; n < 3; n++) {
+					/* the cache maintenance a cpu copy pays is in its time */
+					start = g2d_time_us();
+					if (g2d_copy_cpu(context, d, s, size) < 0)
+						break;
+					t = g2d_time_us() - start;
+					if (t < best_cpu)
+						best_cpu = t;
+
+					start = g2d_time_us();
+					if (g2d_copy_pxp(context, d, s, size) < 0 ||
+					    g2d_finish(context) < 0)
+						break;
+					t = g2d_time_us() - start;
+					if (t < best_pxp)
+						best_pxp = t;
+				}
+				tuning.cpu_us[sc][dc][i] = best_cpu;
+				tuning.pxp_us[sc][dc][i] = best_pxp;
+				if (tuning.threshold[sc][dc] < 0 && best_pxp < best_cpu)
+					tuning.threshold[sc][dc] = size;
+			}
+			if (tuning.threshold[sc][dc] < 0)
+				tuning.threshold[sc][dc] = 0x7fffffff;
+
+			g2d_free(s);
+			g2d_free(d);
+		}
+	}
+	tuning.calibrated = 1;
+
+	pthread_spin_lock(&lock);
+	memcpy(&copy_tuning, &tuning, sizeof(tuning));
+	pthread_spin_unlock(&lock);
+
+	memcpy(&context->stats, &stats, sizeof(struct g2d_stats));
+	return 0;
+}
+
+/* calibrates the copy threshold unless some context already tried */
+static void g2d_copy_calibrate_once(struct g2dContext *context)
+{
+	bool tune = false;
+
+	pthread_spin_lock(&lock);
+	if (!copy_tuning_tried)
+		tune = copy_tuning_tried = true;
+	pthread_spin_unlock(&lock);
+	if (tune)
+		g2d_copy_calibrate(context);
+}
+
+int g2d_query_copy_tuning(struct g2d_copy_tuning *tuning)
+{
+	if (tuning == NULL) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+
+	pthread_spin_lock(&lock);
+	memcpy(tuning, &copy_tuning, sizeof(struct g2d_copy_tuning));
+	pthread_spin_unlock(&lock);
+
+	return 0;
+}
+
+int g2d_copy(void *handle, struct g2d_buf *d, struct g2d_buf* s, int size)
+{
+	int threshold;
+	struct g2dContext *context = (struct g2dContext *)handle;
+
+	if (context == NULL || s == NULL || d == NULL) {
+		g2d_printf("%s: null pointer access\n", __func__);
+		return -1;
+	}
+
+	if (context->current_type == G2D_HARDWARE_CPU)
+		return g2d_copy_cpu(context, d, s, size);
+
+	/* copies never calibrate, the threshold stays fixed until asked to */
+	pthread_spin_lock(&lock);
+	threshold = copy_tuning.threshold[g2d_buf_cacheable(s)][g2d_buf_cacheable(d)];
+	pthread_spin_unlock(&lock);
+
+	/* through begin/end, pending pxp work may still write s or read d */
+	if (size < threshold || size < PXP_COPY_THRESHOLD)
+		return g2d_copy_cpu(context, d, s, size);
+
+	return g2d_copy_pxp(context, d, s, size);
+}
+
+/*
+ * Whether pxp can reach the planes of surf. It takes the chroma right
+ * after the luma at the default pitch, other layouts go to the cpu. When
+ * the cpu can't map a plane either, e.g. a vpu frame from IOGetPhyMem,
+ * pxp keeps reading it as contiguous, as it did before chroma planes
+ * could be placed. A uv_stride of its own always needs the cpu.
+ */
+static int g2d_pxp_planes(struct g2d_surface *surf)
+{
+	int i;
+
+	if (g2d_cpu_planes_contiguous(surf))
+		return 1;
+	if (g2d_cpu_ex(surf)->uv_stride)
+		return 0;
+
+	for (i = 0; i < g2d_cpu_planes(surf->format); i++) {
+		if (g2d_find_buf(g2d_cpu_plane_addr(surf, i),
+				 g2d_cpu_plane_size(surf, i)) == NULL)
+			return 1;
 	}
+
+	return 0;
+}
+
+/* pxp fills the whole of area, rect or not */
+static int g2d_clear_pxp(struct g2dContext *context, struct g2d_surface *area)
+{
+	struct pxp_config_data pxp_conf;
+	struct pxp_layer_param *out_param;
+
+	memset(&pxp_conf, 0, sizeof(struct pxp_config_data));
 	out_param = &(pxp_conf.out_param);
+	out_param->pixel_fmt = g2d_decide_out_support(area->format);
+	if ((int)out_param->pixel_fmt < 0 ||
+	    g2d_cpu_color_space(area) != G2D_BT601_LIMITED ||
+	    !g2d_pxp_planes(area))
+		return G2D_UNSUPPORTED;
 
-	src_param->pixel_fmt = (src_param == &(pxp_conf.s0_param)) ?
-				g2d_decide_ps_support(src->format) :
-				g2d_decide_overlay_support(src->format);
-	out_param->pixel_fmt = g2d_decide_out_support(dst->format);
+	out_param->width  = area->width;
+	out_param->height = area->height;
+	out_param->stride = area->stride;
+	out_param->paddr  = area->planes[0];
+
+	out_param->global_alpha_enable = 1;
+	out_param->global_alpha = (area->clrcolor >> 24) & 0xff;
+	pxp_conf.proc_data.bgcolor = area->clrcolor;
+
+	pxp_conf.handle = context->handle;
+	g2d_config_chan(context, &pxp_conf);
+
+	return 0;
+}
+
+int g2d_clear_ex(void *handle, struct g2d_surface_ex *area)
+{
+	struct g2dContext *context = (struct g2dContext *)handle;
+	int ret;
 
-	if (src_param->pixel_fmt == 0 || out_param->pixel_fmt == 0) {
-		g2d_printf("%s: unsupport pixel format\n", __func__);
+	if (context == NULL) {
+		g2d_printf("%s: invalid handle\n", __func__);
 		return -1;
 	}
-	dest_bpp = g2d_get_bpp(dst->format);
 
-	src_param->stride = src->stride;
-	out_param->stride = dst->stride;
-	src_param->width  = src->width;
-	src_param->height = src->height;
-	src_param->paddr  = src->planes[0];
-	out_param->paddr  = dst->planes[0] + (dst->top * dst->stride + dst->left) * (dest_bpp >> 3);
+	if (area == NULL) {
+		g2d_printf("%s: invalid clear area\n", __func__);
+		return -1;
+	}
 
-	srcRotate = src->rot;
-	dstRotate = dst->rot;
-	pxp_conf.proc_data.hflip = ((srcRotate == G2D_FLIP_H) | (dstRotate == G2D_FLIP_H)) ? 1 : 0;
-	pxp_conf.proc_data.vflip = ((srcRotate == G2D_FLIP_V) | (dstRotate == G2D_FLIP_V)) ? 1 : 0;
+	if (context->current_type == G2D_HARDWARE_CPU)
+		return g2d_clear_cpu(context, &area->base);
 
-	if ((srcRotate == G2D_FLIP_H) || (srcRotate == G2D_FLIP_V))
-		srcRotate = 0;
-	if ((dstRotate == G2D_FLIP_H) || (dstRotate == G2D_FLIP_V))
-		dstRotate = 0;
+	ret = g2d_clear_pxp(context, &area->base);
+	if (ret == G2D_UNSUPPORTED)
+		return g2d_clear_cpu(context, &area->base);
 
-	switch(dstRotate - srcRotate) {
+	return ret;
+}
+
+int g2d_clear(void *handle, struct g2d_surface *area)
+{
+	struct g2d_surface_ex ex;
+
+	return g2d_clear_ex(handle, g2d_surface_wrap(&ex, area));
+}
+
+static int g2d_clear_cpu_limit(void)
+{
+	static int limit;
+	char *env;
+
+	if (!limit) {
+		env = getenv("G2D_CLEAR_CPU_PIXELS");
+		limit = env ? atoi(env) : G2D_CLEAR_CPU_DEFAULT;
+		if (limit < 0)
+			limit = G2D_CLEAR_CPU_DEFAULT;
+		else if (!limit)
+			limit = -1;	/* 0 turns cpu fills off */
+	}
+
+	return limit;
+}
+
+/* fold r into *last when together they are still one rect */
+static int g2d_rect_merge(struct g2d_rect *last, const struct g2d_rect *r)
+{
+	if (last->left == r->left && last->right == r->right &&
+	    r->top <= last->bottom && r->bottom >= last->top) {
+		last->top = r->top < last->top ? r->top : last->top;
+		last->bottom = r->bottom > last->bottom ? r->bottom : last->bottom;
+		return 1;
+	}
+	if (last->top == r->top && last->bottom == r->bottom &&
+	    r->left <= last->right && r->right >= last->left) {
+		last->left = r->left < last->left ? r->left : last->left;
+		last->right = r->right > last->right ? r->right : last->right;
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Fill n rects of surface with color (RGBA8888 like clrcolor), the rect
+ * of surface itself is ignored. Rects are clipped to the surface, and
+ * neighbours sharing an edge are merged. Small ones are filled on the
+ * cpu, the rest go into the current batch, one pxp config each. The
+ * config ioctls saved over a g2d_clear per rect are in the stats.
+ */
+int g2d_clear_rects(void *handle, struct g2d_surface *surface,
+		    const struct g2d_rect *rects, int n, int color)
+{
+	struct g2dContext *context = (struct g2dContext *)handle;
+	struct g2d_surface_ex ex, area;
+	struct g2d_surface *surf = &ex.base;
+	struct g2d_cpu_surface cs;
+	struct g2d_cpu_span *spans;
+	struct g2d_buf *bufs[3];
+	struct g2d_rect *list, r;
+	unsigned long long start, t;
+	int i, count, pxp, cpu = 0, limit, spanned, ret = 0;
+
+	if (context == NULL || surface == NULL || n < 0 ||
+	    (n && rects == NULL)) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+	if (!n)
+		return 0;
+
+	list = (struct g2d_rect *)malloc(n * sizeof(struct g2d_rect));
+	if (list == NULL) {
+		g2d_printf("%s: malloc memory failed!\n", __func__);
+		return -1;
+	}
+
+	for (i = 0, count = 0; i < n; i++) {
+		r.left = rects[i].left > 0 ? rects[i].left : 0;
+		r.top = rects[i].top > 0 ? rects[i].top : 0;
+		r.right = rects[i].right < surface->width ? rects[i].right : surface->width;
+		r.bottom = rects[i].bottom < surface->height ? rects[i].bottom : surface->height;
+		if (r.right <= r.left || r.bottom <= r.top)
+			continue;
+		if (count && g2d_rect_merge(&list[count - 1], &r))
+			context->stats.ioctls_saved++;
+		else
+			list[count++] = r;
+	}
+
+	g2d_surface_wrap(&ex, surface);
+	surf->clrcolor = color;
+	surf->left = surf->top = 0;
+	surf->right = surf->width;
+	surf->bottom = surf->height;
+
+	/* pxp can only take rects of single plane surfaces, rebased per rect */
+	pxp = context->current_type != G2D_HARDWARE_CPU &&
+	      g2d_cpu_planes(surf->format) == 1 &&
+	      (int)g2d_decide_out_support(surf->format) >= 0 &&
+	      g2d_cpu_color_space(surf) == G2D_BT601_LIMITED;
+	limit = pxp ? g2d_clear_cpu_limit() : INT_MAX;
+	/* as in g2d_route_cpu, only rects that start a batch skip pxp */
+	if (pxp && (context->cmd_count || context->busy || context->fence_count))
+		limit = -1;
+
+	start = g2d_time_us();
+	if (g2d_cpu_format_supported(surf->format) &&
+	    g2d_cpu_surface(surf, &cs, bufs) == 0)
+		cpu = 1;
+	else if (!pxp) {
+		g2d_printf("%s: surface can't be cleared\n", __func__);
+		ret = -1;
+	}
+
+	if (cpu && count) {
+		cs.nt = !g2d_buf_cacheable(bufs[0]);
+		spans = (struct g2d_cpu_span *)malloc(count * 3 *
+						      sizeof(struct g2d_cpu_span));
+		if (spans == NULL) {
+			g2d_printf("%s: malloc memory failed!\n", __func__);
+			free(list);
+			return -1;
+		}
+		/* one begin and end covers the rects of all the cpu clears */
+		for (i = 0, spanned = 0; i < count; i++) {
+			if ((list[i].right - list[i].left) *
+			    (list[i].bottom - list[i].top) < limit)
+				g2d_cpu_spans(surf, &list[i], bufs,
+					      spans + 3 * spanned++);
+		}
+		if (spanned && g2d_cpu_begin(context, spans, 3 * spanned) < 0)
+			ret = -1;
+		else if (spanned) {
+			g2d_pending(context, start);
+			t = g2d_time_us();
+			for (i = 0; i < count && ret == 0; i++) {
+				if ((list[i].right - list[i].left) *
+				    (list[i].bottom - list[i].top) >= limit)
+					continue;
+				surf->left = list[i].left;
+				surf->top = list[i].top;
+				surf->right = list[i].right;
+				surf->bottom = list[i].bottom;
+				ret = g2d_cpu_clear(&cs);
+				list[i].right = list[i].left;
+				context->stats.ioctls_saved++;
+			}
+			g2d_cpu_end(spans, 3 * spanned);
+			context->stats.cpu_us += g2d_time_us() - t;
+		}
+		free(spans);
+	}
+
+	for (i = 0; i < count && ret == 0; i++) {
+		if (list[i].right == list[i].left)
+			continue;
+		if (!pxp) {
+			ret = -1;
+			break;
+		}
+		g2d_sub_surface(&area, surf, list[i].left, list[i].top,
+				list[i].right, list[i].bottom);
+		ret = g2d_clear_pxp(context, &area.base);
+	}
+
+	context->stats.clear_rects += count;
+
+	free(list);
+	return ret < 0 ? -1 : 0;
+}
+
+/*
+ * pxp converts yuv with the BT.601 limited range matrix only and needs
+ * the planes of a surface back to back, see g2d_pxp_planes
+ */
+static int g2d_pxp_color_space(struct g2d_surface *src, struct g2d_surface *dst)
+{
+	return g2d_cpu_color_space(src) == G2D_BT601_LIMITED &&
+	       g2d_cpu_color_space(dst) == G2D_BT601_LIMITED &&
+	       g2d_pxp_planes(src) && g2d_pxp_planes(dst);
+}
+
+/* prog != NULL builds the config into it instead of queueing it */
+static int g2d_blit_pxp(struct g2dContext *context, struct g2d_surface *src,
+			struct g2d_surface *dst, struct g2d_blit_prog *prog)
+{
+	int dest_bpp;
+	int srcRotate, dstRotate;
+	struct pxp_config_data pxp_conf;
+	struct pxp_layer_param *src_param, *out_param, *third_param = NULL;
+
+	if (context->blend_dim || !g2d_pxp_color_space(src, dst))
+		return G2D_UNSUPPORTED;
+
+	memset(&pxp_conf, 0, sizeof(struct pxp_config_data));
+
+	if (g2d_has_alpha(src->format) ||
+	    (context->blending && context->global_alpha_enable &&
+	     src->global_alpha < 0xff)) {
+		src_param = &(pxp_conf.ol_param[0]);
+	}
+	else {
+		src_param = &(pxp_conf.s0_param);
+	}
+	out_param = &(pxp_conf.out_param);
+
+	src_param->pixel_fmt = (src_param == &(pxp_conf.s0_param)) ?
+				g2d_decide_ps_support(src->format) :
+				g2d_decide_overlay_support(src->format);
+	out_param->pixel_fmt = g2d_decide_out_support(dst->format);
+
+	if ((int)src_param->pixel_fmt < 0 || (int)out_param->pixel_fmt < 0)
+		return G2D_UNSUPPORTED;
+	dest_bpp = g2d_get_bpp(dst->format);
+
+	src_param->stride = src->stride;
+	out_param->stride = dst->stride;
+	src_param->width  = src->width;
+	src_param->height = src->height;
+	src_param->paddr  = src->planes[0];
+	out_param->paddr  = dst->planes[0] + (dst->top * dst->stride + dst->left) * (dest_bpp >> 3);
+
+	srcRotate = src->rot;
+	dstRotate = dst->rot;
+	pxp_conf.proc_data.hflip = ((srcRotate == G2D_FLIP_H) | (dstRotate == G2D_FLIP_H)) ? 1 : 0;
+	pxp_conf.proc_data.vflip = ((srcRotate == G2D_FLIP_V) | (dstRotate == G2D_FLIP_V)) ? 1 : 0;
+
+	if ((srcRotate == G2D_FLIP_H) || (srcRotate == G2D_FLIP_V))
+		srcRotate = 0;
+	if ((dstRotate == G2D_FLIP_H) || (dstRotate == G2D_FLIP_V))
+		dstRotate = 0;
+
+	switch(dstRotate - srcRotate) {
 		case 1:
 		case -3:
 			pxp_conf.proc_data.rotate = 90;
@@ -689,191 +2272,1287 @@ int g2d_blit(void *handle, struct g2d_surface *src, struct g2d_surface *dst)
 			pxp_conf.proc_data.rotate = 270;
 			break;
 	}
-	if ((pxp_conf.proc_data.rotate == 90) || (pxp_conf.proc_data.rotate == 270)) {
-		if ((src->right - src->left) != (dst->bottom - dst->top) ||
-		    (src->bottom - src->top) != (dst->right - dst->left)) {
-			/* only ps engine can do scaling */
-			if (src_param == &(pxp_conf.ol_param[0])) {
-				g2d_printf("%s: format with alpha cannot be scaled\n", __func__);
-				return -1;
-			}
-		}
+	if ((pxp_conf.proc_data.rotate == 90) || (pxp_conf.proc_data.rotate == 270)) {
+		if ((src->right - src->left) != (dst->bottom - dst->top) ||
+		    (src->bottom - src->top) != (dst->right - dst->left)) {
+			/* only ps engine can do scaling */
+			if (src_param == &(pxp_conf.ol_param[0])) {
+				return G2D_UNSUPPORTED;
+			}
+		}
+	} else {
+		if ((src->right - src->left) != (dst->right - dst->left) ||
+		    (src->bottom - src->top) != (dst->bottom - dst->top)) {
+			/* only ps engine can do scaling */
+			if (src_param == &(pxp_conf.ol_param[0])) {
+				return G2D_UNSUPPORTED;
+			}
+		}
+	}
+
+	if (pxp_conf.proc_data.rotate && (src_param == &(pxp_conf.s0_param))) {
+		pxp_conf.proc_data.rot_pos = 1;
+	}
+
+	if ((pxp_conf.proc_data.rotate == 90) || (pxp_conf.proc_data.rotate == 270)) {
+		if (src_param == &(pxp_conf.ol_param[0])) {
+			out_param->width  = pxp_conf.proc_data.drect.width  = dst->bottom - dst->top;
+			out_param->height = pxp_conf.proc_data.drect.height = dst->right  - dst->left;
+		} else {
+			out_param->width  = pxp_conf.proc_data.drect.width  = dst->right  - dst->left;
+			out_param->height = pxp_conf.proc_data.drect.height = dst->bottom - dst->top;
+		}
+	} else {
+		out_param->width  = pxp_conf.proc_data.drect.width  = dst->right  - dst->left;
+		out_param->height = pxp_conf.proc_data.drect.height = dst->bottom - dst->top;
+	}
+	/* need do alpha blending */
+	if (context->blending) {
+		if (src_param == &(pxp_conf.ol_param[0])) {
+			third_param = &(pxp_conf.s0_param);
+			third_param->pixel_fmt = g2d_decide_ps_support(dst->format);
+		} else {
+			third_param = &(pxp_conf.ol_param[0]);
+			third_param->pixel_fmt = g2d_decide_overlay_support(dst->format);
+		}
+		if ((int)third_param->pixel_fmt < 0)
+			return G2D_UNSUPPORTED;
+
+		pxp_conf.proc_data.combine_enable = 1;
+
+		if (src_param == &(pxp_conf.ol_param[0])) {
+			switch(src->blendfunc) {
+			case G2D_ZERO:  //Cs = Cs * 0
+				if (dst->blendfunc != G2D_ONE) {
+					return G2D_UNSUPPORTED;
+				}
+				src_param->global_alpha_enable = 1;
+				src_param->global_alpha = 0xff;
+				src_param->global_override = 1;
+				break;
+			case G2D_ONE:   //Cs = Cs * 1
+				if (dst->blendfunc != G2D_ZERO) {
+					return G2D_UNSUPPORTED;
+				}
+				src_param->global_alpha_enable = 1;
+				src_param->global_alpha = 0x0;
+				src_param->global_override = 1;
+				break;
+			case G2D_SRC_ALPHA: //Cs = Cs * As
+				if (dst->blendfunc != G2D_ONE_MINUS_SRC_ALPHA) {
+					return G2D_UNSUPPORTED;
+				}
+				src_param->alpha_invert = 1;
+				break;
+			case G2D_ONE_MINUS_SRC_ALPHA:  //Cs = Cs * (1 - As)
+				if (dst->blendfunc != G2D_SRC_ALPHA) {
+					return G2D_UNSUPPORTED;
+				}
+				break;
+			default:
+				return G2D_UNSUPPORTED;
+			}
+		} else {
+			switch(src->blendfunc) {
+			case G2D_ZERO:
+				if (dst->blendfunc != G2D_ONE) {
+					return G2D_UNSUPPORTED;
+				}
+				third_param->global_alpha_enable = 1;
+				third_param->global_alpha = 0x0;
+				third_param->global_override = 1;
+				break;
+			case G2D_ONE:
+				if (dst->blendfunc != G2D_ZERO) {
+					return G2D_UNSUPPORTED;
+				}
+				third_param->global_alpha_enable = 1;
+				third_param->global_alpha = 0xff;
+				third_param->global_override = 1;
+				break;
+			case G2D_DST_ALPHA: //Cs = Cs * Ad
+				if (dst->blendfunc != G2D_ONE_MINUS_DST_ALPHA) {
+					return G2D_UNSUPPORTED;
+				}
+				break;
+			case G2D_ONE_MINUS_DST_ALPHA: //Cs = Cs * (1 - Ad)
+				if (dst->blendfunc != G2D_DST_ALPHA) {
+					return G2D_UNSUPPORTED;
+				}
+				third_param->alpha_invert = 1;
+				break;
+			default:
+				return G2D_UNSUPPORTED;
+			}
+		}
+		if (context->global_alpha_enable && (src->global_alpha < 0xff)) {
+			if (src_param == &(pxp_conf.ol_param[0])) {
+				src_param->global_alpha_enable = 1;
+				src_param->global_alpha = src->global_alpha & 0xff;
+			}
+			else {
+				return G2D_UNSUPPORTED;
+			}
+		}
+		if (context->global_alpha_enable && (dst->global_alpha < 0xff)) {
+			if (src_param == &(pxp_conf.s0_param)) {
+				third_param->global_alpha_enable = 1;
+				third_param->global_alpha = dst->global_alpha & 0xff;
+			}
+			else {
+				return G2D_UNSUPPORTED;
+			}
+		}
+	}
+
+	if (src_param == &(pxp_conf.s0_param)) {
+		pxp_conf.proc_data.srect.top    = src->top;
+		pxp_conf.proc_data.srect.left   = src->left;
+		if (pxp_conf.proc_data.rotate == 90 || pxp_conf.proc_data.rotate == 270) {
+			pxp_conf.proc_data.srect.width  = src->bottom - src->top;
+			pxp_conf.proc_data.srect.height = src->right  - src->left;
+		}
+		else {
+			pxp_conf.proc_data.srect.width  = src->right  - src->left;
+			pxp_conf.proc_data.srect.height = src->bottom - src->top;
+		}
+	}
+
+	if (context->blending) {
+		third_param->stride = out_param->stride;
+		third_param->width  = out_param->width;
+		third_param->height = out_param->height;
+		third_param->paddr  = out_param->paddr;
+		if (third_param == &(pxp_conf.s0_param)) {
+			pxp_conf.proc_data.srect.width  = out_param->width;
+			pxp_conf.proc_data.srect.height = out_param->height;
+		}
+	}
+
+	pxp_conf.handle = context->handle;
+
+	if (prog) {
+		prog->conf = pxp_conf;
+		prog->src_layer = src_param == &(pxp_conf.s0_param) ? 0 : 1;
+		prog->third_layer = !third_param ? -1 :
+				    third_param == &(pxp_conf.s0_param) ? 0 : 1;
+		prog->src_offset = src_param->paddr - src->planes[0];
+		prog->dst_offset = out_param->paddr - dst->planes[0];
+		return 0;
+	}
+
+	g2d_config_chan(context, &pxp_conf);
+
+	return 0;
+}
+
+/*
+ * Longest dst stripe on one axis that keeps dst and src within the pxp
+ * limits and starts every stripe on an exact src pixel, so each stripe
+ * scales with the same phase as the whole blit would. 0 if none.
+ */
+static int g2d_stripe_len(int dlen, int slen)
+{
+	int step, len;
+
+	step = dlen / g2d_cpu_gcd(dlen, slen);
+	len = G2D_PXP_MAX_SIZE;
+	if ((long long)len * slen > (long long)G2D_PXP_MAX_SIZE * dlen)
+		len = (long long)G2D_PXP_MAX_SIZE * dlen / slen;
+	if (len >= dlen)
+		return dlen;
+
+	return len - len % step;
+}
+
+/* surf with the defaults of the g2d_surface_ex fields, NULL for NULL */
+struct g2d_surface_ex *g2d_surface_wrap(struct g2d_surface_ex *ex,
+					const struct g2d_surface *surf)
+{
+	if (surf == NULL)
+		return NULL;
+
+	memset(ex, 0, sizeof(*ex));
+	ex->base = *surf;
+	return ex;
+}
+
+/* sub-surface for rect l,t,r,b of surf, based at its top left pixel */
+void g2d_sub_surface(struct g2d_surface_ex *sub, const struct g2d_surface *surf,
+		     int l, int t, int r, int b)
+{
+	*sub = *g2d_cpu_ex(surf);
+	sub->base.planes[0] += (t * surf->stride + l) * (g2d_get_bpp(surf->format) >> 3);
+	sub->base.left = sub->base.top = 0;
+	sub->base.right = sub->base.width = r - l;
+	sub->base.bottom = sub->base.height = b - t;
+}
+
+static int g2d_needs_stripes(struct g2d_surface *src, struct g2d_surface *dst)
+{
+	return src->width > G2D_PXP_MAX_SIZE || src->height > G2D_PXP_MAX_SIZE ||
+	       dst->width > G2D_PXP_MAX_SIZE || dst->height > G2D_PXP_MAX_SIZE;
+}
+
+/*
+ * Split a blit pxp can't address in one go into stripes of at most
+ * G2D_PXP_MAX_SIZE, all queued in the current batch. The dst rect is cut
+ * into a grid and each cell is mapped back to its src rect with the
+ * rotation and flips of the blit, following the cpu backend.
+ */
+static int g2d_blit_stripes(struct g2dContext *context, struct g2d_surface *src,
+			    struct g2d_surface *dst)
+{
+	struct g2d_surface_ex s, d;
+	struct g2d_blit_prog probe;
+	int rot, hflip, vflip, dw, dh, xlen, ylen, pass, ret;
+	int cell[4], rect[4];
+
+	if (context->blend_dim)
+		return G2D_UNSUPPORTED;
+
+	/* only single plane formats can be rebased per stripe */
+	if (g2d_cpu_planes(src->format) != 1 || g2d_cpu_planes(dst->format) != 1)
+		return G2D_UNSUPPORTED;
+	if (src->stride * (g2d_get_bpp(src->format) >> 3) > G2D_PXP_MAX_PITCH ||
+	    dst->stride * (g2d_get_bpp(dst->format) >> 3) > G2D_PXP_MAX_PITCH)
+		return G2D_UNSUPPORTED;
+
+	rot = g2d_cpu_rotation(src, dst, &hflip, &vflip);
+	dw = dst->right - dst->left;
+	dh = dst->bottom - dst->top;
+
+	/* dst x walks src y on odd quarter turns */
+	xlen = g2d_stripe_len(dw, (rot & 1) ? src->bottom - src->top :
+				       src->right - src->left);
+	ylen = g2d_stripe_len(dh, (rot & 1) ? src->right - src->left :
+				       src->bottom - src->top);
+	if (!xlen || !ylen)
+		return G2D_UNSUPPORTED;
+
+	/*
+	 * The first pass only probes, nothing is queued until pxp is known
+	 * to take every stripe, the cpu gets the whole blit otherwise.
+	 */
+	for (pass = 0; pass < 2; pass++) {
+		for (cell[1] = dst->top; cell[1] < dst->bottom; cell[1] = cell[3]) {
+			cell[3] = cell[1] + ylen < dst->bottom ?
+				  cell[1] + ylen : dst->bottom;
+			for (cell[0] = dst->left; cell[0] < dst->right;
+			     cell[0] = cell[2]) {
+				cell[2] = cell[0] + xlen < dst->right ?
+					  cell[0] + xlen : dst->right;
+
+				/* stripe boundaries are exact, nothing gets rounded */
+				g2d_cpu_map_rect(src, dst, cell, rect, 1);
+				g2d_sub_surface(&s, src, rect[0], rect[1], rect[2], rect[3]);
+				g2d_sub_surface(&d, dst, cell[0], cell[1], cell[2], cell[3]);
+
+				ret = g2d_blit_pxp(context, &s.base, &d.base,
+						   pass ? NULL : &probe);
+				if (ret < 0)
+					return pass && ret == G2D_UNSUPPORTED ? -1 : ret;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Blit cost model, filled once per process by g2d_blit_calibrate: each
+ * engine is timed on a small and a large blit of every feature variant,
+ * giving a fixed cost plus a cost per dst pixel.
+ */
+#define G2D_COST_SMALL		32
+#define G2D_COST_LARGE		256
+#define G2D_COST_RUNS		3
+
+static struct g2d_blit_cost blit_cost;
+static bool blit_cost_tried;
+
+static void g2d_blit_features(struct g2dContext *context, struct g2d_surface *src,
+			      struct g2d_surface *dst, int *features)
+{
+	int rot, hflip, vflip, sw, sh;
+
+	rot = g2d_cpu_rotation(src, dst, &hflip, &vflip);
+	sw = (rot & 1) ? src->bottom - src->top : src->right - src->left;
+	sh = (rot & 1) ? src->right - src->left : src->bottom - src->top;
+
+	features[G2D_COST_COPY] = 1;
+	features[G2D_COST_BLEND] = context->blending;
+	features[G2D_COST_SCALE] = sw != dst->right - dst->left ||
+				   sh != dst->bottom - dst->top;
+	features[G2D_COST_ROTATE] = rot || hflip || vflip;
+	features[G2D_COST_YUV] = src->format >= G2D_NV12;
+}
+
+static int g2d_cost_us(int setup, const int *kpix, const int *features, int pixels)
+{
+	long long ns;
+	int i;
+
+	ns = kpix[G2D_COST_COPY];
+	for (i = 1; i < G2D_COST_FEATURES; i++) {
+		if (features[i] && kpix[i] > kpix[G2D_COST_COPY])
+			ns += kpix[i] - kpix[G2D_COST_COPY];
+	}
+
+	return setup + ns * pixels / 1024 / 1000;
+}
+
+/* whether the cpu can address the blit, and if all it reads is cacheable */
+static int g2d_cpu_reachable(struct g2dContext *context, struct g2d_surface *src,
+			     struct g2d_surface *dst, int *cacheable)
+{
+	struct g2d_buf *buf;
+	int i;
+
+	if (!g2d_cpu_format_supported(src->format) ||
+	    !g2d_cpu_format_supported(dst->format))
+		return 0;
+
+	*cacheable = 1;
+	for (i = 0; i < g2d_cpu_planes(src->format); i++) {
+		buf = g2d_find_buf(g2d_cpu_plane_addr(src, i),
+				   g2d_cpu_plane_size(src, i));
+		if (buf == NULL)
+			return 0;
+		if (!((struct g2d_buf_priv *)buf->buf_handle)->cacheable)
+			*cacheable = 0;
+	}
+	for (i = 0; i < g2d_cpu_planes(dst->format); i++) {
+		buf = g2d_find_buf(g2d_cpu_plane_addr(dst, i),
+				   g2d_cpu_plane_size(dst, i));
+		if (buf == NULL)
+			return 0;
+		if (context->blending &&
+		    !((struct g2d_buf_priv *)buf->buf_handle)->cacheable)
+			*cacheable = 0;
+	}
+
+	return 1;
+}
+
+/* estimates in us, -1 for an engine that can't do the blit */
+static int g2d_blit_estimate(struct g2dContext *context, struct g2d_surface *src,
+			     struct g2d_surface *dst, int probe, int *pxp_us,
+			     int *cpu_us)
+{
+	struct g2d_blit_cost cost;
+	struct g2d_blit_prog prog;
+	int features[G2D_COST_FEATURES];
+	int pixels, cacheable;
+
+	pthread_spin_lock(&lock);
+	memcpy(&cost, &blit_cost, sizeof(cost));
+	pthread_spin_unlock(&lock);
+	if (!cost.calibrated)
+		return -1;
+
+	g2d_blit_features(context, src, dst, features);
+	pixels = (dst->right - dst->left) * (dst->bottom - dst->top);
+
+	*pxp_us = g2d_cost_us(cost.pxp_setup_us, cost.pxp_kpix_ns, features, pixels);
+	if (probe && (context->blend_dim ||
+		      g2d_blit_pxp(context, src, dst, &prog) < 0))
+		*pxp_us = -1;
+
+	*cpu_us = -1;
+	if (g2d_cpu_reachable(context, src, dst, &cacheable))
+		*cpu_us = g2d_cost_us(cost.cpu_setup_us[cacheable],
+				      cost.cpu_kpix_ns[cacheable], features, pixels);
+
+	return 0;
+}
+
+/* calibration surface for feature variant v, size x size on the dst */
+static void g2d_cost_surfaces(struct g2d_buf *sb, struct g2d_buf *db, int v,
+			      int size, struct g2d_surface_ex *src_ex,
+			      struct g2d_surface_ex *dst_ex)
+{
+	struct g2d_surface *src = &src_ex->base, *dst = &dst_ex->base;
+
+	memset(src_ex, 0, sizeof(*src_ex));
+	memset(dst_ex, 0, sizeof(*dst_ex));
+
+	src->format = v == G2D_COST_BLEND ? G2D_BGRA8888 :
+		      v == G2D_COST_YUV ? G2D_NV12 : G2D_BGRX8888;
+	src->width = src->height = src->stride = size;
+	if (v == G2D_COST_SCALE)
+		src->width = src->height = src->stride = size / 2;
+	src->right = src->width;
+	src->bottom = src->height;
+	src->planes[0] = sb->buf_paddr;
+	src->planes[1] = sb->buf_paddr + src->stride * src->height;
+	src->blendfunc = G2D_SRC_ALPHA;
+	src->global_alpha = 0xff;
+
+	dst->format = G2D_BGRX8888;
+	dst->width = dst->height = dst->stride = size;
+	dst->right = dst->bottom = size;
+	dst->planes[0] = db->buf_paddr;
+	dst->blendfunc = G2D_ONE_MINUS_SRC_ALPHA;
+	dst->global_alpha = 0xff;
+	if (v == G2D_COST_ROTATE)
+		dst->rot = G2D_ROTATION_90;
+}
+
+/* best of G2D_COST_RUNS in us, -1 when the engine can't do it */
+static int g2d_cost_time(struct g2dContext *context, struct g2d_surface *src,
+			 struct g2d_surface *dst, int cpu)
+{
+	unsigned long long start, t, best = ~0ULL;
+	int n;
+
+	for (n = 0; n < G2D_COST_RUNS; n++) {
+		start = g2d_time_us();
+		if (cpu) {
+			if (g2d_blit_cpu(context, src, dst, NULL) < 0)
+				return -1;
+		} else {
+			if (g2d_blit_pxp(context, src, dst, NULL) < 0 ||
+			    g2d_finish(context) < 0)
+				return -1;
+		}
+		t = g2d_time_us() - start;
+		if (t < best)
+			best = t;
+	}
+
+	return best;
+}
+
+/* fixed cost and ns per 1024 pixels from the small and large timings */
+static void g2d_cost_fit(int small, int large, int *setup, int *kpix)
+{
+	int ps = G2D_COST_SMALL * G2D_COST_SMALL;
+	int pl = G2D_COST_LARGE * G2D_COST_LARGE;
+
+	*kpix = large > small ? (long long)(large - small) * 1000 * 1024 / (pl - ps) : 0;
+	*setup = small - (long long)*kpix * ps / 1024 / 1000;
+	if (*setup < 0)
+		*setup = 0;
+}
+
+int g2d_blit_calibrate(void *handle)
+{
+	struct g2dContext *context = (struct g2dContext *)handle;
+	struct g2d_blit_cost cost;
+	struct g2d_surface_ex src, dst;
+	struct g2d_stats stats;
+	struct g2d_buf *sb, *db;
+	unsigned int blending, global_alpha_enable;
+	bool blend_dim;
+	int c, v, t[2], setup, kpix, scale_filter, ret = 0;
+
+	if (context == NULL) {
+		g2d_printf("%s: Invalid handle!\n", __func__);
+		return -1;
+	}
+
+	pthread_spin_lock(&lock);
+	blit_cost_tried = true;
+	pthread_spin_unlock(&lock);
+
+	if ((context->cmd_count || context->busy || context->fence_count) &&
+	    g2d_finish(context) < 0)
+		return -1;
+
+	memcpy(&stats, &context->stats, sizeof(struct g2d_stats));
+	blending = context->blending;
+	global_alpha_enable = context->global_alpha_enable;
+	blend_dim = context->blend_dim;
+	context->global_alpha_enable = 0;
+	context->blend_dim = false;
+	scale_filter = context->scale_filter;
+	context->scale_filter = G2D_CPU_FILTER_NEAREST;
+	memset(&cost, 0, sizeof(cost));
+
+	/* pxp is timed on uncached buffers, the cpu on both kinds */
+	for (c = 0; c < 2 && !ret; c++) {
+		sb = g2d_alloc(G2D_COST_LARGE * G2D_COST_LARGE * 4, c);
+		db = g2d_alloc(G2D_COST_LARGE * G2D_COST_LARGE * 4, c);
+		if (sb == NULL || db == NULL) {
+			g2d_printf("%s: no memory for calibration\n", __func__);
+			ret = -1;
+		}
+
+		for (v = 0; v < G2D_COST_FEATURES && !ret; v++) {
+			context->blending = v == G2D_COST_BLEND;
+
+			g2d_cost_surfaces(sb, db, v, G2D_COST_SMALL, &src, &dst);
+			t[0] = g2d_cost_time(context, &src.base, &dst.base, 1);
+			g2d_cost_surfaces(sb, db, v, G2D_COST_LARGE, &src, &dst);
+			t[1] = g2d_cost_time(context, &src.base, &dst.base, 1);
+			if (t[0] < 0 || t[1] < 0) {
+				/* a variant the engine can't do costs like a copy */
+				cost.cpu_kpix_ns[c][v] = cost.cpu_kpix_ns[c][G2D_COST_COPY];
+			} else {
+				g2d_cost_fit(t[0], t[1], &setup, &kpix);
+				cost.cpu_kpix_ns[c][v] = kpix;
+				if (v == G2D_COST_COPY)
+					cost.cpu_setup_us[c] = setup;
+			}
+
+			if (c)
+				continue;
+
+			g2d_cost_surfaces(sb, db, v, G2D_COST_SMALL, &src, &dst);
+			t[0] = g2d_cost_time(context, &src.base, &dst.base, 0);
+			g2d_cost_surfaces(sb, db, v, G2D_COST_LARGE, &src, &dst);
+			t[1] = g2d_cost_time(context, &src.base, &dst.base, 0);
+			if (t[0] < 0 || t[1] < 0) {
+				cost.pxp_kpix_ns[v] = cost.pxp_kpix_ns[G2D_COST_COPY];
+			} else {
+				g2d_cost_fit(t[0], t[1], &setup, &kpix);
+				cost.pxp_kpix_ns[v] = kpix;
+				if (v == G2D_COST_COPY)
+					cost.pxp_setup_us = setup;
+			}
+		}
+
+		if (sb)
+			g2d_free(sb);
+		if (db)
+			g2d_free(db);
+	}
+
+	context->blending = blending;
+	context->global_alpha_enable = global_alpha_enable;
+	context->blend_dim = blend_dim;
+	context->scale_filter = scale_filter;
+	memcpy(&context->stats, &stats, sizeof(struct g2d_stats));
+
+	if (ret < 0)
+		return -1;
+
+	cost.calibrated = 1;
+	pthread_spin_lock(&lock);
+	memcpy(&blit_cost, &cost, sizeof(cost));
+	pthread_spin_unlock(&lock);
+
+	return 0;
+}
+
+int g2d_query_blit_cost_model(struct g2d_blit_cost *cost)
+{
+	if (cost == NULL) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+
+	pthread_spin_lock(&lock);
+	memcpy(cost, &blit_cost, sizeof(struct g2d_blit_cost));
+	pthread_spin_unlock(&lock);
+
+	return 0;
+}
+
+/*
+ * Estimated time of blitting src to dst with the current state of the
+ * context on pxp and on the cpu, -1 when an engine can't do it. Fails
+ * until the cost model is calibrated.
+ */
+int g2d_query_blit_cost(void *handle, struct g2d_surface *src,
+			struct g2d_surface *dst, int *pxp_us, int *cpu_us)
+{
+	struct g2dContext *context = (struct g2dContext *)handle;
+	struct g2d_surface_ex s, d;
+
+	if (context == NULL || src == NULL || dst == NULL ||
+	    pxp_us == NULL || cpu_us == NULL) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+
+	g2d_surface_wrap(&s, src);
+	g2d_surface_wrap(&d, dst);
+	return g2d_blit_estimate(context, &s.base, &d.base, 1, pxp_us, cpu_us);
+}
+
+/* calibrates the cost model unless some context already tried */
+static void g2d_blit_calibrate_once(struct g2dContext *context)
+{
+	bool tune = false;
+
+	pthread_spin_lock(&lock);
+	if (!blit_cost_tried)
+		tune = blit_cost_tried = true;
+	pthread_spin_unlock(&lock);
+	if (tune)
+		g2d_blit_calibrate(context);
+}
+
+/*
+ * Whether the cost model sends this blit to the cpu. Work already queued
+ * on pxp would have to finish before the cpu may touch the buffers, so
+ * only a blit that starts a batch can move. Nothing moves until the
+ * model is calibrated, blits never calibrate it.
+ */
+static int g2d_route_cpu(struct g2dContext *context, struct g2d_surface *src,
+			 struct g2d_surface *dst)
+{
+	int pxp_us, cpu_us;
+
+	if (!context->auto_dispatch || context->blend_dim)
+		return 0;
+
+	if (context->cmd_count || context->busy || context->fence_count)
+		return 0;
+
+	if (g2d_blit_estimate(context, src, dst, 0, &pxp_us, &cpu_us) < 0)
+		return 0;
+
+	return cpu_us >= 0 && cpu_us < pxp_us;
+}
+
+/* whether a blit scales with a G2D_SCALE_* filter, which only the cpu has */
+int g2d_scale_filtered(void *handle, struct g2d_surface *src,
+		       struct g2d_surface *dst)
+{
+	struct g2dContext *context = (struct g2dContext *)handle;
+	int features[G2D_COST_FEATURES];
+
+	if (context->scale_filter == G2D_CPU_FILTER_NEAREST || context->blend_dim)
+		return 0;
+
+	g2d_blit_features(context, src, dst, features);
+	return features[G2D_COST_SCALE];
+}
+
+static int g2d_check_blit(struct g2dContext *context, struct g2d_surface *src,
+			  struct g2d_surface *dst)
+{
+	unsigned int srcWidth,srcHeight,dstWidth,dstHeight;
+
+	if(!src || !dst)
+	{
+		g2d_printf("%s: Invalid src and dst parameters!\n", __func__);
+		return -1;
+	}
+
+	if (!context->blend_dim) {
+		srcWidth = src->right - src->left;
+		srcHeight = src->bottom - src->top;
+
+		if(srcWidth <=0 || srcHeight <= 0 || srcWidth > src->width || srcHeight > src->height || src->width > src->stride)
+		{
+			g2d_printf("%s: Invalid src rect, left %d, top %d, right %d, bottom %d, width %d, height %d, stride %d!\n",
+					__FUNCTION__, src->left, src->top, src->right, src->bottom, src->width, src->height, src->stride);
+			return -1;
+		}
+
+		if(!src->planes[0])
+		{
+			g2d_printf("%s: Invalid src planes[0] pointer=0x%x !\n", __FUNCTION__, src->planes[0]);
+			return -1;
+		}
+	}
+
+	dstWidth = dst->right - dst->left;
+	dstHeight = dst->bottom - dst->top;
+
+	if(dstWidth <=0 || dstHeight <= 0 || dstWidth > dst->width || dstHeight > dst->height || dst->width > dst->stride)
+	{
+		g2d_printf("%s: Invalid dst rect, left %d, top %d, right %d, bottom %d, width %d, height %d, stride %d!\n",
+				__FUNCTION__, dst->left, dst->top, dst->right, dst->bottom, dst->width, dst->height, dst->stride);
+		return -1;
+	}
+
+	if(!dst->planes[0])
+	{
+		g2d_printf("%s: Invalid dst planes[0] pointer=0x%x !\n", __FUNCTION__, dst->planes[0]);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* pxp, stripes of it or the cpu, whichever can and is expected to be faster */
+static int g2d_blit_route(struct g2dContext *context, struct g2d_surface *src,
+			  struct g2d_surface *dst)
+{
+	int ret;
+
+	if (g2d_needs_stripes(src, dst)) {
+		ret = g2d_blit_stripes(context, src, dst);
+	} else if (g2d_route_cpu(context, src, dst)) {
+		context->stats.cpu_blits++;
+		context->stats.cpu_routed++;
+		return g2d_blit_cpu(context, src, dst, NULL);
+	} else {
+		ret = g2d_blit_pxp(context, src, dst, NULL);
+	}
+
+	if (ret == G2D_UNSUPPORTED) {
+		context->stats.cpu_blits++;
+		ret = g2d_blit_cpu(context, src, dst, NULL);
+	} else {
+		context->stats.pxp_blits++;
+	}
+
+	return ret;
+}
+
+/*
+ * pxp truncates to 16 bit. Let it render into a RGBA copy of the dst
+ * rect instead, then dither that into dst on the cpu. The copy starts
+ * as dst when blending needs what is under the blit.
+ */
+static int g2d_blit_dither(struct g2dContext *context, struct g2d_surface *src,
+			   struct g2d_surface *dst)
+{
+	struct g2d_surface_ex tmp_ex, plain_ex;
+	struct g2d_surface *tmp = &tmp_ex.base, *plain = &plain_ex.base;
+	struct g2d_buf *buf;
+	unsigned int blending, global_alpha_enable;
+	int w, h, ret = 0;
+
+	if (g2d_route_cpu(context, src, dst)) {
+		context->stats.cpu_blits++;
+		context->stats.cpu_routed++;
+		return g2d_blit_cpu(context, src, dst, NULL);
+	}
+
+	w = dst->right - dst->left;
+	h = dst->bottom - dst->top;
+	buf = g2d_alloc(w * h * 4, 1);
+	if (buf == NULL) {
+		context->stats.cpu_blits++;
+		return g2d_blit_cpu(context, src, dst, NULL);
+	}
+
+	memset(&tmp_ex, 0, sizeof(tmp_ex));
+	tmp->format = G2D_BGRA8888;
+	tmp->planes[0] = buf->buf_paddr;
+	tmp->right = tmp->width = tmp->stride = w;
+	tmp->bottom = tmp->height = h;
+	tmp->blendfunc = dst->blendfunc;
+	tmp->global_alpha = dst->global_alpha;
+
+	/* the dst rect as is, for the copies between it and tmp */
+	plain_ex = *g2d_cpu_ex(dst);
+	plain->rot = G2D_ROTATION_0;
+
+	blending = context->blending;
+	global_alpha_enable = context->global_alpha_enable;
+
+	if (blending) {
+		context->blending = 0;
+		context->global_alpha_enable = 0;
+		ret = g2d_blit_cpu(context, plain, tmp, NULL);
+		context->blending = blending;
+		context->global_alpha_enable = global_alpha_enable;
+	}
+
+	if (ret == 0) {
+		tmp->rot = dst->rot;
+		ret = g2d_blit_route(context, src, tmp);
+		tmp->rot = G2D_ROTATION_0;
+	}
+
+	if (ret == 0) {
+		context->blending = 0;
+		context->global_alpha_enable = 0;
+		ret = g2d_blit_cpu(context, tmp, plain, NULL);
+		context->blending = blending;
+		context->global_alpha_enable = global_alpha_enable;
+	}
+
+	g2d_free(buf);
+	return ret;
+}
+
+int g2d_blit_ex(void *handle, struct g2d_surface_ex *src_ex,
+		struct g2d_surface_ex *dst_ex)
+{
+	struct g2dContext *context = (struct g2dContext *)handle;
+	/* base comes first, NULL stays NULL for g2d_check_blit */
+	struct g2d_surface *src = (struct g2d_surface *)src_ex;
+	struct g2d_surface *dst = (struct g2d_surface *)dst_ex;
+
+	if (context == NULL) {
+		g2d_printf("%s: Invalid handle!\n", __func__);
+		return -1;
+	}
+
+	if (g2d_check_blit(context, src, dst) < 0)
+		return -1;
+	context->stats.blit_pixels += g2d_rect_pixels(dst);
+
+	if (context->current_type == G2D_HARDWARE_CPU ||
+	    g2d_scale_filtered(context, src, dst)) {
+		context->stats.cpu_blits++;
+		return g2d_blit_cpu(context, src, dst, NULL);
+	}
+
+	if (!context->blend_dim && g2d_dither_wanted(context, src, dst))
+		return g2d_blit_dither(context, src, dst);
+
+	return g2d_blit_route(context, src, dst);
+}
+
+int g2d_blit(void *handle, struct g2d_surface *src, struct g2d_surface *dst)
+{
+	struct g2d_surface_ex s, d;
+
+	return g2d_blit_ex(handle, g2d_surface_wrap(&s, src),
+			   g2d_surface_wrap(&d, dst));
+}
+
+/*
+ * Blit src to dst but only draw the clip part of the dst rect. Filtered
+ * scaling then samples as for the whole rect, where a blit of the same
+ * part as a smaller rect would clamp the filter taps at its edges.
+ */
+int g2d_blit_clip(void *handle, struct g2d_surface *src,
+		  struct g2d_surface *dst, const struct g2d_rect *clip)
+{
+	struct g2dContext *context = (struct g2dContext *)handle;
+	struct g2d_surface_ex s, d;
+
+	if (context == NULL || clip == NULL) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+
+	if (g2d_check_blit(context, src, dst) < 0)
+		return -1;
+
+	context->stats.cpu_blits++;
+	if (clip->right > clip->left && clip->bottom > clip->top) {
+		int w = (clip->right < dst->right ? clip->right : dst->right) -
+			(clip->left > dst->left ? clip->left : dst->left);
+		int h = (clip->bottom < dst->bottom ? clip->bottom : dst->bottom) -
+			(clip->top > dst->top ? clip->top : dst->top);
+
+		if (w > 0 && h > 0)
+			context->stats.blit_pixels += w * h;
+	} else {
+		context->stats.blit_pixels += g2d_rect_pixels(dst);
+	}
+	g2d_surface_wrap(&s, src);
+	g2d_surface_wrap(&d, dst);
+	return g2d_blit_cpu(context, &s.base, &d.base, clip);
+}
+
+/*
+ * Resolve a blit once for callers that repeat it with other buffers of
+ * the same layout. The program snapshots src, dst and the blending,
+ * global alpha, dither and scale filter state of the context, changing
+ * them afterwards does not affect it. g2d_exec_blit then only patches
+ * the plane addresses. Free it with g2d_free_blit.
+ */
+int g2d_prepare_blit_ex(void *handle, struct g2d_surface_ex *src_ex,
+			struct g2d_surface_ex *dst_ex, void **program)
+{
+	int ret;
+	struct g2d_blit_prog *prog;
+	struct g2dContext *context = (struct g2dContext *)handle;
+	struct g2d_surface *src = (struct g2d_surface *)src_ex;
+	struct g2d_surface *dst = (struct g2d_surface *)dst_ex;
+
+	if (context == NULL || program == NULL) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+	*program = NULL;
+
+	if (g2d_check_blit(context, src, dst) < 0)
+		return -1;
+
+	prog = (struct g2d_blit_prog *)calloc(1, sizeof(*prog));
+	if (prog == NULL) {
+		g2d_printf("%s: malloc memory failed!\n", __func__);
+		return -1;
+	}
+	prog->context = context;
+	prog->src = *src_ex;
+	prog->dst = *dst_ex;
+	prog->blending = context->blending;
+	prog->global_alpha_enable = context->global_alpha_enable;
+	prog->dither = context->dither;
+	prog->blend_dim = context->blend_dim;
+	prog->scale_filter = context->scale_filter;
+
+	if (context->current_type == G2D_HARDWARE_CPU ||
+	    g2d_scale_filtered(context, src, dst) ||
+	    g2d_dither_wanted(context, src, dst)) {
+		prog->cpu = true;
+	} else {
+		ret = g2d_blit_pxp(context, src, dst, prog);
+		if (ret == G2D_UNSUPPORTED) {
+			prog->cpu = true;
+		} else if (ret < 0) {
+			free(prog);
+			return -1;
+		}
+	}
+
+	*program = prog;
+	return 0;
+}
+
+int g2d_prepare_blit(void *handle, struct g2d_surface *src,
+		     struct g2d_surface *dst, void **program)
+{
+	struct g2d_surface_ex s, d;
+
+	return g2d_prepare_blit_ex(handle, g2d_surface_wrap(&s, src),
+				   g2d_surface_wrap(&d, dst), program);
+}
+
+static struct pxp_layer_param *g2d_prog_layer(struct g2d_blit_prog *prog,
+					      int layer)
+{
+	return layer ? &prog->conf.ol_param[0] : &prog->conf.s0_param;
+}
+
+/* exchange the blending state of the context with the one prog kept */
+static void g2d_prog_swap_state(struct g2d_blit_prog *prog)
+{
+	struct g2dContext *context = prog->context;
+	unsigned int blending = context->blending;
+	unsigned int global_alpha_enable = context->global_alpha_enable;
+	int dither = context->dither;
+	bool blend_dim = context->blend_dim;
+	int scale_filter = context->scale_filter;
+
+	context->blending = prog->blending;
+	context->global_alpha_enable = prog->global_alpha_enable;
+	context->dither = prog->dither;
+	context->blend_dim = prog->blend_dim;
+	context->scale_filter = prog->scale_filter;
+
+	prog->blending = blending;
+	prog->global_alpha_enable = global_alpha_enable;
+	prog->dither = dither;
+	prog->blend_dim = blend_dim;
+	prog->scale_filter = scale_filter;
+}
+
+/* src_planes/dst_planes replace planes[] of the prepared surfaces */
+int g2d_exec_blit(void *program, int *src_planes, int *dst_planes)
+{
+	struct g2d_blit_prog *prog = (struct g2d_blit_prog *)program;
+	struct g2dContext *context;
+	int i, ret;
+
+	if (prog == NULL || dst_planes == NULL ||
+	    (src_planes == NULL && !prog->blend_dim)) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+	context = prog->context;
+	context->stats.blit_pixels += g2d_rect_pixels(&prog->dst.base);
+
+	for (i = 0; i < 3; i++) {
+		if (src_planes)
+			prog->src.base.planes[i] = src_planes[i];
+		prog->dst.base.planes[i] = dst_planes[i];
+	}
+
+	/*
+	 * planes pxp can't reach this time go to the cpu, which blends the
+	 * way the context did at prepare time like the pxp config does
+	 */
+	if (prog->cpu || !g2d_pxp_planes(&prog->src.base) ||
+	    !g2d_pxp_planes(&prog->dst.base)) {
+		g2d_prog_swap_state(prog);
+		ret = g2d_blit_cpu(context, &prog->src.base, &prog->dst.base, NULL);
+		g2d_prog_swap_state(prog);
+		return ret;
+	}
+
+	if (src_planes)
+		g2d_prog_layer(prog, prog->src_layer)->paddr =
+			src_planes[0] + prog->src_offset;
+	prog->conf.out_param.paddr = dst_planes[0] + prog->dst_offset;
+	if (prog->third_layer >= 0)
+		g2d_prog_layer(prog, prog->third_layer)->paddr =
+			prog->conf.out_param.paddr;
+
+	g2d_config_chan(context, &prog->conf);
+
+	return 0;
+}
+
+int g2d_free_blit(void *program)
+{
+	free(program);
+	return 0;
+}
+
+static int g2d_same_rect(struct g2d_surface *a, struct g2d_surface *b)
+{
+	return a->planes[0] == b->planes[0] && a->format == b->format &&
+	       a->stride == b->stride && a->left == b->left &&
+	       a->top == b->top && a->right == b->right &&
+	       a->bottom == b->bottom;
+}
+
+/*
+ * Compose an opaque bottom layer and a blended layer above it onto the
+ * same dst rect in one pxp pass: bg goes through the PS engine (scaling,
+ * rotation, yuv), fg through the overlay. The driver only programs
+ * ol_param[0], so a pass holds at most these two layers.
+ */
+static int g2d_blit_pxp_pair(struct g2dContext *context,
+			     struct g2d_surface *bg, struct g2d_surface *bg_dst,
+			     struct g2d_surface *fg, struct g2d_surface *fg_dst)
+{
+	int rotate, src_bpp, dest_bpp;
+	struct pxp_config_data pxp_conf;
+	struct pxp_layer_param *s0_param, *ol_param, *out_param;
+
+	if (!context->blending || context->blend_dim ||
+	    g2d_scale_filtered(context, bg, bg_dst) ||
+	    g2d_dither_wanted(context, bg, bg_dst))
+		return G2D_UNSUPPORTED;
+
+	if (!g2d_same_rect(bg_dst, fg_dst) ||
+	    !g2d_pxp_color_space(bg, bg_dst) || !g2d_pxp_color_space(fg, fg_dst))
+		return G2D_UNSUPPORTED;
+
+	/* bg replaces dst, as a plain ONE/ZERO copy would */
+	if (bg->blendfunc != G2D_ONE || bg_dst->blendfunc != G2D_ZERO)
+		return G2D_UNSUPPORTED;
+	if ((fg->blendfunc != G2D_SRC_ALPHA ||
+	     fg_dst->blendfunc != G2D_ONE_MINUS_SRC_ALPHA) &&
+	    (fg->blendfunc != G2D_ONE_MINUS_SRC_ALPHA ||
+	     fg_dst->blendfunc != G2D_SRC_ALPHA))
+		return G2D_UNSUPPORTED;
+	if (context->global_alpha_enable &&
+	    (bg->global_alpha < 0xff || bg_dst->global_alpha < 0xff ||
+	     fg_dst->global_alpha < 0xff))
+		return G2D_UNSUPPORTED;
+
+	/* flips and rot_pos 0 rotation would apply to both layers */
+	if (bg->rot == G2D_FLIP_H || bg->rot == G2D_FLIP_V ||
+	    bg_dst->rot == G2D_FLIP_H || bg_dst->rot == G2D_FLIP_V ||
+	    fg->rot != G2D_ROTATION_0 || fg_dst->rot != G2D_ROTATION_0)
+		return G2D_UNSUPPORTED;
+
+	/* the overlay can't scale */
+	if (fg->right - fg->left != fg_dst->right - fg_dst->left ||
+	    fg->bottom - fg->top != fg_dst->bottom - fg_dst->top)
+		return G2D_UNSUPPORTED;
+
+	memset(&pxp_conf, 0, sizeof(struct pxp_config_data));
+	s0_param = &(pxp_conf.s0_param);
+	ol_param = &(pxp_conf.ol_param[0]);
+	out_param = &(pxp_conf.out_param);
+
+	s0_param->pixel_fmt = g2d_decide_ps_support(bg->format);
+	ol_param->pixel_fmt = g2d_decide_overlay_support(fg->format);
+	out_param->pixel_fmt = g2d_decide_out_support(bg_dst->format);
+	if ((int)s0_param->pixel_fmt < 0 || (int)ol_param->pixel_fmt < 0 ||
+	    (int)out_param->pixel_fmt < 0)
+		return G2D_UNSUPPORTED;
+	src_bpp = g2d_get_bpp(fg->format);
+	dest_bpp = g2d_get_bpp(bg_dst->format);
+
+	switch (bg_dst->rot - bg->rot) {
+	case 1:
+	case -3:
+		rotate = 90;
+		break;
+	case 2:
+	case -2:
+		rotate = 180;
+		break;
+	case 3:
+	case -1:
+		rotate = 270;
+		break;
+	default:
+		rotate = 0;
+		break;
+	}
+	pxp_conf.proc_data.rotate = rotate;
+	pxp_conf.proc_data.rot_pos = rotate ? 1 : 0;
+
+	s0_param->stride = bg->stride;
+	s0_param->width  = bg->width;
+	s0_param->height = bg->height;
+	s0_param->paddr  = bg->planes[0];
+	pxp_conf.proc_data.srect.top  = bg->top;
+	pxp_conf.proc_data.srect.left = bg->left;
+	if (rotate == 90 || rotate == 270) {
+		pxp_conf.proc_data.srect.width  = bg->bottom - bg->top;
+		pxp_conf.proc_data.srect.height = bg->right  - bg->left;
 	} else {
-		if ((src->right - src->left) != (dst->right - dst->left) ||
-		    (src->bottom - src->top) != (dst->bottom - dst->top)) {
-			/* only ps engine can do scaling */
-			if (src_param == &(pxp_conf.ol_param[0])) {
-				g2d_printf("%s: format with alpha cannot be scaled\n", __func__);
-				return -1;
-			}
-		}
+		pxp_conf.proc_data.srect.width  = bg->right  - bg->left;
+		pxp_conf.proc_data.srect.height = bg->bottom - bg->top;
 	}
 
-	if (pxp_conf.proc_data.rotate && (src_param == &(pxp_conf.s0_param))) {
-		pxp_conf.proc_data.rot_pos = 1;
+	out_param->stride = bg_dst->stride;
+	out_param->paddr  = bg_dst->planes[0] +
+		(bg_dst->top * bg_dst->stride + bg_dst->left) * (dest_bpp >> 3);
+	out_param->width  = pxp_conf.proc_data.drect.width  =
+		bg_dst->right  - bg_dst->left;
+	out_param->height = pxp_conf.proc_data.drect.height =
+		bg_dst->bottom - bg_dst->top;
+
+	/* the overlay covers the output from its top left corner */
+	ol_param->stride = fg->stride;
+	ol_param->width  = out_param->width;
+	ol_param->height = out_param->height;
+	ol_param->paddr  = fg->planes[0] +
+		(fg->top * fg->stride + fg->left) * (src_bpp >> 3);
+	if (fg->blendfunc == G2D_SRC_ALPHA)
+		ol_param->alpha_invert = 1;
+	if (context->global_alpha_enable && fg->global_alpha < 0xff) {
+		ol_param->global_alpha_enable = 1;
+		ol_param->global_alpha = fg->global_alpha & 0xff;
 	}
+	pxp_conf.proc_data.combine_enable = 1;
 
-	if ((pxp_conf.proc_data.rotate == 90) || (pxp_conf.proc_data.rotate == 270)) {
-		if (src_param == &(pxp_conf.ol_param[0])) {
-			out_param->width  = pxp_conf.proc_data.drect.width  = dst->bottom - dst->top;
-			out_param->height = pxp_conf.proc_data.drect.height = dst->right  - dst->left;
-		} else {
-			out_param->width  = pxp_conf.proc_data.drect.width  = dst->right  - dst->left;
-			out_param->height = pxp_conf.proc_data.drect.height = dst->bottom - dst->top;
-		}
-	} else {
-		out_param->width  = pxp_conf.proc_data.drect.width  = dst->right  - dst->left;
-		out_param->height = pxp_conf.proc_data.drect.height = dst->bottom - dst->top;
+	pxp_conf.handle = context->handle;
+	g2d_config_chan(context, &pxp_conf);
+
+	return 0;
+}
+
+/*
+ * Blit layers src[0..layers-1] bottom up, src[i] onto dst[i]. The dst
+ * rects normally share one surface. The result matches a g2d_blit per
+ * layer, but an opaque layer and the blended layer on top of it land
+ * in one pxp pass when their dst rects match, saving a round trip of
+ * the dst rect through memory.
+ */
+int g2d_blit_multi(void *handle, struct g2d_surface *src, int layers,
+		   struct g2d_surface *dst)
+{
+	int i, ret;
+	struct g2dContext *context = (struct g2dContext *)handle;
+	struct g2d_surface_ex pair[4];
+
+	if (context == NULL) {
+		g2d_printf("%s: Invalid handle!\n", __func__);
+		return -1;
 	}
-	/* need do alpha blending */
-	if (context->blending) {
-		if (src_param == &(pxp_conf.ol_param[0])) {
-			third_param = &(pxp_conf.s0_param);
-			third_param->pixel_fmt = g2d_decide_ps_support(dst->format);
-		} else {
-			third_param = &(pxp_conf.ol_param[0]);
-			third_param->pixel_fmt = g2d_decide_overlay_support(dst->format);
-		}
-		if (third_param->pixel_fmt == 0) {
-			g2d_printf("%s: unsupport blending type\n", __func__);
-			return -1;
-		}
 
-		pxp_conf.proc_data.combine_enable = 1;
+	if (!src || !dst || layers <= 0) {
+		g2d_printf("%s: Invalid layers!\n", __func__);
+		return -1;
+	}
 
-		if (src_param == &(pxp_conf.ol_param[0])) {
-			switch(src->blendfunc) {
-			case G2D_ZERO:  //Cs = Cs * 0
-				if (dst->blendfunc != G2D_ONE) {
-					g2d_printf("%s(line %d): unsupported blending operation\n",
-						   __func__, __LINE__);
-					return -1;
-				}
-				src_param->global_alpha_enable = 1;
-				src_param->global_alpha = 0xff;
-				src_param->global_override = 1;
-				break;
-			case G2D_ONE:   //Cs = Cs * 1
-				if (dst->blendfunc != G2D_ZERO) {
-					g2d_printf("%s(line %d): unsupported blending operation\n",
-						   __func__, __LINE__);
-					return -1;
-				}
-				src_param->global_alpha_enable = 1;
-				src_param->global_alpha = 0x0;
-				src_param->global_override = 1;
-				break;
-			case G2D_SRC_ALPHA: //Cs = Cs * As
-				if (dst->blendfunc != G2D_ONE_MINUS_SRC_ALPHA) {
-					g2d_printf("%s(line %d): unsupported blending operation\n",
-						   __func__, __LINE__);
-					return -1;
-				}
-				src_param->alpha_invert = 1;
-				break;
-			case G2D_ONE_MINUS_SRC_ALPHA:  //Cs = Cs * (1 - As)
-				if (dst->blendfunc != G2D_SRC_ALPHA) {
-					g2d_printf("%s(line %d): unsupported blending operation\n",
-						   __func__, __LINE__);
-					return -1;
-				}
-				break;
-			default:
-				g2d_printf("%s: unspported source blendfunc\n", __func__);
-				return -1;
-			}
-		} else {
-			switch(src->blendfunc) {
-			case G2D_ZERO:
-				if (dst->blendfunc != G2D_ONE) {
-					g2d_printf("%s(line %d): unsupported blending operation\n",
-						   __func__, __LINE__);
-					return -1;
-				}
-				third_param->global_alpha_enable = 1;
-				third_param->global_alpha = 0x0;
-				third_param->global_override = 1;
-				break;
-			case G2D_ONE:
-				if (dst->blendfunc != G2D_ZERO) {
-					g2d_printf("%s(line %d): unsupported blending operation\n",
-						   __func__, __LINE__);
-					return -1;
-				}
-				third_param->global_alpha_enable = 1;
-				third_param->global_alpha = 0xff;
-				third_param->global_override = 1;
-				break;
-			case G2D_DST_ALPHA: //Cs = Cs * Ad
-				if (dst->blendfunc != G2D_ONE_MINUS_DST_ALPHA) {
-					g2d_printf("%s(line %d): unsupported blending operation\n",
-						   __func__, __LINE__);
-					return -1;
-				}
-				break;
-			case G2D_ONE_MINUS_DST_ALPHA: //Cs = Cs * (1 - Ad)
-				if (dst->blendfunc != G2D_DST_ALPHA) {
-					g2d_printf("%s(line %d): unsupported blending operation\n",
-						   __func__, __LINE__);
-					return -1;
-				}
-				third_param->alpha_invert = 1;
-				break;
-			default:
-				g2d_printf("%s: unsupported source blendfunc\n", __func__);
-				return -1;
-			}
-		}
-		if (context->global_alpha_enable && (src->global_alpha < 0xff)) {
-			if (src_param == &(pxp_conf.ol_param[0])) {
-				src_param->global_alpha_enable = 1;
-				src_param->global_alpha = src->global_alpha & 0xff;
-			}
-			else {
-				g2d_printf("%s: source with global alpha should not be in PS\n", __func__);
-				return -1;
-			}
-		}
-		if (context->global_alpha_enable && (dst->global_alpha < 0xff)) {
-			if (src_param == &(pxp_conf.s0_param)) {
-				third_param->global_alpha_enable = 1;
-				third_param->global_alpha = dst->global_alpha & 0xff;
-			}
-			else {
-				g2d_printf("%s: dest with global alpha should not be in PS\n", __func__);
+	for (i = 0; i < layers; i++) {
+		if (g2d_check_blit(context, &src[i], &dst[i]) < 0)
+			return -1;
+	}
+
+	for (i = 0; i < layers; ) {
+		if (i + 1 < layers && context->current_type != G2D_HARDWARE_CPU) {
+			g2d_surface_wrap(&pair[0], &src[i]);
+			g2d_surface_wrap(&pair[1], &dst[i]);
+			g2d_surface_wrap(&pair[2], &src[i + 1]);
+			g2d_surface_wrap(&pair[3], &dst[i + 1]);
+			ret = g2d_blit_pxp_pair(context, &pair[0].base, &pair[1].base,
+						&pair[2].base, &pair[3].base);
+			if (ret < 0 && ret != G2D_UNSUPPORTED)
 				return -1;
+			if (ret == 0) {
+				context->stats.blit_pixels += g2d_rect_pixels(&dst[i]) +
+							      g2d_rect_pixels(&dst[i + 1]);
+				i += 2;
+				continue;
 			}
 		}
-	}
 
-	if (src_param == &(pxp_conf.s0_param)) {
-		pxp_conf.proc_data.srect.top    = src->top;
-		pxp_conf.proc_data.srect.left   = src->left;
-		if (pxp_conf.proc_data.rotate == 90 || pxp_conf.proc_data.rotate == 270) {
-			pxp_conf.proc_data.srect.width  = src->bottom - src->top;
-			pxp_conf.proc_data.srect.height = src->right  - src->left;
-		}
-		else {
-			pxp_conf.proc_data.srect.width  = src->right  - src->left;
-			pxp_conf.proc_data.srect.height = src->bottom - src->top;
-		}
+		if (g2d_blit(handle, &src[i], &dst[i]) < 0)
+			return -1;
+		i++;
 	}
 
-	if (context->blending) {
-		third_param->stride = out_param->stride;
-		third_param->width  = out_param->width;
-		third_param->height = out_param->height;
-		third_param->paddr  = out_param->paddr;
-		if (third_param == &(pxp_conf.s0_param)) {
-			pxp_conf.proc_data.srect.width  = out_param->width;
-			pxp_conf.proc_data.srect.height = out_param->height;
-		}
+	return 0;
+}
+
+static void *g2d_fence_worker(void *arg)
+{
+	struct g2dContext *context = (struct g2dContext *)arg;
+	struct pxp_chan_handle chan_handle;
+	unsigned long long one = 1;
+	int efd;
+
+	pthread_mutex_lock(&context->fence_mutex);
+	for (;;) {
+		while (!context->fence_count && !context->fence_exit)
+			pthread_cond_wait(&context->fence_cond, &context->fence_mutex);
+		if (!context->fence_count)
+			break;
+		efd = context->fence_queue[context->fence_head];
+		pthread_mutex_unlock(&context->fence_mutex);
+
+		chan_handle.handle = context->handle;
+		if (ioctl(fd, PXP_IOC_WAIT4CMPLT, &chan_handle) < 0)
+			g2d_printf("%s: failed to wait task complete\n", __func__);
+		if (write(efd, &one, sizeof(one)) != sizeof(one))
+			g2d_printf("%s: failed to signal fence\n", __func__);
+		close(efd);
+
+		pthread_mutex_lock(&context->fence_mutex);
+		context->fence_head = (context->fence_head + 1) % G2D_FENCE_MAX;
+		context->fence_count--;
+		pthread_cond_broadcast(&context->fence_cond);
 	}
+	pthread_mutex_unlock(&context->fence_mutex);
 
-	pxp_conf.handle = context->handle;
-	g2d_config_chan(&pxp_conf);
+	return NULL;
+}
 
-	return 0;
+/* wait until every fence of the context has been signalled */
+static void g2d_fence_drain(struct g2dContext *context)
+{
+	if (!context->fence_running)
+		return;
+
+	pthread_mutex_lock(&context->fence_mutex);
+	while (context->fence_count)
+		pthread_cond_wait(&context->fence_cond, &context->fence_mutex);
+	pthread_mutex_unlock(&context->fence_mutex);
+}
+
+static void g2d_fence_stop(struct g2dContext *context)
+{
+	if (!context->fence_running)
+		return;
+
+	pthread_mutex_lock(&context->fence_mutex);
+	context->fence_exit = true;
+	pthread_cond_broadcast(&context->fence_cond);
+	pthread_mutex_unlock(&context->fence_mutex);
+
+	pthread_join(context->fence_thread, NULL);
+	pthread_mutex_destroy(&context->fence_mutex);
+	pthread_cond_destroy(&context->fence_cond);
+	context->fence_running = false;
+}
+
+
+/* 4 buckets per power of two, below 4us one per microsecond */
+static int g2d_latency_bucket(unsigned long long us)
+{
+	int msb = 2, b;
+
+	if (us < 4)
+		return (int)us;
+	while (us >> (msb + 1))
+		msb++;
+	b = (msb - 1) * 4 + (int)((us >> (msb - 2)) & 3);
+
+	return b < G2D_LATENCY_BUCKETS ? b : G2D_LATENCY_BUCKETS - 1;
+}
+
+/* largest latency falling in bucket b */
+static int g2d_latency_bound(int b)
+{
+	if (b < 4)
+		return b;
+	return ((5 + (b & 3)) << (b / 4 - 1)) - 1;
 }
 
 int g2d_flush(void *handle)
@@ -886,11 +3565,10 @@ int g2d_flush(void *handle)
 		return -1;
 	}
 
-	ret = ioctl(fd, PXP_IOC_START_CHAN, &context->handle);
-	if (ret < 0) {
-		g2d_printf("%s: failed to commit pxp task\n", __func__);
+	ret = g2d_submit(context);
+	if (ret < 0)
 		return -1;
-	}
+	context->busy = true;
 
 	return 0;
 }
@@ -900,24 +3578,189 @@ int g2d_finish(void *handle)
 	int ret;
 	struct g2dContext *context = (struct g2dContext *)handle;
 	struct pxp_chan_handle chan_handle;
+	unsigned long long start, end;
 
 	if (context == NULL) {
 		g2d_printf("%s: Invalid handle!\n", __func__);
 		return -1;
 	}
 
-	ret = ioctl(fd, PXP_IOC_START_CHAN, &context->handle);
-	if (ret < 0) {
-		g2d_printf("%s: failed to commit pxp task\n", __func__);
+	/* each submission is waited for once, let the fence thread go first */
+	g2d_fence_drain(context);
+
+	ret = g2d_submit(context);
+	if (ret < 0)
 		return -1;
-	}
 
 	chan_handle.handle = context->handle;
+	start = g2d_time_us();
 	ret = ioctl(fd, PXP_IOC_WAIT4CMPLT, &chan_handle);
+	end = g2d_time_us();
+	context->busy = false;
+	context->stats.waits++;
+	context->stats.wait_us += end - start;
 	if (ret < 0) {
 		g2d_printf("%s: failed to wait task complete\n", __func__);
 		return -1;
 	}
 
+	if (context->pending_us) {
+		context->stats.latency[g2d_latency_bucket(end - context->pending_us)]++;
+		context->pending_us = 0;
+	}
+
+	return 0;
+}
+
+int g2d_query_stats(void *handle, struct g2d_stats *stats)
+{
+	struct g2dContext *context = (struct g2dContext *)handle;
+
+	if (context == NULL || stats == NULL) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+
+	memcpy(stats, &context->stats, sizeof(struct g2d_stats));
+	return 0;
+}
+
+/*
+ * Latency in microseconds that percentile percent of the g2d_finish
+ * calls counted in the stats stayed within, rounded up to the bucket
+ * bound. 0 when nothing was counted.
+ */
+int g2d_query_latency(void *handle, int percentile, int *us)
+{
+	struct g2dContext *context = (struct g2dContext *)handle;
+	unsigned long long total = 0, want, seen = 0;
+	int b;
+
+	if (context == NULL || us == NULL || percentile < 0 || percentile > 100) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+
+	for (b = 0; b < G2D_LATENCY_BUCKETS; b++)
+		total += context->stats.latency[b];
+
+	*us = 0;
+	if (total == 0)
+		return 0;
+
+	want = (total * percentile + 99) / 100;
+	if (want == 0)
+		want = 1;
+	for (b = 0; b < G2D_LATENCY_BUCKETS; b++) {
+		seen += context->stats.latency[b];
+		if (seen >= want)
+			break;
+	}
+	*us = g2d_latency_bound(b);
+
+	return 0;
+}
+
+int g2d_reset_stats(void *handle)
+{
+	struct g2dContext *context = (struct g2dContext *)handle;
+
+	if (context == NULL) {
+		g2d_printf("%s: Invalid handle!\n", __func__);
+		return -1;
+	}
+
+	memset(&context->stats, 0, sizeof(struct g2d_stats));
+	return 0;
+}
+
+/*
+ * Submit like g2d_flush and return an eventfd in *fence_fd that becomes
+ * readable once pxp has completed the submission. The caller owns the fd
+ * and closes it, it can be polled or passed to g2d_wait_fence.
+ */
+int g2d_flush_fence(void *handle, int *fence_fd)
+{
+	int efd, wfd;
+	struct g2dContext *context = (struct g2dContext *)handle;
+
+	if (context == NULL || fence_fd == NULL) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+
+	if (!context->fence_running) {
+		pthread_mutex_init(&context->fence_mutex, NULL);
+		pthread_cond_init(&context->fence_cond, NULL);
+		context->fence_exit = false;
+		if (pthread_create(&context->fence_thread, NULL,
+				   g2d_fence_worker, context)) {
+			g2d_printf("%s: failed to start fence thread\n", __func__);
+			pthread_mutex_destroy(&context->fence_mutex);
+			pthread_cond_destroy(&context->fence_cond);
+			return -1;
+		}
+		context->fence_running = true;
+	}
+
+	efd = eventfd(0, 0);
+	if (efd < 0) {
+		g2d_printf("%s: failed to create fence\n", __func__);
+		return -1;
+	}
+
+	/* the thread signals its own copy, the caller may close efd early */
+	wfd = dup(efd);
+	if (wfd < 0) {
+		close(efd);
+		g2d_printf("%s: failed to create fence\n", __func__);
+		return -1;
+	}
+
+	if (g2d_submit(context) < 0) {
+		close(wfd);
+		close(efd);
+		return -1;
+	}
+	/* the fence thread's wait covers earlier flushes too */
+	context->busy = false;
+	context->pending_us = 0;
+
+	pthread_mutex_lock(&context->fence_mutex);
+	while (context->fence_count == G2D_FENCE_MAX)
+		pthread_cond_wait(&context->fence_cond, &context->fence_mutex);
+	context->fence_queue[(context->fence_head + context->fence_count) %
+			     G2D_FENCE_MAX] = wfd;
+	context->fence_count++;
+	pthread_cond_broadcast(&context->fence_cond);
+	pthread_mutex_unlock(&context->fence_mutex);
+
+	*fence_fd = efd;
+	return 0;
+}
+
+/* timeout in milliseconds, -1 waits forever */
+int g2d_wait_fence(int fence_fd, int timeout)
+{
+	struct pollfd pfd;
+	int ret;
+
+	if (fence_fd < 0) {
+		g2d_printf("%s: Invalid fence!\n", __func__);
+		return -1;
+	}
+
+	pfd.fd = fence_fd;
+	pfd.events = POLLIN;
+	do {
+		ret = poll(&pfd, 1, timeout);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret <= 0) {
+		if (ret < 0)
+			g2d_printf("%s: failed to poll fence\n", __func__);
+		return -1;
+	}
+
 	return 0;
 }
@@ -71,6 +71,15 @@ enum g2d_cap_mode
     G2D_DITHER                = 1,
     G2D_GLOBAL_ALPHA          = 2,//only support source global alpha
     G2D_BLEND_DIM             = 3,//support special blend effect
+    G2D_BATCH                 = 4,//record operations and submit them on flush, enabled by default,
+                                  //still one config ioctl per operation, the driver takes no lists
+    G2D_AUTO_DISPATCH         = 5,//send blits to the engine the cost model expects to be faster, off by default,
+                                  //routes nothing before g2d_blit_calibrate, G2D_AUTO_DISPATCH=1 in
+                                  //the environment enables it and calibrates in g2d_open
+    G2D_SCALE_BILINEAR        = 6,//scale with a filter on the cpu instead of pxp,
+    G2D_SCALE_BICUBIC         = 7,//enabling one of these disables the others,
+    G2D_SCALE_LANCZOS         = 8,//nearest scaling when none is enabled
+    G2D_DITHER_DIFFUSION      = 9,//error diffusion instead of the ordered G2D_DITHER, enabling one disables the other
 };
 
 enum g2d_rotation
@@ -83,6 +92,14 @@ enum g2d_rotation
     G2D_FLIP_V                = 5,
 };
 
+enum g2d_color_space
+{
+    G2D_BT601_LIMITED         = 0,//default, the only matrix pxp converts with
+    G2D_BT601_FULL            = 1,
+    G2D_BT709_LIMITED         = 2,
+    G2D_BT709_FULL            = 3,
+};
+
 enum g2d_cache_mode
 {
     G2D_CACHE_CLEAN           = 0,
@@ -94,6 +111,7 @@ enum g2d_hardware_type
 {
     G2D_HARDWARE_2D           = 0,//default type
     G2D_HARDWARE_VG           = 1,
+    G2D_HARDWARE_CPU          = 2,//software rendering, also used when pxp can't do an operation
 };
 
 struct g2d_surface
@@ -112,6 +130,9 @@ struct g2d_surface
                   //VYUY: planes[0] - packed VYUY
                   //NV16: planes[0] - Y, planes[1] - packed UV
                   //NV61: planes[0] - Y, planes[1] - packed VU
+                  //chroma planes may live in other buffers, 0 means right after the previous plane,
+                  //placed ones need g2d buffers (g2d_alloc, g2d_buf_import_fd), pxp reads planes
+                  //outside them as if they followed each other
 
     //blit rectangle in surface
     int left;
@@ -137,6 +158,19 @@ struct g2d_surface
     enum g2d_rotation rot;
 };
 
+//g2d_surface with the yuv fields taken by the _ex entry points, the plain
+//entry points behave as if they were 0
+struct g2d_surface_ex
+{
+    struct g2d_surface base;
+
+    //matrix and range of yuv planes, ignored for rgb formats
+    enum g2d_color_space color_space;
+
+    //bytes per line of the chroma planes of planar and semi-planar yuv, 0 derives it from stride
+    int uv_stride;
+};
+
 struct g2d_buf
 {
     void *buf_handle;
@@ -145,26 +179,178 @@ struct g2d_buf
     int  buf_size;
 };
 
+//g2d_finish latency histogram, 4 buckets per power of two microseconds
+#define G2D_LATENCY_BUCKETS   96
+
+struct g2d_stats
+{
+    unsigned int ops;//operations recorded by clear/blit/copy
+    unsigned int submits;//batches committed by flush/finish
+    unsigned int ioctls;//config and start ioctls issued for them
+    unsigned long long submit_us;//time spent in those ioctls
+    unsigned int pxp_blits;//g2d_blit calls done on pxp
+    unsigned int cpu_blits;//g2d_blit calls done on the cpu
+    unsigned int cpu_routed;//of those, sent there by the cost model
+    unsigned long long blit_pixels;//dst pixels of blit calls, for megapixels per second
+    unsigned long long cpu_us;//time spent blitting and clearing on the cpu
+    unsigned int waits;//pxp completion waits of g2d_finish
+    unsigned long long wait_us;//time spent in them
+    unsigned int latency[G2D_LATENCY_BUCKETS];//time from the first outstanding
+                                              //operation to g2d_finish returning,
+                                              //see g2d_query_latency
+    unsigned int clear_rects;//rects filled by g2d_clear_rects after merging
+    unsigned int ioctls_saved;//config ioctls it saved over a g2d_clear per rect,
+                              //by merging and by filling small rects on the cpu
+};
+
+//feature variants of the blit cost model
+#define G2D_COST_COPY         0
+#define G2D_COST_BLEND        1
+#define G2D_COST_SCALE        2
+#define G2D_COST_ROTATE       3//rotation or flip
+#define G2D_COST_YUV          4//yuv source
+#define G2D_COST_FEATURES     5
+
+//a blit costs setup_us plus kpix_ns per 1024 dst pixels, features add their
+//extra kpix_ns over G2D_COST_COPY
+struct g2d_blit_cost
+{
+    int calibrated;
+    int pxp_setup_us;
+    int pxp_kpix_ns[G2D_COST_FEATURES];
+    //[0] uncached buffers, [1] cacheable buffers
+    int cpu_setup_us[2];
+    int cpu_kpix_ns[2][G2D_COST_FEATURES];
+};
+
+#define G2D_COPY_TUNING_MIN   4096
+#define G2D_COPY_TUNING_SIZES 9//4KB up to 1MB
+#define G2D_COPY_TUNING_MAX   (G2D_COPY_TUNING_MIN << (G2D_COPY_TUNING_SIZES - 1))
+
+struct g2d_copy_tuning
+{
+    int calibrated;
+
+    //g2d_copy sizes from which pxp is used, [src cacheable][dst cacheable],
+    //a fixed 1KB until g2d_copy_calibrate runs, G2D_COPY_CALIBRATE=1 in the
+    //environment calibrates in g2d_open, copies never calibrate
+    int threshold[2][2];
+
+    //best time measured for each size, G2D_COPY_TUNING_MIN << i bytes,
+    //cpu times include the cache maintenance of the copy
+    int cpu_us[2][2][G2D_COPY_TUNING_SIZES];
+    int pxp_us[2][2][G2D_COPY_TUNING_SIZES];
+};
+
+struct g2d_pool_stats
+{
+    unsigned int hits;//g2d_alloc calls served from the pool
+    unsigned int misses;//g2d_alloc calls that went to the driver
+    unsigned int releases;//pooled buffers given back to the driver
+    unsigned int cached_buffers;//freed buffers kept mapped in the pool
+    unsigned int cached_bytes;
+};
+
+//bytes g2d_cache_op* maintained, reset once a frame to get per frame numbers
+struct g2d_cache_stats
+{
+    unsigned int full_ops;//whole buffer ops through the driver
+    unsigned int range_ops;//ops done on the range only
+    unsigned long long full_bytes;
+    unsigned long long range_bytes;
+};
+
+struct g2d_rect
+{
+    int left;
+    int top;
+    int right;
+    int bottom;
+};
+
+//compositor counters, pixels are output pixels written by clears and blits
+struct g2d_comp_stats
+{
+    unsigned int frames;
+    unsigned int blits;
+    unsigned int clears;
+    unsigned long long damage_pixels;
+    unsigned long long touched_pixels;
+};
+
 int g2d_open(void **handle);
 int g2d_close(void *handle);
 
 int g2d_make_current(void *handle, enum g2d_hardware_type type);
 
 int g2d_clear(void *handle, struct g2d_surface *area);
+int g2d_clear_rects(void *handle, struct g2d_surface *surface,
+                    const struct g2d_rect *rects, int n, int color);
 int g2d_blit(void *handle, struct g2d_surface *src, struct g2d_surface *dst);
+int g2d_blit_multi(void *handle, struct g2d_surface *src, int layers,
+		   struct g2d_surface *dst);
+int g2d_clear_ex(void *handle, struct g2d_surface_ex *area);
+int g2d_blit_ex(void *handle, struct g2d_surface_ex *src,
+		struct g2d_surface_ex *dst);
+
+int g2d_prepare_blit(void *handle, struct g2d_surface *src,
+		     struct g2d_surface *dst, void **program);
+int g2d_prepare_blit_ex(void *handle, struct g2d_surface_ex *src,
+			struct g2d_surface_ex *dst, void **program);
+int g2d_exec_blit(void *program, int *src_planes, int *dst_planes);
+int g2d_free_blit(void *program);
+
+int g2d_blit_calibrate(void *handle);
+int g2d_query_blit_cost(void *handle, struct g2d_surface *src,
+			struct g2d_surface *dst, int *pxp_us, int *cpu_us);
+int g2d_query_blit_cost_model(struct g2d_blit_cost *cost);
+
 int g2d_copy(void *handle, struct g2d_buf *d, struct g2d_buf* s, int size);
+int g2d_copy_calibrate(void *handle);
+int g2d_query_copy_tuning(struct g2d_copy_tuning *tuning);
 
 int g2d_query_cap(void *handle, enum g2d_cap_mode cap, int *enable);
 int g2d_enable(void *handle, enum g2d_cap_mode cap);
 int g2d_disable(void *handle, enum g2d_cap_mode cap);
 
 int g2d_cache_op(struct g2d_buf *buf, enum g2d_cache_mode op);
+int g2d_cache_op_range(struct g2d_buf *buf, int offset, int len,
+		       enum g2d_cache_mode op);
+int g2d_cache_op_rect(struct g2d_buf *buf, int offset, int width, int height,
+		      int stride, enum g2d_cache_mode op);
+int g2d_query_cache_stats(struct g2d_cache_stats *stats);
+int g2d_reset_cache_stats(void);
 struct g2d_buf *g2d_alloc(int size, int cacheable);
 int g2d_free(struct g2d_buf *buf);
+//dma-buf sharing, surfaces refer to an imported buffer by its buf_paddr
+struct g2d_buf *g2d_buf_import_fd(int dmabuf_fd, int size);
+//only dups the fd of buffers from g2d_buf_import_fd, g2d_alloc memory has
+//no dma-buf and fails; allocate shared memory from an exporter and import it
+int g2d_buf_export_fd(struct g2d_buf *buf, int *dmabuf_fd);
+int g2d_trim_pool(int keep_bytes);
+int g2d_query_pool_stats(struct g2d_pool_stats *stats);
 
 int g2d_flush(void *handle);
 int g2d_finish(void *handle);
 
+int g2d_flush_fence(void *handle, int *fence_fd);
+int g2d_wait_fence(int fence_fd, int timeout);
+
+int g2d_comp_create(void *handle, struct g2d_surface *output, void **comp);
+int g2d_comp_destroy(void *comp);
+int g2d_comp_set_output(void *comp, struct g2d_surface *output);
+int g2d_comp_set_layer(void *comp, int z, struct g2d_surface *src,
+		       struct g2d_surface *dst);
+int g2d_comp_remove_layer(void *comp, int z);
+int g2d_comp_damage(void *comp, int z, struct g2d_rect *rects, int count);
+int g2d_comp_render(void *comp);
+int g2d_comp_query_stats(void *comp, struct g2d_comp_stats *stats);
+int g2d_comp_reset_stats(void *comp);
+
+int g2d_query_stats(void *handle, struct g2d_stats *stats);
+int g2d_query_latency(void *handle, int percentile, int *us);
+int g2d_reset_stats(void *handle);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,607 @@
+/*
+ *  Copyright (C) 2014 Freescale Semiconductor, Inc.
+ *  All Rights Reserved.
+ *
+ *  The following programs are the sole property of Freescale Semiconductor Inc.,
+ *  and contain its proprietary and confidential information.
+ *
+ */
+
+/*
+ *	g2d_comp.c
+ *	Damage tracking compositor on top of the g2d blit api. Only the
+ *	damaged parts of the output are recomposed, from the topmost layer
+ *	that covers them opaquely upwards, and all of it goes out as one
+ *	batch per frame.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "g2d.h"
+#include "g2d_cpu.h"
+
+#define g2d_printf printf
+
+#define G2D_COMP_MAX_LAYERS	16
+#define G2D_COMP_MAX_DAMAGE	16
+
+struct g2d_comp_layer {
+	bool used;
+	struct g2d_surface src;
+	struct g2d_surface dst;
+};
+
+struct g2d_comp {
+	void *handle;
+	struct g2d_surface output;
+	struct g2d_comp_layer layers[G2D_COMP_MAX_LAYERS];
+	/* disjoint output rects to recompose on the next render */
+	struct g2d_rect damage[G2D_COMP_MAX_DAMAGE];
+	int damage_count;
+	struct g2d_comp_stats stats;
+};
+
+static int g2d_rect_area(const struct g2d_rect *r)
+{
+	return (r->right - r->left) * (r->bottom - r->top);
+}
+
+static int g2d_rect_empty(const struct g2d_rect *r)
+{
+	return r->right <= r->left || r->bottom <= r->top;
+}
+
+static void g2d_rect_intersect(struct g2d_rect *r, const struct g2d_rect *a,
+			       const struct g2d_rect *b)
+{
+	r->left = a->left > b->left ? a->left : b->left;
+	r->top = a->top > b->top ? a->top : b->top;
+	r->right = a->right < b->right ? a->right : b->right;
+	r->bottom = a->bottom < b->bottom ? a->bottom : b->bottom;
+}
+
+static void g2d_rect_union(struct g2d_rect *r, const struct g2d_rect *a,
+			   const struct g2d_rect *b)
+{
+	r->left = a->left < b->left ? a->left : b->left;
+	r->top = a->top < b->top ? a->top : b->top;
+	r->right = a->right > b->right ? a->right : b->right;
+	r->bottom = a->bottom > b->bottom ? a->bottom : b->bottom;
+}
+
+static int g2d_rect_contains(const struct g2d_rect *a, const struct g2d_rect *b)
+{
+	return a->left <= b->left && a->top <= b->top &&
+	       a->right >= b->right && a->bottom >= b->bottom;
+}
+
+static void g2d_surface_rect(struct g2d_rect *r, const struct g2d_surface *s)
+{
+	r->left = s->left;
+	r->top = s->top;
+	r->right = s->right;
+	r->bottom = s->bottom;
+}
+
+/* area the union of a and b covers that neither of them does */
+static int g2d_rect_waste(const struct g2d_rect *a, const struct g2d_rect *b)
+{
+	struct g2d_rect u, i;
+	int overlap;
+
+	g2d_rect_union(&u, a, b);
+	g2d_rect_intersect(&i, a, b);
+	overlap = g2d_rect_empty(&i) ? 0 : g2d_rect_area(&i);
+
+	return g2d_rect_area(&u) - g2d_rect_area(a) - g2d_rect_area(b) + overlap;
+}
+
+/*
+ * Add a rect to the damage list. Overlapping rects are merged so the
+ * list stays disjoint and no pixel is blended twice, close ones when
+ * the bounding box wastes less than the smaller of the two covers.
+ */
+static void g2d_comp_add_damage(struct g2d_comp *comp, const struct g2d_rect *rect)
+{
+	struct g2d_rect r, out, i;
+	int n, best, waste, best_waste, small;
+
+	g2d_surface_rect(&out, &comp->output);
+	g2d_rect_intersect(&r, rect, &out);
+	if (g2d_rect_empty(&r))
+		return;
+
+again:
+	for (n = 0; n < comp->damage_count; n++) {
+		g2d_rect_intersect(&i, &r, &comp->damage[n]);
+		small = g2d_rect_area(&r) < g2d_rect_area(&comp->damage[n]) ?
+			g2d_rect_area(&r) : g2d_rect_area(&comp->damage[n]);
+		if (!g2d_rect_empty(&i) ||
+		    g2d_rect_waste(&r, &comp->damage[n]) < small)
+			break;
+	}
+
+	if (n == comp->damage_count && n == G2D_COMP_MAX_DAMAGE) {
+		/* full, merge with the rect that grows the least */
+		best = 0;
+		best_waste = g2d_rect_waste(&r, &comp->damage[0]);
+		for (n = 1; n < comp->damage_count; n++) {
+			waste = g2d_rect_waste(&r, &comp->damage[n]);
+			if (waste < best_waste) {
+				best = n;
+				best_waste = waste;
+			}
+		}
+		n = best;
+	}
+
+	if (n < comp->damage_count) {
+		g2d_rect_union(&r, &r, &comp->damage[n]);
+		comp->damage[n] = comp->damage[--comp->damage_count];
+		/* the bigger rect may touch others now */
+		goto again;
+	}
+
+	comp->damage[comp->damage_count++] = r;
+}
+
+/*
+ * Grow r so its edges inside a scaled layer fall on dst pixels that
+ * start an exact src pixel. A partial blit then samples with the phase
+ * of the whole layer. Returns whether r changed.
+ */
+static int g2d_comp_align(struct g2d_comp *c, struct g2d_rect *r)
+{
+	struct g2d_comp_layer *layer;
+	const struct g2d_surface *d;
+	int z, rot, hflip, vflip, sx, sy, off, changed = 0;
+
+	for (z = 0; z < G2D_COMP_MAX_LAYERS; z++) {
+		layer = &c->layers[z];
+		if (!layer->used)
+			continue;
+		d = &layer->dst;
+		/* filtered layers are drawn whole and clipped, any edge will do */
+		if (g2d_scale_filtered(c->handle, &layer->src, &layer->dst))
+			continue;
+
+		rot = g2d_cpu_rotation(&layer->src, d, &hflip, &vflip);
+		sx = (d->right - d->left) /
+		     g2d_cpu_gcd(d->right - d->left, (rot & 1) ?
+			     layer->src.bottom - layer->src.top :
+			     layer->src.right - layer->src.left);
+		sy = (d->bottom - d->top) /
+		     g2d_cpu_gcd(d->bottom - d->top, (rot & 1) ?
+			     layer->src.right - layer->src.left :
+			     layer->src.bottom - layer->src.top);
+
+		if (r->left > d->left && r->left < d->right &&
+		    r->top < d->bottom && r->bottom > d->top) {
+			off = (r->left - d->left) % sx;
+			if (off) {
+				r->left -= off;
+				changed = 1;
+			}
+		}
+		if (r->right > d->left && r->right < d->right &&
+		    r->top < d->bottom && r->bottom > d->top) {
+			off = (r->right - d->left) % sx;
+			if (off) {
+				r->right += sx - off;
+				changed = 1;
+			}
+		}
+		if (r->top > d->top && r->top < d->bottom &&
+		    r->left < d->right && r->right > d->left) {
+			off = (r->top - d->top) % sy;
+			if (off) {
+				r->top -= off;
+				changed = 1;
+			}
+		}
+		if (r->bottom > d->top && r->bottom < d->bottom &&
+		    r->left < d->right && r->right > d->left) {
+			off = (r->bottom - d->top) % sy;
+			if (off) {
+				r->bottom += sy - off;
+				changed = 1;
+			}
+		}
+	}
+
+	return changed;
+}
+
+/* align all damage, merging what grows into each other, until stable */
+static void g2d_comp_align_damage(struct g2d_comp *c)
+{
+	struct g2d_rect damage[G2D_COMP_MAX_DAMAGE], r;
+	int i, count, changed;
+
+	do {
+		changed = 0;
+		count = c->damage_count;
+		memcpy(damage, c->damage, count * sizeof(damage[0]));
+		c->damage_count = 0;
+		for (i = 0; i < count; i++) {
+			r = damage[i];
+			while (g2d_comp_align(c, &r))
+				changed = 1;
+			g2d_comp_add_damage(c, &r);
+		}
+	} while (changed);
+}
+
+/*
+ * A layer hides what is under it when blending it gives its own pixels:
+ * one/zero does for any source, otherwise the source alpha has to be one
+ * everywhere so that src_alpha and one_minus_src_alpha are one and zero.
+ */
+static int g2d_comp_layer_opaque(const struct g2d_comp_layer *layer)
+{
+	enum g2d_blend_func sf = layer->src.blendfunc;
+	enum g2d_blend_func df = layer->dst.blendfunc;
+
+	if (layer->src.global_alpha < 0xff)
+		return 0;
+	if (sf == G2D_ONE && df == G2D_ZERO)
+		return 1;
+
+	return !g2d_cpu_has_alpha(layer->src.format) &&
+	       (sf == G2D_ONE || sf == G2D_SRC_ALPHA) &&
+	       (df == G2D_ZERO || df == G2D_ONE_MINUS_SRC_ALPHA);
+}
+
+int g2d_comp_create(void *handle, struct g2d_surface *output, void **comp)
+{
+	struct g2d_comp *c;
+
+	if (handle == NULL || output == NULL || comp == NULL) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+
+	/* damage is cleared through sub-surfaces of the output */
+	if (g2d_cpu_planes(output->format) != 1) {
+		g2d_printf("%s: unsupported output format\n", __func__);
+		return -1;
+	}
+
+	c = (struct g2d_comp *)calloc(1, sizeof(*c));
+	if (c == NULL) {
+		g2d_printf("%s: malloc memory failed!\n", __func__);
+		return -1;
+	}
+	c->handle = handle;
+	c->output = *output;
+
+	*comp = c;
+	return 0;
+}
+
+int g2d_comp_destroy(void *comp)
+{
+	free(comp);
+	return 0;
+}
+
+/*
+ * Switch to another output buffer of the same layout. Its content is not
+ * known, so all of it is recomposed on the next render.
+ */
+int g2d_comp_set_output(void *comp, struct g2d_surface *output)
+{
+	struct g2d_comp *c = (struct g2d_comp *)comp;
+	struct g2d_rect r;
+
+	if (c == NULL || output == NULL ||
+	    g2d_cpu_planes(output->format) != 1) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+
+	c->output = *output;
+	g2d_surface_rect(&r, output);
+	g2d_comp_add_damage(c, &r);
+
+	return 0;
+}
+
+/*
+ * Place layer z (0 is the bottom) with its src rect on the dst rect of
+ * the output. Only the rect, rot, blendfunc and global_alpha of dst are
+ * used, the rest comes from the output. Moving or changing a layer
+ * damages where it was and where it is now, content updates are
+ * reported with g2d_comp_damage.
+ */
+int g2d_comp_set_layer(void *comp, int z, struct g2d_surface *src,
+		       struct g2d_surface *dst)
+{
+	struct g2d_comp *c = (struct g2d_comp *)comp;
+	struct g2d_comp_layer *layer;
+	struct g2d_rect r;
+
+	if (c == NULL || src == NULL || dst == NULL ||
+	    z < 0 || z >= G2D_COMP_MAX_LAYERS) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+
+	if (dst->left < c->output.left || dst->top < c->output.top ||
+	    dst->right > c->output.right || dst->bottom > c->output.bottom ||
+	    dst->right <= dst->left || dst->bottom <= dst->top ||
+	    src->right <= src->left || src->bottom <= src->top) {
+		g2d_printf("%s: Invalid layer rect!\n", __func__);
+		return -1;
+	}
+
+	layer = &c->layers[z];
+	if (layer->used) {
+		if (!memcmp(&layer->src, src, sizeof(*src)) &&
+		    layer->dst.left == dst->left && layer->dst.top == dst->top &&
+		    layer->dst.right == dst->right &&
+		    layer->dst.bottom == dst->bottom &&
+		    layer->dst.rot == dst->rot &&
+		    layer->dst.blendfunc == dst->blendfunc &&
+		    layer->dst.global_alpha == dst->global_alpha)
+			return 0;
+
+		g2d_surface_rect(&r, &layer->dst);
+		g2d_comp_add_damage(c, &r);
+	}
+
+	layer->used = true;
+	layer->src = *src;
+	layer->dst = *dst;
+
+	g2d_surface_rect(&r, &layer->dst);
+	g2d_comp_add_damage(c, &r);
+
+	return 0;
+}
+
+int g2d_comp_remove_layer(void *comp, int z)
+{
+	struct g2d_comp *c = (struct g2d_comp *)comp;
+	struct g2d_rect r;
+
+	if (c == NULL || z < 0 || z >= G2D_COMP_MAX_LAYERS) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+
+	if (c->layers[z].used) {
+		g2d_surface_rect(&r, &c->layers[z].dst);
+		g2d_comp_add_damage(c, &r);
+		c->layers[z].used = false;
+	}
+
+	return 0;
+}
+
+/*
+ * Report count rects of layer z's src surface as changed, all of its src
+ * rect when rects is NULL.
+ */
+int g2d_comp_damage(void *comp, int z, struct g2d_rect *rects, int count)
+{
+	struct g2d_comp *c = (struct g2d_comp *)comp;
+	struct g2d_comp_layer *layer;
+	struct g2d_rect r, src;
+	int i, in[4], out[4];
+
+	if (c == NULL || z < 0 || z >= G2D_COMP_MAX_LAYERS ||
+	    (rects == NULL && count)) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+
+	layer = &c->layers[z];
+	if (!layer->used)
+		return 0;
+
+	if (rects == NULL) {
+		g2d_surface_rect(&r, &layer->dst);
+		g2d_comp_add_damage(c, &r);
+		return 0;
+	}
+
+	g2d_surface_rect(&src, &layer->src);
+	for (i = 0; i < count; i++) {
+		g2d_rect_intersect(&r, &rects[i], &src);
+		if (g2d_rect_empty(&r))
+			continue;
+
+		in[0] = r.left;
+		in[1] = r.top;
+		in[2] = r.right;
+		in[3] = r.bottom;
+		g2d_cpu_map_rect(&layer->src, &layer->dst, in, out, 0);
+		r.left = out[0];
+		r.top = out[1];
+		r.right = out[2];
+		r.bottom = out[3];
+		g2d_comp_add_damage(c, &r);
+	}
+
+	return 0;
+}
+
+static int g2d_comp_blit_layer(struct g2d_comp *c, struct g2d_comp_layer *layer,
+			       const struct g2d_rect *r)
+{
+	struct g2d_surface src, dst;
+	int in[4], out[4], filtered, ret;
+
+	filtered = g2d_scale_filtered(c->handle, &layer->src, &layer->dst);
+
+	src = layer->src;
+	dst = c->output;
+	if (filtered) {
+		/* the whole layer, clipped to r */
+		dst.left = layer->dst.left;
+		dst.top = layer->dst.top;
+		dst.right = layer->dst.right;
+		dst.bottom = layer->dst.bottom;
+	} else {
+		in[0] = r->left;
+		in[1] = r->top;
+		in[2] = r->right;
+		in[3] = r->bottom;
+		g2d_cpu_map_rect(&layer->src, &layer->dst, in, out, 1);
+
+		src.left = out[0];
+		src.top = out[1];
+		src.right = out[2];
+		src.bottom = out[3];
+		if (src.right <= src.left || src.bottom <= src.top)
+			return 0;
+
+		dst.left = r->left;
+		dst.top = r->top;
+		dst.right = r->right;
+		dst.bottom = r->bottom;
+	}
+	dst.rot = layer->dst.rot;
+	dst.blendfunc = layer->dst.blendfunc;
+	dst.global_alpha = layer->dst.global_alpha;
+
+	if (g2d_comp_layer_opaque(layer)) {
+		g2d_disable(c->handle, G2D_BLEND);
+	} else {
+		g2d_enable(c->handle, G2D_BLEND);
+		if (src.global_alpha < 0xff)
+			g2d_enable(c->handle, G2D_GLOBAL_ALPHA);
+		else
+			g2d_disable(c->handle, G2D_GLOBAL_ALPHA);
+	}
+
+	if (filtered)
+		ret = g2d_blit_clip(c->handle, &src, &dst, r);
+	else
+		ret = g2d_blit(c->handle, &src, &dst);
+	if (ret < 0)
+		return -1;
+
+	c->stats.blits++;
+	c->stats.touched_pixels += g2d_rect_area(r);
+
+	return 0;
+}
+
+/*
+ * Recompose the damaged parts of the output and flush them as one
+ * batch. Each damage rect starts at the topmost opaque layer covering
+ * it, or at output->clrcolor when none does, so the layers below are
+ * never read. The blend state of the context is restored afterwards.
+ */
+int g2d_comp_render(void *comp)
+{
+	struct g2d_comp *c = (struct g2d_comp *)comp;
+	struct g2d_comp_layer *layer;
+	struct g2d_surface_ex output, area;
+	struct g2d_rect r, d;
+	int i, z, base, blend, global_alpha, ret = 0;
+
+	if (c == NULL) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+
+	c->stats.frames++;
+	if (!c->damage_count)
+		return 0;
+
+	g2d_comp_align_damage(c);
+
+	g2d_query_cap(c->handle, G2D_BLEND, &blend);
+	g2d_query_cap(c->handle, G2D_GLOBAL_ALPHA, &global_alpha);
+	g2d_surface_wrap(&output, &c->output);
+
+	for (i = 0; i < c->damage_count && !ret; i++) {
+		d = c->damage[i];
+		c->stats.damage_pixels += g2d_rect_area(&d);
+
+		/* occlusion culling: nothing under an opaque cover is drawn */
+		base = -1;
+		for (z = G2D_COMP_MAX_LAYERS - 1; z >= 0; z--) {
+			layer = &c->layers[z];
+			if (!layer->used || !g2d_comp_layer_opaque(layer))
+				continue;
+			g2d_surface_rect(&r, &layer->dst);
+			if (g2d_rect_contains(&r, &d)) {
+				base = z;
+				break;
+			}
+		}
+
+		if (base < 0) {
+			g2d_sub_surface(&area, &output.base, d.left, d.top,
+					d.right, d.bottom);
+			if (g2d_clear(c->handle, &area.base) < 0) {
+				ret = -1;
+				break;
+			}
+			c->stats.clears++;
+			c->stats.touched_pixels += g2d_rect_area(&d);
+			base = 0;
+		}
+
+		for (z = base; z < G2D_COMP_MAX_LAYERS; z++) {
+			layer = &c->layers[z];
+			if (!layer->used)
+				continue;
+			g2d_surface_rect(&r, &layer->dst);
+			g2d_rect_intersect(&r, &r, &d);
+			if (g2d_rect_empty(&r))
+				continue;
+			if (g2d_comp_blit_layer(c, layer, &r) < 0) {
+				ret = -1;
+				break;
+			}
+		}
+	}
+	c->damage_count = 0;
+
+	if (blend)
+		g2d_enable(c->handle, G2D_BLEND);
+	else
+		g2d_disable(c->handle, G2D_BLEND);
+	if (global_alpha)
+		g2d_enable(c->handle, G2D_GLOBAL_ALPHA);
+	else
+		g2d_disable(c->handle, G2D_GLOBAL_ALPHA);
+
+	if (g2d_flush(c->handle) < 0)
+		ret = -1;
+
+	return ret;
+}
+
+int g2d_comp_query_stats(void *comp, struct g2d_comp_stats *stats)
+{
+	struct g2d_comp *c = (struct g2d_comp *)comp;
+
+	if (c == NULL || stats == NULL) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+
+	*stats = c->stats;
+	return 0;
+}
+
+int g2d_comp_reset_stats(void *comp)
+{
+	struct g2d_comp *c = (struct g2d_comp *)comp;
+
+	if (c == NULL) {
+		g2d_printf("%s: Invalid parameters!\n", __func__);
+		return -1;
+	}
+
+	memset(&c->stats, 0, sizeof(c->stats));
+	return 0;
+}
@@ -0,0 +1,2660 @@
+/*
+ *  Copyright (C) 2014 Freescale Semiconductor, Inc.
+ *  All Rights Reserved.
+ *
+ *  The following programs are the sole property of Freescale Semiconductor Inc.,
+ *  and contain its proprietary and confidential information.
+ *
+ */
+
+/*
+ * Software implementation of g2d_blit/g2d_clear. Pixels go through a row
+ * of RGBA8888 (bytes R, G, B, A): source pixels are fetched and converted
+ * into it, blended with the destination row if needed and converted back
+ * when stored. Rows are split across a few threads for large surfaces.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define G2D_CPU_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define G2D_CPU_SSE2
+#endif
+#include "g2d_cpu.h"
+
+#define g2d_printf printf
+
+struct g2d_cpu_job {
+	struct g2d_cpu_blit *blit;
+	struct g2d_cpu_surface *area;	/* set for clear */
+	int y0;
+	int y1;
+	int ret;
+};
+
+/*
+ * Filter taps and the horizontally filtered lines they build are fixed
+ * point with this many fractional bits.
+ */
+#define G2D_CPU_FILTER_BITS	14
+#define G2D_CPU_LINE_BITS	6
+#define G2D_CPU_FILTER_CACHE	8
+#define G2D_CPU_FILTER_MAX_TAPS	64
+
+/*
+ * Coefficients of a filter resampling src_len pixels to dst_len, the
+ * same for every blit of that size pair. Taps are relative to the start
+ * of the src rect and clamp to its edges when fetched.
+ */
+struct g2d_cpu_filter {
+	int filter;
+	int src_len, dst_len;
+	int taps;		/* even, short windows are padded with zeros */
+	int users;
+	int cached;
+	unsigned int stamp;
+	int *start;		/* first tap of each dst pixel */
+	short *weight;		/* taps per dst pixel, summing to 1 << G2D_CPU_FILTER_BITS */
+};
+
+static struct g2d_cpu_filter *filter_cache[G2D_CPU_FILTER_CACHE];
+static unsigned int filter_stamp;
+static pthread_mutex_t filter_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* map of a blit, shared read only by all worker threads */
+struct g2d_cpu_map {
+	int dst_w, dst_h;
+	int rot;		/* quarter turns, clockwise */
+	int hflip, vflip;
+	int cx0, cx1, cy0, cy1;	/* clip, relative to the dst rect */
+	int *sx;		/* src column for each u */
+	int *sy;		/* src row for each v */
+	/* filtered scaling: dst x walks fin, dst y walks fout */
+	struct g2d_cpu_filter *fin, *fout;
+	int rev_x, rev_y;
+	int dither;		/* G2D_CPU_DITHER_*, none unless dst is 16 bit */
+};
+
+/* round(x / 255) for 0 <= x <= 255 * 255 */
+#define DIV255(x)	((((x) + 128) + (((x) + 128) >> 8)) >> 8)
+
+static inline unsigned char clamp255(int v)
+{
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+int g2d_cpu_format_supported(enum g2d_format format)
+{
+	switch (format) {
+	case G2D_RGB565:
+	case G2D_BGR565:
+	case G2D_RGBA8888:
+	case G2D_RGBX8888:
+	case G2D_BGRA8888:
+	case G2D_BGRX8888:
+	case G2D_ARGB8888:
+	case G2D_ABGR8888:
+	case G2D_XRGB8888:
+	case G2D_XBGR8888:
+	case G2D_NV12:
+	case G2D_I420:
+	case G2D_YV12:
+	case G2D_NV21:
+	case G2D_YUYV:
+	case G2D_YVYU:
+	case G2D_UYVY:
+	case G2D_VYUY:
+	case G2D_NV16:
+	case G2D_NV61:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+int g2d_cpu_planes(enum g2d_format format)
+{
+	switch (format) {
+	case G2D_I420:
+	case G2D_YV12:
+		return 3;
+	case G2D_NV12:
+	case G2D_NV21:
+	case G2D_NV16:
+	case G2D_NV61:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+/* bytes per line of a plane */
+static int g2d_cpu_pitch(const struct g2d_surface *surf, int plane)
+{
+	if (plane && g2d_cpu_ex(surf)->uv_stride)
+		return g2d_cpu_ex(surf)->uv_stride;
+
+	switch (surf->format) {
+	case G2D_RGB565:
+	case G2D_BGR565:
+	case G2D_YUYV:
+	case G2D_YVYU:
+	case G2D_UYVY:
+	case G2D_VYUY:
+		return surf->stride * 2;
+	case G2D_I420:
+	case G2D_YV12:
+		return plane ? surf->stride / 2 : surf->stride;
+	case G2D_NV12:
+	case G2D_NV21:
+	case G2D_NV16:
+	case G2D_NV61:
+		return surf->stride;
+	default:
+		return surf->stride * 4;
+	}
+}
+
+int g2d_cpu_plane_size(const struct g2d_surface *surf, int plane)
+{
+	int lines = surf->height;
+
+	if (plane && (surf->format == G2D_I420 || surf->format == G2D_YV12 ||
+		      surf->format == G2D_NV12 || surf->format == G2D_NV21))
+		lines = (surf->height + 1) / 2;
+
+	return g2d_cpu_pitch(surf, plane) * lines;
+}
+
+/* address of a plane, an unset chroma plane follows the one before it */
+int g2d_cpu_plane_addr(const struct g2d_surface *surf, int plane)
+{
+	if (!plane || surf->planes[plane])
+		return surf->planes[plane];
+
+	return g2d_cpu_plane_addr(surf, plane - 1) +
+	       g2d_cpu_plane_size(surf, plane - 1);
+}
+
+/*
+ * Whether the planes follow each other at the default pitches, the only
+ * layout pxp can read and write: it takes one address per layer and finds
+ * the chroma planes from stride and height.
+ */
+int g2d_cpu_planes_contiguous(const struct g2d_surface *surf)
+{
+	struct g2d_surface_ex packed = *g2d_cpu_ex(surf);
+	int i, uv_stride = packed.uv_stride;
+
+	packed.uv_stride = 0;
+	for (i = 1; i < g2d_cpu_planes(surf->format); i++) {
+		if (g2d_cpu_plane_addr(surf, i) !=
+		    g2d_cpu_plane_addr(surf, i - 1) +
+		    g2d_cpu_plane_size(&packed.base, i - 1))
+			return 0;
+		if (uv_stride && uv_stride != g2d_cpu_pitch(&packed.base, i))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* byte offsets of r, g, b, a in a 32bpp pixel, a < 0 if not used */
+static void g2d_cpu_rgb32_layout(enum g2d_format format, int *r, int *g,
+				 int *b, int *a)
+{
+	switch (format) {
+	case G2D_RGBA8888:
+	case G2D_RGBX8888:
+		*r = 0; *g = 1; *b = 2; *a = 3;
+		break;
+	case G2D_BGRA8888:
+	case G2D_BGRX8888:
+		*b = 0; *g = 1; *r = 2; *a = 3;
+		break;
+	case G2D_ARGB8888:
+	case G2D_XRGB8888:
+		*a = 0; *r = 1; *g = 2; *b = 3;
+		break;
+	default:
+		*a = 0; *b = 1; *g = 2; *r = 3;
+		break;
+	}
+
+	if (format == G2D_RGBX8888 || format == G2D_BGRX8888 ||
+	    format == G2D_XRGB8888 || format == G2D_XBGR8888)
+		*a = -1;
+}
+
+/* byte offsets of y0, u, y1, v in a packed 4:2:2 pixel pair */
+static void g2d_cpu_yuv422_layout(enum g2d_format format, int *y0, int *u,
+				  int *y1, int *v)
+{
+	switch (format) {
+	case G2D_YUYV:
+		*y0 = 0; *u = 1; *y1 = 2; *v = 3;
+		break;
+	case G2D_YVYU:
+		*y0 = 0; *v = 1; *y1 = 2; *u = 3;
+		break;
+	case G2D_UYVY:
+		*u = 0; *y0 = 1; *v = 2; *y1 = 3;
+		break;
+	default:
+		*v = 0; *y0 = 1; *u = 2; *y1 = 3;
+		break;
+	}
+}
+
+/*
+ * Fixed point yuv matrices with 8 fractional bits, indexed by
+ * enum g2d_color_space. Chroma is centered on 128, luma starts at y_off.
+ */
+struct g2d_cpu_csc {
+	int y_off;
+	int cy, vr, ug, vg, ub;		/* yuv to rgb */
+	int ry, gy, by;			/* rgb to yuv */
+	int ru, gu, bu;
+	int rv, gv, bv;
+};
+
+static const struct g2d_cpu_csc g2d_cpu_csc_table[] = {
+	/* BT.601 limited range */
+	{ 16, 298, 409, 100, 208, 516,
+	  66, 129, 25, -38, -74, 112, 112, -94, -18 },
+	/* BT.601 full range */
+	{ 0, 256, 359, 88, 183, 454,
+	  77, 150, 29, -43, -85, 128, 128, -107, -21 },
+	/* BT.709 limited range */
+	{ 16, 298, 459, 55, 136, 541,
+	  47, 157, 16, -26, -86, 112, 112, -102, -10 },
+	/* BT.709 full range */
+	{ 0, 256, 403, 48, 120, 475,
+	  54, 183, 19, -29, -99, 128, 128, -116, -12 },
+};
+
+static int g2d_cpu_is_yuv(enum g2d_format format)
+{
+	return format >= G2D_NV12 && format <= G2D_NV61;
+}
+
+/* chroma on every other line */
+static int g2d_cpu_yuv420(enum g2d_format format)
+{
+	return format == G2D_NV12 || format == G2D_NV21 ||
+	       format == G2D_I420 || format == G2D_YV12;
+}
+
+/* color space the yuv planes of surf use, BT.601 limited for rgb */
+int g2d_cpu_color_space(const struct g2d_surface *surf)
+{
+	int color_space = g2d_cpu_ex(surf)->color_space;
+
+	if (!g2d_cpu_is_yuv(surf->format) ||
+	    (unsigned int)color_space > G2D_BT709_FULL)
+		return G2D_BT601_LIMITED;
+	return color_space;
+}
+
+/* whether the pixels of format carry alpha */
+int g2d_cpu_has_alpha(enum g2d_format format)
+{
+	int r, g, b, a;
+
+	if (!g2d_cpu_format_supported(format) || g2d_cpu_is_yuv(format) ||
+	    format == G2D_RGB565 || format == G2D_BGR565)
+		return 0;
+
+	g2d_cpu_rgb32_layout(format, &r, &g, &b, &a);
+	return a >= 0;
+}
+
+static inline const struct g2d_cpu_csc *g2d_cpu_csc(const struct g2d_surface *surf)
+{
+	return &g2d_cpu_csc_table[g2d_cpu_color_space(surf)];
+}
+
+static inline void yuv_to_rgba(const struct g2d_cpu_csc *m, int y, int u,
+			       int v, unsigned char *p)
+{
+	int c = m->cy * (y - m->y_off) + 128;
+
+	u -= 128;
+	v -= 128;
+	p[0] = clamp255((c + m->vr * v) >> 8);
+	p[1] = clamp255((c - m->ug * u - m->vg * v) >> 8);
+	p[2] = clamp255((c + m->ub * u) >> 8);
+	p[3] = 255;
+}
+
+static inline void rgba_to_yuv(const struct g2d_cpu_csc *m,
+			       const unsigned char *p, int *y, int *u, int *v)
+{
+	int r = p[0], g = p[1], b = p[2];
+
+	*y = clamp255(((m->ry * r + m->gy * g + m->by * b + 128) >> 8) + m->y_off);
+	*u = clamp255(((m->ru * r + m->gu * g + m->bu * b + 128) >> 8) + 128);
+	*v = clamp255(((m->rv * r + m->gv * g + m->bv * b + 128) >> 8) + 128);
+}
+
+/* fetch n pixels at (xs[i], ys[i]) as RGBA8888 */
+static void g2d_cpu_fetch(const struct g2d_cpu_surface *s, const int *xs,
+			  const int *ys, int n, unsigned char *out)
+{
+	enum g2d_format format = s->surf->format;
+	const struct g2d_cpu_csc *m = g2d_cpu_csc(s->surf);
+	int pitch0 = g2d_cpu_pitch(s->surf, 0);
+	int pitch1 = g2d_cpu_pitch(s->surf, 1);
+	int r, g, b, a, y0, u, y1, v;
+	unsigned char *p, *q;
+	unsigned short c;
+	int i;
+
+	switch (format) {
+	case G2D_RGB565:
+	case G2D_BGR565:
+		for (i = 0; i < n; i++, out += 4) {
+			c = *(unsigned short *)(s->planes[0] + ys[i] * pitch0 + xs[i] * 2);
+			r = (c >> 11) & 0x1f;
+			g = (c >> 5) & 0x3f;
+			b = c & 0x1f;
+			if (format == G2D_BGR565) {
+				a = r; r = b; b = a;
+			}
+			out[0] = (r << 3) | (r >> 2);
+			out[1] = (g << 2) | (g >> 4);
+			out[2] = (b << 3) | (b >> 2);
+			out[3] = 255;
+		}
+		break;
+	case G2D_YUYV:
+	case G2D_YVYU:
+	case G2D_UYVY:
+	case G2D_VYUY:
+		g2d_cpu_yuv422_layout(format, &y0, &u, &y1, &v);
+		for (i = 0; i < n; i++, out += 4) {
+			p = s->planes[0] + ys[i] * pitch0 + (xs[i] & ~1) * 2;
+			yuv_to_rgba(m, p[(xs[i] & 1) ? y1 : y0], p[u], p[v], out);
+		}
+		break;
+	case G2D_I420:
+	case G2D_YV12:
+		for (i = 0; i < n; i++, out += 4) {
+			p = s->planes[1] + (ys[i] >> 1) * pitch1 + (xs[i] >> 1);
+			q = s->planes[2] + (ys[i] >> 1) * pitch1 + (xs[i] >> 1);
+			if (format == G2D_YV12) {
+				unsigned char *t = p; p = q; q = t;
+			}
+			yuv_to_rgba(m, s->planes[0][ys[i] * pitch0 + xs[i]], *p, *q, out);
+		}
+		break;
+	case G2D_NV12:
+	case G2D_NV21:
+	case G2D_NV16:
+	case G2D_NV61:
+		for (i = 0; i < n; i++, out += 4) {
+			y0 = (format == G2D_NV12 || format == G2D_NV21) ?
+			     ys[i] >> 1 : ys[i];
+			p = s->planes[1] + y0 * pitch1 + (xs[i] & ~1);
+			if (format == G2D_NV12 || format == G2D_NV16)
+				yuv_to_rgba(m, s->planes[0][ys[i] * pitch0 + xs[i]], p[0], p[1], out);
+			else
+				yuv_to_rgba(m, s->planes[0][ys[i] * pitch0 + xs[i]], p[1], p[0], out);
+		}
+		break;
+	default:
+		g2d_cpu_rgb32_layout(format, &r, &g, &b, &a);
+		for (i = 0; i < n; i++, out += 4) {
+			p = s->planes[0] + ys[i] * pitch0 + xs[i] * 4;
+			out[0] = p[r];
+			out[1] = p[g];
+			out[2] = p[b];
+			out[3] = a < 0 ? 255 : p[a];
+		}
+		break;
+	}
+}
+
+/* store n RGBA8888 pixels from (x, y) on */
+static void g2d_cpu_store(const struct g2d_cpu_surface *s, int x, int y,
+			  int n, const unsigned char *in)
+{
+	enum g2d_format format = s->surf->format;
+	const struct g2d_cpu_csc *m = g2d_cpu_csc(s->surf);
+	int pitch0 = g2d_cpu_pitch(s->surf, 0);
+	int pitch1 = g2d_cpu_pitch(s->surf, 1);
+	int r, g, b, a, y0, u, y1, v, cy, cu, cv;
+	unsigned char *p, *q;
+	unsigned short *c;
+	int i;
+
+	switch (format) {
+	case G2D_RGB565:
+	case G2D_BGR565:
+		c = (unsigned short *)(s->planes[0] + y * pitch0) + x;
+		for (i = 0; i < n; i++, in += 4) {
+			r = in[0] >> 3;
+			g = in[1] >> 2;
+			b = in[2] >> 3;
+			if (format == G2D_BGR565)
+				c[i] = (b << 11) | (g << 5) | r;
+			else
+				c[i] = (r << 11) | (g << 5) | b;
+		}
+		break;
+	case G2D_YUYV:
+	case G2D_YVYU:
+	case G2D_UYVY:
+	case G2D_VYUY:
+		g2d_cpu_yuv422_layout(format, &y0, &u, &y1, &v);
+		for (i = 0; i < n; i++, in += 4) {
+			p = s->planes[0] + y * pitch0 + ((x + i) & ~1) * 2;
+			rgba_to_yuv(m, in, &cy, &cu, &cv);
+			p[((x + i) & 1) ? y1 : y0] = cy;
+			if (!((x + i) & 1)) {
+				p[u] = cu;
+				p[v] = cv;
+			}
+		}
+		break;
+	case G2D_I420:
+	case G2D_YV12:
+		for (i = 0; i < n; i++, in += 4) {
+			rgba_to_yuv(m, in, &cy, &cu, &cv);
+			s->planes[0][y * pitch0 + x + i] = cy;
+			if ((y & 1) || ((x + i) & 1))
+				continue;
+			p = s->planes[1] + (y >> 1) * pitch1 + ((x + i) >> 1);
+			q = s->planes[2] + (y >> 1) * pitch1 + ((x + i) >> 1);
+			if (format == G2D_YV12) {
+				unsigned char *t = p; p = q; q = t;
+			}
+			*p = cu;
+			*q = cv;
+		}
+		break;
+	case G2D_NV12:
+	case G2D_NV21:
+	case G2D_NV16:
+	case G2D_NV61:
+		for (i = 0; i < n; i++, in += 4) {
+			rgba_to_yuv(m, in, &cy, &cu, &cv);
+			s->planes[0][y * pitch0 + x + i] = cy;
+			if ((x + i) & 1)
+				continue;
+			if (format == G2D_NV12 || format == G2D_NV21) {
+				if (y & 1)
+					continue;
+				p = s->planes[1] + (y >> 1) * pitch1 + x + i;
+			} else {
+				p = s->planes[1] + y * pitch1 + x + i;
+			}
+			if (format == G2D_NV12 || format == G2D_NV16) {
+				p[0] = cu;
+				p[1] = cv;
+			} else {
+				p[0] = cv;
+				p[1] = cu;
+			}
+		}
+		break;
+	default:
+		g2d_cpu_rgb32_layout(format, &r, &g, &b, &a);
+		p = s->planes[0] + y * pitch0 + x * 4;
+		for (i = 0; i < n; i++, in += 4, p += 4) {
+			p[r] = in[0];
+			p[g] = in[1];
+			p[b] = in[2];
+			/* the unused byte of X formats is written as 0xff */
+			if (a < 0)
+				p[6 - r - g - b] = 0xff;
+			else
+				p[a] = in[3];
+		}
+		break;
+	}
+}
+
+static inline int g2d_cpu_factor(enum g2d_blend_func func, int as, int ad)
+{
+	switch (func) {
+	case G2D_ZERO:
+		return 0;
+	case G2D_SRC_ALPHA:
+		return as;
+	case G2D_ONE_MINUS_SRC_ALPHA:
+		return 255 - as;
+	case G2D_DST_ALPHA:
+		return ad;
+	case G2D_ONE_MINUS_DST_ALPHA:
+		return 255 - ad;
+	case G2D_ONE:
+	default:
+		return 255;
+	}
+}
+
+/* s = s * As + d * (1 - As) on every channel, the usual source over */
+static void g2d_cpu_blend_over(unsigned char *s, const unsigned char *d, int n)
+{
+	int i = 0, k, as, x;
+
+#if defined(G2D_CPU_NEON)
+	uint16x8_t c128 = vdupq_n_u16(128);
+
+	for (; i + 8 <= n; i += 8) {
+		uint8x8x4_t vs = vld4_u8(s + i * 4);
+		uint8x8x4_t vd = vld4_u8(d + i * 4);
+		uint8x8_t va = vs.val[3];
+		uint8x8_t vi = vmvn_u8(va);
+
+		for (k = 0; k < 4; k++) {
+			uint16x8_t t = vmull_u8(vs.val[k], va);
+			t = vmlal_u8(t, vd.val[k], vi);
+			t = vaddq_u16(t, c128);
+			vs.val[k] = vaddhn_u16(t, vshrq_n_u16(t, 8));
+		}
+		vst4_u8(s + i * 4, vs);
+	}
+#elif defined(G2D_CPU_SSE2)
+	__m128i zero = _mm_setzero_si128();
+	__m128i c255 = _mm_set1_epi16(255);
+	__m128i c128 = _mm_set1_epi16(128);
+
+	for (; i + 4 <= n; i += 4) {
+		__m128i vs = _mm_loadu_si128((__m128i *)(s + i * 4));
+		__m128i vd = _mm_loadu_si128((const __m128i *)(d + i * 4));
+		__m128i res[2];
+
+		for (k = 0; k < 2; k++) {
+			__m128i ws = k ? _mm_unpackhi_epi8(vs, zero) : _mm_unpacklo_epi8(vs, zero);
+			__m128i wd = k ? _mm_unpackhi_epi8(vd, zero) : _mm_unpacklo_epi8(vd, zero);
+			__m128i wa = _mm_shufflehi_epi16(_mm_shufflelo_epi16(ws, 0xff), 0xff);
+			__m128i t = _mm_add_epi16(_mm_mullo_epi16(ws, wa),
+						  _mm_mullo_epi16(wd, _mm_sub_epi16(c255, wa)));
+			t = _mm_add_epi16(t, c128);
+			res[k] = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+		}
+		_mm_storeu_si128((__m128i *)(s + i * 4), _mm_packus_epi16(res[0], res[1]));
+	}
+#endif
+
+	for (; i < n; i++) {
+		as = s[i * 4 + 3];
+		for (k = 0; k < 4; k++) {
+			x = s[i * 4 + k] * as + d[i * 4 + k] * (255 - as);
+			s[i * 4 + k] = DIV255(x);
+		}
+	}
+}
+
+static void g2d_cpu_blend(struct g2d_cpu_blit *blit, unsigned char *s,
+			  unsigned char *d, int n)
+{
+	enum g2d_blend_func sf = blit->src.surf->blendfunc;
+	enum g2d_blend_func df = blit->dst.surf->blendfunc;
+	int i, k, as, ad, fs, fd, x;
+
+	if (blit->global_alpha < 255)
+		for (i = 0; i < n; i++)
+			s[i * 4 + 3] = DIV255(s[i * 4 + 3] * blit->global_alpha);
+	if (blit->dst_global_alpha < 255)
+		for (i = 0; i < n; i++)
+			d[i * 4 + 3] = DIV255(d[i * 4 + 3] * blit->dst_global_alpha);
+
+	if (sf == G2D_SRC_ALPHA && df == G2D_ONE_MINUS_SRC_ALPHA) {
+		g2d_cpu_blend_over(s, d, n);
+		return;
+	}
+
+	for (i = 0; i < n; i++, s += 4, d += 4) {
+		as = s[3];
+		ad = d[3];
+		fs = g2d_cpu_factor(sf, as, ad);
+		fd = g2d_cpu_factor(df, as, ad);
+		for (k = 0; k < 4; k++) {
+			x = DIV255(s[k] * fs) + DIV255(d[k] * fd);
+			s[k] = x > 255 ? 255 : x;
+		}
+	}
+}
+
+static double g2d_cpu_kernel(int filter, double x)
+{
+	x = fabs(x);
+	switch (filter) {
+	case G2D_CPU_FILTER_BILINEAR:
+		return x < 1 ? 1 - x : 0;
+	case G2D_CPU_FILTER_BICUBIC:
+		/* Keys cubic, a = -0.5 */
+		if (x < 1)
+			return (1.5 * x - 2.5) * x * x + 1;
+		if (x < 2)
+			return ((-0.5 * x + 2.5) * x - 4) * x + 2;
+		return 0;
+	default:
+		/* Lanczos, 3 lobes */
+		if (x < 1e-8)
+			return 1;
+		if (x >= 3)
+			return 0;
+		return 3 * sin(M_PI * x) * sin(M_PI * x / 3) / (M_PI * M_PI * x * x);
+	}
+}
+
+static struct g2d_cpu_filter *g2d_cpu_filter_build(int filter, int src_len,
+						   int dst_len)
+{
+	static const int radius[] = { 0, 1, 2, 3 };
+	struct g2d_cpu_filter *f;
+	double scale = (double)src_len / dst_len;
+	double fscale = scale > 1 ? scale : 1;
+	double support, center, w[G2D_CPU_FILTER_MAX_TAPS], sum;
+	int k, i, first, last, taps = 0, q, total, big;
+
+	/*
+	 * downscaling widens the kernel to filter out detail, up to what
+	 * the window can hold
+	 */
+	if (fscale > (G2D_CPU_FILTER_MAX_TAPS / 2 - 1) / radius[filter])
+		fscale = (G2D_CPU_FILTER_MAX_TAPS / 2 - 1) / radius[filter];
+	support = radius[filter] * fscale;
+
+	/* widest window */
+	for (k = 0; k < dst_len; k++) {
+		center = (k + 0.5) * scale - 0.5;
+		first = (int)floor(center - support) + 1;
+		last = (int)ceil(center + support) - 1;
+		if (last - first + 1 > taps)
+			taps = last - first + 1;
+	}
+	taps = (taps + 1) & ~1;
+
+	f = (struct g2d_cpu_filter *)malloc(sizeof(*f) + dst_len * sizeof(int) +
+					    dst_len * taps * sizeof(short));
+	if (f == NULL)
+		return NULL;
+	f->filter = filter;
+	f->src_len = src_len;
+	f->dst_len = dst_len;
+	f->taps = taps;
+	f->users = 0;
+	f->cached = 0;
+	f->stamp = 0;
+	f->start = (int *)(f + 1);
+	f->weight = (short *)(f->start + dst_len);
+
+	for (k = 0; k < dst_len; k++) {
+		center = (k + 0.5) * scale - 0.5;
+		first = (int)floor(center - support) + 1;
+		sum = 0;
+		for (i = 0; i < taps; i++) {
+			w[i] = g2d_cpu_kernel(filter, (first + i - center) / fscale);
+			sum += w[i];
+		}
+
+		/* round, then give what rounding lost to the biggest tap */
+		total = 0;
+		big = 0;
+		for (i = 0; i < taps; i++) {
+			q = (int)floor(w[i] * (1 << G2D_CPU_FILTER_BITS) / sum + 0.5);
+			f->weight[k * taps + i] = q;
+			total += q;
+			if (q > f->weight[k * taps + big])
+				big = i;
+		}
+		f->weight[k * taps + big] += (1 << G2D_CPU_FILTER_BITS) - total;
+		f->start[k] = first;
+	}
+
+	return f;
+}
+
+/* coefficients for a size pair, shared through a small LRU cache */
+static struct g2d_cpu_filter *g2d_cpu_filter_get(int filter, int src_len,
+						 int dst_len)
+{
+	struct g2d_cpu_filter *f, *old;
+	int i, slot = -1;
+
+	pthread_mutex_lock(&filter_mutex);
+	for (i = 0; i < G2D_CPU_FILTER_CACHE; i++) {
+		f = filter_cache[i];
+		if (f && f->filter == filter && f->src_len == src_len &&
+		    f->dst_len == dst_len) {
+			f->users++;
+			f->stamp = ++filter_stamp;
+			pthread_mutex_unlock(&filter_mutex);
+			return f;
+		}
+	}
+	pthread_mutex_unlock(&filter_mutex);
+
+	f = g2d_cpu_filter_build(filter, src_len, dst_len);
+	if (f == NULL) {
+		g2d_printf("%s: can't build a %d to %d filter\n", __func__,
+			   src_len, dst_len);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&filter_mutex);
+	for (i = 0; i < G2D_CPU_FILTER_CACHE; i++) {
+		old = filter_cache[i];
+		if (old == NULL) {
+			slot = i;
+			break;
+		}
+		if (!old->users && (slot < 0 ||
+				    old->stamp < filter_cache[slot]->stamp))
+			slot = i;
+	}
+	/* tables still in use stay, the new one is then dropped after use */
+	if (slot >= 0) {
+		old = filter_cache[slot];
+		if (old)
+			free(old);
+		filter_cache[slot] = f;
+		f->cached = 1;
+	}
+	f->users = 1;
+	f->stamp = ++filter_stamp;
+	pthread_mutex_unlock(&filter_mutex);
+
+	return f;
+}
+
+static void g2d_cpu_filter_put(struct g2d_cpu_filter *f)
+{
+	if (f == NULL)
+		return;
+
+	pthread_mutex_lock(&filter_mutex);
+	if (!--f->users && !f->cached)
+		free(f);
+	pthread_mutex_unlock(&filter_mutex);
+}
+
+/* filter RGBA pixels of a src line into outputs k0..k0 + n - 1 */
+static void g2d_cpu_filter_line(short *out, const unsigned char *line, int lo,
+				const struct g2d_cpu_filter *f, int k0, int n)
+{
+	const unsigned char *p;
+	const short *w;
+	int taps = f->taps, k, i;
+#if defined(G2D_CPU_SSE2)
+	__m128i zero = _mm_setzero_si128(), acc, q;
+#elif defined(G2D_CPU_NEON)
+	int32x4_t acc;
+	int16x8_t q;
+#else
+	int c, acc;
+#endif
+
+	for (k = k0; k < k0 + n; k++, out += 4) {
+		p = line + (f->start[k] - lo) * 4;
+		w = f->weight + k * taps;
+#if defined(G2D_CPU_SSE2)
+		/* two pixels a step, channels paired for madd */
+		acc = zero;
+		for (i = 0; i < taps; i += 2) {
+			q = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + i * 4)),
+					      zero);
+			q = _mm_unpacklo_epi16(q, _mm_srli_si128(q, 8));
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(q,
+				_mm_set1_epi32(((unsigned short)w[i + 1] << 16) |
+					       (unsigned short)w[i])));
+		}
+		acc = _mm_srai_epi32(_mm_add_epi32(acc, _mm_set1_epi32(1 <<
+				(G2D_CPU_FILTER_BITS - G2D_CPU_LINE_BITS - 1))),
+				G2D_CPU_FILTER_BITS - G2D_CPU_LINE_BITS);
+		_mm_storel_epi64((__m128i *)out, _mm_packs_epi32(acc, acc));
+#elif defined(G2D_CPU_NEON)
+		acc = vdupq_n_s32(0);
+		for (i = 0; i < taps; i += 2) {
+			q = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p + i * 4)));
+			acc = vmlal_n_s16(acc, vget_low_s16(q), w[i]);
+			acc = vmlal_n_s16(acc, vget_high_s16(q), w[i + 1]);
+		}
+		vst1_s16(out, vqmovn_s32(vrshrq_n_s32(acc,
+				G2D_CPU_FILTER_BITS - G2D_CPU_LINE_BITS)));
+#else
+		for (c = 0; c < 4; c++) {
+			acc = 0;
+			for (i = 0; i < taps; i++)
+				acc += p[i * 4 + c] * w[i];
+			acc = (acc + (1 << (G2D_CPU_FILTER_BITS - G2D_CPU_LINE_BITS - 1))) >>
+			      (G2D_CPU_FILTER_BITS - G2D_CPU_LINE_BITS);
+			out[c] = acc < -32768 ? -32768 : (acc > 32767 ? 32767 : acc);
+		}
+#endif
+	}
+}
+
+/* combine taps filtered lines of n values into RGBA bytes */
+static void g2d_cpu_filter_lines(unsigned char *out, const short **lines,
+				 const short *w, int taps, int n)
+{
+	const int bits = G2D_CPU_FILTER_BITS + G2D_CPU_LINE_BITS;
+	int e = 0, t, acc;
+#if defined(G2D_CPU_SSE2)
+	__m128i lo, hi, a, b, wv, round = _mm_set1_epi32(1 << (bits - 1));
+
+	for (; e + 8 <= n; e += 8) {
+		lo = hi = _mm_setzero_si128();
+		for (t = 0; t < taps; t += 2) {
+			a = _mm_loadu_si128((const __m128i *)(lines[t] + e));
+			b = _mm_loadu_si128((const __m128i *)(lines[t + 1] + e));
+			wv = _mm_set1_epi32(((unsigned short)w[t + 1] << 16) |
+					    (unsigned short)w[t]);
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wv));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wv));
+		}
+		lo = _mm_srai_epi32(_mm_add_epi32(lo, round), bits);
+		hi = _mm_srai_epi32(_mm_add_epi32(hi, round), bits);
+		a = _mm_packs_epi32(lo, hi);
+		_mm_storel_epi64((__m128i *)(out + e), _mm_packus_epi16(a, a));
+	}
+#elif defined(G2D_CPU_NEON)
+	int32x4_t lo, hi;
+	int16x8_t a;
+
+	for (; e + 8 <= n; e += 8) {
+		lo = hi = vdupq_n_s32(0);
+		for (t = 0; t < taps; t++) {
+			a = vld1q_s16(lines[t] + e);
+			lo = vmlal_n_s16(lo, vget_low_s16(a), w[t]);
+			hi = vmlal_n_s16(hi, vget_high_s16(a), w[t]);
+		}
+		vst1_u8(out + e, vqmovun_s16(vcombine_s16(
+			vqmovn_s32(vrshrq_n_s32(lo, G2D_CPU_FILTER_BITS + G2D_CPU_LINE_BITS)),
+			vqmovn_s32(vrshrq_n_s32(hi, G2D_CPU_FILTER_BITS + G2D_CPU_LINE_BITS)))));
+	}
+#endif
+	for (; e < n; e++) {
+		acc = 0;
+		for (t = 0; t < taps; t++)
+			acc += lines[t][e] * w[t];
+		out[e] = clamp255((acc + (1 << (bits - 1))) >> bits);
+	}
+}
+
+/*
+ * Per thread state of a filtered blit: src lines filtered along dst x
+ * are kept in a ring of fout->taps slots, indexed by src line modulo
+ * the ring size, so consecutive dst rows reuse them.
+ */
+struct g2d_cpu_scaler {
+	int k0, n;		/* fin outputs kept per line */
+	int lo, len;		/* src pixels fetched per line */
+	short *ring;
+	int *key;		/* src line held by each slot, -1 if none */
+	const short **lines;
+	int *xs, *ys;
+	unsigned char *line;
+};
+
+static struct g2d_cpu_scaler *g2d_cpu_scaler_alloc(struct g2d_cpu_blit *blit,
+						   struct g2d_cpu_map *map)
+{
+	const struct g2d_surface *src = blit->src.surf;
+	struct g2d_cpu_filter *fin = map->fin;
+	struct g2d_cpu_scaler *sc;
+	int taps = map->fout->taps, n, k0, lo, len, i, p;
+
+	n = map->cx1 - map->cx0;
+	k0 = map->rev_x ? map->dst_w - map->cx1 : map->cx0;
+	lo = fin->start[k0];
+	len = fin->start[k0 + n - 1] + fin->taps - lo;
+
+	sc = (struct g2d_cpu_scaler *)malloc(sizeof(*sc) +
+					     taps * n * 4 * sizeof(short) +
+					     taps * (sizeof(int) + sizeof(short *)) +
+					     len * (2 * sizeof(int) + 4));
+	if (sc == NULL)
+		return NULL;
+	sc->k0 = k0;
+	sc->n = n;
+	sc->lo = lo;
+	sc->len = len;
+	sc->ring = (short *)(sc + 1);
+	sc->key = (int *)(sc->ring + taps * n * 4);
+	sc->lines = (const short **)(sc->key + taps);
+	sc->xs = (int *)(sc->lines + taps);
+	sc->ys = sc->xs + len;
+	sc->line = (unsigned char *)(sc->ys + len);
+
+	for (i = 0; i < taps; i++)
+		sc->key[i] = -1;
+	/* dst x walks src x for even turns, src y for odd ones */
+	for (i = 0; i < len; i++) {
+		p = lo + i;
+		p = p < 0 ? 0 : (p >= fin->src_len ? fin->src_len - 1 : p);
+		if (map->rot & 1)
+			sc->ys[i] = src->top + p;
+		else
+			sc->xs[i] = src->left + p;
+	}
+
+	return sc;
+}
+
+static const short *g2d_cpu_scaler_line(struct g2d_cpu_blit *blit,
+					struct g2d_cpu_map *map,
+					struct g2d_cpu_scaler *sc, int s)
+{
+	const struct g2d_surface *src = blit->src.surf;
+	int slot = s % map->fout->taps, i;
+	short *l = sc->ring + slot * sc->n * 4;
+
+	if (sc->key[slot] == s)
+		return l;
+
+	for (i = 0; i < sc->len; i++) {
+		if (map->rot & 1)
+			sc->xs[i] = src->left + s;
+		else
+			sc->ys[i] = src->top + s;
+	}
+	g2d_cpu_fetch(&blit->src, sc->xs, sc->ys, sc->len, sc->line);
+	g2d_cpu_filter_line(l, sc->line, sc->lo, map->fin, sc->k0, sc->n);
+	sc->key[slot] = s;
+
+	return l;
+}
+
+/* filtered src pixels of dst row dy, clip columns only */
+static void g2d_cpu_scale_row(struct g2d_cpu_blit *blit, struct g2d_cpu_map *map,
+			      struct g2d_cpu_scaler *sc, int dy,
+			      unsigned char *srow)
+{
+	struct g2d_cpu_filter *fout = map->fout;
+	unsigned int *px = (unsigned int *)srow, t;
+	int o, i, s;
+
+	o = map->rev_y ? map->dst_h - 1 - dy : dy;
+	for (i = 0; i < fout->taps; i++) {
+		s = fout->start[o] + i;
+		s = s < 0 ? 0 : (s >= fout->src_len ? fout->src_len - 1 : s);
+		sc->lines[i] = g2d_cpu_scaler_line(blit, map, sc, s);
+	}
+	g2d_cpu_filter_lines(srow, sc->lines, fout->weight + o * fout->taps,
+			     fout->taps, sc->n * 4);
+
+	if (map->rev_x) {
+		for (i = 0; i < sc->n / 2; i++) {
+			t = px[i];
+			px[i] = px[sc->n - 1 - i];
+			px[sc->n - 1 - i] = t;
+		}
+	}
+}
+
+/* 8x8 Bayer matrix, thresholds 0..63 */
+static const unsigned char g2d_cpu_bayer[8][8] = {
+	{  0, 32,  8, 40,  2, 34, 10, 42 },
+	{ 48, 16, 56, 24, 50, 18, 58, 26 },
+	{ 12, 44,  4, 36, 14, 46,  6, 38 },
+	{ 60, 28, 52, 20, 62, 30, 54, 22 },
+	{  3, 35, 11, 43,  1, 33,  9, 41 },
+	{ 51, 19, 59, 27, 49, 17, 57, 25 },
+	{ 15, 47,  7, 39, 13, 45,  5, 37 },
+	{ 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+/*
+ * Ordered dither of a RGBA row about to be stored as 565 at (x, y). Each
+ * channel becomes q = (v * max + t) / 255 with a Bayer threshold t kept
+ * within the range where values already on the 565 grid stay put, then
+ * is shifted back up for the store to truncate. The pattern only depends
+ * on the position in the surface, so partial redraws line up.
+ */
+static void g2d_cpu_dither_ordered(unsigned char *row, int x, int y, int n)
+{
+	static const unsigned short max[4] = { 31, 63, 31, 0 };
+	static const unsigned short shl[4] = { 8, 4, 8, 0 };
+	const unsigned char *b = g2d_cpu_bayer[y & 7];
+	unsigned short pat[16 * 4];
+	const unsigned short *t;
+	int i, k, v;
+
+	for (i = 0; i < 16; i++) {
+		pat[i * 4] = pat[i * 4 + 2] = 21 + ((b[i & 7] * 215) >> 6);
+		pat[i * 4 + 1] = 45 + ((b[i & 7] * 166) >> 6);
+		pat[i * 4 + 3] = 0;
+	}
+
+	i = 0;
+#if defined(G2D_CPU_SSE2)
+	{
+		__m128i zero = _mm_setzero_si128(), one = _mm_set1_epi16(1);
+		__m128i mul = _mm_set_epi16(0, 31, 63, 31, 0, 31, 63, 31);
+		__m128i sh = _mm_set_epi16(0, 8, 4, 8, 0, 8, 4, 8);
+		__m128i amask = _mm_set1_epi32(0xff000000);
+		__m128i v8, lo, hi;
+
+		for (; i + 4 <= n; i += 4) {
+			t = pat + ((x + i) & 7) * 4;
+			v8 = _mm_loadu_si128((const __m128i *)(row + i * 4));
+			lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v8, zero), mul),
+					   _mm_loadu_si128((const __m128i *)t));
+			hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v8, zero), mul),
+					   _mm_loadu_si128((const __m128i *)(t + 8)));
+			/* x / 255 = (x + 1 + (x >> 8)) >> 8 for x < 65535 */
+			lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, one),
+							  _mm_srli_epi16(lo, 8)), 8);
+			hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, one),
+							  _mm_srli_epi16(hi, 8)), 8);
+			lo = _mm_packus_epi16(_mm_mullo_epi16(lo, sh),
+					      _mm_mullo_epi16(hi, sh));
+			_mm_storeu_si128((__m128i *)(row + i * 4),
+					 _mm_or_si128(lo, _mm_and_si128(v8, amask)));
+		}
+	}
+#elif defined(G2D_CPU_NEON)
+	{
+		static const unsigned short mul8[8] = { 31, 63, 31, 0, 31, 63, 31, 0 };
+		static const unsigned short sh8[8] = { 8, 4, 8, 0, 8, 4, 8, 0 };
+		uint16x8_t mul = vld1q_u16(mul8), sh = vld1q_u16(sh8);
+		uint16x8_t one = vdupq_n_u16(1), lo, hi;
+		uint8x16_t amask = vreinterpretq_u8_u32(vdupq_n_u32(0xff000000));
+		uint8x16_t v8;
+
+		for (; i + 4 <= n; i += 4) {
+			t = pat + ((x + i) & 7) * 4;
+			v8 = vld1q_u8(row + i * 4);
+			lo = vmlaq_u16(vld1q_u16(t), vmovl_u8(vget_low_u8(v8)), mul);
+			hi = vmlaq_u16(vld1q_u16(t + 8), vmovl_u8(vget_high_u8(v8)), mul);
+			lo = vshrq_n_u16(vaddq_u16(vaddq_u16(lo, one), vshrq_n_u16(lo, 8)), 8);
+			hi = vshrq_n_u16(vaddq_u16(vaddq_u16(hi, one), vshrq_n_u16(hi, 8)), 8);
+			vst1q_u8(row + i * 4, vbslq_u8(amask, v8,
+				 vcombine_u8(vmovn_u16(vmulq_u16(lo, sh)),
+					     vmovn_u16(vmulq_u16(hi, sh)))));
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		t = pat + ((x + i) & 7) * 4;
+		for (k = 0; k < 3; k++) {
+			v = (row[i * 4 + k] * max[k] + t[k]) / 255;
+			row[i * 4 + k] = v * shl[k];
+		}
+	}
+}
+
+/*
+ * Floyd-Steinberg dither of a RGBA row about to be stored as 565. err
+ * holds the errors, in 1/16, pushed into this row and the next one,
+ * each n + 2 RGB triplets wide.
+ */
+static void g2d_cpu_dither_diffuse(unsigned char *row, int *err, int n)
+{
+	int *cur = err, *next = err + (n + 2) * 3;
+	int i, k, bits, v, q, e;
+
+	for (i = 0; i < n; i++) {
+		for (k = 0; k < 3; k++) {
+			bits = k == 1 ? 6 : 5;
+			v = clamp255(row[i * 4 + k] + ((cur[(i + 1) * 3 + k] + 8) >> 4));
+			q = v >> (8 - bits);
+			/* error against what reading the pixel back gives */
+			e = v - ((q << (8 - bits)) | (q >> (2 * bits - 8)));
+			cur[(i + 2) * 3 + k] += 7 * e;
+			next[i * 3 + k] += 3 * e;
+			next[(i + 1) * 3 + k] += 5 * e;
+			next[(i + 2) * 3 + k] += e;
+			row[i * 4 + k] = q << (8 - bits);
+		}
+	}
+
+	memcpy(cur, next, (n + 2) * 3 * sizeof(int));
+	memset(next, 0, (n + 2) * 3 * sizeof(int));
+}
+
+static void g2d_cpu_blit_rows(struct g2d_cpu_blit *blit, struct g2d_cpu_map *map,
+			      struct g2d_cpu_scaler *sc, int *err, int y0,
+			      int y1, int *xs, int *ys, unsigned char *srow,
+			      unsigned char *drow)
+{
+	const struct g2d_surface *dst = blit->dst.surf;
+	int w = map->dst_w, h = map->dst_h, n = map->cx1 - map->cx0;
+	int dx, dy, ddx, ddy, u, v, i;
+	unsigned int color;
+
+	for (dy = map->cy0 + y0; dy < map->cy0 + y1; dy++) {
+		if (blit->blend_dim) {
+			color = blit->src.surf->clrcolor;
+			for (i = 0; i < n; i++) {
+				srow[i * 4] = color & 0xff;
+				srow[i * 4 + 1] = (color >> 8) & 0xff;
+				srow[i * 4 + 2] = (color >> 16) & 0xff;
+				srow[i * 4 + 3] = (color >> 24) & 0xff;
+			}
+		} else if (sc) {
+			g2d_cpu_scale_row(blit, map, sc, dy, srow);
+		} else {
+			for (dx = map->cx0; dx < map->cx1; dx++) {
+				ddx = map->hflip ? w - 1 - dx : dx;
+				ddy = map->vflip ? h - 1 - dy : dy;
+				switch (map->rot) {
+				case 1:
+					u = ddy;
+					v = w - 1 - ddx;
+					break;
+				case 2:
+					u = w - 1 - ddx;
+					v = h - 1 - ddy;
+					break;
+				case 3:
+					u = h - 1 - ddy;
+					v = ddx;
+					break;
+				default:
+					u = ddx;
+					v = ddy;
+					break;
+				}
+				xs[dx - map->cx0] = map->sx[u];
+				ys[dx - map->cx0] = map->sy[v];
+			}
+			g2d_cpu_fetch(&blit->src, xs, ys, n, srow);
+		}
+
+		if (blit->blending) {
+			for (i = 0; i < n; i++) {
+				xs[i] = dst->left + map->cx0 + i;
+				ys[i] = dst->top + dy;
+			}
+			g2d_cpu_fetch(&blit->dst, xs, ys, n, drow);
+			g2d_cpu_blend(blit, srow, drow, n);
+		}
+
+		if (map->dither == G2D_CPU_DITHER_ORDERED)
+			g2d_cpu_dither_ordered(srow, dst->left + map->cx0,
+					       dst->top + dy, n);
+		else if (map->dither == G2D_CPU_DITHER_DIFFUSION)
+			g2d_cpu_dither_diffuse(srow, err, n);
+
+		g2d_cpu_store(&blit->dst, dst->left + map->cx0, dst->top + dy, n,
+			      srow);
+	}
+}
+
+/*
+ * Fill size bytes with the 4 byte pattern pat, starting with pat[0].
+ * nt writes whole 16 byte blocks with non-temporal stores, for uncached
+ * destinations.
+ */
+static void g2d_cpu_fill_span(unsigned char *dst, const unsigned char *pat,
+			      int size, int nt)
+{
+	int i = 0;
+#if defined(G2D_CPU_SSE2) || defined(G2D_CPU_NEON)
+	unsigned char v[16];
+	int head, j;
+
+	head = (16 - ((unsigned long)dst & 15)) & 15;
+	if (size >= 32) {
+		for (; i < head; i++)
+			dst[i] = pat[i & 3];
+		for (j = 0; j < 16; j++)
+			v[j] = pat[(head + j) & 3];
+#if defined(G2D_CPU_SSE2)
+		{
+			__m128i c = _mm_loadu_si128((const __m128i *)v);
+
+			if (nt) {
+				for (; i + 16 <= size; i += 16)
+					_mm_stream_si128((__m128i *)(dst + i), c);
+				_mm_sfence();
+			} else {
+				for (; i + 16 <= size; i += 16)
+					_mm_store_si128((__m128i *)(dst + i), c);
+			}
+		}
+#else
+		{
+			uint8x16_t c = vld1q_u8(v);
+
+			(void)nt;
+			for (; i + 16 <= size; i += 16)
+				vst1q_u8(dst + i, c);
+		}
+#endif
+	}
+#else
+	unsigned int word;
+
+	(void)nt;
+	for (; i < size && ((unsigned long)(dst + i) & 3); i++)
+		dst[i] = pat[i & 3];
+	if (i < size) {
+		unsigned char w[4] = { pat[i & 3], pat[(i + 1) & 3],
+				       pat[(i + 2) & 3], pat[(i + 3) & 3] };
+
+		memcpy(&word, w, 4);
+		for (; i + 4 <= size; i += 4)
+			*(unsigned int *)(dst + i) = word;
+	}
+#endif
+	for (; i < size; i++)
+		dst[i] = pat[i & 3];
+}
+
+static void g2d_cpu_clear_rows(struct g2d_cpu_surface *area, int y0, int y1,
+			       unsigned char *row)
+{
+	const struct g2d_surface *surf = area->surf;
+	unsigned int color = surf->clrcolor;
+	int w = surf->right - surf->left;
+	int pitch = g2d_cpu_pitch(surf, 0);
+	int bpp = pitch / surf->stride;
+	unsigned char pat[4];
+	struct g2d_cpu_surface px;
+	int y, i;
+
+	for (i = 0; i < w; i++) {
+		row[i * 4] = color & 0xff;
+		row[i * 4 + 1] = (color >> 8) & 0xff;
+		row[i * 4 + 2] = (color >> 16) & 0xff;
+		row[i * 4 + 3] = (color >> 24) & 0xff;
+	}
+
+	/* rgb is a solid fill of one converted pixel */
+	if (g2d_cpu_planes(surf->format) == 1 && !g2d_cpu_is_yuv(surf->format)) {
+		memset(&px, 0, sizeof(px));
+		px.surf = surf;
+		px.planes[0] = pat;
+		g2d_cpu_store(&px, 0, 0, 1, row);
+		if (bpp == 2) {
+			pat[2] = pat[0];
+			pat[3] = pat[1];
+		}
+		for (y = y0; y < y1; y++)
+			g2d_cpu_fill_span(area->planes[0] +
+					  (surf->top + y) * pitch +
+					  surf->left * bpp,
+					  pat, w * bpp, area->nt);
+		return;
+	}
+
+	for (y = y0; y < y1; y++)
+		g2d_cpu_store(area, surf->left, surf->top + y, w, row);
+}
+
+static void *g2d_cpu_worker(void *arg)
+{
+	struct g2d_cpu_job *job = (struct g2d_cpu_job *)arg;
+	struct g2d_cpu_map *map;
+	struct g2d_cpu_scaler *sc = NULL;
+	unsigned char *srow, *drow;
+	int *xs, *ys, *err = NULL, w;
+
+	if (job->area) {
+		w = job->area->surf->right - job->area->surf->left;
+		srow = malloc(w * 4);
+		if (srow == NULL) {
+			job->ret = -1;
+			return NULL;
+		}
+		g2d_cpu_clear_rows(job->area, job->y0, job->y1, srow);
+		free(srow);
+		return NULL;
+	}
+
+	map = (struct g2d_cpu_map *)job->blit->map;
+	w = map->cx1 - map->cx0;
+	xs = malloc(w * 2 * sizeof(int));
+	srow = malloc(w * 8);
+	if (map->fin)
+		sc = g2d_cpu_scaler_alloc(job->blit, map);
+	if (map->dither == G2D_CPU_DITHER_DIFFUSION)
+		err = calloc((w + 2) * 6, sizeof(int));
+	if (xs == NULL || srow == NULL || (map->fin && sc == NULL) ||
+	    (map->dither == G2D_CPU_DITHER_DIFFUSION && err == NULL)) {
+		free(xs);
+		free(srow);
+		free(sc);
+		free(err);
+		job->ret = -1;
+		return NULL;
+	}
+	ys = xs + w;
+	drow = srow + w * 4;
+
+	g2d_cpu_blit_rows(job->blit, map, sc, err, job->y0, job->y1, xs, ys,
+			  srow, drow);
+
+	free(xs);
+	free(srow);
+	free(sc);
+	free(err);
+	return NULL;
+}
+
+static int g2d_cpu_threads(int pixels)
+{
+	static int cpus;
+
+	if (pixels < G2D_CPU_THREAD_PIXELS)
+		return 1;
+
+	if (!cpus) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		if (cpus < 1)
+			cpus = 1;
+		if (cpus > G2D_CPU_MAX_THREADS)
+			cpus = G2D_CPU_MAX_THREADS;
+	}
+
+	return cpus;
+}
+
+/* run fn over n jobs of size bytes each, the calling thread included */
+static void g2d_cpu_spawn(void *(*fn)(void *), void *jobs, size_t size, int n)
+{
+	pthread_t tid[G2D_CPU_MAX_THREADS];
+	unsigned char *job = (unsigned char *)jobs;
+	int i, started;
+
+	for (i = 1; i < n; i++) {
+		if (pthread_create(&tid[i], NULL, fn, job + i * size))
+			break;
+	}
+	started = i;
+
+	/* the calling thread takes the first share and any not started */
+	fn(job);
+	for (i = started; i < n; i++)
+		fn(job + i * size);
+
+	for (i = 1; i < started; i++)
+		pthread_join(tid[i], NULL);
+}
+
+struct g2d_cpu_copy_job {
+	unsigned char *dst;
+	const unsigned char *src;
+	int size;
+	int nt;
+};
+
+/*
+ * Streaming copy for uncached destinations: whole 64 byte lines are
+ * written with non-temporal stores so the write buffer can merge them,
+ * and the destination is never read into the cache.
+ */
+static void g2d_cpu_copy_span(unsigned char *dst, const unsigned char *src,
+			      int size, int nt)
+{
+#if defined(G2D_CPU_SSE2)
+	int head;
+
+	if (nt && size >= 128) {
+		head = (16 - ((unsigned long)dst & 15)) & 15;
+		memcpy(dst, src, head);
+		dst += head;
+		src += head;
+		size -= head;
+		for (; size >= 64; size -= 64, dst += 64, src += 64) {
+			__m128i a = _mm_loadu_si128((const __m128i *)src);
+			__m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+			__m128i c = _mm_loadu_si128((const __m128i *)(src + 32));
+			__m128i d = _mm_loadu_si128((const __m128i *)(src + 48));
+			_mm_stream_si128((__m128i *)dst, a);
+			_mm_stream_si128((__m128i *)(dst + 16), b);
+			_mm_stream_si128((__m128i *)(dst + 32), c);
+			_mm_stream_si128((__m128i *)(dst + 48), d);
+		}
+		_mm_sfence();
+	}
+#elif defined(G2D_CPU_NEON)
+	if (nt) {
+		for (; size >= 64; size -= 64, dst += 64, src += 64) {
+			uint8x16_t a = vld1q_u8(src);
+			uint8x16_t b = vld1q_u8(src + 16);
+			uint8x16_t c = vld1q_u8(src + 32);
+			uint8x16_t d = vld1q_u8(src + 48);
+			vst1q_u8(dst, a);
+			vst1q_u8(dst + 16, b);
+			vst1q_u8(dst + 32, c);
+			vst1q_u8(dst + 48, d);
+		}
+	}
+#endif
+	memcpy(dst, src, size);
+}
+
+static void *g2d_cpu_copy_worker(void *arg)
+{
+	struct g2d_cpu_copy_job *job = (struct g2d_cpu_copy_job *)arg;
+
+	g2d_cpu_copy_span(job->dst, job->src, job->size, job->nt);
+	return NULL;
+}
+
+/* nt selects non-temporal stores, meant for uncached destinations */
+void g2d_cpu_copy(void *dst, const void *src, int size, int nt)
+{
+	struct g2d_cpu_copy_job job[G2D_CPU_MAX_THREADS];
+	int n, i, off, end;
+
+	n = size < G2D_CPU_THREAD_BYTES ? 1 : g2d_cpu_threads(size / 4);
+
+	for (i = 0, off = 0; i < n; i++, off = end) {
+		/* split on 64 byte lines */
+		end = (i == n - 1) ? size : ((long long)size * (i + 1) / n) & ~63;
+		job[i].dst = (unsigned char *)dst + off;
+		job[i].src = (const unsigned char *)src + off;
+		job[i].size = end - off;
+		job[i].nt = nt;
+	}
+
+	g2d_cpu_spawn(g2d_cpu_copy_worker, job, sizeof(job[0]), n);
+}
+
+/* run rows [0, lines) over the worker threads */
+static int g2d_cpu_run(struct g2d_cpu_blit *blit, struct g2d_cpu_surface *area,
+		       int width, int lines)
+{
+	struct g2d_cpu_job job[G2D_CPU_MAX_THREADS];
+	int n, i, ret = 0;
+
+	n = g2d_cpu_threads(width * lines);
+	if (n > lines)
+		n = lines;
+	/* error diffusion carries its errors down through every row */
+	if (blit && ((struct g2d_cpu_map *)blit->map)->dither ==
+		    G2D_CPU_DITHER_DIFFUSION)
+		n = 1;
+
+	for (i = 0; i < n; i++) {
+		job[i].blit = blit;
+		job[i].area = area;
+		job[i].y0 = lines * i / n;
+		job[i].y1 = lines * (i + 1) / n;
+		job[i].ret = 0;
+	}
+
+	g2d_cpu_spawn(g2d_cpu_worker, job, sizeof(job[0]), n);
+
+	for (i = 1; i < n; i++) {
+		if (job[i].ret < 0)
+			ret = -1;
+	}
+
+	return job[0].ret < 0 ? -1 : ret;
+}
+
+/* quarter turns clockwise from src to dst, flips apply to dst first */
+int g2d_cpu_rotation(const struct g2d_surface *src,
+		     const struct g2d_surface *dst, int *hflip, int *vflip)
+{
+	int srcRotate = src->rot, dstRotate = dst->rot;
+
+	*hflip = (srcRotate == G2D_FLIP_H) || (dstRotate == G2D_FLIP_H);
+	*vflip = (srcRotate == G2D_FLIP_V) || (dstRotate == G2D_FLIP_V);
+	if ((srcRotate == G2D_FLIP_H) || (srcRotate == G2D_FLIP_V))
+		srcRotate = 0;
+	if ((dstRotate == G2D_FLIP_H) || (dstRotate == G2D_FLIP_V))
+		dstRotate = 0;
+
+	return (dstRotate - srcRotate + 4) & 3;
+}
+
+static void g2d_cpu_map_span(int a0, int a1, int from, int to, int rev,
+			     int *b0, int *b1)
+{
+	int t;
+
+	if (rev) {
+		t = from - a1;
+		a1 = from - a0;
+		a0 = t;
+	}
+	*b0 = (long long)a0 * to / from;
+	*b1 = ((long long)a1 * to + from - 1) / from;
+}
+
+/* Greatest common divisor of a and b, a when b is 0. */
+int g2d_cpu_gcd(int a, int b)
+{
+	int t;
+
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+/*
+ * Map rect in[] (left, top, right, bottom) between the dst rect and the
+ * src rect of a blit, rounding outwards. to_src maps dst pixels to the
+ * src pixels they sample, otherwise src pixels to where they land.
+ */
+void g2d_cpu_map_rect(const struct g2d_surface *src,
+		      const struct g2d_surface *dst, const int *in, int *out,
+		      int to_src)
+{
+	int rot, hflip, vflip, rev_x, rev_y, dw, dh, sw, sh;
+	int a0, a1, b0, b1, x0, x1, y0, y1;
+
+	rot = g2d_cpu_rotation(src, dst, &hflip, &vflip);
+	dw = dst->right - dst->left;
+	dh = dst->bottom - dst->top;
+	sw = src->right - src->left;
+	sh = src->bottom - src->top;
+
+	/* dst x walks src x (even rot) or src y (odd rot), reversed for 1, 2 */
+	rev_x = (rot == 1 || rot == 2) ^ hflip;
+	rev_y = (rot == 2 || rot == 3) ^ vflip;
+	if (rot & 1) {
+		a0 = sw;
+		sw = sh;
+		sh = a0;
+	}
+
+	if (to_src) {
+		g2d_cpu_map_span(in[0] - dst->left, in[2] - dst->left, dw, sw,
+				 rev_x, &a0, &a1);
+		g2d_cpu_map_span(in[1] - dst->top, in[3] - dst->top, dh, sh,
+				 rev_y, &b0, &b1);
+		if (rot & 1) {
+			out[0] = src->left + b0;
+			out[1] = src->top + a0;
+			out[2] = src->left + b1;
+			out[3] = src->top + a1;
+		} else {
+			out[0] = src->left + a0;
+			out[1] = src->top + b0;
+			out[2] = src->left + a1;
+			out[3] = src->top + b1;
+		}
+	} else {
+		if (rot & 1) {
+			a0 = in[1] - src->top;
+			a1 = in[3] - src->top;
+			b0 = in[0] - src->left;
+			b1 = in[2] - src->left;
+		} else {
+			a0 = in[0] - src->left;
+			a1 = in[2] - src->left;
+			b0 = in[1] - src->top;
+			b1 = in[3] - src->top;
+		}
+		g2d_cpu_map_span(a0, a1, sw, dw, rev_x, &x0, &x1);
+		g2d_cpu_map_span(b0, b1, sh, dh, rev_y, &y0, &y1);
+		out[0] = dst->left + x0;
+		out[1] = dst->top + y0;
+		out[2] = dst->left + x1;
+		out[3] = dst->top + y1;
+	}
+}
+
+/*
+ * Rotation and flips without scaling, blending or format conversion are
+ * a pure permutation of the pixels, done plane by plane without going
+ * through the RGBA row. dst is walked in tiles small enough for the src
+ * and dst lines of a tile to stay in L1; inside a tile, 90/270 degree
+ * turns transpose blocks of 8x8 (4x4 for 32 bits) pixels in registers.
+ */
+#define G2D_CPU_TILE		64
+
+struct g2d_cpu_perm {
+	unsigned char *dst;		/* first pixel of the dst rect */
+	const unsigned char *src;	/* first pixel of the src rect */
+	int dst_pitch, src_pitch;
+	int w, h;			/* dst rect, in pixels of the plane */
+	int esize;			/* bytes per pixel: 1, 2 or 4 */
+	int transpose;			/* dst rows walk src columns */
+	int rev_x, rev_y;		/* dst x, y walk their src axis reversed */
+	int pad;			/* padding byte of X formats + 1, 0 if none */
+	int y0, y1;			/* dst rows of a job */
+};
+
+/*
+ * out[j][i] = in[i][j] for a block of k x k pixels; rows are given as
+ * pointers so that reversed walks are just a matter of ordering them.
+ */
+static void g2d_cpu_transpose_block(unsigned char **out,
+				    const unsigned char **in, int k, int esize)
+{
+	int i, j;
+
+#if defined(G2D_CPU_SSE2)
+	if (esize == 4 && k == 4) {
+		__m128i a = _mm_loadu_si128((const __m128i *)in[0]);
+		__m128i b = _mm_loadu_si128((const __m128i *)in[1]);
+		__m128i c = _mm_loadu_si128((const __m128i *)in[2]);
+		__m128i d = _mm_loadu_si128((const __m128i *)in[3]);
+		__m128i t0 = _mm_unpacklo_epi32(a, b);
+		__m128i t1 = _mm_unpacklo_epi32(c, d);
+		__m128i t2 = _mm_unpackhi_epi32(a, b);
+		__m128i t3 = _mm_unpackhi_epi32(c, d);
+
+		_mm_storeu_si128((__m128i *)out[0], _mm_unpacklo_epi64(t0, t1));
+		_mm_storeu_si128((__m128i *)out[1], _mm_unpackhi_epi64(t0, t1));
+		_mm_storeu_si128((__m128i *)out[2], _mm_unpacklo_epi64(t2, t3));
+		_mm_storeu_si128((__m128i *)out[3], _mm_unpackhi_epi64(t2, t3));
+		return;
+	}
+	if (esize == 2 && k == 8) {
+		__m128i r[8], a[8], b[8];
+
+		for (i = 0; i < 8; i++)
+			r[i] = _mm_loadu_si128((const __m128i *)in[i]);
+		for (i = 0; i < 8; i += 2) {
+			a[i] = _mm_unpacklo_epi16(r[i], r[i + 1]);
+			a[i + 1] = _mm_unpackhi_epi16(r[i], r[i + 1]);
+		}
+		/* b[0..3]: columns 0-1, 2-3, 4-5, 6-7 of rows 0-3, b[4..7] rows 4-7 */
+		for (i = 0; i < 8; i += 4) {
+			b[i] = _mm_unpacklo_epi32(a[i], a[i + 2]);
+			b[i + 1] = _mm_unpackhi_epi32(a[i], a[i + 2]);
+			b[i + 2] = _mm_unpacklo_epi32(a[i + 1], a[i + 3]);
+			b[i + 3] = _mm_unpackhi_epi32(a[i + 1], a[i + 3]);
+		}
+		for (i = 0; i < 4; i++) {
+			_mm_storeu_si128((__m128i *)out[2 * i],
+					 _mm_unpacklo_epi64(b[i], b[i + 4]));
+			_mm_storeu_si128((__m128i *)out[2 * i + 1],
+					 _mm_unpackhi_epi64(b[i], b[i + 4]));
+		}
+		return;
+	}
+	if (esize == 1 && k == 8) {
+		__m128i r[8], a[4], b[4], c;
+
+		for (i = 0; i < 8; i++)
+			r[i] = _mm_loadl_epi64((const __m128i *)in[i]);
+		for (i = 0; i < 4; i++)
+			a[i] = _mm_unpacklo_epi8(r[2 * i], r[2 * i + 1]);
+		b[0] = _mm_unpacklo_epi16(a[0], a[1]);
+		b[1] = _mm_unpackhi_epi16(a[0], a[1]);
+		b[2] = _mm_unpacklo_epi16(a[2], a[3]);
+		b[3] = _mm_unpackhi_epi16(a[2], a[3]);
+		/* each c holds two output rows */
+		for (i = 0; i < 4; i++) {
+			c = (i & 1) ? _mm_unpackhi_epi32(b[i >> 1], b[(i >> 1) + 2]) :
+				      _mm_unpacklo_epi32(b[i >> 1], b[(i >> 1) + 2]);
+			_mm_storel_epi64((__m128i *)out[2 * i], c);
+			_mm_storel_epi64((__m128i *)out[2 * i + 1],
+					 _mm_unpackhi_epi64(c, c));
+		}
+		return;
+	}
+#elif defined(G2D_CPU_NEON)
+	if (esize == 4 && k == 4) {
+		uint32x4x2_t p = vtrnq_u32(vld1q_u32((const uint32_t *)in[0]),
+					   vld1q_u32((const uint32_t *)in[1]));
+		uint32x4x2_t q = vtrnq_u32(vld1q_u32((const uint32_t *)in[2]),
+					   vld1q_u32((const uint32_t *)in[3]));
+
+		vst1q_u32((uint32_t *)out[0], vcombine_u32(vget_low_u32(p.val[0]),
+							   vget_low_u32(q.val[0])));
+		vst1q_u32((uint32_t *)out[1], vcombine_u32(vget_low_u32(p.val[1]),
+							   vget_low_u32(q.val[1])));
+		vst1q_u32((uint32_t *)out[2], vcombine_u32(vget_high_u32(p.val[0]),
+							   vget_high_u32(q.val[0])));
+		vst1q_u32((uint32_t *)out[3], vcombine_u32(vget_high_u32(p.val[1]),
+							   vget_high_u32(q.val[1])));
+		return;
+	}
+	if (esize == 2 && k == 8) {
+		uint16x8x2_t t[4];
+		uint32x4x2_t u[4];
+
+		for (i = 0; i < 4; i++)
+			t[i] = vtrnq_u16(vld1q_u16((const uint16_t *)in[2 * i]),
+					 vld1q_u16((const uint16_t *)in[2 * i + 1]));
+		/* u[0], u[1]: rows 0-3, u[2], u[3]: rows 4-7 */
+		for (i = 0; i < 4; i++)
+			u[i] = vtrnq_u32(vreinterpretq_u32_u16(t[(i & 2) + 0].val[i & 1]),
+					 vreinterpretq_u32_u16(t[(i & 2) + 1].val[i & 1]));
+		for (i = 0; i < 4; i++) {
+			uint32x4_t top = u[i & 1].val[i >> 1];
+			uint32x4_t bot = u[2 + (i & 1)].val[i >> 1];
+
+			vst1q_u32((uint32_t *)out[i], vcombine_u32(vget_low_u32(top),
+								   vget_low_u32(bot)));
+			vst1q_u32((uint32_t *)out[i + 4],
+				  vcombine_u32(vget_high_u32(top), vget_high_u32(bot)));
+		}
+		return;
+	}
+	if (esize == 1 && k == 8) {
+		uint8x8x2_t t[4];
+		uint16x4x2_t u[4];
+		uint32x2x2_t w;
+
+		for (i = 0; i < 4; i++)
+			t[i] = vtrn_u8(vld1_u8(in[2 * i]), vld1_u8(in[2 * i + 1]));
+		/* u[0], u[1]: rows 0-3, u[2], u[3]: rows 4-7 */
+		for (i = 0; i < 4; i++)
+			u[i] = vtrn_u16(vreinterpret_u16_u8(t[(i & 2) + 0].val[i & 1]),
+					vreinterpret_u16_u8(t[(i & 2) + 1].val[i & 1]));
+		for (i = 0; i < 4; i++) {
+			w = vtrn_u32(vreinterpret_u32_u16(u[i & 1].val[i >> 1]),
+				     vreinterpret_u32_u16(u[2 + (i & 1)].val[i >> 1]));
+			vst1_u8(out[i], vreinterpret_u8_u32(w.val[0]));
+			vst1_u8(out[i + 4], vreinterpret_u8_u32(w.val[1]));
+		}
+		return;
+	}
+#endif
+	for (j = 0; j < k; j++)
+		for (i = 0; i < k; i++)
+			memcpy(out[j] + i * esize, in[i] + j * esize, esize);
+}
+
+static void g2d_cpu_reverse_row(unsigned char *dst, const unsigned char *src,
+				int w, int esize)
+{
+	int i;
+
+	src += (w - 1) * esize;
+	switch (esize) {
+	case 1:
+		for (i = 0; i < w; i++)
+			dst[i] = src[-i];
+		break;
+	case 2:
+		for (i = 0; i < w; i++)
+			((unsigned short *)dst)[i] =
+				((const unsigned short *)src)[-i];
+		break;
+	default:
+		for (i = 0; i < w; i++)
+			((unsigned int *)dst)[i] = ((const unsigned int *)src)[-i];
+		break;
+	}
+}
+
+static inline const unsigned char *g2d_cpu_perm_src(struct g2d_cpu_perm *p,
+						    int dx, int dy)
+{
+	/* transposed: dst y walks src x, dst x walks src y */
+	int u = p->rev_x ? p->w - 1 - dx : dx;
+	int v = p->rev_y ? p->h - 1 - dy : dy;
+
+	if (p->transpose)
+		return p->src + u * p->src_pitch + v * p->esize;
+	return p->src + v * p->src_pitch + u * p->esize;
+}
+
+static void g2d_cpu_transpose_tile(struct g2d_cpu_perm *p, int x0, int x1,
+				   int y0, int y1)
+{
+	const unsigned char *in[8];
+	unsigned char *out[8];
+	int k = p->esize == 4 ? 4 : 8;
+	int x, y, i;
+
+	for (y = y0; y < y1; y += k) {
+		for (x = x0; x < x1; x += k) {
+			if (y + k > y1 || x + k > x1) {
+				int xe = x + k < x1 ? x + k : x1;
+				int ye = y + k < y1 ? y + k : y1;
+				int dx, dy;
+
+				for (dy = y; dy < ye; dy++)
+					for (dx = x; dx < xe; dx++)
+						memcpy(p->dst + dy * p->dst_pitch +
+						       dx * p->esize,
+						       g2d_cpu_perm_src(p, dx, dy),
+						       p->esize);
+				continue;
+			}
+			/*
+			 * src row i of the block feeds dst column x + i; the
+			 * block's src columns run up or down with dst y
+			 */
+			for (i = 0; i < k; i++) {
+				in[i] = g2d_cpu_perm_src(p, x + i,
+							 p->rev_y ? y + k - 1 : y);
+				out[i] = p->dst + (p->rev_y ? y + k - 1 - i : y + i) *
+					 p->dst_pitch + x * p->esize;
+			}
+			g2d_cpu_transpose_block(out, in, k, p->esize);
+		}
+	}
+}
+
+/* X formats get 0xff in the padding byte, as g2d_cpu_store() writes it */
+static void g2d_cpu_perm_pad(struct g2d_cpu_perm *p, int y0, int y1)
+{
+	unsigned char *row;
+	int x, y;
+
+	for (y = y0; y < y1; y++) {
+		row = p->dst + y * p->dst_pitch + p->pad - 1;
+		for (x = 0; x < p->w; x++)
+			row[x * 4] = 0xff;
+	}
+}
+
+static void *g2d_cpu_perm_worker(void *arg)
+{
+	struct g2d_cpu_perm *p = (struct g2d_cpu_perm *)arg;
+	int x, y, ye;
+
+	if (!p->transpose) {
+		for (y = p->y0; y < p->y1; y++) {
+			if (p->rev_x)
+				g2d_cpu_reverse_row(p->dst + y * p->dst_pitch,
+						    g2d_cpu_perm_src(p, p->w - 1, y),
+						    p->w, p->esize);
+			else
+				memcpy(p->dst + y * p->dst_pitch,
+				       g2d_cpu_perm_src(p, 0, y), p->w * p->esize);
+			if (p->pad)
+				g2d_cpu_perm_pad(p, y, y + 1);
+		}
+		return NULL;
+	}
+
+	for (y = p->y0; y < p->y1; y = ye) {
+		ye = y + G2D_CPU_TILE < p->y1 ? y + G2D_CPU_TILE : p->y1;
+		for (x = 0; x < p->w; x += G2D_CPU_TILE)
+			g2d_cpu_transpose_tile(p, x, x + G2D_CPU_TILE < p->w ?
+					       x + G2D_CPU_TILE : p->w, y, ye);
+		if (p->pad)
+			g2d_cpu_perm_pad(p, y, ye);
+	}
+	return NULL;
+}
+
+/* pixel size and subsampling of a plane, 0 if the plane can't be permuted */
+static int g2d_cpu_perm_plane(enum g2d_format format, int plane, int *xs,
+			      int *ys)
+{
+	*xs = *ys = 1;
+	switch (format) {
+	case G2D_RGB565:
+	case G2D_BGR565:
+		return 2;
+	case G2D_RGBA8888:
+	case G2D_RGBX8888:
+	case G2D_BGRA8888:
+	case G2D_BGRX8888:
+	case G2D_ARGB8888:
+	case G2D_ABGR8888:
+	case G2D_XRGB8888:
+	case G2D_XBGR8888:
+		return 4;
+	case G2D_NV12:
+	case G2D_NV21:
+		*xs = *ys = plane ? 2 : 1;
+		return plane ? 2 : 1;
+	case G2D_NV16:
+	case G2D_NV61:
+		*xs = plane ? 2 : 1;
+		return plane ? 2 : 1;
+	case G2D_I420:
+	case G2D_YV12:
+		*xs = *ys = plane ? 2 : 1;
+		return 1;
+	default:
+		/* packed 4:2:2 pairs pixels in a macropixel */
+		return 0;
+	}
+}
+
+/*
+ * Bytes of a plane under rect r of surf: *height rows of *width bytes,
+ * *stride apart, from *offset past the plane address. Chroma rows and
+ * columns are rounded out, as are the pixel pairs of packed 4:2:2.
+ */
+void g2d_cpu_plane_rect(const struct g2d_surface *surf, int plane,
+			const struct g2d_rect *r, int *offset, int *width,
+			int *height, int *stride)
+{
+	int bpp, xs, ys, left = r->left, right = r->right;
+
+	bpp = g2d_cpu_perm_plane(surf->format, plane, &xs, &ys);
+	if (!bpp) {
+		bpp = 2;
+		left &= ~1;
+		right = (right + 1) & ~1;
+		if (right > surf->stride)
+			right = surf->stride;
+	}
+	left /= xs;
+	right = (right + xs - 1) / xs;
+
+	*stride = g2d_cpu_pitch(surf, plane);
+	*offset = r->top / ys * *stride + left * bpp;
+	*width = (right - left) * bpp;
+	*height = (r->bottom + ys - 1) / ys - r->top / ys;
+}
+
+/* 0 when done, 1 when the blit is not a pure permutation */
+static int g2d_cpu_permute(struct g2d_cpu_blit *blit)
+{
+	const struct g2d_surface *src = blit->src.surf;
+	const struct g2d_surface *dst = blit->dst.surf;
+	struct g2d_cpu_perm job[G2D_CPU_MAX_THREADS];
+	struct g2d_cpu_perm perm;
+	int rot, hflip, vflip, dw, dh, sw, sh;
+	int plane, planes, xs, ys, n, i, r, g, b, a;
+
+	if (blit->blend_dim || blit->blending || src->format != dst->format ||
+	    g2d_cpu_color_space(src) != g2d_cpu_color_space(dst) ||
+	    blit->clip.right > blit->clip.left ||
+	    !g2d_cpu_perm_plane(src->format, 0, &xs, &ys))
+		return 1;
+
+	rot = g2d_cpu_rotation(src, dst, &hflip, &vflip);
+	dw = dst->right - dst->left;
+	dh = dst->bottom - dst->top;
+	sw = src->right - src->left;
+	sh = src->bottom - src->top;
+	if ((rot & 1) ? (sw != dh || sh != dw) : (sw != dw || sh != dh))
+		return 1;
+
+	planes = g2d_cpu_planes(src->format);
+	for (plane = 1; plane < planes; plane++) {
+		g2d_cpu_perm_plane(src->format, plane, &xs, &ys);
+		/* a 4:2:2 chroma sample turned on its side would be 2:4:2 */
+		if ((rot & 1) && xs != ys)
+			return 1;
+		if (((src->left | src->right | dst->left | dst->right) & (xs - 1)) ||
+		    ((src->top | src->bottom | dst->top | dst->bottom) & (ys - 1)))
+			return 1;
+	}
+
+	memset(&perm, 0, sizeof(perm));
+	perm.transpose = rot & 1;
+	perm.rev_x = (rot == 1 || rot == 2) ^ hflip;
+	perm.rev_y = (rot == 2 || rot == 3) ^ vflip;
+	if (g2d_cpu_perm_plane(src->format, 0, &xs, &ys) == 4) {
+		g2d_cpu_rgb32_layout(src->format, &r, &g, &b, &a);
+		if (a < 0)
+			perm.pad = 6 - r - g - b + 1;
+	}
+
+	for (plane = 0; plane < planes; plane++) {
+		perm.esize = g2d_cpu_perm_plane(src->format, plane, &xs, &ys);
+		perm.src_pitch = g2d_cpu_pitch(src, plane);
+		perm.dst_pitch = g2d_cpu_pitch(dst, plane);
+		perm.src = blit->src.planes[plane] +
+			   (src->top / ys) * perm.src_pitch +
+			   (src->left / xs) * perm.esize;
+		perm.dst = blit->dst.planes[plane] +
+			   (dst->top / ys) * perm.dst_pitch +
+			   (dst->left / xs) * perm.esize;
+		perm.w = dw / xs;
+		perm.h = dh / ys;
+
+		n = g2d_cpu_threads(perm.w * perm.h);
+		if (n > perm.h)
+			n = perm.h;
+		for (i = 0; i < n; i++) {
+			job[i] = perm;
+			job[i].y0 = perm.h * i / n;
+			job[i].y1 = perm.h * (i + 1) / n;
+		}
+		g2d_cpu_spawn(g2d_cpu_perm_worker, job, sizeof(job[0]), n);
+	}
+
+	return 0;
+}
+
+/*
+ * Unscaled conversions with a yuv side, without rotation or blending, go
+ * line by line through planar y, u and v lines with chroma at half the
+ * horizontal resolution. Between yuv formats of the same color space
+ * this only moves bytes around.
+ */
+struct g2d_cpu_conv {
+	struct g2d_cpu_blit *blit;
+	const struct g2d_cpu_csc *in;	/* NULL for a rgb src */
+	const struct g2d_cpu_csc *out;	/* NULL for a rgb dst */
+	int w;
+	int y0;
+	int y1;
+	int ret;
+};
+
+#if defined(G2D_CPU_SSE2)
+/* (cx * x + cp * p + cq * q + add) >> 8 of 8 signed 16 bit lanes */
+static inline __m128i g2d_cpu_csc_sse2(__m128i x, __m128i p, __m128i q,
+				       int cx, int cp, int cq, int add)
+{
+	__m128i k0 = _mm_set1_epi32(((unsigned int)cp << 16) | (cx & 0xffff));
+	__m128i k1 = _mm_set1_epi32(((unsigned int)add << 16) | (cq & 0xffff));
+	__m128i one = _mm_set1_epi16(1);
+	__m128i lo, hi;
+
+	lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(x, p), k0),
+			   _mm_madd_epi16(_mm_unpacklo_epi16(q, one), k1));
+	hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(x, p), k0),
+			   _mm_madd_epi16(_mm_unpackhi_epi16(q, one), k1));
+	return _mm_packs_epi32(_mm_srai_epi32(lo, 8), _mm_srai_epi32(hi, 8));
+}
+#elif defined(G2D_CPU_NEON)
+/* clamp255((cx * x + cp * p + cq * q + add) >> 8) of 8 lanes */
+static inline uint8x8_t g2d_cpu_csc_neon(int16x8_t x, int16x8_t p,
+					 int16x8_t q, int cx, int cp, int cq,
+					 int add)
+{
+	int32x4_t lo = vdupq_n_s32(add), hi = vdupq_n_s32(add);
+
+	lo = vmlal_n_s16(lo, vget_low_s16(x), cx);
+	hi = vmlal_n_s16(hi, vget_high_s16(x), cx);
+	lo = vmlal_n_s16(lo, vget_low_s16(p), cp);
+	hi = vmlal_n_s16(hi, vget_high_s16(p), cp);
+	lo = vmlal_n_s16(lo, vget_low_s16(q), cq);
+	hi = vmlal_n_s16(hi, vget_high_s16(q), cq);
+	return vqmovun_s16(vcombine_s16(vqmovn_s32(vshrq_n_s32(lo, 8)),
+					vqmovn_s32(vshrq_n_s32(hi, 8))));
+}
+#endif
+
+/* n pixels from a y line and half resolution u, v lines to RGBA8888 */
+static void g2d_cpu_yuv_to_rgba_row(const struct g2d_cpu_csc *m,
+				    unsigned char *out, const unsigned char *y,
+				    const unsigned char *u,
+				    const unsigned char *v, int n)
+{
+	int i = 0;
+#if defined(G2D_CPU_SSE2)
+	__m128i zero = _mm_setzero_si128();
+	__m128i y_off = _mm_set1_epi16(m->y_off);
+	__m128i c128 = _mm_set1_epi16(128);
+	__m128i alpha = _mm_set1_epi16(255);
+	int c;
+
+	for (; i + 8 <= n; i += 8) {
+		__m128i yy, uu, vv, r, g, b, rb, ga;
+
+		yy = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(y + i)), zero);
+		yy = _mm_sub_epi16(yy, y_off);
+		memcpy(&c, u + i / 2, 4);
+		uu = _mm_cvtsi32_si128(c);
+		uu = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_unpacklo_epi8(uu, uu), zero), c128);
+		memcpy(&c, v + i / 2, 4);
+		vv = _mm_cvtsi32_si128(c);
+		vv = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_unpacklo_epi8(vv, vv), zero), c128);
+
+		r = g2d_cpu_csc_sse2(yy, vv, uu, m->cy, m->vr, 0, 128);
+		g = g2d_cpu_csc_sse2(yy, uu, vv, m->cy, -m->ug, -m->vg, 128);
+		b = g2d_cpu_csc_sse2(yy, uu, vv, m->cy, m->ub, 0, 128);
+
+		/* r0..r7 b0..b7 and g0..g7 a0..a7 to r g b a per pixel */
+		rb = _mm_packus_epi16(r, b);
+		ga = _mm_packus_epi16(g, alpha);
+		r = _mm_unpacklo_epi8(rb, ga);
+		b = _mm_unpackhi_epi8(rb, ga);
+		_mm_storeu_si128((__m128i *)(out + 4 * i), _mm_unpacklo_epi16(r, b));
+		_mm_storeu_si128((__m128i *)(out + 4 * i + 16), _mm_unpackhi_epi16(r, b));
+	}
+#elif defined(G2D_CPU_NEON)
+	unsigned char t[8] = { 0 };
+
+	for (; i + 8 <= n; i += 8) {
+		int16x8_t yy, uu, vv;
+		uint8x8x4_t px;
+
+		yy = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(y + i)));
+		yy = vsubq_s16(yy, vdupq_n_s16(m->y_off));
+		memcpy(t, u + i / 2, 4);
+		uu = vreinterpretq_s16_u16(vmovl_u8(vzip_u8(vld1_u8(t), vld1_u8(t)).val[0]));
+		uu = vsubq_s16(uu, vdupq_n_s16(128));
+		memcpy(t, v + i / 2, 4);
+		vv = vreinterpretq_s16_u16(vmovl_u8(vzip_u8(vld1_u8(t), vld1_u8(t)).val[0]));
+		vv = vsubq_s16(vv, vdupq_n_s16(128));
+
+		px.val[0] = g2d_cpu_csc_neon(yy, vv, uu, m->cy, m->vr, 0, 128);
+		px.val[1] = g2d_cpu_csc_neon(yy, uu, vv, m->cy, -m->ug, -m->vg, 128);
+		px.val[2] = g2d_cpu_csc_neon(yy, uu, vv, m->cy, m->ub, 0, 128);
+		px.val[3] = vdup_n_u8(255);
+		vst4_u8(out + 4 * i, px);
+	}
+#endif
+	for (; i < n; i++)
+		yuv_to_rgba(m, y[i], u[i >> 1], v[i >> 1], out + 4 * i);
+}
+
+/* n RGBA8888 pixels to a y line and half resolution u, v lines */
+static void g2d_cpu_rgba_to_yuv_row(const struct g2d_cpu_csc *m,
+				    unsigned char *y, unsigned char *u,
+				    unsigned char *v, const unsigned char *in,
+				    int n)
+{
+	int i = 0, cy, cu, cv;
+#if defined(G2D_CPU_SSE2)
+	__m128i mask = _mm_set1_epi32(0xff);
+	__m128i c128 = _mm_set1_epi16(128);
+	int y_add = 128 + (m->y_off << 8);
+
+	for (; i + 8 <= n; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(in + 4 * i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(in + 4 * i + 16));
+		__m128i r, g, bl, t;
+
+		r = _mm_packs_epi32(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+		g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 8), mask),
+				    _mm_and_si128(_mm_srli_epi32(b, 8), mask));
+		bl = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 16), mask),
+				     _mm_and_si128(_mm_srli_epi32(b, 16), mask));
+
+		t = g2d_cpu_csc_sse2(r, g, bl, m->ry, m->gy, m->by, y_add);
+		_mm_storel_epi64((__m128i *)(y + i), _mm_packus_epi16(t, t));
+
+		/* chroma of the even pixels */
+		t = g2d_cpu_csc_sse2(r, g, bl, m->ru, m->gu, m->bu, 128);
+		t = _mm_add_epi16(t, c128);
+		t = _mm_srai_epi32(_mm_slli_epi32(t, 16), 16);
+		t = _mm_packs_epi32(t, t);
+		cu = _mm_cvtsi128_si32(_mm_packus_epi16(t, t));
+		memcpy(u + i / 2, &cu, 4);
+		t = g2d_cpu_csc_sse2(r, g, bl, m->rv, m->gv, m->bv, 128);
+		t = _mm_add_epi16(t, c128);
+		t = _mm_srai_epi32(_mm_slli_epi32(t, 16), 16);
+		t = _mm_packs_epi32(t, t);
+		cv = _mm_cvtsi128_si32(_mm_packus_epi16(t, t));
+		memcpy(v + i / 2, &cv, 4);
+	}
+#elif defined(G2D_CPU_NEON)
+	int y_add = 128 + (m->y_off << 8), c_add = 128 + (128 << 8);
+	unsigned char t[8];
+
+	for (; i + 8 <= n; i += 8) {
+		uint8x8x4_t px = vld4_u8(in + 4 * i);
+		int16x8_t r = vreinterpretq_s16_u16(vmovl_u8(px.val[0]));
+		int16x8_t g = vreinterpretq_s16_u16(vmovl_u8(px.val[1]));
+		int16x8_t b = vreinterpretq_s16_u16(vmovl_u8(px.val[2]));
+		uint8x8_t c;
+
+		vst1_u8(y + i, g2d_cpu_csc_neon(r, g, b, m->ry, m->gy, m->by, y_add));
+
+		/* chroma of the even pixels */
+		c = g2d_cpu_csc_neon(r, g, b, m->ru, m->gu, m->bu, c_add);
+		vst1_u8(t, vuzp_u8(c, c).val[0]);
+		memcpy(u + i / 2, t, 4);
+		c = g2d_cpu_csc_neon(r, g, b, m->rv, m->gv, m->bv, c_add);
+		vst1_u8(t, vuzp_u8(c, c).val[0]);
+		memcpy(v + i / 2, t, 4);
+	}
+#endif
+	for (; i < n; i++) {
+		rgba_to_yuv(m, in + 4 * i, &cy, &cu, &cv);
+		y[i] = cy;
+		if (!(i & 1)) {
+			u[i >> 1] = cu;
+			v[i >> 1] = cv;
+		}
+	}
+}
+
+/* n interleaved chroma pairs to separate lines */
+static void g2d_cpu_uv_split(unsigned char *u, unsigned char *v,
+			     const unsigned char *uv, int n)
+{
+	int i = 0;
+#if defined(G2D_CPU_SSE2)
+	__m128i mask = _mm_set1_epi16(0xff);
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(uv + 2 * i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(uv + 2 * i + 16));
+
+		_mm_storeu_si128((__m128i *)(u + i),
+				 _mm_packus_epi16(_mm_and_si128(a, mask),
+						  _mm_and_si128(b, mask)));
+		_mm_storeu_si128((__m128i *)(v + i),
+				 _mm_packus_epi16(_mm_srli_epi16(a, 8),
+						  _mm_srli_epi16(b, 8)));
+	}
+#elif defined(G2D_CPU_NEON)
+	for (; i + 16 <= n; i += 16) {
+		uint8x16x2_t a = vld2q_u8(uv + 2 * i);
+
+		vst1q_u8(u + i, a.val[0]);
+		vst1q_u8(v + i, a.val[1]);
+	}
+#endif
+	for (; i < n; i++) {
+		u[i] = uv[2 * i];
+		v[i] = uv[2 * i + 1];
+	}
+}
+
+static void g2d_cpu_uv_merge(unsigned char *uv, const unsigned char *u,
+			     const unsigned char *v, int n)
+{
+	int i = 0;
+#if defined(G2D_CPU_SSE2)
+	for (; i + 16 <= n; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(u + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(v + i));
+
+		_mm_storeu_si128((__m128i *)(uv + 2 * i), _mm_unpacklo_epi8(a, b));
+		_mm_storeu_si128((__m128i *)(uv + 2 * i + 16), _mm_unpackhi_epi8(a, b));
+	}
+#elif defined(G2D_CPU_NEON)
+	for (; i + 16 <= n; i += 16) {
+		uint8x16x2_t a;
+
+		a.val[0] = vld1q_u8(u + i);
+		a.val[1] = vld1q_u8(v + i);
+		vst2q_u8(uv + 2 * i, a);
+	}
+#endif
+	for (; i < n; i++) {
+		uv[2 * i] = u[i];
+		uv[2 * i + 1] = v[i];
+	}
+}
+
+#if defined(G2D_CPU_SSE2)
+/* byte k of each 32 bit lane of a and b as 8 16 bit lanes */
+static inline __m128i g2d_cpu_byte_sse2(__m128i a, __m128i b, int k)
+{
+	__m128i mask = _mm_set1_epi32(0xff);
+	__m128i shift = _mm_cvtsi32_si128(8 * k);
+
+	return _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(a, shift), mask),
+			       _mm_and_si128(_mm_srl_epi32(b, shift), mask));
+}
+#endif
+
+/* n pixels of a packed 4:2:2 line to y, u and v lines, n even */
+static void g2d_cpu_yuv422_unpack(unsigned char *y, unsigned char *u,
+				  unsigned char *v, const unsigned char *p,
+				  enum g2d_format format, int n)
+{
+	int o[4], i = 0;
+
+	g2d_cpu_yuv422_layout(format, &o[0], &o[1], &o[2], &o[3]);
+#if defined(G2D_CPU_SSE2)
+	for (; i + 16 <= n; i += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(p + 2 * i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(p + 2 * i + 16));
+		__m128i t;
+
+		t = _mm_or_si128(g2d_cpu_byte_sse2(a, b, o[0]),
+				 _mm_slli_epi16(g2d_cpu_byte_sse2(a, b, o[2]), 8));
+		_mm_storeu_si128((__m128i *)(y + i), t);
+		t = g2d_cpu_byte_sse2(a, b, o[1]);
+		_mm_storel_epi64((__m128i *)(u + i / 2), _mm_packus_epi16(t, t));
+		t = g2d_cpu_byte_sse2(a, b, o[3]);
+		_mm_storel_epi64((__m128i *)(v + i / 2), _mm_packus_epi16(t, t));
+	}
+#elif defined(G2D_CPU_NEON)
+	for (; i + 16 <= n; i += 16) {
+		uint8x8x4_t a = vld4_u8(p + 2 * i);
+		uint8x8x2_t yy;
+
+		yy.val[0] = a.val[o[0]];
+		yy.val[1] = a.val[o[2]];
+		vst2_u8(y + i, yy);
+		vst1_u8(u + i / 2, a.val[o[1]]);
+		vst1_u8(v + i / 2, a.val[o[3]]);
+	}
+#endif
+	for (; i < n; i += 2) {
+		y[i] = p[2 * i + o[0]];
+		y[i + 1] = p[2 * i + o[2]];
+		u[i / 2] = p[2 * i + o[1]];
+		v[i / 2] = p[2 * i + o[3]];
+	}
+}
+
+static void g2d_cpu_yuv422_pack(unsigned char *p, const unsigned char *y,
+				const unsigned char *u, const unsigned char *v,
+				enum g2d_format format, int n)
+{
+	int o[4], i = 0;
+
+	g2d_cpu_yuv422_layout(format, &o[0], &o[1], &o[2], &o[3]);
+#if defined(G2D_CPU_SSE2)
+	for (; i + 16 <= n; i += 16) {
+		__m128i zero = _mm_setzero_si128();
+		__m128i yy = _mm_loadu_si128((const __m128i *)(y + i));
+		__m128i c[4], lo, hi;
+		int k;
+
+		c[0] = _mm_and_si128(yy, _mm_set1_epi16(0xff));
+		c[2] = _mm_srli_epi16(yy, 8);
+		c[1] = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(u + i / 2)), zero);
+		c[3] = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(v + i / 2)), zero);
+		lo = hi = zero;
+		for (k = 0; k < 4; k++) {
+			__m128i shift = _mm_cvtsi32_si128(8 * o[k]);
+
+			lo = _mm_or_si128(lo, _mm_sll_epi32(_mm_unpacklo_epi16(c[k], zero), shift));
+			hi = _mm_or_si128(hi, _mm_sll_epi32(_mm_unpackhi_epi16(c[k], zero), shift));
+		}
+		_mm_storeu_si128((__m128i *)(p + 2 * i), lo);
+		_mm_storeu_si128((__m128i *)(p + 2 * i + 16), hi);
+	}
+#elif defined(G2D_CPU_NEON)
+	for (; i + 16 <= n; i += 16) {
+		uint8x8x2_t yy = vld2_u8(y + i);
+		uint8x8x4_t a;
+
+		a.val[o[0]] = yy.val[0];
+		a.val[o[2]] = yy.val[1];
+		a.val[o[1]] = vld1_u8(u + i / 2);
+		a.val[o[3]] = vld1_u8(v + i / 2);
+		vst4_u8(p + 2 * i, a);
+	}
+#endif
+	for (; i < n; i += 2) {
+		p[2 * i + o[0]] = y[i];
+		p[2 * i + o[2]] = y[i + 1];
+		p[2 * i + o[1]] = u[i / 2];
+		p[2 * i + o[3]] = v[i / 2];
+	}
+}
+
+/*
+ * w pixels of line sy of a yuv surface from x on. y, u and v point into
+ * the planes when they are planar, at an unpacked copy in buf otherwise.
+ */
+static void g2d_cpu_yuv_get(const struct g2d_cpu_surface *s, int x, int sy,
+			    int w, unsigned char *buf, const unsigned char **y,
+			    const unsigned char **u, const unsigned char **v)
+{
+	enum g2d_format format = s->surf->format;
+	int pitch0 = g2d_cpu_pitch(s->surf, 0);
+	int pitch1 = g2d_cpu_pitch(s->surf, 1);
+	int cy = g2d_cpu_yuv420(format) ? sy >> 1 : sy;
+	unsigned char *bu = buf + w, *bv = bu + w / 2;
+	const unsigned char *c;
+
+	switch (format) {
+	case G2D_I420:
+	case G2D_YV12:
+		*y = s->planes[0] + sy * pitch0 + x;
+		*u = s->planes[1] + cy * pitch1 + x / 2;
+		*v = s->planes[2] + cy * pitch1 + x / 2;
+		if (format == G2D_YV12) {
+			c = *u; *u = *v; *v = c;
+		}
+		break;
+	case G2D_NV12:
+	case G2D_NV21:
+	case G2D_NV16:
+	case G2D_NV61:
+		*y = s->planes[0] + sy * pitch0 + x;
+		c = s->planes[1] + cy * pitch1 + x;
+		if (format == G2D_NV12 || format == G2D_NV16)
+			g2d_cpu_uv_split(bu, bv, c, w / 2);
+		else
+			g2d_cpu_uv_split(bv, bu, c, w / 2);
+		*u = bu;
+		*v = bv;
+		break;
+	default:
+		g2d_cpu_yuv422_unpack(buf, bu, bv, s->planes[0] + sy * pitch0 + x * 2,
+				      format, w);
+		*y = buf;
+		*u = bu;
+		*v = bv;
+		break;
+	}
+}
+
+/* store line dy of a yuv surface, chroma only on the lines that carry it */
+static void g2d_cpu_yuv_put(const struct g2d_cpu_surface *s, int x, int dy,
+			    int w, const unsigned char *y,
+			    const unsigned char *u, const unsigned char *v)
+{
+	enum g2d_format format = s->surf->format;
+	int pitch0 = g2d_cpu_pitch(s->surf, 0);
+	int pitch1 = g2d_cpu_pitch(s->surf, 1);
+	int chroma = !g2d_cpu_yuv420(format) || !(dy & 1);
+	int cy = g2d_cpu_yuv420(format) ? dy >> 1 : dy;
+
+	switch (format) {
+	case G2D_I420:
+	case G2D_YV12:
+		memcpy(s->planes[0] + dy * pitch0 + x, y, w);
+		if (!chroma)
+			break;
+		if (format == G2D_YV12) {
+			const unsigned char *t = u; u = v; v = t;
+		}
+		memcpy(s->planes[1] + cy * pitch1 + x / 2, u, w / 2);
+		memcpy(s->planes[2] + cy * pitch1 + x / 2, v, w / 2);
+		break;
+	case G2D_NV12:
+	case G2D_NV21:
+	case G2D_NV16:
+	case G2D_NV61:
+		memcpy(s->planes[0] + dy * pitch0 + x, y, w);
+		if (!chroma)
+			break;
+		if (format == G2D_NV12 || format == G2D_NV16)
+			g2d_cpu_uv_merge(s->planes[1] + cy * pitch1 + x, u, v, w / 2);
+		else
+			g2d_cpu_uv_merge(s->planes[1] + cy * pitch1 + x, v, u, w / 2);
+		break;
+	default:
+		g2d_cpu_yuv422_pack(s->planes[0] + dy * pitch0 + x * 2, y, u, v,
+				    format, w);
+		break;
+	}
+}
+
+static void *g2d_cpu_conv_worker(void *arg)
+{
+	struct g2d_cpu_conv *job = (struct g2d_cpu_conv *)arg;
+	const struct g2d_surface *src = job->blit->src.surf;
+	const struct g2d_surface *dst = job->blit->dst.surf;
+	const unsigned char *y = NULL, *u = NULL, *v = NULL;
+	unsigned char *yuv, *rgba;
+	int *xs = NULL, w = job->w, i, r;
+
+	yuv = malloc(w * 6);
+	if (job->in == NULL)
+		xs = malloc(w * 2 * sizeof(int));
+	if (yuv == NULL || (job->in == NULL && xs == NULL)) {
+		free(yuv);
+		free(xs);
+		job->ret = -1;
+		return NULL;
+	}
+	rgba = yuv + w * 2;
+	if (xs) {
+		for (i = 0; i < w; i++)
+			xs[i] = src->left + i;
+	}
+
+	for (r = job->y0; r < job->y1; r++) {
+		if (job->in) {
+			g2d_cpu_yuv_get(&job->blit->src, src->left, src->top + r,
+					w, yuv, &y, &u, &v);
+			if (job->in != job->out)
+				g2d_cpu_yuv_to_rgba_row(job->in, rgba, y, u, v, w);
+		} else {
+			for (i = 0; i < w; i++)
+				xs[w + i] = src->top + r;
+			g2d_cpu_fetch(&job->blit->src, xs, xs + w, w, rgba);
+		}
+
+		if (job->out == NULL) {
+			g2d_cpu_store(&job->blit->dst, dst->left, dst->top + r,
+				      w, rgba);
+			continue;
+		}
+		if (job->in != job->out) {
+			y = yuv;
+			u = yuv + w;
+			v = u + w / 2;
+			g2d_cpu_rgba_to_yuv_row(job->out, yuv, yuv + w,
+						yuv + w + w / 2, rgba, w);
+		}
+		g2d_cpu_yuv_put(&job->blit->dst, dst->left, dst->top + r, w,
+				y, u, v);
+	}
+
+	free(yuv);
+	free(xs);
+	return NULL;
+}
+
+/* 0 when done, 1 when the blit is not a plain conversion with a yuv side */
+static int g2d_cpu_convert(struct g2d_cpu_blit *blit)
+{
+	const struct g2d_surface *src = blit->src.surf;
+	const struct g2d_surface *dst = blit->dst.surf;
+	struct g2d_cpu_conv job[G2D_CPU_MAX_THREADS];
+	int rot, hflip, vflip, w, h, n, i, ret = 0;
+
+	if (blit->blend_dim || blit->blending ||
+	    blit->clip.right > blit->clip.left ||
+	    (!g2d_cpu_is_yuv(src->format) && !g2d_cpu_is_yuv(dst->format)))
+		return 1;
+	if (blit->dither != G2D_CPU_DITHER_NONE &&
+	    (dst->format == G2D_RGB565 || dst->format == G2D_BGR565))
+		return 1;
+
+	rot = g2d_cpu_rotation(src, dst, &hflip, &vflip);
+	w = dst->right - dst->left;
+	h = dst->bottom - dst->top;
+	if (rot || hflip || vflip || w <= 0 || h <= 0 ||
+	    src->right - src->left != w || src->bottom - src->top != h)
+		return 1;
+
+	/* chroma pairs have to line up on both sides */
+	if ((w & 1) || (g2d_cpu_is_yuv(src->format) && (src->left & 1)) ||
+	    (g2d_cpu_is_yuv(dst->format) && (dst->left & 1)))
+		return 1;
+
+	n = g2d_cpu_threads(w * h);
+	if (n > h)
+		n = h;
+	for (i = 0; i < n; i++) {
+		job[i].blit = blit;
+		job[i].in = g2d_cpu_is_yuv(src->format) ? g2d_cpu_csc(src) : NULL;
+		job[i].out = g2d_cpu_is_yuv(dst->format) ? g2d_cpu_csc(dst) : NULL;
+		job[i].w = w;
+		job[i].y0 = h * i / n;
+		job[i].y1 = h * (i + 1) / n;
+		job[i].ret = 0;
+	}
+	g2d_cpu_spawn(g2d_cpu_conv_worker, job, sizeof(job[0]), n);
+
+	for (i = 0; i < n; i++) {
+		if (job[i].ret < 0)
+			ret = -1;
+	}
+
+	return ret;
+}
+
+int g2d_cpu_blit(struct g2d_cpu_blit *blit)
+{
+	const struct g2d_surface *src = blit->src.surf;
+	const struct g2d_surface *dst = blit->dst.surf;
+	const struct g2d_rect *clip = &blit->clip;
+	struct g2d_cpu_filter *fx, *fy;
+	struct g2d_cpu_map map;
+	int src_w, src_h, u_range, v_range;
+	int i, ret;
+
+	if (!g2d_cpu_format_supported(dst->format) ||
+	    (!blit->blend_dim && !g2d_cpu_format_supported(src->format))) {
+		g2d_printf("%s: unsupported format\n", __func__);
+		return -1;
+	}
+
+	if (!g2d_cpu_permute(blit))
+		return 0;
+
+	ret = g2d_cpu_convert(blit);
+	if (ret <= 0)
+		return ret;
+
+	memset(&map, 0, sizeof(map));
+	map.dst_w = dst->right - dst->left;
+	map.dst_h = dst->bottom - dst->top;
+	map.cx1 = map.dst_w;
+	map.cy1 = map.dst_h;
+	if (clip->right > clip->left && clip->bottom > clip->top) {
+		map.cx0 = clip->left > dst->left ? clip->left - dst->left : 0;
+		map.cy0 = clip->top > dst->top ? clip->top - dst->top : 0;
+		if (clip->right < dst->right)
+			map.cx1 = clip->right - dst->left;
+		if (clip->bottom < dst->bottom)
+			map.cy1 = clip->bottom - dst->top;
+		if (map.cx1 <= map.cx0 || map.cy1 <= map.cy0)
+			return 0;
+	}
+
+	map.rot = g2d_cpu_rotation(src, dst, &map.hflip, &map.vflip);
+	if (dst->format == G2D_RGB565 || dst->format == G2D_BGR565)
+		map.dither = blit->dither;
+
+	u_range = (map.rot & 1) ? map.dst_h : map.dst_w;
+	v_range = (map.rot & 1) ? map.dst_w : map.dst_h;
+	src_w = src->right - src->left;
+	src_h = src->bottom - src->top;
+
+	if (blit->filter != G2D_CPU_FILTER_NEAREST && !blit->blend_dim &&
+	    (src_w != u_range || src_h != v_range)) {
+		fx = g2d_cpu_filter_get(blit->filter, src_w, u_range);
+		fy = g2d_cpu_filter_get(blit->filter, src_h, v_range);
+		if (fx == NULL || fy == NULL) {
+			g2d_cpu_filter_put(fx);
+			g2d_cpu_filter_put(fy);
+			return -1;
+		}
+		map.fin = (map.rot & 1) ? fy : fx;
+		map.fout = (map.rot & 1) ? fx : fy;
+		map.rev_x = (map.rot == 1 || map.rot == 2) ^ map.hflip;
+		map.rev_y = (map.rot == 2 || map.rot == 3) ^ map.vflip;
+
+		blit->map = &map;
+		ret = g2d_cpu_run(blit, NULL, map.cx1 - map.cx0, map.cy1 - map.cy0);
+		blit->map = NULL;
+
+		g2d_cpu_filter_put(fx);
+		g2d_cpu_filter_put(fy);
+		return ret;
+	}
+
+	map.sx = malloc((u_range + v_range) * sizeof(int));
+	if (map.sx == NULL)
+		return -1;
+	map.sy = map.sx + u_range;
+
+	/* nearest sample at pixel centers */
+	for (i = 0; i < u_range; i++)
+		map.sx[i] = src->left + (2 * i + 1) * src_w / (2 * u_range);
+	for (i = 0; i < v_range; i++)
+		map.sy[i] = src->top + (2 * i + 1) * src_h / (2 * v_range);
+
+	blit->map = &map;
+	ret = g2d_cpu_run(blit, NULL, map.cx1 - map.cx0, map.cy1 - map.cy0);
+	blit->map = NULL;
+
+	free(map.sx);
+	return ret;
+}
+
+int g2d_cpu_clear(struct g2d_cpu_surface *area)
+{
+	const struct g2d_surface *surf = area->surf;
+
+	if (!g2d_cpu_format_supported(surf->format)) {
+		g2d_printf("%s: unsupported format\n", __func__);
+		return -1;
+	}
+
+	return g2d_cpu_run(NULL, area, surf->right - surf->left,
+			   surf->bottom - surf->top);
+}
@@ -0,0 +1,100 @@
+/*
+ *  Copyright (C) 2014 Freescale Semiconductor, Inc.
+ *  All Rights Reserved.
+ *
+ *  The following programs are the sole property of Freescale Semiconductor Inc.,
+ *  and contain its proprietary and confidential information.
+ *
+ */
+
+/*
+ *	g2d_cpu.h
+ *	Internal interface of the software backend used when PxP can't do
+ *	the job or the cpu is made current
+ */
+
+#ifndef __G2D_CPU_H__
+#define __G2D_CPU_H__
+
+#include "g2d.h"
+
+#define G2D_CPU_MAX_THREADS	4
+/* surfaces smaller than this are not worth splitting across threads */
+#define G2D_CPU_THREAD_PIXELS	(64 * 1024)
+#define G2D_CPU_THREAD_BYTES	(G2D_CPU_THREAD_PIXELS * 4)
+
+/* scaling filters, nearest leaves scaling to pxp when it can */
+#define G2D_CPU_FILTER_NEAREST	0
+#define G2D_CPU_FILTER_BILINEAR	1
+#define G2D_CPU_FILTER_BICUBIC	2
+#define G2D_CPU_FILTER_LANCZOS	3
+
+/* dithering of 16 bit destinations */
+#define G2D_CPU_DITHER_NONE	0
+#define G2D_CPU_DITHER_ORDERED	1
+#define G2D_CPU_DITHER_DIFFUSION	2
+
+/*
+ * Every g2d_surface handled inside the library is the base of a
+ * g2d_surface_ex. The plain entry points wrap theirs with
+ * g2d_surface_wrap, and copies have to take the whole g2d_surface_ex.
+ */
+static inline const struct g2d_surface_ex *g2d_cpu_ex(const struct g2d_surface *surf)
+{
+	return (const struct g2d_surface_ex *)surf;
+}
+
+/* cpu view of a g2d_surface, planes resolved to virtual addresses */
+struct g2d_cpu_surface {
+	const struct g2d_surface *surf;
+	unsigned char *planes[3];
+	int nt;			/* uncached, clears use non-temporal stores */
+};
+
+struct g2d_cpu_blit {
+	struct g2d_cpu_surface src;
+	struct g2d_cpu_surface dst;
+	int blending;
+	int global_alpha;	/* 255 unless global alpha applies to src */
+	int dst_global_alpha;	/* 255 unless global alpha applies to dst */
+	int blend_dim;		/* src is a constant src->clrcolor */
+	int filter;		/* G2D_CPU_FILTER_* used when the blit scales */
+	int dither;		/* G2D_CPU_DITHER_* used when dst is RGB565/BGR565 */
+	struct g2d_rect clip;	/* part of the dst rect to draw, all if empty */
+	void *map;		/* private to g2d_cpu.c */
+};
+
+int g2d_cpu_format_supported(enum g2d_format format);
+int g2d_cpu_planes(enum g2d_format format);
+int g2d_cpu_plane_size(const struct g2d_surface *surf, int plane);
+int g2d_cpu_plane_addr(const struct g2d_surface *surf, int plane);
+void g2d_cpu_plane_rect(const struct g2d_surface *surf, int plane,
+			const struct g2d_rect *r, int *offset, int *width,
+			int *height, int *stride);
+int g2d_cpu_planes_contiguous(const struct g2d_surface *surf);
+int g2d_cpu_color_space(const struct g2d_surface *surf);
+int g2d_cpu_has_alpha(enum g2d_format format);
+
+int g2d_cpu_gcd(int a, int b);
+int g2d_cpu_rotation(const struct g2d_surface *src,
+		     const struct g2d_surface *dst, int *hflip, int *vflip);
+void g2d_cpu_map_rect(const struct g2d_surface *src,
+		      const struct g2d_surface *dst, const int *in, int *out,
+		      int to_src);
+
+void g2d_cpu_copy(void *dst, const void *src, int size, int nt);
+int g2d_cpu_blit(struct g2d_cpu_blit *blit);
+int g2d_cpu_clear(struct g2d_cpu_surface *area);
+
+/* helpers of g2d.c shared with the rest of the library */
+int g2d_has_alpha(enum g2d_format format);
+int g2d_scale_filtered(void *handle, struct g2d_surface *src,
+		       struct g2d_surface *dst);
+int g2d_blit_clip(void *handle, struct g2d_surface *src,
+		  struct g2d_surface *dst, const struct g2d_rect *clip);
+struct g2d_surface_ex *g2d_surface_wrap(struct g2d_surface_ex *ex,
+					const struct g2d_surface *surf);
+void g2d_sub_surface(struct g2d_surface_ex *sub, const struct g2d_surface *surf,
+		     int l, int t, int r, int b);
+
+#endif
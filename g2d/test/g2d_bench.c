@@ -0,0 +1,868 @@
+/*
+ *  Copyright (C) 2014 Freescale Semiconductor, Inc.
+ *  All Rights Reserved.
+ *
+ *  The following programs are the sole property of Freescale Semiconductor Inc.,
+ *  and contain its proprietary and confidential information.
+ *
+ */
+
+/*
+ *	g2d_bench.c
+ *	Blit throughput over source format, size, rotation and blending,
+ *	batched against unbatched submission, with 1 to 4 threads that each
+ *	own a context, prepared programs against g2d_blit for sprites, UI
+ *	traces through the compositor, the cpu rotation kernels over
+ *	format, angle and size, scaling per filter, and 1080p conversion
+ *	to RGB565 per dither mode. Every blit of the sweep is
+ *	finished before the next one so each lands in the g2d_finish
+ *	latency histogram. One row per case with megapixels per second,
+ *	latency percentiles, wall and process cpu microseconds per blit,
+ *	ioctls per blit (completion waits included), dst pixels written per
+ *	blit and the share of blits run on the cpu; UI rows count frames
+ *	instead of blits. Needs the pxp, run on the target, all cases unless
+ *	one is named:
+ *	  g2d_bench [csv|json] [iterations] [case]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "g2d.h"
+
+#define MAX_W	1920
+#define MAX_H	1080
+
+/* a UI frame worth of small blits for the batch case */
+#define BATCH_BLITS	40
+#define SPRITE		64
+
+#define MAX_THREADS	4
+
+struct bench_format {
+	enum g2d_format format;
+	const char *name;
+};
+
+static const struct bench_format formats[] = {
+	{ G2D_RGB565, "RGB565" },
+	{ G2D_RGBA8888, "RGBA8888" },
+	{ G2D_BGRA8888, "BGRA8888" },
+	{ G2D_BGRX8888, "BGRX8888" },
+	{ G2D_NV12, "NV12" },
+	{ G2D_NV21, "NV21" },
+	{ G2D_I420, "I420" },
+	{ G2D_YV12, "YV12" },
+	{ G2D_NV16, "NV16" },
+	{ G2D_YUYV, "YUYV" },
+	{ G2D_UYVY, "UYVY" },
+};
+
+#define NUM_FORMATS	(sizeof(formats) / sizeof(formats[0]))
+
+/* sources of the blit sweep, the rest of the table is for the grid */
+static const enum g2d_format blit_formats[] = {
+	G2D_RGB565, G2D_RGBA8888, G2D_BGRA8888, G2D_BGRX8888,
+	G2D_NV12, G2D_I420, G2D_YUYV, G2D_UYVY,
+};
+
+static const enum g2d_format rotate_formats[] = {
+	G2D_RGB565, G2D_RGBA8888, G2D_BGRX8888, G2D_NV12,
+	G2D_NV21, G2D_I420, G2D_YV12, G2D_NV16,
+};
+
+static const int sizes[][2] = {
+	{ 320, 240 }, { 640, 480 }, { 1280, 720 }, { 1920, 1080 },
+};
+
+static const int rots[] = {
+	G2D_ROTATION_0, G2D_ROTATION_90, G2D_ROTATION_180, G2D_FLIP_H,
+};
+
+/* one output row, arg is what the case varies beyond the columns */
+struct bench_row {
+	const char *name;
+	char arg[32];
+	enum g2d_format src, dst;
+	int width, height, rot, blend;
+};
+
+static int json, iterations = 20, rows;
+static struct g2d_buf *src_buf, *dst_buf;
+
+static const char *format_name(enum g2d_format format)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_FORMATS; i++)
+		if (formats[i].format == format)
+			return formats[i].name;
+	return "?";
+}
+
+/* wall time and the cpu time of the whole process, all threads */
+struct bench_time {
+	unsigned long long us;
+	unsigned long long cpu_us;
+};
+
+static unsigned long long now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static unsigned long long cpu_now_us(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (unsigned long long)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+	       ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static void time_start(struct bench_time *t)
+{
+	t->us = now_us();
+	t->cpu_us = cpu_now_us();
+}
+
+static void time_stop(struct bench_time *t)
+{
+	t->us = now_us() - t->us;
+	t->cpu_us = cpu_now_us() - t->cpu_us;
+}
+
+/* w x h at the top left of buf, chroma planes follow the luma */
+static void set_surface(struct g2d_surface *s, struct g2d_buf *buf,
+			enum g2d_format format, int w, int h)
+{
+	memset(s, 0, sizeof(*s));
+	s->format = format;
+	s->planes[0] = buf->buf_paddr;
+	s->right = s->width = s->stride = w;
+	s->bottom = s->height = h;
+	s->global_alpha = 255;
+}
+
+/* ops blits of the row took t, stats and latencies are theirs */
+static void report(const struct bench_row *row, const struct g2d_stats *st,
+		   const int *lat, int ops, const struct bench_time *t)
+{
+	double mps, usop, cpuop, iop, pix, cpu;
+
+	mps = t->us ? (double)row->width * row->height * ops / t->us : 0;
+	usop = ops ? (double)t->us / ops : 0;
+	cpuop = ops ? (double)t->cpu_us / ops : 0;
+	iop = ops ? (double)(st->ioctls + st->waits) / ops : 0;
+	pix = ops ? (double)st->blit_pixels / ops : 0;
+	cpu = st->pxp_blits + st->cpu_blits ?
+	      100.0 * st->cpu_blits / (st->pxp_blits + st->cpu_blits) : 0;
+
+	if (json) {
+		printf("%s\n  {\"case\": \"%s\", \"arg\": \"%s\", \"src\": \"%s\", "
+		       "\"dst\": \"%s\", \"width\": %d, \"height\": %d, "
+		       "\"rot\": %d, \"blend\": %d, \"mp_s\": %.2f, "
+		       "\"p50_us\": %d, \"p90_us\": %d, \"p99_us\": %d, "
+		       "\"us_per_op\": %.2f, \"cpu_us_per_op\": %.2f, "
+		       "\"ioctls_per_op\": %.2f, \"pixels_per_op\": %.0f, "
+		       "\"cpu_pct\": %.1f}",
+		       rows ? "," : "[", row->name, row->arg,
+		       format_name(row->src), format_name(row->dst),
+		       row->width, row->height, row->rot, row->blend, mps,
+		       lat[0], lat[1], lat[2], usop, cpuop, iop, pix, cpu);
+	} else {
+		if (!rows)
+			printf("case,arg,src,dst,width,height,rot,blend,mp_s,"
+			       "p50_us,p90_us,p99_us,us_per_op,cpu_us_per_op,"
+			       "ioctls_per_op,pixels_per_op,cpu_pct\n");
+		printf("%s,%s,%s,%s,%d,%d,%d,%d,%.2f,%d,%d,%d,%.2f,%.2f,%.2f,%.0f,%.1f\n",
+		       row->name, row->arg, format_name(row->src),
+		       format_name(row->dst), row->width, row->height, row->rot,
+		       row->blend, mps, lat[0], lat[1], lat[2], usop, cpuop, iop,
+		       pix, cpu);
+	}
+	rows++;
+}
+
+static void report_handle(const struct bench_row *row, void *handle, int ops,
+			  const struct bench_time *t)
+{
+	struct g2d_stats st;
+	int lat[3];
+
+	g2d_query_stats(handle, &st);
+	g2d_query_latency(handle, 50, &lat[0]);
+	g2d_query_latency(handle, 90, &lat[1]);
+	g2d_query_latency(handle, 99, &lat[2]);
+	report(row, &st, lat, ops, t);
+}
+
+/* surfaces for the row, the dst rect turns with odd quarter rotations */
+static void row_surfaces(const struct bench_row *row, struct g2d_surface *s,
+			 struct g2d_surface *d)
+{
+	int quarter = row->rot == G2D_ROTATION_90 || row->rot == G2D_ROTATION_270;
+
+	set_surface(s, src_buf, row->src, row->width, row->height);
+	set_surface(d, dst_buf, row->dst, quarter ? row->height : row->width,
+		    quarter ? row->width : row->height);
+	d->rot = row->rot;
+	if (row->blend) {
+		s->blendfunc = G2D_SRC_ALPHA;
+		d->blendfunc = G2D_ONE_MINUS_SRC_ALPHA;
+	}
+}
+
+/* iterations finished blits of the row after one untimed warm-up */
+static int run_row(void *handle, const struct bench_row *row)
+{
+	struct g2d_surface s, d;
+	struct bench_time t;
+	int i;
+
+	row_surfaces(row, &s, &d);
+	if (row->blend)
+		g2d_enable(handle, G2D_BLEND);
+
+	if (g2d_blit(handle, &s, &d) < 0 || g2d_finish(handle) < 0)
+		goto fail;
+	g2d_reset_stats(handle);
+
+	time_start(&t);
+	for (i = 0; i < iterations; i++) {
+		if (g2d_blit(handle, &s, &d) < 0 || g2d_finish(handle) < 0)
+			goto fail;
+	}
+	time_stop(&t);
+
+	if (row->blend)
+		g2d_disable(handle, G2D_BLEND);
+	report_handle(row, handle, iterations, &t);
+	return 0;
+
+fail:
+	if (row->blend)
+		g2d_disable(handle, G2D_BLEND);
+	fprintf(stderr, "%s %s %dx%d rot %d blend %d failed\n", row->name,
+		format_name(row->src), row->width, row->height, row->rot,
+		row->blend);
+	return -1;
+}
+
+static int bench_blit(void *handle)
+{
+	struct bench_row row;
+	unsigned int f, z, r;
+	int ret = 0;
+
+	memset(&row, 0, sizeof(row));
+	row.name = "blit";
+	row.dst = G2D_BGRA8888;
+	for (f = 0; f < sizeof(blit_formats) / sizeof(blit_formats[0]); f++) {
+		for (z = 0; z < sizeof(sizes) / sizeof(sizes[0]); z++) {
+			for (r = 0; r < sizeof(rots) / sizeof(rots[0]); r++) {
+				for (row.blend = 0; row.blend < 2; row.blend++) {
+					row.src = blit_formats[f];
+					row.width = sizes[z][0];
+					row.height = sizes[z][1];
+					row.rot = rots[r];
+					if (run_row(handle, &row) < 0)
+						ret = -1;
+				}
+			}
+		}
+	}
+
+	return ret;
+}
+
+/* same format rotations and flips on the cpu, rotation 0 is the copy */
+static int bench_rotate(void *handle)
+{
+	static const int angles[] = {
+		G2D_ROTATION_0, G2D_ROTATION_90, G2D_ROTATION_180,
+		G2D_ROTATION_270, G2D_FLIP_H, G2D_FLIP_V,
+	};
+	struct bench_row row;
+	unsigned int f, a, z;
+	int ret = 0;
+
+	if (g2d_make_current(handle, G2D_HARDWARE_CPU) < 0)
+		return -1;
+
+	memset(&row, 0, sizeof(row));
+	row.name = "rotate";
+	strcpy(row.arg, "cpu");
+	for (f = 0; f < sizeof(rotate_formats) / sizeof(rotate_formats[0]); f++) {
+		for (a = 0; a < sizeof(angles) / sizeof(angles[0]); a++) {
+			/* 640x480 up, below that setup hides the kernel */
+			for (z = 1; z < sizeof(sizes) / sizeof(sizes[0]); z++) {
+				row.src = row.dst = rotate_formats[f];
+				row.width = sizes[z][0];
+				row.height = sizes[z][1];
+				row.rot = angles[a];
+				if (run_row(handle, &row) < 0)
+					ret = -1;
+			}
+		}
+	}
+
+	g2d_make_current(handle, G2D_HARDWARE_2D);
+	return ret;
+}
+
+/*
+ * 720p up to 1080p and 1080p down to 360p with each filter, on the cpu
+ * where the filters run and the pxp cannot take RGBA8888 anyway.
+ * Megapixels count dst pixels.
+ */
+static int bench_scale(void *handle)
+{
+	static const struct {
+		int cap;
+		const char *name;
+	} filters[] = {
+		{ -1, "nearest" },
+		{ G2D_SCALE_BILINEAR, "bilinear" },
+		{ G2D_SCALE_BICUBIC, "bicubic" },
+		{ G2D_SCALE_LANCZOS, "lanczos" },
+	};
+	static const int scales[][4] = {
+		{ 1280, 720, 1920, 1080 },
+		{ 1920, 1080, 640, 360 },
+	};
+	struct bench_row row;
+	struct bench_time t;
+	struct g2d_surface s, d;
+	unsigned int f, z;
+	int i, ret = 0;
+
+	if (g2d_make_current(handle, G2D_HARDWARE_CPU) < 0)
+		return -1;
+
+	memset(&row, 0, sizeof(row));
+	row.name = "scale";
+	row.src = row.dst = G2D_RGBA8888;
+	for (f = 0; f < sizeof(filters) / sizeof(filters[0]); f++) {
+		if (filters[f].cap >= 0)
+			g2d_enable(handle, filters[f].cap);
+		for (z = 0; z < sizeof(scales) / sizeof(scales[0]); z++) {
+			snprintf(row.arg, sizeof(row.arg), "%s:%dx%d",
+				 filters[f].name, scales[z][0], scales[z][1]);
+			row.width = scales[z][2];
+			row.height = scales[z][3];
+			set_surface(&s, src_buf, row.src, scales[z][0], scales[z][1]);
+			set_surface(&d, dst_buf, row.dst, row.width, row.height);
+
+			if (g2d_blit(handle, &s, &d) < 0 || g2d_finish(handle) < 0)
+				goto fail;
+			g2d_reset_stats(handle);
+
+			time_start(&t);
+			for (i = 0; i < iterations; i++) {
+				if (g2d_blit(handle, &s, &d) < 0 ||
+				    g2d_finish(handle) < 0)
+					goto fail;
+			}
+			time_stop(&t);
+
+			report_handle(&row, handle, iterations, &t);
+			continue;
+fail:
+			fprintf(stderr, "scale %s failed\n", row.arg);
+			ret = -1;
+		}
+		if (filters[f].cap >= 0)
+			g2d_disable(handle, filters[f].cap);
+	}
+
+	g2d_make_current(handle, G2D_HARDWARE_2D);
+	return ret;
+}
+
+/*
+ * 1080p conversion to RGB565 without dithering, with the ordered matrix
+ * and with error diffusion. BGRA8888 goes through the pxp with the dither
+ * as a post-pass and through the cpu backend, RGBA8888 only through the
+ * cpu as the pxp cannot take it.
+ */
+static int bench_dither(void *handle)
+{
+	static const struct {
+		int cap;
+		const char *name;
+	} dithers[] = {
+		{ -1, "none" },
+		{ G2D_DITHER, "ordered" },
+		{ G2D_DITHER_DIFFUSION, "diffusion" },
+	};
+	static const struct {
+		enum g2d_format src;
+		enum g2d_hardware_type type;
+		const char *name;
+	} paths[] = {
+		{ G2D_BGRA8888, G2D_HARDWARE_2D, "pxp" },
+		{ G2D_BGRA8888, G2D_HARDWARE_CPU, "cpu" },
+		{ G2D_RGBA8888, G2D_HARDWARE_CPU, "cpu" },
+	};
+	struct bench_row row;
+	unsigned int p, m;
+	int ret = 0;
+
+	memset(&row, 0, sizeof(row));
+	row.name = "dither";
+	row.dst = G2D_RGB565;
+	row.width = MAX_W;
+	row.height = MAX_H;
+	for (p = 0; p < sizeof(paths) / sizeof(paths[0]); p++) {
+		if (g2d_make_current(handle, paths[p].type) < 0) {
+			ret = -1;
+			continue;
+		}
+		row.src = paths[p].src;
+		for (m = 0; m < sizeof(dithers) / sizeof(dithers[0]); m++) {
+			snprintf(row.arg, sizeof(row.arg), "%s:%s",
+				 dithers[m].name, paths[p].name);
+			if (dithers[m].cap >= 0)
+				g2d_enable(handle, dithers[m].cap);
+			if (run_row(handle, &row) < 0)
+				ret = -1;
+			if (dithers[m].cap >= 0)
+				g2d_disable(handle, dithers[m].cap);
+		}
+	}
+
+	g2d_make_current(handle, G2D_HARDWARE_2D);
+	return ret;
+}
+
+/*
+ * Frames of small blits spread over dst, finished per frame or per blit.
+ * With a program prepared for the top left sprite, each blit only moves
+ * its dst plane to the sprite instead of going through g2d_blit.
+ */
+static int run_frames(void *handle, int finish_each, void *program)
+{
+	struct g2d_surface s, d;
+	int src_planes[3] = { src_buf->buf_paddr, 0, 0 }, dst_planes[3] = { 0 };
+	int f, i, ret;
+
+	set_surface(&s, src_buf, G2D_BGRX8888, SPRITE, SPRITE);
+	set_surface(&d, dst_buf, G2D_BGRX8888, MAX_W, MAX_H);
+
+	for (f = 0; f < iterations; f++) {
+		for (i = 0; i < BATCH_BLITS; i++) {
+			d.left = (i % 20) * (SPRITE + 8);
+			d.top = (i / 20) * (SPRITE + 8);
+			d.right = d.left + SPRITE;
+			d.bottom = d.top + SPRITE;
+			if (program) {
+				dst_planes[0] = dst_buf->buf_paddr +
+						(d.top * MAX_W + d.left) * 4;
+				ret = g2d_exec_blit(program, src_planes, dst_planes);
+			} else {
+				ret = g2d_blit(handle, &s, &d);
+			}
+			if (ret < 0)
+				return -1;
+			if (finish_each && g2d_finish(handle) < 0)
+				return -1;
+		}
+		if (g2d_finish(handle) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * The same frames recorded and submitted on g2d_finish, passed to the
+ * driver blit by blit, and finished after every blit
+ */
+static int bench_batch(void *handle)
+{
+	static const char *modes[] = { "batched", "unbatched", "finish_each" };
+	struct bench_row row;
+	struct bench_time t;
+	int m, ret = 0;
+
+	memset(&row, 0, sizeof(row));
+	row.name = "batch";
+	row.src = row.dst = G2D_BGRX8888;
+	row.width = row.height = SPRITE;
+
+	for (m = 0; m < 3; m++) {
+		strcpy(row.arg, modes[m]);
+		if (m == 1)
+			g2d_disable(handle, G2D_BATCH);
+		g2d_reset_stats(handle);
+
+		time_start(&t);
+		if (run_frames(handle, m == 2, NULL) < 0) {
+			fprintf(stderr, "batch %s failed\n", modes[m]);
+			ret = -1;
+		}
+		time_stop(&t);
+
+		if (m == 1)
+			g2d_enable(handle, G2D_BATCH);
+		if (!ret)
+			report_handle(&row, handle, iterations * BATCH_BLITS, &t);
+	}
+
+	return ret;
+}
+
+struct bench_thread {
+	pthread_t tid;
+	void *handle;
+	struct g2d_buf *src, *dst;
+	const struct bench_row *row;
+	int ret;
+};
+
+static void *thread_blits(void *arg)
+{
+	struct bench_thread *th = (struct bench_thread *)arg;
+	const struct bench_row *row = th->row;
+	struct g2d_surface s, d;
+	int i;
+
+	set_surface(&s, th->src, row->src, row->width, row->height);
+	set_surface(&d, th->dst, row->dst, row->width, row->height);
+
+	for (i = 0; i < iterations; i++) {
+		if (g2d_blit(th->handle, &s, &d) < 0 ||
+		    g2d_finish(th->handle) < 0) {
+			th->ret = -1;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Threads with a context and buffers each, so each gets its own pxp
+ * channel up to the G2D_CHANNELS cap. Rows add up the ioctls and blits
+ * of all threads and take the worst thread's latencies.
+ */
+static int bench_threads(void *handle)
+{
+	struct bench_thread th[MAX_THREADS];
+	struct bench_row row;
+	struct g2d_stats st, one;
+	struct bench_time t;
+	int size, lat[3], us, pct[3] = { 50, 90, 99 };
+	int n, i, k, started, failed, ret = 0;
+
+	memset(&row, 0, sizeof(row));
+	row.name = "threads";
+	row.src = row.dst = G2D_BGRX8888;
+	row.width = 1280;
+	row.height = 720;
+	size = row.width * row.height * 4;
+
+	for (n = 1; n <= MAX_THREADS; n *= 2) {
+		memset(th, 0, sizeof(th));
+		for (i = 0; i < n; i++) {
+			th[i].row = &row;
+			if (g2d_open(&th[i].handle) < 0)
+				break;
+			th[i].src = g2d_alloc(size, 0);
+			th[i].dst = g2d_alloc(size, 0);
+			if (th[i].src == NULL || th[i].dst == NULL)
+				break;
+		}
+		if (i < n) {
+			fprintf(stderr, "threads %d: no context or memory\n", n);
+			ret = -1;
+			goto next;
+		}
+
+		time_start(&t);
+		for (started = 0; started < n; started++) {
+			if (pthread_create(&th[started].tid, NULL, thread_blits,
+					   &th[started]))
+				break;
+		}
+		for (i = 0; i < started; i++)
+			pthread_join(th[i].tid, NULL);
+		time_stop(&t);
+
+		memset(&st, 0, sizeof(st));
+		memset(lat, 0, sizeof(lat));
+		failed = 0;
+		for (i = 0; i < n; i++) {
+			if (i >= started || th[i].ret < 0)
+				failed = 1;
+			g2d_query_stats(th[i].handle, &one);
+			st.ioctls += one.ioctls;
+			st.waits += one.waits;
+			st.blit_pixels += one.blit_pixels;
+			st.pxp_blits += one.pxp_blits;
+			st.cpu_blits += one.cpu_blits;
+			for (k = 0; k < 3; k++) {
+				g2d_query_latency(th[i].handle, pct[k], &us);
+				if (us > lat[k])
+					lat[k] = us;
+			}
+		}
+		if (failed) {
+			fprintf(stderr, "threads %d failed\n", n);
+			ret = -1;
+			goto next;
+		}
+
+		sprintf(row.arg, "%d", n);
+		report(&row, &st, lat, n * iterations, &t);
+next:
+		for (i = 0; i < n; i++) {
+			if (th[i].src)
+				g2d_free(th[i].src);
+			if (th[i].dst)
+				g2d_free(th[i].dst);
+			if (th[i].handle)
+				g2d_close(th[i].handle);
+		}
+	}
+
+	return ret;
+}
+
+/* cpu time per sprite blit, setup dominates at this size */
+static int bench_prepared(void *handle)
+{
+	struct bench_row row;
+	struct bench_time t;
+	struct g2d_surface s, d;
+	void *program = NULL;
+	int p, ret = 0;
+
+	memset(&row, 0, sizeof(row));
+	row.name = "prepared";
+	row.src = row.dst = G2D_BGRX8888;
+	row.width = row.height = SPRITE;
+
+	set_surface(&s, src_buf, G2D_BGRX8888, SPRITE, SPRITE);
+	set_surface(&d, dst_buf, G2D_BGRX8888, MAX_W, MAX_H);
+	d.right = d.bottom = SPRITE;
+	if (g2d_prepare_blit(handle, &s, &d, &program) < 0) {
+		fprintf(stderr, "prepared: g2d_prepare_blit failed\n");
+		return -1;
+	}
+
+	for (p = 0; p < 2; p++) {
+		strcpy(row.arg, p ? "exec_blit" : "g2d_blit");
+		g2d_reset_stats(handle);
+
+		time_start(&t);
+		if (run_frames(handle, 0, p ? program : NULL) < 0) {
+			fprintf(stderr, "prepared %s failed\n", row.arg);
+			ret = -1;
+			continue;
+		}
+		time_stop(&t);
+
+		report_handle(&row, handle, iterations * BATCH_BLITS, &t);
+	}
+
+	g2d_free_blit(program);
+	return ret;
+}
+
+/* layers of the UI scene, bottom up */
+enum {
+	UI_WALLPAPER,
+	UI_STATUS,
+	UI_WINDOW,
+	UI_CURSOR,
+	UI_LAYERS,
+};
+
+static void ui_layer(void *comp, int z, enum g2d_format format, int x, int y,
+		     int w, int h)
+{
+	struct g2d_surface s, d;
+
+	set_surface(&s, src_buf, format, w, h);
+	memset(&d, 0, sizeof(d));
+	d.left = x;
+	d.top = y;
+	d.right = x + w;
+	d.bottom = y + h;
+	d.global_alpha = 255;
+	if (format == G2D_BGRA8888) {
+		s.blendfunc = G2D_SRC_ALPHA;
+		d.blendfunc = G2D_ONE_MINUS_SRC_ALPHA;
+	} else {
+		s.blendfunc = G2D_ONE;
+		d.blendfunc = G2D_ZERO;
+	}
+	g2d_comp_set_layer(comp, z, &s, &d);
+}
+
+/* what changes every frame of a trace */
+static void ui_step(void *comp, struct g2d_surface *output, int trace, int f)
+{
+	struct g2d_rect clock = { 1200, 4, 1264, 28 };
+
+	switch (trace) {
+	case 1:
+		ui_layer(comp, UI_CURSOR, G2D_BGRA8888, 400 + (f * 7) % 640,
+			 300 + (f * 3) % 320, 32, 32);
+		break;
+	case 2:
+		g2d_comp_damage(comp, UI_STATUS, &clock, 1);
+		break;
+	case 3:
+		g2d_comp_damage(comp, UI_WINDOW, NULL, 0);
+		break;
+	case 4:
+		g2d_comp_damage(comp, UI_WALLPAPER, NULL, 0);
+		break;
+	case 5:
+		g2d_comp_set_output(comp, output);
+		break;
+	}
+}
+
+/*
+ * 720p desktop with a status bar, a translucent window and a cursor,
+ * rendered through the compositor. Traces change nothing, move the
+ * cursor, tick a clock, scroll the window, play video on the wallpaper
+ * or redraw everything like a client without damage tracking would.
+ */
+static int bench_ui(void *handle)
+{
+	static const char *traces[] = {
+		"idle", "cursor", "clock", "scroll", "video", "full",
+	};
+	struct g2d_comp_stats cs;
+	struct g2d_surface output;
+	struct g2d_stats st;
+	struct bench_row row;
+	struct bench_time t;
+	void *comp;
+	int tr, f, lat[3], ret = 0;
+
+	memset(&row, 0, sizeof(row));
+	row.name = "ui";
+	row.src = G2D_BGRA8888;
+	row.dst = G2D_BGRX8888;
+	row.width = 1280;
+	row.height = 720;
+	row.blend = 1;
+
+	set_surface(&output, dst_buf, row.dst, row.width, row.height);
+	for (tr = 0; tr < 6; tr++) {
+		if (g2d_comp_create(handle, &output, &comp) < 0)
+			return -1;
+		ui_layer(comp, UI_WALLPAPER, G2D_BGRX8888, 0, 0, 1280, 720);
+		ui_layer(comp, UI_STATUS, G2D_BGRX8888, 0, 0, 1280, 32);
+		ui_layer(comp, UI_WINDOW, G2D_BGRA8888, 320, 160, 640, 400);
+		ui_layer(comp, UI_CURSOR, G2D_BGRA8888, 400, 300, 32, 32);
+		if (g2d_comp_render(comp) < 0 || g2d_finish(handle) < 0)
+			goto fail;
+		g2d_comp_reset_stats(comp);
+		g2d_reset_stats(handle);
+
+		time_start(&t);
+		for (f = 0; f < iterations; f++) {
+			ui_step(comp, &output, tr, f);
+			if (g2d_comp_render(comp) < 0 || g2d_finish(handle) < 0)
+				goto fail;
+		}
+		time_stop(&t);
+
+		/* the compositor also counts the output it clears */
+		g2d_query_stats(handle, &st);
+		g2d_comp_query_stats(comp, &cs);
+		st.blit_pixels = cs.touched_pixels;
+		g2d_query_latency(handle, 50, &lat[0]);
+		g2d_query_latency(handle, 90, &lat[1]);
+		g2d_query_latency(handle, 99, &lat[2]);
+		strcpy(row.arg, traces[tr]);
+		report(&row, &st, lat, iterations, &t);
+		g2d_comp_destroy(comp);
+		continue;
+fail:
+		fprintf(stderr, "ui %s failed\n", traces[tr]);
+		g2d_comp_destroy(comp);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+static const struct bench_case {
+	const char *name;
+	int (*run)(void *handle);
+} cases[] = {
+	{ "blit", bench_blit },
+	{ "batch", bench_batch },
+	{ "threads", bench_threads },
+	{ "prepared", bench_prepared },
+	{ "ui", bench_ui },
+	{ "rotate", bench_rotate },
+	{ "scale", bench_scale },
+	{ "dither", bench_dither },
+};
+
+int main(int argc, char **argv)
+{
+	const char *only = NULL;
+	void *handle;
+	unsigned int c;
+	int ret = 0, ran = 0;
+
+	if (argc >= 2)
+		json = !strcmp(argv[1], "json");
+	if (argc >= 3)
+		iterations = atoi(argv[2]);
+	if (argc >= 4)
+		only = argv[3];
+	if (iterations < 1)
+		iterations = 1;
+
+	if (g2d_open(&handle) < 0)
+		return 1;
+
+	src_buf = g2d_alloc(MAX_W * MAX_H * 4, 0);
+	dst_buf = g2d_alloc(MAX_W * MAX_H * 4, 0);
+	if (src_buf == NULL || dst_buf == NULL) {
+		fprintf(stderr, "no memory for the surfaces\n");
+		ret = -1;
+		goto out;
+	}
+	memset(src_buf->buf_vaddr, 0x80, MAX_W * MAX_H * 4);
+
+	for (c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+		if (only && strcmp(only, cases[c].name))
+			continue;
+		if (cases[c].run(handle) < 0)
+			ret = -1;
+		ran++;
+	}
+	if (!ran) {
+		fprintf(stderr, "no case named %s\n", only);
+		ret = -1;
+	}
+
+	if (json)
+		printf(rows ? "\n]\n" : "[]\n");
+out:
+	if (src_buf)
+		g2d_free(src_buf);
+	if (dst_buf)
+		g2d_free(dst_buf);
+	g2d_close(handle);
+	return ret < 0 ? 1 : 0;
+}
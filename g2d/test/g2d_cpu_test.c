@@ -0,0 +1,736 @@
+/*
+ *  Copyright (C) 2014 Freescale Semiconductor, Inc.
+ *  All Rights Reserved.
+ *
+ *  The following programs are the sole property of Freescale Semiconductor Inc.,
+ *  and contain its proprietary and confidential information.
+ *
+ */
+
+/*
+ *	g2d_cpu_test.c
+ *	Checks g2d_cpu_blit against plain scalar references: format
+ *	conversion between all rgb formats, rotations and flips, nearest,
+ *	bilinear, bicubic and lanczos scaling, blending, clipping, and
+ *	ordered and error diffusion dither to 16 bit. Runs on the host, no
+ *	pxp needed.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "g2d_cpu.h"
+
+#define W	37
+#define H	23
+
+static const enum g2d_format rgb_formats[] = {
+	G2D_RGB565, G2D_RGBA8888, G2D_RGBX8888, G2D_BGRA8888, G2D_BGRX8888,
+	G2D_BGR565, G2D_ARGB8888, G2D_ABGR8888, G2D_XRGB8888, G2D_XBGR8888,
+};
+
+#define NUM_RGB_FORMATS	(sizeof(rgb_formats) / sizeof(rgb_formats[0]))
+
+static int fails;
+
+static int bpp(enum g2d_format format)
+{
+	return (format == G2D_RGB565 || format == G2D_BGR565) ? 2 : 4;
+}
+
+static int div255(int x)
+{
+	return (x + 127) / 255;
+}
+
+/* byte offsets of r, g, b, a in a 32 bit format, a is -1 if unused */
+static void layout(enum g2d_format format, int *o)
+{
+	static const int rgba[] = { 0, 1, 2, 3 }, bgra[] = { 2, 1, 0, 3 };
+	static const int argb[] = { 1, 2, 3, 0 }, abgr[] = { 3, 2, 1, 0 };
+	const int *l;
+
+	switch (format) {
+	case G2D_RGBA8888: case G2D_RGBX8888: l = rgba; break;
+	case G2D_BGRA8888: case G2D_BGRX8888: l = bgra; break;
+	case G2D_ARGB8888: case G2D_XRGB8888: l = argb; break;
+	default: l = abgr; break;
+	}
+	memcpy(o, l, 4 * sizeof(int));
+	if (format == G2D_RGBX8888 || format == G2D_BGRX8888 ||
+	    format == G2D_XRGB8888 || format == G2D_XBGR8888)
+		o[3] = -1;
+}
+
+static void ref_load(enum g2d_format format, const unsigned char *p,
+		     unsigned char *rgba)
+{
+	int o[4], r, g, b;
+	unsigned short c;
+
+	if (bpp(format) == 2) {
+		c = p[0] | p[1] << 8;
+		r = c >> 11;
+		g = (c >> 5) & 0x3f;
+		b = c & 0x1f;
+		if (format == G2D_BGR565) {
+			int t = r; r = b; b = t;
+		}
+		rgba[0] = r << 3 | r >> 2;
+		rgba[1] = g << 2 | g >> 4;
+		rgba[2] = b << 3 | b >> 2;
+		rgba[3] = 255;
+		return;
+	}
+
+	layout(format, o);
+	rgba[0] = p[o[0]];
+	rgba[1] = p[o[1]];
+	rgba[2] = p[o[2]];
+	rgba[3] = o[3] < 0 ? 255 : p[o[3]];
+}
+
+static void ref_store(enum g2d_format format, const unsigned char *rgba,
+		      unsigned char *p)
+{
+	int o[4], r = rgba[0] >> 3, g = rgba[1] >> 2, b = rgba[2] >> 3;
+	unsigned short c;
+
+	if (bpp(format) == 2) {
+		c = format == G2D_BGR565 ? b << 11 | g << 5 | r : r << 11 | g << 5 | b;
+		p[0] = c & 0xff;
+		p[1] = c >> 8;
+		return;
+	}
+
+	layout(format, o);
+	p[o[0]] = rgba[0];
+	p[o[1]] = rgba[1];
+	p[o[2]] = rgba[2];
+	/* the padding byte of X formats is written as 0xff */
+	p[o[3] < 0 ? 6 - o[0] - o[1] - o[2] : o[3]] = o[3] < 0 ? 0xff : rgba[3];
+}
+
+/* the cpu backend expects the g2d_surface_ex the library wraps surfaces in */
+static void set_surface(struct g2d_surface_ex *ex, struct g2d_cpu_surface *cs,
+			unsigned char *mem, enum g2d_format format, int w, int h)
+{
+	struct g2d_surface *s = &ex->base;
+
+	memset(ex, 0, sizeof(*ex));
+	memset(cs, 0, sizeof(*cs));
+	s->format = format;
+	s->width = s->stride = s->right = w;
+	s->height = s->bottom = h;
+	s->global_alpha = 255;
+	cs->surf = s;
+	cs->planes[0] = mem;
+}
+
+static void fill_random(unsigned char *p, int n)
+{
+	while (n--)
+		*p++ = rand();
+}
+
+static int compare(const char *what, const unsigned char *out,
+		   const unsigned char *ref, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (out[i] != ref[i]) {
+			printf("FAIL %s: byte %d is %d, expected %d\n", what, i,
+			       out[i], ref[i]);
+			fails++;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void test_formats(void)
+{
+	unsigned char src[W * H * 4], dst[W * H * 4], ref[W * H * 4], px[4];
+	struct g2d_surface_ex s, d;
+	struct g2d_cpu_blit blit;
+	unsigned int i, j;
+	int k, sb, db;
+	char what[64];
+
+	for (i = 0; i < NUM_RGB_FORMATS; i++) {
+		for (j = 0; j < NUM_RGB_FORMATS; j++) {
+			sb = bpp(rgb_formats[i]);
+			db = bpp(rgb_formats[j]);
+			fill_random(src, sizeof(src));
+			memset(dst, 0, sizeof(dst));
+			for (k = 0; k < W * H; k++) {
+				ref_load(rgb_formats[i], src + k * sb, px);
+				ref_store(rgb_formats[j], px, ref + k * db);
+			}
+
+			memset(&blit, 0, sizeof(blit));
+			set_surface(&s, &blit.src, src, rgb_formats[i], W, H);
+			set_surface(&d, &blit.dst, dst, rgb_formats[j], W, H);
+			blit.global_alpha = blit.dst_global_alpha = 255;
+			sprintf(what, "format %d to %d", rgb_formats[i], rgb_formats[j]);
+			if (g2d_cpu_blit(&blit) < 0) {
+				printf("FAIL %s: blit failed\n", what);
+				fails++;
+				continue;
+			}
+			compare(what, dst, ref, W * H * db);
+		}
+	}
+}
+
+/* src pixel a dst pixel of a w x h src blit with rotation rot comes from */
+static void ref_rotate(int rot, int w, int h, int dx, int dy, int *sx, int *sy)
+{
+	switch (rot) {
+	case G2D_ROTATION_90:  *sx = dy; *sy = h - 1 - dx; break;
+	case G2D_ROTATION_180: *sx = w - 1 - dx; *sy = h - 1 - dy; break;
+	case G2D_ROTATION_270: *sx = w - 1 - dy; *sy = dx; break;
+	case G2D_FLIP_H:       *sx = w - 1 - dx; *sy = dy; break;
+	case G2D_FLIP_V:       *sx = dx; *sy = h - 1 - dy; break;
+	default:               *sx = dx; *sy = dy; break;
+	}
+}
+
+static int quarter_turn(int rot)
+{
+	return rot == G2D_ROTATION_90 || rot == G2D_ROTATION_270;
+}
+
+/* bytes per pixel and subsampling of a plane, 0 past the last plane */
+static int plane_layout(enum g2d_format format, int plane, int *xs, int *ys)
+{
+	*xs = *ys = 1;
+	switch (format) {
+	case G2D_NV12:
+	case G2D_NV21:
+		*xs = *ys = plane ? 2 : 1;
+		return plane < 2 ? plane + 1 : 0;
+	case G2D_NV16:
+		*xs = plane ? 2 : 1;
+		return plane < 2 ? plane + 1 : 0;
+	case G2D_I420:
+	case G2D_YV12:
+		*xs = *ys = plane ? 2 : 1;
+		return plane < 3;
+	default:
+		return plane ? 0 : bpp(format);
+	}
+}
+
+/*
+ * Every rotation and flip of rgb and yuv surfaces, plane by plane: a
+ * small rect, one over several tiles and one over the threading
+ * threshold. Yuv rects are even for whole chroma samples; 4:2:2 chroma
+ * would not survive a quarter turn, so NV16 only flips.
+ */
+static void test_rotations(void)
+{
+	static const enum g2d_format formats[] = {
+		G2D_RGBA8888, G2D_RGB565, G2D_NV12, G2D_NV21, G2D_I420,
+		G2D_YV12, G2D_NV16,
+	};
+	static const int rots[] = { G2D_ROTATION_0, G2D_ROTATION_90,
+		G2D_ROTATION_180, G2D_ROTATION_270, G2D_FLIP_H, G2D_FLIP_V };
+	static const int sizes[][2] = { { W, H }, { 150, 98 }, { 302, 258 } };
+	unsigned char *src, *dst, *ref, *sp, *dp, *rp;
+	struct g2d_surface_ex s, d;
+	struct g2d_cpu_blit blit;
+	int f, r, z, p, e, xs, ys, pw, ph, qw, qh, w, h, x, y, sx, sy, dw, dh;
+	int size;
+	char what[64];
+
+	size = 302 * 258 * 4;
+	src = malloc(size);
+	dst = malloc(size);
+	ref = malloc(size);
+	if (!src || !dst || !ref) {
+		printf("FAIL rotations: no memory\n");
+		fails++;
+		goto out;
+	}
+
+	for (f = 0; f < (int)(sizeof(formats) / sizeof(formats[0])); f++) {
+		for (z = 0; z < 3; z++) {
+			w = sizes[z][0];
+			h = sizes[z][1];
+			if (formats[f] >= G2D_NV12 && ((w | h) & 1))
+				continue;
+			for (r = 0; r < 6; r++) {
+				if (formats[f] == G2D_NV16 && quarter_turn(rots[r]))
+					continue;
+				dw = quarter_turn(rots[r]) ? h : w;
+				dh = quarter_turn(rots[r]) ? w : h;
+
+				fill_random(src, size);
+				memset(dst, 0, size);
+				memset(&blit, 0, sizeof(blit));
+				set_surface(&s, &blit.src, src, formats[f], w, h);
+				set_surface(&d, &blit.dst, dst, formats[f], dw, dh);
+				d.base.rot = rots[r];
+				blit.global_alpha = blit.dst_global_alpha = 255;
+
+				/* planes back to back, each rotated on its own */
+				sp = src;
+				dp = dst;
+				rp = ref;
+				for (p = 0; (e = plane_layout(formats[f], p, &xs, &ys)); p++) {
+					pw = w / xs;
+					ph = h / ys;
+					qw = quarter_turn(rots[r]) ? ph : pw;
+					qh = quarter_turn(rots[r]) ? pw : ph;
+					blit.src.planes[p] = sp;
+					blit.dst.planes[p] = dp;
+					for (y = 0; y < qh; y++)
+						for (x = 0; x < qw; x++) {
+							ref_rotate(rots[r], pw, ph, x, y, &sx, &sy);
+							memcpy(rp + (y * qw + x) * e,
+							       sp + (sy * pw + sx) * e, e);
+						}
+					sp += pw * ph * e;
+					dp += pw * ph * e;
+					rp += pw * ph * e;
+				}
+
+				sprintf(what, "format %d rotation %d of %dx%d",
+					formats[f], rots[r], w, h);
+				if (g2d_cpu_blit(&blit) < 0) {
+					printf("FAIL %s: blit failed\n", what);
+					fails++;
+					continue;
+				}
+				compare(what, dst, ref, dp - dst);
+			}
+		}
+	}
+
+out:
+	free(src);
+	free(dst);
+	free(ref);
+}
+
+static void test_scaling(void)
+{
+	static const int sizes[][2] = { { 74, 46 }, { 111, 23 }, { 19, 12 }, { 5, 40 } };
+	unsigned char src[W * H * 4], *dst, *ref;
+	struct g2d_surface_ex s, d;
+	struct g2d_cpu_blit blit;
+	int i, x, y, sx, sy, dw, dh;
+	char what[64];
+
+	for (i = 0; i < 4; i++) {
+		dw = sizes[i][0];
+		dh = sizes[i][1];
+		dst = malloc(dw * dh * 4);
+		ref = malloc(dw * dh * 4);
+		fill_random(src, sizeof(src));
+		/* nearest sample at pixel centers */
+		for (y = 0; y < dh; y++) {
+			sy = (2 * y + 1) * H / (2 * dh);
+			for (x = 0; x < dw; x++) {
+				sx = (2 * x + 1) * W / (2 * dw);
+				memcpy(ref + (y * dw + x) * 4, src + (sy * W + sx) * 4, 4);
+			}
+		}
+
+		memset(&blit, 0, sizeof(blit));
+		set_surface(&s, &blit.src, src, G2D_RGBA8888, W, H);
+		set_surface(&d, &blit.dst, dst, G2D_RGBA8888, dw, dh);
+		blit.global_alpha = blit.dst_global_alpha = 255;
+		sprintf(what, "scaling to %dx%d", dw, dh);
+		if (g2d_cpu_blit(&blit) < 0) {
+			printf("FAIL %s: blit failed\n", what);
+			fails++;
+		} else {
+			compare(what, dst, ref, dw * dh * 4);
+		}
+		free(dst);
+		free(ref);
+	}
+}
+
+static double ref_kernel(int filter, double x)
+{
+	x = fabs(x);
+	if (filter == G2D_CPU_FILTER_BILINEAR)
+		return x < 1 ? 1 - x : 0;
+	if (filter == G2D_CPU_FILTER_BICUBIC)
+		return x < 1 ? 1.5 * x * x * x - 2.5 * x * x + 1 :
+		       x < 2 ? -0.5 * x * x * x + 2.5 * x * x - 4 * x + 2 : 0;
+	if (x == 0)
+		return 1;
+	return x < 3 ? 3 * sin(M_PI * x) * sin(M_PI * x / 3) / (M_PI * M_PI * x * x) : 0;
+}
+
+/*
+ * Normalized weights of src pixels 0..slen - 1 for dst pixel k, centers
+ * aligned and the kernel widened by the downscale factor
+ */
+static void ref_weights(int filter, int slen, int dlen, int k, double *w)
+{
+	static const int radius[] = { 0, 1, 2, 3 };
+	double scale = (double)slen / dlen, fs = scale > 1 ? scale : 1;
+	double c = (k + 0.5) * scale - 0.5, sum = 0;
+	int i, j;
+
+	memset(w, 0, slen * sizeof(double));
+	for (i = (int)floor(c - radius[filter] * fs) + 1;
+	     i < c + radius[filter] * fs; i++) {
+		/* outside the rect the edge pixel repeats */
+		j = i < 0 ? 0 : i >= slen ? slen - 1 : i;
+		w[j] += ref_kernel(filter, (i - c) / fs);
+		sum += ref_kernel(filter, (i - c) / fs);
+	}
+	for (i = 0; i < slen; i++)
+		w[i] /= sum;
+}
+
+/*
+ * Bilinear, bicubic and lanczos scaling, with every rotation and flip,
+ * against the src rotated first and then filtered in floating point.
+ * The blit rounds its fixed point taps, so one step off is allowed.
+ */
+static void test_filters(void)
+{
+	static const int sizes[][2] = { { 61, 50 }, { 19, 12 }, { 111, 9 } };
+	static const int rots[] = { G2D_ROTATION_0, G2D_ROTATION_90,
+		G2D_ROTATION_180, G2D_ROTATION_270, G2D_FLIP_H, G2D_FLIP_V };
+	unsigned char src[W * H * 4], rot[W * H * 4], *dst;
+	double *wx, *wy, *tmp, v;
+	struct g2d_surface_ex s, d;
+	struct g2d_cpu_blit blit;
+	int f, r, i, x, y, k, j, sx, sy, rw, rh, dw, dh, bad;
+	char what[64];
+
+	for (f = G2D_CPU_FILTER_BILINEAR; f <= G2D_CPU_FILTER_LANCZOS; f++) {
+		for (r = 0; r < 6; r++) {
+			for (i = 0; i < 3; i++) {
+				dw = sizes[i][0];
+				dh = sizes[i][1];
+				rw = quarter_turn(rots[r]) ? H : W;
+				rh = quarter_turn(rots[r]) ? W : H;
+				dst = malloc(dw * dh * 4);
+				wx = malloc(dw * rw * sizeof(double));
+				wy = malloc(dh * rh * sizeof(double));
+				tmp = malloc(rh * dw * 4 * sizeof(double));
+
+				fill_random(src, sizeof(src));
+				for (y = 0; y < rh; y++)
+					for (x = 0; x < rw; x++) {
+						ref_rotate(rots[r], W, H, x, y, &sx, &sy);
+						memcpy(rot + (y * rw + x) * 4,
+						       src + (sy * W + sx) * 4, 4);
+					}
+				for (x = 0; x < dw; x++)
+					ref_weights(f, rw, dw, x, wx + x * rw);
+				for (y = 0; y < dh; y++)
+					ref_weights(f, rh, dh, y, wy + y * rh);
+				for (y = 0; y < rh; y++)
+					for (x = 0; x < dw * 4; x++) {
+						v = 0;
+						for (j = 0; j < rw; j++)
+							v += wx[x / 4 * rw + j] *
+							     rot[(y * rw + j) * 4 + x % 4];
+						tmp[y * dw * 4 + x] = v;
+					}
+
+				memset(&blit, 0, sizeof(blit));
+				set_surface(&s, &blit.src, src, G2D_RGBA8888, W, H);
+				set_surface(&d, &blit.dst, dst, G2D_RGBA8888, dw, dh);
+				d.base.rot = rots[r];
+				blit.global_alpha = blit.dst_global_alpha = 255;
+				blit.filter = f;
+				sprintf(what, "filter %d rotation %d to %dx%d", f,
+					rots[r], dw, dh);
+				if (g2d_cpu_blit(&blit) < 0) {
+					printf("FAIL %s: blit failed\n", what);
+					fails++;
+					goto next;
+				}
+
+				for (k = 0, bad = 0; k < dw * dh * 4 && !bad; k++) {
+					v = 0;
+					for (j = 0; j < rh; j++)
+						v += wy[k / (dw * 4) * rh + j] *
+						     tmp[j * dw * 4 + k % (dw * 4)];
+					v = floor(v + 0.5);
+					v = v < 0 ? 0 : v > 255 ? 255 : v;
+					if (fabs(dst[k] - v) > 1) {
+						printf("FAIL %s: byte %d is %d, expected %d\n",
+						       what, k, dst[k], (int)v);
+						fails++;
+						bad = 1;
+					}
+				}
+next:
+				free(dst);
+				free(wx);
+				free(wy);
+				free(tmp);
+			}
+		}
+	}
+}
+
+static int ref_factor(enum g2d_blend_func func, int as, int ad)
+{
+	switch (func) {
+	case G2D_ZERO: return 0;
+	case G2D_SRC_ALPHA: return as;
+	case G2D_ONE_MINUS_SRC_ALPHA: return 255 - as;
+	case G2D_DST_ALPHA: return ad;
+	case G2D_ONE_MINUS_DST_ALPHA: return 255 - ad;
+	default: return 255;
+	}
+}
+
+static void test_blending(void)
+{
+	static const enum g2d_blend_func funcs[][2] = {
+		{ G2D_SRC_ALPHA, G2D_ONE_MINUS_SRC_ALPHA },
+		{ G2D_ONE, G2D_ONE_MINUS_SRC_ALPHA },
+		{ G2D_ONE_MINUS_DST_ALPHA, G2D_ONE },
+		{ G2D_DST_ALPHA, G2D_ZERO },
+	};
+	static const int galpha[] = { 255, 128 };
+	unsigned char src[W * H * 4], dst[W * H * 4], ref[W * H * 4];
+	struct g2d_surface_ex s, d;
+	struct g2d_cpu_blit blit;
+	int f, g, i, k, as, ad, x;
+	char what[64];
+
+	for (g = 0; g < 2; g++) {
+		for (f = 0; f < 4; f++) {
+			fill_random(src, sizeof(src));
+			fill_random(dst, sizeof(dst));
+			for (i = 0; i < W * H * 4; i += 4) {
+				as = div255(src[i + 3] * galpha[g]);
+				ad = dst[i + 3];
+				for (k = 0; k < 4; k++) {
+					int sc = k == 3 ? as : src[i + k];
+
+					if (funcs[f][0] == G2D_SRC_ALPHA &&
+					    funcs[f][1] == G2D_ONE_MINUS_SRC_ALPHA)
+						x = div255(sc * as + dst[i + k] * (255 - as));
+					else
+						x = div255(sc * ref_factor(funcs[f][0], as, ad)) +
+						    div255(dst[i + k] * ref_factor(funcs[f][1], as, ad));
+					ref[i + k] = x > 255 ? 255 : x;
+				}
+			}
+
+			memset(&blit, 0, sizeof(blit));
+			set_surface(&s, &blit.src, src, G2D_RGBA8888, W, H);
+			set_surface(&d, &blit.dst, dst, G2D_RGBA8888, W, H);
+			s.base.blendfunc = funcs[f][0];
+			d.base.blendfunc = funcs[f][1];
+			blit.blending = 1;
+			blit.global_alpha = galpha[g];
+			blit.dst_global_alpha = 255;
+			sprintf(what, "blend %d/%d global alpha %d", funcs[f][0],
+				funcs[f][1], galpha[g]);
+			if (g2d_cpu_blit(&blit) < 0) {
+				printf("FAIL %s: blit failed\n", what);
+				fails++;
+				continue;
+			}
+			compare(what, dst, ref, sizeof(dst));
+		}
+	}
+}
+
+static void test_clip(void)
+{
+	unsigned char src[W * H * 4], dst[W * H * 4], ref[W * H * 4];
+	struct g2d_surface_ex s, d;
+	struct g2d_cpu_blit blit;
+	int x, y;
+
+	fill_random(src, sizeof(src));
+	fill_random(dst, sizeof(dst));
+	memcpy(ref, dst, sizeof(dst));
+	for (y = 5; y < 17; y++)
+		for (x = 3; x < 30; x++)
+			memcpy(ref + (y * W + x) * 4, src + (y * W + x) * 4, 4);
+
+	memset(&blit, 0, sizeof(blit));
+	set_surface(&s, &blit.src, src, G2D_RGBA8888, W, H);
+	set_surface(&d, &blit.dst, dst, G2D_RGBA8888, W, H);
+	blit.global_alpha = blit.dst_global_alpha = 255;
+	blit.clip.left = 3;
+	blit.clip.top = 5;
+	blit.clip.right = 30;
+	blit.clip.bottom = 17;
+	if (g2d_cpu_blit(&blit) < 0) {
+		printf("FAIL clip: blit failed\n");
+		fails++;
+		return;
+	}
+	compare("clip", dst, ref, sizeof(dst));
+}
+
+/* 8x8 Bayer matrix, thresholds 0..63 */
+static const unsigned char bayer[8][8] = {
+	{  0, 32,  8, 40,  2, 34, 10, 42 },
+	{ 48, 16, 56, 24, 50, 18, 58, 26 },
+	{ 12, 44,  4, 36, 14, 46,  6, 38 },
+	{ 60, 28, 52, 20, 62, 30, 54, 22 },
+	{  3, 35, 11, 43,  1, 33,  9, 41 },
+	{ 51, 19, 59, 27, 49, 17, 57, 25 },
+	{ 15, 47,  7, 39, 13, 45,  5, 37 },
+	{ 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+/* 565 level of channel k (r, g, b) of v at dst surface position (x, y) */
+static int ref_ordered(int v, int k, int x, int y)
+{
+	int b = bayer[y & 7][x & 7];
+
+	if (k == 1)
+		return (v * 63 + 45 + ((b * 166) >> 6)) / 255;
+	return (v * 31 + 21 + ((b * 215) >> 6)) / 255;
+}
+
+/*
+ * Floyd-Steinberg over the whole rect, left to right on every row, errors
+ * in 1/16 against the value the 565 level reads back as; errors pushed
+ * out of the rect are dropped
+ */
+static void ref_diffuse(const unsigned char *rgba, int w, int h, int *err,
+			unsigned char *q)
+{
+	int x, y, k, bits, v, e, *c;
+
+	memset(err, 0, w * h * 3 * sizeof(int));
+	for (y = 0; y < h; y++) {
+		for (x = 0; x < w; x++) {
+			for (k = 0; k < 3; k++) {
+				bits = k == 1 ? 6 : 5;
+				c = err + (y * w + x) * 3 + k;
+				v = rgba[(y * w + x) * 4 + k] + ((*c + 8) >> 4);
+				v = v < 0 ? 0 : v > 255 ? 255 : v;
+				q[(y * w + x) * 3 + k] = v >> (8 - bits);
+				e = v - ((v >> (8 - bits) << (8 - bits)) |
+					 (v >> (8 - bits) >> (2 * bits - 8)));
+				if (x + 1 < w)
+					c[3] += 7 * e;
+				if (y + 1 < h) {
+					if (x > 0)
+						c[w * 3 - 3] += 3 * e;
+					c[w * 3] += 5 * e;
+					if (x + 1 < w)
+						c[w * 3 + 3] += e;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Rects above the threading threshold, with an odd width for the vector
+ * tails, at an offset in dst so the ordered pattern has to follow the
+ * surface position
+ */
+static void test_dither(void)
+{
+	static const enum g2d_format formats[][2] = {
+		{ G2D_RGBA8888, G2D_RGB565 },
+		{ G2D_BGRA8888, G2D_BGR565 },
+	};
+	enum { DW = 413, DH = 171, DL = 3, DT = 5, SW = DW + 9, SH = DH + 8 };
+	unsigned char *src, *dst, *ref, *rgba, *q, c[3];
+	int *err, f, m, x, y, k, i;
+	struct g2d_surface_ex s, d;
+	struct g2d_cpu_blit blit;
+	char what[64];
+
+	src = malloc(DW * DH * 4);
+	dst = malloc(SW * SH * 2);
+	ref = malloc(SW * SH * 2);
+	rgba = malloc(DW * DH * 4);
+	q = malloc(DW * DH * 3);
+	err = malloc(DW * DH * 3 * sizeof(int));
+	if (!src || !dst || !ref || !rgba || !q || !err) {
+		printf("FAIL dither: no memory\n");
+		fails++;
+		goto out;
+	}
+
+	for (f = 0; f < 2; f++) {
+		for (m = G2D_CPU_DITHER_ORDERED; m <= G2D_CPU_DITHER_DIFFUSION; m++) {
+			fill_random(src, DW * DH * 4);
+			fill_random(dst, SW * SH * 2);
+			memcpy(ref, dst, SW * SH * 2);
+			for (i = 0; i < DW * DH; i++)
+				ref_load(formats[f][0], src + i * 4, rgba + i * 4);
+			if (m == G2D_CPU_DITHER_DIFFUSION)
+				ref_diffuse(rgba, DW, DH, err, q);
+			for (y = 0; y < DH; y++) {
+				for (x = 0; x < DW; x++) {
+					i = y * DW + x;
+					for (k = 0; k < 3; k++) {
+						c[k] = m == G2D_CPU_DITHER_ORDERED ?
+						       ref_ordered(rgba[i * 4 + k], k,
+								   DL + x, DT + y) :
+						       q[i * 3 + k];
+						/* stored as the top bits by ref_store */
+						c[k] <<= k == 1 ? 2 : 3;
+					}
+					ref_store(formats[f][1], c,
+						  ref + ((DT + y) * SW + DL + x) * 2);
+				}
+			}
+
+			memset(&blit, 0, sizeof(blit));
+			set_surface(&s, &blit.src, src, formats[f][0], DW, DH);
+			set_surface(&d, &blit.dst, dst, formats[f][1], SW, SH);
+			d.base.left = DL;
+			d.base.top = DT;
+			d.base.right = DL + DW;
+			d.base.bottom = DT + DH;
+			blit.global_alpha = blit.dst_global_alpha = 255;
+			blit.dither = m;
+			sprintf(what, "%s dither %d to %d",
+				m == G2D_CPU_DITHER_ORDERED ? "ordered" : "diffusion",
+				formats[f][0], formats[f][1]);
+			if (g2d_cpu_blit(&blit) < 0) {
+				printf("FAIL %s: blit failed\n", what);
+				fails++;
+				continue;
+			}
+			compare(what, dst, ref, SW * SH * 2);
+		}
+	}
+
+out:
+	free(src);
+	free(dst);
+	free(ref);
+	free(rgba);
+	free(q);
+	free(err);
+}
+
+int main(void)
+{
+	srand(1);
+
+	test_formats();
+	test_rotations();
+	test_scaling();
+	test_filters();
+	test_blending();
+	test_clip();
+	test_dither();
+
+	printf("%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,330 @@
+/*
+ *  Copyright (C) 2014 Freescale Semiconductor, Inc.
+ *  All Rights Reserved.
+ *
+ *  The following programs are the sole property of Freescale Semiconductor Inc.,
+ *  and contain its proprietary and confidential information.
+ *
+ */
+
+/*
+ *	g2d_stripe_test.c
+ *	Builds g2d.c with a pxp limit of 64 pixels so every blit below is
+ *	split into stripes, and runs the stripes on a software pxp that
+ *	executes each channel config with the cpu backend. The striped result
+ *	must match the same blit done by the cpu backend in one go, for
+ *	scaled, rotated and flipped rects. Runs on the host, no pxp needed.
+ */
+
+#define G2D_PXP_MAX_SIZE	64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/pxp_device.h>
+
+#include "g2d.h"
+#include "g2d_cpu.h"
+
+#define W	320
+#define H	240
+
+/* any fd the process does not own, only the software pxp sees it */
+#define PXP_FD		1000
+#define PXP_PHYS_BASE	0x10000000
+#define PXP_MAX_BUFS	16
+
+static struct {
+	unsigned int phys, size;
+	void *mem;
+} pxp_bufs[PXP_MAX_BUFS];
+
+static unsigned int pxp_next_phys = PXP_PHYS_BASE;
+static int pxp_configs;
+static int fails;
+
+static void *pxp_virt(unsigned int phys)
+{
+	int i;
+
+	for (i = 0; i < PXP_MAX_BUFS; i++)
+		if (pxp_bufs[i].mem && phys >= pxp_bufs[i].phys &&
+		    phys < pxp_bufs[i].phys + pxp_bufs[i].size)
+			return (char *)pxp_bufs[i].mem + (phys - pxp_bufs[i].phys);
+	return NULL;
+}
+
+static int pxp_format(unsigned int fourcc)
+{
+	switch (fourcc) {
+	case PXP_PIX_FMT_RGB565:
+		return G2D_RGB565;
+	case PXP_PIX_FMT_RGB32:
+		return G2D_BGRX8888;
+	default:
+		return -1;
+	}
+}
+
+static int cpu_blit(struct g2d_surface_ex *s, void *src,
+		    struct g2d_surface_ex *d, void *dst)
+{
+	struct g2d_cpu_blit blit;
+
+	memset(&blit, 0, sizeof(blit));
+	blit.src.surf = &s->base;
+	blit.src.planes[0] = src;
+	blit.dst.surf = &d->base;
+	blit.dst.planes[0] = dst;
+	blit.global_alpha = blit.dst_global_alpha = 255;
+	return g2d_cpu_blit(&blit);
+}
+
+/* the ps path of one channel config, the only one the stripes below use */
+static int pxp_run(struct pxp_config_data *conf)
+{
+	struct pxp_layer_param *in = &conf->s0_param, *out = &conf->out_param;
+	struct pxp_proc_data *proc = &conf->proc_data;
+	struct g2d_surface_ex s, d;
+	int quarter = proc->rotate == 90 || proc->rotate == 270;
+	void *src = pxp_virt(in->paddr), *dst = pxp_virt(out->paddr);
+
+	pxp_configs++;
+	if (conf->ol_param[0].paddr || proc->combine_enable ||
+	    pxp_format(in->pixel_fmt) < 0 || pxp_format(out->pixel_fmt) < 0 ||
+	    (quarter && (proc->hflip || proc->vflip)) || !src || !dst)
+		return -1;
+
+	memset(&s, 0, sizeof(s));
+	memset(&d, 0, sizeof(d));
+	s.base.format = pxp_format(in->pixel_fmt);
+	s.base.width = in->width;
+	s.base.height = in->height;
+	s.base.stride = in->stride;
+	s.base.left = proc->srect.left;
+	s.base.top = proc->srect.top;
+	/* srect is given in rotated space */
+	s.base.right = s.base.left + (quarter ? proc->srect.height : proc->srect.width);
+	s.base.bottom = s.base.top + (quarter ? proc->srect.width : proc->srect.height);
+	s.base.global_alpha = 255;
+
+	/* out paddr already points at the top left dst pixel */
+	d.base.format = pxp_format(out->pixel_fmt);
+	d.base.width = d.base.right = proc->drect.width;
+	d.base.height = d.base.bottom = proc->drect.height;
+	d.base.stride = out->stride;
+	d.base.global_alpha = 255;
+	d.base.rot = proc->hflip ? G2D_FLIP_H : proc->vflip ? G2D_FLIP_V :
+		     proc->rotate / 90;
+
+	return cpu_blit(&s, src, &d, dst);
+}
+
+static int pxp_open(const char *path, int flags, ...)
+{
+	return PXP_FD;
+}
+
+static int pxp_close(int f)
+{
+	return f == PXP_FD ? 0 : close(f);
+}
+
+static int pxp_ioctl(int f, unsigned long req, void *arg)
+{
+	struct pxp_mem_desc *mem = arg;
+	int i;
+
+	if (f != PXP_FD)
+		return ioctl(f, req, arg);
+
+	switch (req) {
+	case PXP_IOC_GET_CHAN:
+		*(int *)arg = 1;
+		return 0;
+	case PXP_IOC_CONFIG_CHAN:
+		return pxp_run(arg);
+	case PXP_IOC_GET_PHYMEM:
+		for (i = 0; i < PXP_MAX_BUFS && pxp_bufs[i].mem; i++)
+			;
+		if (i == PXP_MAX_BUFS)
+			return -1;
+		pxp_bufs[i].mem = calloc(1, mem->size);
+		if (pxp_bufs[i].mem == NULL)
+			return -1;
+		pxp_bufs[i].phys = mem->phys_addr = pxp_next_phys;
+		pxp_bufs[i].size = mem->size;
+		mem->handle = i + 1;
+		pxp_next_phys += (mem->size + 4095) & ~4095;
+		return 0;
+	case PXP_IOC_PUT_PHYMEM:
+		for (i = 0; i < PXP_MAX_BUFS; i++)
+			if (pxp_bufs[i].mem && pxp_bufs[i].phys == mem->phys_addr) {
+				free(pxp_bufs[i].mem);
+				pxp_bufs[i].mem = NULL;
+			}
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+static void *pxp_mmap(void *addr, size_t len, int prot, int flags, int f,
+		      off_t off)
+{
+	void *p = f == PXP_FD ? pxp_virt(off) : NULL;
+
+	return p ? p : MAP_FAILED;
+}
+
+static int pxp_munmap(void *addr, size_t len)
+{
+	return 0;
+}
+
+/* the system headers are in, only the calls of g2d.c get redirected */
+#define open	pxp_open
+#define close	pxp_close
+#define ioctl	pxp_ioctl
+#define mmap	pxp_mmap
+#define munmap	pxp_munmap
+
+#include "g2d.c"
+
+static void set_surface(struct g2d_surface *s, struct g2d_buf *buf,
+			enum g2d_format format)
+{
+	memset(s, 0, sizeof(*s));
+	s->format = format;
+	s->planes[0] = buf->buf_paddr;
+	s->width = s->stride = W;
+	s->height = H;
+	s->global_alpha = 255;
+}
+
+/*
+ * src and dst rect sizes, scales whose stripes can start on exact src
+ * pixels; one case fits a single stripe on the oversized surface
+ */
+static const int rects[][4] = {
+	{ 100, 80, 200, 160 },
+	{ 160, 120, 80, 60 },
+	{ 96, 72, 144, 108 },
+	{ 200, 150, 200, 150 },
+	{ 64, 48, 64, 48 },
+};
+
+static void test_stripes(void *handle, enum g2d_format format)
+{
+	static const int rots[] = {
+		G2D_ROTATION_0, G2D_ROTATION_90, G2D_ROTATION_180,
+		G2D_ROTATION_270, G2D_FLIP_H, G2D_FLIP_V,
+	};
+	int size = W * H * (g2d_get_bpp(format) >> 3);
+	struct g2d_buf *sb, *db;
+	struct g2d_surface_ex s, d;
+	unsigned char *ref, *p;
+	unsigned int sc, r, side;
+	int i, configs;
+
+	sb = g2d_alloc(size, 0);
+	db = g2d_alloc(size, 0);
+	ref = malloc(size);
+	if (sb == NULL || db == NULL || ref == NULL) {
+		printf("FAIL: no memory\n");
+		fails++;
+		goto out;
+	}
+
+	p = sb->buf_vaddr;
+	for (i = 0; i < size; i++)
+		p[i] = rand();
+
+	for (sc = 0; sc < sizeof(rects) / sizeof(rects[0]); sc++) {
+		for (r = 0; r < sizeof(rots) / sizeof(rots[0]); r++) {
+			for (side = 0; side < 2; side++) {
+				memset(&s, 0, sizeof(s));
+				memset(&d, 0, sizeof(d));
+				set_surface(&s.base, sb, format);
+				set_surface(&d.base, db, format);
+				s.base.left = 3;
+				s.base.top = 5;
+				s.base.right = 3 + rects[sc][0];
+				s.base.bottom = 5 + rects[sc][1];
+				d.base.left = 7;
+				d.base.top = 2;
+				if (rots[r] == G2D_ROTATION_90 ||
+				    rots[r] == G2D_ROTATION_270) {
+					d.base.right = 7 + rects[sc][3];
+					d.base.bottom = 2 + rects[sc][2];
+				} else {
+					d.base.right = 7 + rects[sc][2];
+					d.base.bottom = 2 + rects[sc][3];
+				}
+				if (side)
+					s.base.rot = rots[r];
+				else
+					d.base.rot = rots[r];
+
+				memset(ref, 0, size);
+				if (cpu_blit(&s, sb->buf_vaddr, &d, ref) < 0) {
+					printf("FAIL rect %u rot %d: reference blit failed\n",
+					       sc, rots[r]);
+					fails++;
+					continue;
+				}
+
+				memset(db->buf_vaddr, 0, size);
+				configs = pxp_configs;
+				if (g2d_blit(handle, &s.base, &d.base) < 0 ||
+				    g2d_finish(handle) < 0) {
+					printf("FAIL rect %u rot %d on %s: striped blit failed\n",
+					       sc, rots[r], side ? "src" : "dst");
+					fails++;
+					continue;
+				}
+				if (pxp_configs == configs) {
+					printf("FAIL rect %u rot %d on %s: left to the cpu\n",
+					       sc, rots[r], side ? "src" : "dst");
+					fails++;
+				}
+				if (memcmp(db->buf_vaddr, ref, size)) {
+					printf("FAIL rect %u rot %d on %s: stripes differ from the cpu\n",
+					       sc, rots[r], side ? "src" : "dst");
+					fails++;
+				}
+			}
+		}
+	}
+
+out:
+	if (sb)
+		g2d_free(sb);
+	if (db)
+		g2d_free(db);
+	free(ref);
+}
+
+int main(void)
+{
+	void *handle;
+
+	srand(1);
+
+	if (g2d_open(&handle) < 0) {
+		printf("FAIL: g2d_open\n");
+		return 1;
+	}
+
+	test_stripes(handle, G2D_BGRX8888);
+	test_stripes(handle, G2D_RGB565);
+
+	g2d_close(handle);
+
+	printf("%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}
@@ -0,0 +1,336 @@
+/*
+ *  Copyright (C) 2014 Freescale Semiconductor, Inc.
+ *  All Rights Reserved.
+ *
+ *  The following programs are the sole property of Freescale Semiconductor Inc.,
+ *  and contain its proprietary and confidential information.
+ *
+ */
+
+/*
+ *	g2d_yuv_test.c
+ *	Checks the yuv paths of g2d_cpu_blit bit for bit against a scalar
+ *	reference: yuv to rgb and rgb to yuv in every color space, and yuv
+ *	to yuv within and across color spaces. Each case runs once through
+ *	the line converter and once through the per pixel path, which a
+ *	clip rect forces. Runs on the host, no pxp needed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "g2d_cpu.h"
+
+/* even, and wide enough for the simd loops and their tails */
+#define W	38
+#define H	24
+
+static const enum g2d_format yuv_formats[] = {
+	G2D_NV12, G2D_I420, G2D_YV12, G2D_NV21, G2D_YUYV,
+	G2D_YVYU, G2D_UYVY, G2D_VYUY, G2D_NV16, G2D_NV61,
+};
+
+#define NUM_YUV_FORMATS	(sizeof(yuv_formats) / sizeof(yuv_formats[0]))
+
+/* 8 bit fixed point matrices indexed by enum g2d_color_space */
+static const struct {
+	int y_off, cy, vr, ug, vg, ub;
+	int ry, gy, by, ru, gu, bu, rv, gv, bv;
+} csc[] = {
+	{ 16, 298, 409, 100, 208, 516, 66, 129, 25, -38, -74, 112, 112, -94, -18 },
+	{ 0, 256, 359, 88, 183, 454, 77, 150, 29, -43, -85, 128, 128, -107, -21 },
+	{ 16, 298, 459, 55, 136, 541, 47, 157, 16, -26, -86, 112, 112, -102, -10 },
+	{ 0, 256, 403, 48, 120, 475, 54, 183, 19, -29, -99, 128, 128, -116, -12 },
+};
+
+static int fails;
+
+static int clamp(int v)
+{
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static void ref_to_rgb(int cs, int y, int u, int v, unsigned char *p)
+{
+	int c = csc[cs].cy * (y - csc[cs].y_off) + 128;
+
+	u -= 128;
+	v -= 128;
+	p[0] = clamp((c + csc[cs].vr * v) >> 8);
+	p[1] = clamp((c - csc[cs].ug * u - csc[cs].vg * v) >> 8);
+	p[2] = clamp((c + csc[cs].ub * u) >> 8);
+	p[3] = 255;
+}
+
+static void ref_to_yuv(int cs, const unsigned char *p, int *y, int *u, int *v)
+{
+	int r = p[0], g = p[1], b = p[2];
+
+	*y = clamp(((csc[cs].ry * r + csc[cs].gy * g + csc[cs].by * b + 128) >> 8) +
+		   csc[cs].y_off);
+	*u = clamp(((csc[cs].ru * r + csc[cs].gu * g + csc[cs].bu * b + 128) >> 8) + 128);
+	*v = clamp(((csc[cs].rv * r + csc[cs].gv * g + csc[cs].bv * b + 128) >> 8) + 128);
+}
+
+static int is420(enum g2d_format f)
+{
+	return f == G2D_NV12 || f == G2D_NV21 || f == G2D_I420 || f == G2D_YV12;
+}
+
+static int is_packed(enum g2d_format f)
+{
+	return f >= G2D_YUYV && f <= G2D_VYUY;
+}
+
+static int yuv_size(enum g2d_format f)
+{
+	return is420(f) ? W * H * 3 / 2 : W * H * 2;
+}
+
+/* byte offsets of y0, u, y1, v in a packed pixel pair */
+static void layout422(enum g2d_format f, int *o)
+{
+	static const int yuyv[] = { 0, 1, 2, 3 }, yvyu[] = { 0, 3, 2, 1 };
+	static const int uyvy[] = { 1, 0, 3, 2 }, vyuy[] = { 1, 2, 3, 0 };
+
+	memcpy(o, f == G2D_YUYV ? yuyv : f == G2D_YVYU ? yvyu :
+	       f == G2D_UYVY ? uyvy : vyuy, 4 * sizeof(int));
+}
+
+/* luma of pixel x, y in a W x H frame with the planes back to back */
+static unsigned char *ref_y(enum g2d_format f, unsigned char *m, int x, int y)
+{
+	int o[4];
+
+	if (!is_packed(f))
+		return m + y * W + x;
+	layout422(f, o);
+	return m + y * W * 2 + (x & ~1) * 2 + o[(x & 1) ? 2 : 0];
+}
+
+/* u (c = 0) or v (c = 1) that pixel x, y uses */
+static unsigned char *ref_c(enum g2d_format f, unsigned char *m, int x, int y,
+			    int c)
+{
+	int cy = is420(f) ? y / 2 : y, o[4];
+
+	switch (f) {
+	case G2D_YV12:
+		c = !c;
+		/* fall through */
+	case G2D_I420:
+		return m + W * H + c * (W / 2) * (H / 2) + cy * (W / 2) + x / 2;
+	case G2D_NV21:
+	case G2D_NV61:
+		c = !c;
+		/* fall through */
+	case G2D_NV12:
+	case G2D_NV16:
+		return m + W * H + cy * W + (x & ~1) + c;
+	default:
+		layout422(f, o);
+		return m + y * W * 2 + (x & ~1) * 2 + o[c ? 3 : 1];
+	}
+}
+
+/* the chroma of a line only lands on the lines that carry it */
+static int carries_chroma(enum g2d_format f, int x, int y)
+{
+	return !(x & 1) && (!is420(f) || !(y & 1));
+}
+
+static void set_surface(struct g2d_surface_ex *ex, struct g2d_cpu_surface *cs,
+			unsigned char *mem, enum g2d_format format,
+			int color_space)
+{
+	struct g2d_surface *s = &ex->base;
+
+	memset(ex, 0, sizeof(*ex));
+	memset(cs, 0, sizeof(*cs));
+	s->format = format;
+	s->width = s->stride = s->right = W;
+	s->height = s->bottom = H;
+	s->global_alpha = 255;
+	ex->color_space = color_space;
+	cs->surf = s;
+	cs->planes[0] = mem;
+	if (format == G2D_I420 || format == G2D_YV12) {
+		cs->planes[1] = mem + W * H;
+		cs->planes[2] = cs->planes[1] + (W / 2) * (H / 2);
+	} else if (!is_packed(format)) {
+		cs->planes[1] = mem + W * H;
+	}
+}
+
+static void fill_random(unsigned char *p, int n)
+{
+	while (n--)
+		*p++ = rand();
+}
+
+/* src and dst set up, the converter or with clip the per pixel path */
+static void run(const char *what, struct g2d_cpu_blit *blit, int clip,
+		const unsigned char *out, const unsigned char *ref, int n)
+{
+	int i;
+
+	blit->global_alpha = blit->dst_global_alpha = 255;
+	if (clip) {
+		blit->clip.right = W;
+		blit->clip.bottom = H;
+	}
+	if (g2d_cpu_blit(blit) < 0) {
+		printf("FAIL %s%s: blit failed\n", what, clip ? " per pixel" : "");
+		fails++;
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (out[i] != ref[i]) {
+			printf("FAIL %s%s: byte %d is %d, expected %d\n", what,
+			       clip ? " per pixel" : "", i, out[i], ref[i]);
+			fails++;
+			return;
+		}
+	}
+}
+
+static void test_to_rgb(void)
+{
+	unsigned char src[W * H * 2], dst[W * H * 4], ref[W * H * 4];
+	struct g2d_surface_ex s, d;
+	struct g2d_cpu_blit blit;
+	enum g2d_format f;
+	unsigned int i;
+	int cs, clip, x, y;
+	char what[64];
+
+	for (i = 0; i < NUM_YUV_FORMATS; i++) {
+		f = yuv_formats[i];
+		for (cs = 0; cs < 4; cs++) {
+			fill_random(src, sizeof(src));
+			for (y = 0; y < H; y++)
+				for (x = 0; x < W; x++)
+					ref_to_rgb(cs, *ref_y(f, src, x, y),
+						   *ref_c(f, src, x, y, 0),
+						   *ref_c(f, src, x, y, 1),
+						   ref + (y * W + x) * 4);
+
+			sprintf(what, "yuv %d to rgb, color space %d", f, cs);
+			for (clip = 0; clip < 2; clip++) {
+				memset(dst, 0, sizeof(dst));
+				memset(&blit, 0, sizeof(blit));
+				set_surface(&s, &blit.src, src, f, cs);
+				set_surface(&d, &blit.dst, dst, G2D_RGBA8888, 0);
+				run(what, &blit, clip, dst, ref, sizeof(dst));
+			}
+		}
+	}
+}
+
+static void test_to_yuv(void)
+{
+	unsigned char src[W * H * 4], dst[W * H * 2], ref[W * H * 2];
+	struct g2d_surface_ex s, d;
+	struct g2d_cpu_blit blit;
+	enum g2d_format f;
+	unsigned int i;
+	int cs, clip, x, y, cy, cu, cv;
+	char what[64];
+
+	for (i = 0; i < NUM_YUV_FORMATS; i++) {
+		f = yuv_formats[i];
+		for (cs = 0; cs < 4; cs++) {
+			fill_random(src, sizeof(src));
+			memset(ref, 0, sizeof(ref));
+			for (y = 0; y < H; y++)
+				for (x = 0; x < W; x++) {
+					ref_to_yuv(cs, src + (y * W + x) * 4, &cy, &cu, &cv);
+					*ref_y(f, ref, x, y) = cy;
+					if (!carries_chroma(f, x, y))
+						continue;
+					*ref_c(f, ref, x, y, 0) = cu;
+					*ref_c(f, ref, x, y, 1) = cv;
+				}
+
+			sprintf(what, "rgb to yuv %d, color space %d", f, cs);
+			for (clip = 0; clip < 2; clip++) {
+				memset(dst, 0, sizeof(dst));
+				memset(&blit, 0, sizeof(blit));
+				set_surface(&s, &blit.src, src, G2D_RGBA8888, 0);
+				set_surface(&d, &blit.dst, dst, f, cs);
+				run(what, &blit, clip, dst, ref, yuv_size(f));
+			}
+		}
+	}
+}
+
+/*
+ * The line converter moves the samples when the color spaces match and
+ * goes through rgb otherwise; the per pixel path always goes through rgb.
+ */
+static void test_yuv_to_yuv(void)
+{
+	static const int spaces[][2] = {
+		{ G2D_BT601_LIMITED, G2D_BT601_LIMITED },
+		{ G2D_BT709_FULL, G2D_BT709_FULL },
+		{ G2D_BT601_LIMITED, G2D_BT709_LIMITED },
+		{ G2D_BT709_FULL, G2D_BT601_FULL },
+	};
+	unsigned char src[W * H * 2], dst[W * H * 2], ref[W * H * 2], px[4];
+	struct g2d_surface_ex s, d;
+	struct g2d_cpu_blit blit;
+	enum g2d_format sf, df;
+	unsigned int i, j, k;
+	int clip, x, y, cy, cu, cv;
+	char what[64];
+
+	for (i = 0; i < NUM_YUV_FORMATS; i++) {
+		for (j = 0; j < NUM_YUV_FORMATS; j++) {
+			sf = yuv_formats[i];
+			df = yuv_formats[j];
+			for (k = 0; k < 4; k++) {
+				fill_random(src, sizeof(src));
+				sprintf(what, "yuv %d to yuv %d, color space %d to %d",
+					sf, df, spaces[k][0], spaces[k][1]);
+				for (clip = 0; clip < 2; clip++) {
+					memset(ref, 0, sizeof(ref));
+					for (y = 0; y < H; y++)
+						for (x = 0; x < W; x++) {
+							cy = *ref_y(sf, src, x, y);
+							cu = *ref_c(sf, src, x, y, 0);
+							cv = *ref_c(sf, src, x, y, 1);
+							if (clip || spaces[k][0] != spaces[k][1]) {
+								ref_to_rgb(spaces[k][0], cy, cu, cv, px);
+								ref_to_yuv(spaces[k][1], px, &cy, &cu, &cv);
+							}
+							*ref_y(df, ref, x, y) = cy;
+							if (!carries_chroma(df, x, y))
+								continue;
+							*ref_c(df, ref, x, y, 0) = cu;
+							*ref_c(df, ref, x, y, 1) = cv;
+						}
+
+					memset(dst, 0, sizeof(dst));
+					memset(&blit, 0, sizeof(blit));
+					set_surface(&s, &blit.src, src, sf, spaces[k][0]);
+					set_surface(&d, &blit.dst, dst, df, spaces[k][1]);
+					run(what, &blit, clip, dst, ref, yuv_size(df));
+				}
+			}
+		}
+	}
+}
+
+int main(void)
+{
+	srand(1);
+
+	test_to_rgb();
+	test_to_yuv();
+	test_yuv_to_yuv();
+
+	printf("%s\n", fails ? "FAIL" : "PASS");
+	return fails ? 1 : 0;
+}
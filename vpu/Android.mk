@@ -34,4 +34,18 @@ LOCAL_PRELINK_MODULE := false
 LOCAL_MODULE_TAGS := eng
 include $(BUILD_SHARED_LIBRARY)
 
+# encoder header cache test, the Android build maps VPU memory differently
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := test/vpu_enc_header_test.c
+ifeq ($(BOARD_SOC_CLASS),IMX6)
+LOCAL_CFLAGS += -DBUILD_FOR_ANDROID -DIMX6Q
+else
+LOCAL_CFLAGS += -DBUILD_FOR_ANDROID -D$(BOARD_SOC_TYPE)
+endif
+LOCAL_C_INCLUDES += $(LOCAL_PATH)
+LOCAL_SHARED_LIBRARIES := libvpu libc
+LOCAL_MODULE := vpu_enc_header_test
+LOCAL_MODULE_TAGS := tests
+include $(BUILD_EXECUTABLE)
+
 endif
@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2015 Freescale Semiconductor, Inc.
+ */
+
+/* The following programs are the sole property of Freescale Semiconductor Inc.,
+ * and contain its proprietary and confidential information. */
+
+/*!
+ * @file vpu_enc_fps.c
+ *
+ * @brief Encode frame rate with and without the submission queue.
+ *
+ * Encodes the same H.264 source frame, 1080p by default, once with
+ * vpu_EncStartOneFrame() and once with vpu_EncQueueFrame(), both in ring
+ * buffer mode, and prints the frames per second of each run. Needs the
+ * VPU, run on the target:
+ *   vpu_enc_fps [width height [frames]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "vpu_lib.h"
+#include "vpu_io.h"
+
+#define BS_SIZE		(4 * 1024 * 1024)
+#define MAX_FB		8
+
+static vpu_mem_desc bs_mem;
+static vpu_mem_desc fb_mem[MAX_FB];
+static FrameBuffer fb[MAX_FB];
+static int fb_num;
+
+static int alloc_fb(int stride, int height)
+{
+	vpu_mem_desc *mem = &fb_mem[fb_num];
+	FrameBuffer *f = &fb[fb_num];
+	int size = stride * height;
+
+	memset(mem, 0, sizeof(*mem));
+	mem->size = size * 3 / 2 + size / 4;
+	if (IOGetPhyMem(mem))
+		return -1;
+
+	f->myIndex = fb_num;
+	f->strideY = stride;
+	f->strideC = stride / 2;
+	f->bufY = mem->phy_addr;
+	f->bufCb = f->bufY + size;
+	f->bufCr = f->bufCb + size / 4;
+	f->bufMvCol = f->bufCr + size / 4;
+	return fb_num++;
+}
+
+static void free_fb(void)
+{
+	while (fb_num > 0)
+		IOFreePhyMem(&fb_mem[--fb_num]);
+}
+
+static int open_enc(EncHandle *handle, int width, int height)
+{
+	EncOpenParam op;
+	EncInitialInfo init;
+	EncExtBufInfo ext;
+	int i, n, stride = (width + 15) & ~15;
+
+	memset(&op, 0, sizeof(op));
+	op.bitstreamFormat = STD_AVC;
+	op.bitstreamBuffer = bs_mem.phy_addr;
+	op.bitstreamBufferSize = BS_SIZE;
+	op.picWidth = width;
+	op.picHeight = height;
+	op.frameRateInfo = 30;
+	op.gopSize = 30;
+	op.enableAutoSkip = 1;
+	op.rcIntraQp = -1;
+	op.userGamma = (Uint32)(0.75 * 32768);
+	op.RcIntervalMode = 1;
+	op.ringBufferEnable = 1;
+
+	if (vpu_EncOpen(handle, &op) != RETCODE_SUCCESS)
+		return -1;
+
+	memset(&init, 0, sizeof(init));
+	if (vpu_EncGetInitialInfo(*handle, &init) != RETCODE_SUCCESS)
+		return -1;
+
+	/* references, then subsampling A and B, then the source */
+	n = init.minFrameBufferCount;
+	if (n + 3 > MAX_FB)
+		return -1;
+	for (i = 0; i < n + 3; i++)
+		if (alloc_fb(stride, (height + 15) & ~15) < 0)
+			return -1;
+
+	memset(&ext, 0, sizeof(ext));
+	if (vpu_EncRegisterFrameBuffer(*handle, fb, n, stride, stride,
+				       fb[n].bufY, fb[n + 1].bufY,
+				       &ext) != RETCODE_SUCCESS)
+		return -1;
+
+	return n + 2;
+}
+
+/* wait for the running frame, collect it and drain the ring buffer */
+static int collect(EncHandle handle)
+{
+	EncOutputInfo out;
+	PhysicalAddress rd, wr;
+	Uint32 size;
+	RetCode ret;
+
+	while (vpu_IsBusy())
+		vpu_WaitForInt(200);
+
+	memset(&out, 0, sizeof(out));
+	ret = vpu_EncGetOutputInfo(handle, &out);
+	if (ret != RETCODE_SUCCESS)
+		return -1;
+	/* a frame left queued on a lock timeout starts with the next one */
+	if (out.queueStatus != RETCODE_SUCCESS &&
+	    out.queueStatus != RETCODE_FAILURE_TIMEOUT)
+		return -1;
+
+	if (vpu_EncGetBitstreamBuffer(handle, &rd, &wr, &size) != RETCODE_SUCCESS)
+		return -1;
+	vpu_EncUpdateBitstreamBuffer(handle, size);
+	return 0;
+}
+
+static double now_sec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double run(int width, int height, int frames, int queued)
+{
+	EncHandle handle;
+	EncParam param;
+	double t;
+	int src, sent = 0, done = 0;
+
+	src = open_enc(&handle, width, height);
+	if (src < 0) {
+		printf("encoder open failed\n");
+		free_fb();
+		return -1;
+	}
+
+	memset(&param, 0, sizeof(param));
+	param.sourceFrame = &fb[src];
+	param.quantParam = 30;
+	param.enableAutoSkip = 1;
+
+	t = now_sec();
+	while (done < frames) {
+		if (!queued) {
+			if (vpu_EncStartOneFrame(handle, &param) != RETCODE_SUCCESS)
+				break;
+			sent++;
+		} else {
+			/* keep the queue full behind the running frame */
+			while (sent < frames &&
+			       vpu_EncQueueFrame(handle, &param) == RETCODE_SUCCESS)
+				sent++;
+			if (sent == done)
+				break;
+		}
+		if (collect(handle) < 0)
+			break;
+		done++;
+	}
+	t = now_sec() - t;
+
+	vpu_EncClose(handle);
+	free_fb();
+
+	if (done < frames) {
+		printf("%s run stopped after %d of %d frames\n",
+		       queued ? "queued" : "sync", done, frames);
+		return -1;
+	}
+	return frames / t;
+}
+
+int main(int argc, char **argv)
+{
+	int width = 1920, height = 1080, frames = 300;
+	double sync_fps, queued_fps;
+
+	if (argc >= 3) {
+		width = atoi(argv[1]);
+		height = atoi(argv[2]);
+	}
+	if (argc >= 4)
+		frames = atoi(argv[3]);
+
+	if (vpu_Init(NULL) != RETCODE_SUCCESS)
+		return 1;
+
+	memset(&bs_mem, 0, sizeof(bs_mem));
+	bs_mem.size = BS_SIZE;
+	if (IOGetPhyMem(&bs_mem)) {
+		vpu_UnInit();
+		return 1;
+	}
+
+	sync_fps = run(width, height, frames, 0);
+	queued_fps = run(width, height, frames, 1);
+
+	IOFreePhyMem(&bs_mem);
+	vpu_UnInit();
+
+	if (sync_fps < 0 || queued_fps < 0)
+		return 1;
+
+	printf("%dx%d, %d frames: sync %.1f fps, queued %.1f fps\n",
+	       width, height, frames, sync_fps, queued_fps);
+	return 0;
+}
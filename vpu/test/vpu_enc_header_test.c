@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2015 Freescale Semiconductor, Inc.
+ */
+
+/* The following programs are the sole property of Freescale Semiconductor Inc.,
+ * and contain its proprietary and confidential information. */
+
+/*!
+ * @file vpu_enc_header_test.c
+ *
+ * @brief Repeat ENC_PUT_AVC_HEADER requests must be served from the cache.
+ *
+ * Puts the SPS and PPS of an H.264 encoder twice, clearing the bitstream
+ * buffer in between. The second request of each must not run a command,
+ * must write back the same bytes and set the same size. Built by the
+ * Makefile and by Android.mk, as the Android build maps memory differently.
+ * Needs the VPU, run on the target.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vpu_util.h"
+
+#define BS_SIZE		(1024 * 1024)
+#define WIDTH		320
+#define HEIGHT		240
+#define MAX_FB		8
+
+static vpu_mem_desc bs_mem;
+static vpu_mem_desc fb_mem[MAX_FB];
+static FrameBuffer fb[MAX_FB];
+static int fb_num;
+
+static int alloc_fb(int stride, int height)
+{
+	vpu_mem_desc *mem = &fb_mem[fb_num];
+	FrameBuffer *f = &fb[fb_num];
+	int size = stride * height;
+
+	memset(mem, 0, sizeof(*mem));
+	mem->size = size * 3 / 2 + size / 4;
+	if (IOGetPhyMem(mem))
+		return -1;
+
+	f->myIndex = fb_num;
+	f->strideY = stride;
+	f->strideC = stride / 2;
+	f->bufY = mem->phy_addr;
+	f->bufCb = f->bufY + size;
+	f->bufCr = f->bufCb + size / 4;
+	f->bufMvCol = f->bufCr + size / 4;
+	return fb_num++;
+}
+
+static void free_fb(void)
+{
+	while (fb_num > 0)
+		IOFreePhyMem(&fb_mem[--fb_num]);
+}
+
+static int open_enc(EncHandle *handle)
+{
+	EncOpenParam op;
+	EncInitialInfo init;
+	EncExtBufInfo ext;
+	int i, n;
+
+	memset(&op, 0, sizeof(op));
+	op.bitstreamFormat = STD_AVC;
+	op.bitstreamBuffer = bs_mem.phy_addr;
+	op.bitstreamBufferSize = BS_SIZE;
+	op.picWidth = WIDTH;
+	op.picHeight = HEIGHT;
+	op.frameRateInfo = 30;
+	op.gopSize = 30;
+	op.rcIntraQp = -1;
+	op.userGamma = (Uint32)(0.75 * 32768);
+	op.RcIntervalMode = 1;
+	/* headers go to a fixed place: linear buffer on mx6, given buf before */
+	op.ringBufferEnable = 0;
+	op.dynamicAllocEnable = !cpu_is_mx6x();
+
+	if (vpu_EncOpen(handle, &op) != RETCODE_SUCCESS)
+		return -1;
+
+	memset(&init, 0, sizeof(init));
+	if (vpu_EncGetInitialInfo(*handle, &init) != RETCODE_SUCCESS)
+		return -1;
+
+	n = init.minFrameBufferCount;
+	if (n + 2 > MAX_FB)
+		return -1;
+	for (i = 0; i < n + 2; i++)
+		if (alloc_fb(WIDTH, HEIGHT) < 0)
+			return -1;
+
+	memset(&ext, 0, sizeof(ext));
+	if (vpu_EncRegisterFrameBuffer(*handle, fb, n, WIDTH, WIDTH,
+				       fb[n].bufY, fb[n + 1].bufY,
+				       &ext) != RETCODE_SUCCESS)
+		return -1;
+
+	return 0;
+}
+
+static int put_header(EncHandle handle, int type, EncHeaderParam *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->headerType = type;
+	hdr->buf = bs_mem.phy_addr;
+	hdr->size = BS_SIZE;
+	return vpu_EncGiveCommand(handle, ENC_PUT_AVC_HEADER, hdr) ==
+	       RETCODE_SUCCESS ? 0 : -1;
+}
+
+static int test_header(EncHandle handle, int type, const char *name)
+{
+	Uint8 *bs = (Uint8 *)bs_mem.virt_uaddr;
+	EncHeaderParam first, again;
+	Uint8 *bytes;
+	int saved_before, saved_after, ret = -1;
+
+	if (put_header(handle, type, &first) < 0 || first.size <= 0) {
+		printf("FAIL %s: header command failed\n", name);
+		return -1;
+	}
+	bytes = malloc(first.size);
+	if (bytes == NULL)
+		return -1;
+	memcpy(bytes, bs + (first.buf - bs_mem.phy_addr), first.size);
+
+	memset(bs, 0, BS_SIZE);
+	vpu_EncGiveCommand(handle, ENC_GET_HEADER_CMD_SAVED, &saved_before);
+	if (put_header(handle, type, &again) < 0) {
+		printf("FAIL %s: repeat header command failed\n", name);
+		goto out;
+	}
+	vpu_EncGiveCommand(handle, ENC_GET_HEADER_CMD_SAVED, &saved_after);
+
+	if (saved_after != saved_before + 1)
+		printf("FAIL %s: repeat not served from the cache\n", name);
+	else if (again.buf != first.buf || again.size != first.size)
+		printf("FAIL %s: repeat at %lx size %d, first at %lx size %d\n",
+		       name, again.buf, again.size, first.buf, first.size);
+	else if (memcmp(bs + (again.buf - bs_mem.phy_addr), bytes, first.size))
+		printf("FAIL %s: repeat wrote different bytes\n", name);
+	else
+		ret = 0;
+
+out:
+	free(bytes);
+	return ret;
+}
+
+int main(void)
+{
+	EncHandle handle;
+	int ret = 1;
+
+	if (vpu_Init(NULL) != RETCODE_SUCCESS) {
+		printf("FAIL: vpu_Init\n");
+		return 1;
+	}
+
+	memset(&bs_mem, 0, sizeof(bs_mem));
+	bs_mem.size = BS_SIZE;
+	if (IOGetPhyMem(&bs_mem) || IOGetVirtMem(&bs_mem) <= 0) {
+		printf("FAIL: no bitstream buffer\n");
+		goto out;
+	}
+
+	if (open_enc(&handle) < 0) {
+		printf("FAIL: encoder open\n");
+		free_fb();
+		goto out_bs;
+	}
+
+	if (test_header(handle, SPS_RBSP, "SPS") == 0 &&
+	    test_header(handle, PPS_RBSP, "PPS") == 0)
+		ret = 0;
+
+	vpu_EncClose(handle);
+	free_fb();
+out_bs:
+	IOFreeVirtMem(&bs_mem);
+	IOFreePhyMem(&bs_mem);
+out:
+	vpu_UnInit();
+	printf("%s\n", ret ? "FAIL" : "PASS");
+	return ret;
+}
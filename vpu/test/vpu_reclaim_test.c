@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2015 Freescale Semiconductor, Inc.
+ */
+
+/* The following programs are the sole property of Freescale Semiconductor Inc.,
+ * and contain its proprietary and confidential information. */
+
+/*!
+ * @file vpu_reclaim_test.c
+ *
+ * @brief Kill test for the reclamation of instances of dead processes.
+ *
+ * Children open decoder instances and are killed with SIGKILL, once
+ * outside the API mutex with every free instance taken, and once while
+ * holding the API mutex. Afterwards a fresh process must be able to open
+ * as many instances as before. Needs the VPU, run on the target.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "vpu_util.h"
+
+#define BS_SIZE		(256 * 1024)
+
+extern semaphore_t *vpu_semap;
+
+static vpu_mem_desc bs_mem;
+
+static int open_dec(DecHandle *handle)
+{
+	DecOpenParam op;
+
+	memset(&op, 0, sizeof(op));
+	op.bitstreamFormat = STD_MPEG4;
+	op.bitstreamBuffer = bs_mem.phy_addr;
+	op.pBitStream = (Uint8 *)bs_mem.virt_uaddr;
+	op.bitstreamBufferSize = BS_SIZE;
+
+	return vpu_DecOpen(handle, &op) == RETCODE_SUCCESS;
+}
+
+static int vpu_start(void)
+{
+	if (vpu_Init(NULL) != RETCODE_SUCCESS)
+		return -1;
+
+	memset(&bs_mem, 0, sizeof(bs_mem));
+	bs_mem.size = BS_SIZE;
+	if (IOGetPhyMem(&bs_mem) || IOGetVirtMem(&bs_mem) <= 0)
+		return -1;
+
+	return 0;
+}
+
+/* open as many instances as possible, optionally close them again */
+static int open_all(DecHandle *handle, int close)
+{
+	int i, n = 0;
+
+	while (n < MAX_NUM_INSTANCE && open_dec(&handle[n]))
+		n++;
+
+	if (close)
+		for (i = 0; i < n; i++)
+			vpu_DecClose(handle[i]);
+
+	return n;
+}
+
+/* instances a fresh process can open, -1 on failure */
+static int count_free(void)
+{
+	DecHandle handle[MAX_NUM_INSTANCE];
+	int status, n;
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		if (vpu_start() < 0)
+			_exit(255);
+		n = open_all(handle, 1);
+		IOFreeVirtMem(&bs_mem);
+		IOFreePhyMem(&bs_mem);
+		vpu_UnInit();
+		_exit(n);
+	}
+
+	if (pid < 0 || waitpid(pid, &status, 0) != pid ||
+	    !WIFEXITED(status) || WEXITSTATUS(status) == 255)
+		return -1;
+
+	return WEXITSTATUS(status);
+}
+
+/* a child that opens instances and dies, with the API mutex if locked */
+static int run_killed(int all, int locked)
+{
+	DecHandle handle[MAX_NUM_INSTANCE];
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		if (vpu_start() < 0)
+			_exit(1);
+		if (all)
+			open_all(handle, 0);
+		else if (!open_dec(&handle[0]))
+			_exit(1);
+		if (locked && !semaphore_wait(vpu_semap, API_MUTEX))
+			_exit(1);
+		kill(getpid(), SIGKILL);
+		_exit(1);
+	}
+
+	if (pid < 0 || waitpid(pid, &status, 0) != pid)
+		return -1;
+
+	return WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL ? 0 : -1;
+}
+
+int main(void)
+{
+	int before, after, fail = 0;
+
+	before = count_free();
+	if (before <= 0) {
+		printf("no decoder instance can be opened\n");
+		return 1;
+	}
+
+	/* no EOWNERDEAD, the full pool has to be scanned */
+	if (run_killed(1, 0) < 0) {
+		printf("killed child without lock did not run\n");
+		return 1;
+	}
+	after = count_free();
+	printf("killed without lock: %d of %d instances free\n", after, before);
+	if (after != before)
+		fail++;
+
+	/* EOWNERDEAD on the next lock */
+	if (run_killed(0, 1) < 0) {
+		printf("killed child holding the lock did not run\n");
+		return 1;
+	}
+	after = count_free();
+	printf("killed holding lock: %d of %d instances free\n", after, before);
+	if (after != before)
+		fail++;
+
+	printf("%s\n", fail ? "FAIL" : "PASS");
+	return fail ? 1 : 0;
+}
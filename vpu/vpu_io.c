@@ -748,6 +748,55 @@ int IOFreeVirtMem(vpu_mem_desc * buff)
 	return 0;
 }
 
+/*!
+ * @brief Map a physical range through the VPU device in every build.
+ *
+ * Unlike IOGetVirtMem(), which returns the allocator's mapping on Android,
+ * this maps any range the VPU owns, such as a bitstream buffer known only
+ * by its physical address. phy_addr must be page aligned.
+ *
+ * @param	buff	the structure containing memory information to be mapped.
+ *
+ * @return	user space address on success or -1 ((int)MAP_FAILED) on failure.
+ */
+int IOMapPhyMem(vpu_mem_desc * buff)
+{
+	unsigned long va_addr;
+
+	va_addr = (unsigned long)mmap(NULL, buff->size, PROT_READ | PROT_WRITE,
+				      MAP_SHARED, vpu_fd, buff->phy_addr);
+	if ((void *)va_addr == MAP_FAILED) {
+		buff->virt_uaddr = 0;
+		return -1;
+	}
+
+	buff->virt_uaddr = va_addr;
+	return va_addr;
+}
+
+/*!
+ * @brief Unmap a range mapped by IOMapPhyMem().
+ *
+ * @param	buff	the structure containing memory information to be unmapped;
+ *
+ * @return
+ * @li 0        Success
+ * @li Others 	Failure
+ */
+int IOUnmapPhyMem(vpu_mem_desc * buff)
+{
+	int ret = 0;
+
+	if (buff->virt_uaddr != 0) {
+		ret = munmap((void *)buff->virt_uaddr, buff->size);
+		if (ret != 0)
+			err_msg("munmap failed\n");
+	}
+
+	buff->virt_uaddr = 0;
+	return ret;
+}
+
 /*!
  * @brief map vmalloced share memory to user space.
  *
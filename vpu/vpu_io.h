@@ -66,6 +66,8 @@ int IOGetPhyMem(vpu_mem_desc * buff);
 int IOFreePhyMem(vpu_mem_desc * buff);
 int IOGetVirtMem(vpu_mem_desc * buff);
 int IOFreeVirtMem(vpu_mem_desc * buff);
+int IOMapPhyMem(vpu_mem_desc * buff);
+int IOUnmapPhyMem(vpu_mem_desc * buff);
 int IOGetVShareMem(int size);
 int IOWaitForInt(int timeout_in_ms);
 int IOPhyMemCheck(unsigned long phyaddr, const char *name);
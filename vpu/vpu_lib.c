@@ -65,6 +65,89 @@ static __inline void LeaveInit()
 	pthread_mutex_unlock(&lock);
 }
 
+static void GetIramPlan(SecAxiUse *pSecAxiUse, IramPlanInfo *pInfo)
+{
+	pInfo->iramSize = pSecAxiUse->iramSize;
+	pInfo->iramUsed = pSecAxiUse->iramUsed;
+	pInfo->bwSaved = pSecAxiUse->bwSaved;
+	pInfo->useMe = pSecAxiUse->useHostMeEnable;
+	pInfo->useDbk = pSecAxiUse->useHostDbkEnable;
+	pInfo->useBit = pSecAxiUse->useHostBitEnable;
+	pInfo->useIp = pSecAxiUse->useHostIpEnable;
+	pInfo->useOvl = pSecAxiUse->useHostOvlEnable;
+}
+
+/*
+ * Stamp the end of a picture in Maverick cache tuning mode, the first time
+ * the library sees the VPU idle after PIC_RUN.
+ */
+static void DecCacheTunePicDone(CodecInst *pCodecInst)
+{
+	DecInfo *pDecInfo;
+
+	if (pCodecInst == NULL || pCodecInst->codecMode == MJPG_DEC ||
+	    pCodecInst->codecMode == MJPG_ENC ||
+	    pCodecInst->codecMode == AVC_ENC || pCodecInst->codecMode == MP4_ENC)
+		return;
+
+	pDecInfo = &pCodecInst->CodecInfo.decInfo;
+	if (pDecInfo->cacheTuneCand < 0 || pDecInfo->cacheTuneEnded)
+		return;
+
+	gettimeofday(&pDecInfo->cacheTuneEnd, NULL);
+	pDecInfo->cacheTuneEnded = 1;
+}
+
+/*
+ * Accumulate the decode time of one frame in Maverick cache tuning mode.
+ * The first frames warm up the cache and are not timed, nor are frames
+ * whose end was not seen by vpu_WaitForInt() or vpu_IsBusy(), since the
+ * time until vpu_DecGetOutputInfo() includes the latency of the caller.
+ */
+static void DecCacheTuneFrameDone(DecInfo *pDecInfo)
+{
+	Int64 us;
+
+	if (!pDecInfo->cacheTuneEnded)
+		return;
+	if (pDecInfo->cacheTuneSkip < MAVERICK_CACHE_TUNE_SKIP) {
+		pDecInfo->cacheTuneSkip++;
+		return;
+	}
+	if (pDecInfo->cacheTuneFrames >= MAVERICK_CACHE_TUNE_FRAMES)
+		return;
+
+	us = (Int64)(pDecInfo->cacheTuneEnd.tv_sec -
+		     pDecInfo->cacheTuneStart.tv_sec) * 1000000 +
+	     (pDecInfo->cacheTuneEnd.tv_usec - pDecInfo->cacheTuneStart.tv_usec);
+	pDecInfo->cacheTuneTime += us;
+	pDecInfo->cacheTuneFrames++;
+}
+
+/*
+ * Encoder commands which only read state back; any other command may change
+ * a parameter carried in the SPS/PPS/VOL headers.
+ */
+static __inline int is_enc_query_command(CodecCommand cmd)
+{
+	switch (cmd) {
+	case ENC_GET_SPS_RBSP:
+	case ENC_GET_PPS_RBSP:
+	case ENC_PUT_MP4_HEADER:
+	case ENC_PUT_AVC_HEADER:
+	case ENC_GET_VIDEO_HEADER:
+	case ENC_GET_VOS_HEADER:
+	case ENC_GET_VO_HEADER:
+	case ENC_GET_VOL_HEADER:
+	case ENC_GET_JPEG_HEADER:
+	case GET_IRAM_PLAN:
+	case ENC_GET_HEADER_CMD_SAVED:
+		return true;
+	default:
+		return false;
+	}
+}
+
 static __inline int is_mx6x_mjpg_codec(int codecMode)
 {
 	if (cpu_is_mx6x() && (codecMode == MJPG_DEC ||
@@ -114,6 +197,8 @@ int vpu_IsBusy()
 			}
 		}
 	}
+	if (cpu_is_mx6x() && !vpu_busy && !jpu_busy)
+		DecCacheTunePicDone(*ppendingInst);
 	IOClkGateSet(false);
 
 	return (vpu_busy != 0 || jpu_busy != 0);
@@ -243,6 +328,8 @@ int vpu_WaitForInt(int timeout_in_ms)
 	if (ret == 0) {
 		pCodecInst = *ppendingInst;
 		log_time(pCodecInst->instIndex, PIC_DONE);
+		if (cpu_is_mx6x())
+			DecCacheTunePicDone(pCodecInst);
 	}
 
 	return ret;
@@ -1074,6 +1161,7 @@ RetCode vpu_EncGetInitialInfo(EncHandle handle, EncInitialInfo * info)
 
 	/* Set secondAXI IRAM */
 	iramParam.width = pEncOP->picWidth;
+	iramParam.height = pEncOP->picHeight;
 	SetEncSecondAXIIRAM(&pEncInfo->secAxiUse, &iramParam);
 
 	if (!cpu_is_mx6x()) {
@@ -1320,6 +1408,22 @@ RetCode vpu_EncRegisterFrameBuffer(EncHandle handle, FrameBuffer * bufArray,
 	return RETCODE_SUCCESS;
 }
 
+/*
+ * End of the encoder output the application can read, VPU register lock
+ * held. A frame started from the queue writes on behind the collected
+ * one, so the pointer saved at collection is the end until it is done.
+ */
+static PhysicalAddress EncStreamWrPtr(CodecInst *pCodecInst, int instIndex)
+{
+	EncInfo *pEncInfo = &pCodecInst->CodecInfo.encInfo;
+
+	if (pEncInfo->encQueueRunning && *ppendingInst == pCodecInst)
+		return pEncInfo->encOutWrPtr;
+
+	return (pCodecInst->instIndex == instIndex) ?
+		VpuReadReg(BIT_WR_PTR) : pCodecInst->ctxRegs[CTX_BIT_WR_PTR];
+}
+
 RetCode vpu_EncGetBitstreamBuffer(EncHandle handle,
 				  PhysicalAddress * prdPtr,
 				  PhysicalAddress * pwrPtr, Uint32 * size)
@@ -1374,9 +1478,7 @@ RetCode vpu_EncGetBitstreamBuffer(EncHandle handle,
 	/* Check current instance is in running or not, if not
 	   Get the pointer from back context regs */
 	instIndex = (int)VpuReadReg(BIT_RUN_INDEX);
-	wrPtr = (pCodecInst->instIndex == instIndex) ?
-		    VpuReadReg(BIT_WR_PTR) :
-		    pCodecInst->ctxRegs[CTX_BIT_WR_PTR];
+	wrPtr = EncStreamWrPtr(pCodecInst, instIndex);
 	UnlockVpuReg(vpu_semap);
 
 	if (pEncInfo->ringBufferEnable == 1) {
@@ -1461,9 +1563,7 @@ RetCode vpu_EncUpdateBitstreamBuffer(EncHandle handle, Uint32 size)
 	}
 
 	instIndex = (int)VpuReadReg(BIT_RUN_INDEX);
-	wrPtr = (pCodecInst->instIndex == instIndex) ?
-		    VpuReadReg(BIT_WR_PTR) :
-		    pCodecInst->ctxRegs[CTX_BIT_WR_PTR];
+	wrPtr = EncStreamWrPtr(pCodecInst, instIndex);
 	UnlockVpuReg(vpu_semap);
 
 	if (rdPtr < wrPtr) {
@@ -1497,24 +1597,13 @@ RetCode vpu_EncUpdateBitstreamBuffer(EncHandle handle, Uint32 size)
 	return RETCODE_SUCCESS;
 }
 
-/*!
- * @brief Starts encoding one frame.
- *
- * @param handle [Input] The handle obtained from vpu_EncOpen().
- * @param pParam [Input] Pointer to EncParam data structure.
- *
- * @return
- * @li RETCODE_SUCCESS Successful operation.
- * @li RETCODE_INVALID_HANDLE encHandle is invalid.
- * @li RETCODE_FRAME_NOT_COMPLETE A frame has not been finished.
- * @li RETCODE_WRONG_CALL_SEQUENCE Wrong calling sequence.
- * @li RETCODE_INVALID_PARAM pParam is invalid.
- * @li RETCODE_INVALID_FRAME_BUFFER skipPicture in EncParam is 0
- * and sourceFrame in EncParam is a null pointer.
+/*
+ * Program the registers for one picture and issue PIC_RUN. Called with
+ * the VPU lock held and param already checked; the lock stays held
+ * until vpu_EncGetOutputInfo() collects the picture.
  */
-RetCode vpu_EncStartOneFrame(EncHandle handle, EncParam * param)
+static RetCode EncIssueFrame(CodecInst *pCodecInst, EncParam *param)
 {
-	CodecInst *pCodecInst;
 	EncInfo *pEncInfo;
 	FrameBuffer *pSrcFrame;
 	Uint32 rotMirEnable = 0;
@@ -1522,8 +1611,6 @@ RetCode vpu_EncStartOneFrame(EncHandle handle, EncParam * param)
 	Uint32 val;
 	RetCode ret;
 
-	ENTER_FUNC();
-
 	/* When doing pre-rotation, mirroring is applied first and rotation
 	 * later, vice versa when doing post-rotation.
 	 * For consistency, pre-rotation is converted to post-rotation
@@ -1534,28 +1621,9 @@ RetCode vpu_EncStartOneFrame(EncHandle handle, EncParam * param)
 		6, 5, 4, 7, 2, 3, 0, 1
 	};
 
-	ret = CheckEncInstanceValidity(handle);
-	if (ret != RETCODE_SUCCESS)
-		return ret;
-
-	pCodecInst = handle;
 	pEncInfo = &pCodecInst->CodecInfo.encInfo;
-
-	/* This means frame buffers have not been registered. */
-	if (!is_mx6x_mjpg_codec(pCodecInst->codecMode) && pEncInfo->frameBufPool == 0) {
-		return RETCODE_WRONG_CALL_SEQUENCE;
-	}
-
-	ret = CheckEncParam(pCodecInst, param);
-	if (ret != RETCODE_SUCCESS) {
-		return ret;
-	}
-
 	pSrcFrame = param->sourceFrame;
 
-	if (!LockVpu(vpu_semap))
-		return RETCODE_FAILURE_TIMEOUT;
-
 	/* Workaround for RTL bug of H264 encoder on mx6q */
 	if (cpu_is_mx6q() && (pCodecInst->codecMode == AVC_ENC))
 		vpu_mx6_swreset(0);
@@ -1840,6 +1908,179 @@ RetCode vpu_EncStartOneFrame(EncHandle handle, EncParam * param)
 	return RETCODE_SUCCESS;
 }
 
+/*!
+ * @brief Starts encoding one frame.
+ *
+ * @param handle [Input] The handle obtained from vpu_EncOpen().
+ * @param pParam [Input] Pointer to EncParam data structure.
+ *
+ * @return
+ * @li RETCODE_SUCCESS Successful operation.
+ * @li RETCODE_INVALID_HANDLE encHandle is invalid.
+ * @li RETCODE_FRAME_NOT_COMPLETE A frame has not been finished.
+ * @li RETCODE_WRONG_CALL_SEQUENCE Wrong calling sequence.
+ * @li RETCODE_INVALID_PARAM pParam is invalid.
+ * @li RETCODE_INVALID_FRAME_BUFFER skipPicture in EncParam is 0
+ * and sourceFrame in EncParam is a null pointer.
+ */
+RetCode vpu_EncStartOneFrame(EncHandle handle, EncParam * param)
+{
+	CodecInst *pCodecInst;
+	EncInfo *pEncInfo;
+	RetCode ret;
+
+	ENTER_FUNC();
+
+	ret = CheckEncInstanceValidity(handle);
+	if (ret != RETCODE_SUCCESS)
+		return ret;
+
+	pCodecInst = handle;
+	pEncInfo = &pCodecInst->CodecInfo.encInfo;
+
+	/* This means frame buffers have not been registered. */
+	if (!is_mx6x_mjpg_codec(pCodecInst->codecMode) && pEncInfo->frameBufPool == 0) {
+		return RETCODE_WRONG_CALL_SEQUENCE;
+	}
+
+	/* Frames queued by vpu_EncQueueFrame() have to go first */
+	if (pEncInfo->encQueueCount)
+		return RETCODE_WRONG_CALL_SEQUENCE;
+
+	ret = CheckEncParam(pCodecInst, param);
+	if (ret != RETCODE_SUCCESS) {
+		return ret;
+	}
+
+	if (!LockVpu(vpu_semap))
+		return RETCODE_FAILURE_TIMEOUT;
+
+	pEncInfo->encQueueRunning = 0;
+	return EncIssueFrame(pCodecInst, param);
+}
+
+static void EncQueuePush(EncInfo *pEncInfo, EncParam *param)
+{
+	EncQueueEntry *e;
+
+	e = &pEncInfo->encQueue[(pEncInfo->encQueueHead +
+				 pEncInfo->encQueueCount) % ENC_QUEUE_DEPTH];
+	e->param = *param;
+	if (param->sourceFrame) {
+		e->srcFrame = *param->sourceFrame;
+		e->param.sourceFrame = &e->srcFrame;
+	}
+	pEncInfo->encQueueCount++;
+}
+
+/* Start the oldest queued frame, the VPU lock must be held */
+static RetCode EncStartQueuedFrame(CodecInst *pCodecInst)
+{
+	EncInfo *pEncInfo = &pCodecInst->CodecInfo.encInfo;
+	EncQueueEntry *e;
+
+	e = &pEncInfo->encQueue[pEncInfo->encQueueHead];
+	pEncInfo->encQueueHead = (pEncInfo->encQueueHead + 1) % ENC_QUEUE_DEPTH;
+	pEncInfo->encQueueCount--;
+
+	pEncInfo->encQueueRunning = 1;
+	return EncIssueFrame(pCodecInst, &e->param);
+}
+
+/* Whether another open instance may be waiting for the VPU */
+static int EncVpuShared(CodecInst *pCodecInst)
+{
+	CodecInst *pInst;
+	int i;
+
+	for (i = 0; i < MAX_NUM_INSTANCE; ++i) {
+		pInst = (CodecInst *)(&vpu_shared_mem->codecInstPool[i]);
+		if (pInst != pCodecInst && pInst->inUse)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*!
+ * @brief Queues one frame for encoding.
+ *
+ * The frame is checked and copied into the instance's submission queue,
+ * which holds up to ENC_QUEUE_DEPTH frames behind the one being encoded.
+ * If the encoder is idle it is started right away, otherwise
+ * vpu_EncGetOutputInfo() starts it once the previous frame is collected,
+ * so the VPU does not wait for the application between frames.
+ * sourceFrame is copied, the buffers it points to must stay valid until
+ * the frame has been encoded.
+ *
+ * Queueing behind a running frame needs ring buffer mode or dynamic
+ * bitstream buffer allocation, since in line buffer mode the next frame
+ * would overwrite the output of the previous one before it is read.
+ *
+ * @param handle [Input] The handle obtained from vpu_EncOpen().
+ * @param pParam [Input] Pointer to EncParam data structure.
+ *
+ * @return
+ * @li RETCODE_SUCCESS Successful operation.
+ * @li RETCODE_INVALID_HANDLE encHandle is invalid.
+ * @li RETCODE_FRAME_NOT_COMPLETE The queue is full.
+ * @li RETCODE_WRONG_CALL_SEQUENCE Wrong calling sequence.
+ * @li RETCODE_INVALID_PARAM pParam is invalid.
+ * @li RETCODE_NOT_SUPPORTED Queueing is not possible for this instance.
+ */
+RetCode vpu_EncQueueFrame(EncHandle handle, EncParam * param)
+{
+	CodecInst *pCodecInst;
+	EncInfo *pEncInfo;
+	RetCode ret;
+
+	ENTER_FUNC();
+
+	ret = CheckEncInstanceValidity(handle);
+	if (ret != RETCODE_SUCCESS)
+		return ret;
+
+	pCodecInst = handle;
+	pEncInfo = &pCodecInst->CodecInfo.encInfo;
+
+	if (is_mx6x_mjpg_codec(pCodecInst->codecMode))
+		return RETCODE_NOT_SUPPORTED;
+
+	if (pEncInfo->frameBufPool == 0)
+		return RETCODE_WRONG_CALL_SEQUENCE;
+
+	if (!pEncInfo->ringBufferEnable && !pEncInfo->dynamicAllocEnable &&
+	    (*ppendingInst == pCodecInst || pEncInfo->encQueueCount)) {
+		err_msg("Frames can't be queued in line buffer mode\n");
+		return RETCODE_NOT_SUPPORTED;
+	}
+
+	ret = CheckEncParam(pCodecInst, param);
+	if (ret != RETCODE_SUCCESS)
+		return ret;
+
+	if (*ppendingInst == pCodecInst) {
+		if (pEncInfo->encQueueCount == ENC_QUEUE_DEPTH)
+			return RETCODE_FRAME_NOT_COMPLETE;
+		EncQueuePush(pEncInfo, param);
+		return RETCODE_SUCCESS;
+	}
+
+	if (!LockVpu(vpu_semap))
+		return RETCODE_FAILURE_TIMEOUT;
+
+	/* A frame is left queued if chaining it timed out on the lock */
+	if (pEncInfo->encQueueCount) {
+		ret = EncStartQueuedFrame(pCodecInst);
+		if (ret == RETCODE_SUCCESS)
+			EncQueuePush(pEncInfo, param);
+		return ret;
+	}
+
+	pEncInfo->encQueueRunning = 1;
+	return EncIssueFrame(pCodecInst, param);
+}
+
 /*!
  * @brief Get information of the output of encoding.
  *
@@ -1847,10 +2088,22 @@ RetCode vpu_EncStartOneFrame(EncHandle handle, EncParam * param)
  * @param info [Output] Pointer to EncOutputInfo data structure.
  *
  * @return
- * @li RETCODE_SUCCESS Successful operation.
+ * Once a frame is collected the next queued one is started, and
+ * info->queueStatus tells how that went: RETCODE_FAILURE_TIMEOUT leaves it
+ * queued for the next call of this function or of vpu_EncQueueFrame(),
+ * other errors mean it could not be started and was dropped. In ring
+ * buffer mode vpu_EncGetBitstreamBuffer() returns only the output of the
+ * collected frame while the queued one runs.
+ *
+ * @return
+ * @li RETCODE_SUCCESS Successful operation, info is valid.
  * @li RETCODE_INVALID_HANDLE encHandle is invalid.
  * @li RETCODE_WRONG_CALL_SEQUENCE Wrong calling sequence.
  * @li RETCODE_INVALID_PARAM info is a null pointer.
+ * @li RETCODE_FAILURE_TIMEOUT No frame was running and the VPU lock timed
+ * out starting the oldest queued frame.
+ * @li RETCODE_FRAME_NOT_COMPLETE No frame was running; the oldest queued
+ * frame has been started instead, wait for it and call again.
  */
 RetCode vpu_EncGetOutputInfo(EncHandle handle, EncOutputInfo * info)
 {
@@ -1873,6 +2126,19 @@ RetCode vpu_EncGetOutputInfo(EncHandle handle, EncOutputInfo * info)
 
 	pCodecInst = handle;
 	pEncInfo = &pCodecInst->CodecInfo.encInfo;
+	info->queueStatus = RETCODE_SUCCESS;
+
+	/* Queued frames left behind by a failed hand-over, start the oldest */
+	if (*ppendingInst == 0 && pEncInfo->encQueueCount) {
+		if (!LockVpu(vpu_semap))
+			return RETCODE_FAILURE_TIMEOUT;
+		ret = EncStartQueuedFrame(pCodecInst);
+		if (ret != RETCODE_SUCCESS) {
+			UnlockVpu(vpu_semap);
+			return ret;
+		}
+		return RETCODE_FRAME_NOT_COMPLETE;
+	}
 
 	if (*ppendingInst == 0) {
 		return RETCODE_WRONG_CALL_SEQUENCE;
@@ -2043,8 +2309,38 @@ RetCode vpu_EncGetOutputInfo(EncHandle handle, EncOutputInfo * info)
 	/* Backup context regs */
 	pCodecInst->ctxRegs[CTX_BIT_WR_PTR] = VpuReadReg(BIT_WR_PTR);
 	pCodecInst->ctxRegs[CTX_BIT_STREAM_PARAM] = VpuReadReg(BIT_BIT_STREAM_PARAM);
+	pEncInfo->encOutWrPtr = pCodecInst->ctxRegs[CTX_BIT_WR_PTR];
+	pEncInfo->encQueueRunning = 0;
 	*ppendingInst = 0;
-	UnlockVpu(vpu_semap);
+
+	if (pEncInfo->encQueueCount == 0) {
+		UnlockVpu(vpu_semap);
+		return RETCODE_SUCCESS;
+	}
+
+	/*
+	 * Start the next queued frame now. Keep the lock when nobody else
+	 * can be waiting for it, otherwise give other instances a turn.
+	 * info is valid either way, a failure goes to info->queueStatus: on
+	 * a lock timeout the frame stays queued for the next
+	 * vpu_EncQueueFrame() or vpu_EncGetOutputInfo(), a frame the VPU
+	 * could not be set up for is dropped.
+	 */
+	if (EncVpuShared(pCodecInst)) {
+		UnlockVpu(vpu_semap);
+		if (!LockVpu(vpu_semap)) {
+			err_msg("queued frame not started, lock timeout\n");
+			info->queueStatus = RETCODE_FAILURE_TIMEOUT;
+			return RETCODE_SUCCESS;
+		}
+	}
+
+	ret = EncStartQueuedFrame(pCodecInst);
+	if (ret != RETCODE_SUCCESS) {
+		err_msg("failed to start queued frame, dropped\n");
+		UnlockVpu(vpu_semap);
+		info->queueStatus = ret;
+	}
 
 	return RETCODE_SUCCESS;
 }
@@ -2077,6 +2373,9 @@ RetCode vpu_EncGiveCommand(EncHandle handle, CodecCommand cmd, void *param)
 	pCodecInst = handle;
 	pEncInfo = &pCodecInst->CodecInfo.encInfo;
 
+	if (!is_enc_query_command(cmd))
+		InvalidateParaSetCache(pEncInfo);
+
 	switch (cmd) {
 	case ENABLE_ROTATION:
 		{
@@ -2152,10 +2451,14 @@ RetCode vpu_EncGiveCommand(EncHandle handle, CodecCommand cmd, void *param)
 				return RETCODE_INVALID_PARAM;
 			}
 
+			if (GetCachedParaSet(pEncInfo, ENC_HDR_SPS, param))
+				break;
+
 			if (!LockVpu(vpu_semap))
 				return RETCODE_FAILURE_TIMEOUT;
 
 			GetParaSet(handle, 0, param);
+			PutCachedParaSet(pEncInfo, ENC_HDR_SPS, param);
 			UnlockVpu(vpu_semap);
 			break;
 		}
@@ -2170,10 +2473,14 @@ RetCode vpu_EncGiveCommand(EncHandle handle, CodecCommand cmd, void *param)
 				return RETCODE_INVALID_PARAM;
 			}
 
+			if (GetCachedParaSet(pEncInfo, ENC_HDR_PPS, param))
+				break;
+
 			if (!LockVpu(vpu_semap))
 				return RETCODE_FAILURE_TIMEOUT;
 
 			GetParaSet(handle, 1, param);
+			PutCachedParaSet(pEncInfo, ENC_HDR_PPS, param);
 			UnlockVpu(vpu_semap);
 			break;
 		}
@@ -2196,11 +2503,15 @@ RetCode vpu_EncGiveCommand(EncHandle handle, CodecCommand cmd, void *param)
 				return RETCODE_INVALID_PARAM;
 			}
 
+			if (GetCachedHeader(handle, encHeaderParam))
+				break;
+
 			if (!LockVpu(vpu_semap))
 				return RETCODE_FAILURE_TIMEOUT;
 
 			EncodeHeader(handle, encHeaderParam);
 			UnlockVpu(vpu_semap);
+			PutCachedHeader(handle, encHeaderParam);
 			break;
 		}
 
@@ -2222,11 +2533,15 @@ RetCode vpu_EncGiveCommand(EncHandle handle, CodecCommand cmd, void *param)
 				return RETCODE_INVALID_PARAM;
 			}
 
+			if (GetCachedHeader(handle, encHeaderParam))
+				break;
+
 			if (!LockVpu(vpu_semap))
 				return RETCODE_FAILURE_TIMEOUT;
 
 			EncodeHeader(handle, encHeaderParam);
 			UnlockVpu(vpu_semap);
+			PutCachedHeader(handle, encHeaderParam);
 			break;
 		}
 
@@ -2302,10 +2617,14 @@ RetCode vpu_EncGiveCommand(EncHandle handle, CodecCommand cmd, void *param)
 				return RETCODE_INVALID_PARAM;
 			}
 
+			if (GetCachedParaSet(pEncInfo, ENC_HDR_VOS, param))
+				break;
+
 			if (!LockVpu(vpu_semap))
 				return RETCODE_FAILURE_TIMEOUT;
 
 			GetParaSet(handle, 1, param);
+			PutCachedParaSet(pEncInfo, ENC_HDR_VOS, param);
 			UnlockVpu(vpu_semap);
 
 			break;
@@ -2320,10 +2639,14 @@ RetCode vpu_EncGiveCommand(EncHandle handle, CodecCommand cmd, void *param)
 				return RETCODE_INVALID_PARAM;
 			}
 
+			if (GetCachedParaSet(pEncInfo, ENC_HDR_VO, param))
+				break;
+
 			if (!LockVpu(vpu_semap))
 				return RETCODE_FAILURE_TIMEOUT;
 
 			GetParaSet(handle, 2, param);
+			PutCachedParaSet(pEncInfo, ENC_HDR_VO, param);
 			UnlockVpu(vpu_semap);
 
 			break;
@@ -2338,10 +2661,14 @@ RetCode vpu_EncGiveCommand(EncHandle handle, CodecCommand cmd, void *param)
 				return RETCODE_INVALID_PARAM;
 			}
 
+			if (GetCachedParaSet(pEncInfo, ENC_HDR_VOL, param))
+				break;
+
 			if (!LockVpu(vpu_semap))
 				return RETCODE_FAILURE_TIMEOUT;
 
 			GetParaSet(handle, 0, param);
+			PutCachedParaSet(pEncInfo, ENC_HDR_VOL, param);
 			UnlockVpu(vpu_semap);
 
 			break;
@@ -2585,6 +2912,22 @@ RetCode vpu_EncGiveCommand(EncHandle handle, CodecCommand cmd, void *param)
 			break;
 		}
 
+	case GET_IRAM_PLAN:
+		{
+			if (param == 0)
+				return RETCODE_INVALID_PARAM;
+			GetIramPlan(&pEncInfo->secAxiUse, (IramPlanInfo *)param);
+			break;
+		}
+
+	case ENC_GET_HEADER_CMD_SAVED:
+		{
+			if (param == 0)
+				return RETCODE_INVALID_PARAM;
+			*(int *)param = pEncInfo->headerCmdSaved;
+			break;
+		}
+
 	default:
 		err_msg("Invalid encoder command\n");
 		return RETCODE_INVALID_COMMAND;
@@ -2740,6 +3083,7 @@ RetCode vpu_DecOpen(DecHandle * pHandle, DecOpenParam * pop)
 		pDecInfo->mapType = pop->mapType;
 		pDecInfo->tiledLinearEnable = pop->tiled2LinearEnable;
 		pDecInfo->cacheConfig.Bypass = 1;
+		pDecInfo->cacheTuneCand = -1;
 #ifdef MEM_PROTECT
 		for (i = 0; i < 6; i++)
 			pDecInfo->writeMemProtectCfg.region[i].enable = 0;
@@ -2835,6 +3179,8 @@ RetCode vpu_DecClose(DecHandle handle)
 	CodecInst *pCodecInst;
 	DecInfo *pDecInfo;
 	RetCode ret;
+	int tuneFrames, tuneCodec = 0, tuneWidth = 0, tuneHeight = 0;
+	int tuneMap = 0, tuneCi = 0, tuneCand = 0, tuneUs = 0;
 
 	ENTER_FUNC();
 
@@ -2873,9 +3219,25 @@ dec_out:
 	/* Free context buf Mem */
 	IOFreePhyMem(&pCodecInst->contextBufMem);
 
+	/* the tuning file is written once the VPU is unlocked */
+	tuneFrames = pDecInfo->cacheTuneCand >= 0 ? pDecInfo->cacheTuneFrames : 0;
+	if (tuneFrames) {
+		tuneCodec = pCodecInst->codecMode;
+		tuneWidth = pDecInfo->initialInfo.picWidth;
+		tuneHeight = pDecInfo->initialInfo.picHeight;
+		tuneMap = pDecInfo->mapType;
+		tuneCi = pDecInfo->openParam.chromaInterleave;
+		tuneCand = pDecInfo->cacheTuneCand;
+		tuneUs = pDecInfo->cacheTuneTime / tuneFrames;
+	}
+
 	FreeCodecInstance(pCodecInst);
 	UnlockVpu(vpu_semap);
 
+	if (tuneFrames)
+		PutMaverickCacheTime(tuneCodec, tuneWidth, tuneHeight, tuneMap,
+				     tuneCi, tuneCand, tuneFrames, tuneUs);
+
 	return RETCODE_SUCCESS;
 }
 
@@ -2931,6 +3293,8 @@ RetCode vpu_DecGetInitialInfo(DecHandle handle, DecInitialInfo * info)
 	SetIramParam iramParam;
 #endif
 	RetCode ret;
+	char *tune_env;
+	int tuning, cacheCand;
 
 	ENTER_FUNC();
 
@@ -3282,9 +3646,21 @@ RetCode vpu_DecGetInitialInfo(DecHandle handle, DecInitialInfo * info)
 
 	if (cpu_is_mx6x()) {
 		SetTiledMapTypeInfo(pDecInfo->mapType, &pDecInfo->sTiledInfo);
-		/* Enable 2-D cache */
-		SetMaverickCache(&pDecInfo->cacheConfig, pDecInfo->mapType,
-			    pDecInfo->openParam.chromaInterleave);
+		/*
+		 * Enable 2-D cache with the fastest configuration benchmarked for
+		 * this stream type, or benchmark the next one in tuning mode
+		 */
+		tune_env = getenv("VPU_CACHE_TUNE");
+		tuning = tune_env ? atoi(tune_env) : 0;
+		cacheCand = GetMaverickCacheCand(pCodecInst->codecMode,
+				info->picWidth, info->picHeight, pDecInfo->mapType,
+				pDecInfo->openParam.chromaInterleave, &tuning);
+		SetMaverickCacheCand(&pDecInfo->cacheConfig, pDecInfo->mapType,
+			    pDecInfo->openParam.chromaInterleave, cacheCand);
+		pDecInfo->cacheTuneCand = tuning ? cacheCand : -1;
+		pDecInfo->cacheTuneSkip = 0;
+		pDecInfo->cacheTuneFrames = 0;
+		pDecInfo->cacheTuneTime = 0;
 	}
 
 	return RETCODE_SUCCESS;
@@ -4214,6 +4590,10 @@ RetCode vpu_DecStartOneFrame(DecHandle handle, DecParam * param)
 	VpuWriteReg(BIT_AXI_SRAM_USE, reg);
 
 	BitIssueCommand(pCodecInst, PIC_RUN);
+	if (pDecInfo->cacheTuneCand >= 0) {
+		gettimeofday(&pDecInfo->cacheTuneStart, NULL);
+		pDecInfo->cacheTuneEnded = 0;
+	}
 
 	*ppendingInst = pCodecInst;
 	return RETCODE_SUCCESS;
@@ -4325,6 +4705,9 @@ RetCode vpu_DecGetOutputInfo(DecHandle handle, DecOutputInfo * info)
 	if (VpuReadReg(BIT_BUSY_FLAG))
 		err_msg("fatal: VPU is busy in %s\n", __func__);
 
+	if (pDecInfo->cacheTuneCand >= 0)
+		DecCacheTuneFrameDone(pDecInfo);
+
 	val = VpuReadReg(RET_DEC_PIC_SUCCESS);
 	info->decodingSuccess = (val & 0x01);
 
@@ -5079,6 +5462,14 @@ RetCode vpu_DecGiveCommand(DecHandle handle, CodecCommand cmd, void *param)
 			break;
 		}
 
+	case GET_IRAM_PLAN:
+		{
+			if (param == 0)
+				return RETCODE_INVALID_PARAM;
+			GetIramPlan(&pDecInfo->secAxiUse, (IramPlanInfo *)param);
+			break;
+		}
+
 	default:
 		return RETCODE_INVALID_COMMAND;
 	}
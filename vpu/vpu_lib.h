@@ -145,7 +145,9 @@ typedef enum {
 
 	DEC_SET_FRAME_DELAY,
 	ENC_SET_INTRA_REFRESH_MODE,
-	ENC_ENABLE_SOF_STUFF
+	ENC_ENABLE_SOF_STUFF,
+	GET_IRAM_PLAN,
+	ENC_GET_HEADER_CMD_SAVED
 } CodecCommand;
 
 typedef struct {
@@ -608,6 +610,10 @@ typedef struct {
 	EncReportInfo mbInfo;
 	EncReportInfo mvInfo;
 	EncReportInfo sliceInfo;
+
+	/* starting the next frame queued by vpu_EncQueueFrame(),
+	 * RETCODE_SUCCESS if it started or none was queued */
+	RetCode queueStatus;
 } EncOutputInfo;
 
 typedef struct {
@@ -643,6 +649,18 @@ typedef enum {
 	PPS_RBSP_MVC
 } AvcHeaderType;
 
+/* Secondary AXI IRAM placement chosen for an instance */
+typedef struct {
+	int iramSize;		/* total IRAM budget in bytes */
+	int iramUsed;		/* IRAM bytes placed for this instance */
+	int bwSaved;		/* estimated DDR bytes saved per frame */
+	int useMe;		/* motion estimation search ram, not on mx6 */
+	int useDbk;		/* deblocking line buffer */
+	int useBit;		/* BIT processor buffer */
+	int useIp;		/* intra prediction buffer */
+	int useOvl;		/* VC-1 overlap filter buffer */
+} IramPlanInfo;
+
 typedef struct {
 	Uint32 gopNumber;
 	Uint32 intraQp;
@@ -751,6 +769,7 @@ RetCode vpu_EncGetBitstreamBuffer(EncHandle handle, PhysicalAddress * prdPtr,
 				  PhysicalAddress * pwrPtr, Uint32 * size);
 RetCode vpu_EncUpdateBitstreamBuffer(EncHandle handle, Uint32 size);
 RetCode vpu_EncStartOneFrame(EncHandle handle, EncParam * param);
+RetCode vpu_EncQueueFrame(EncHandle handle, EncParam * param);
 RetCode vpu_EncGetOutputInfo(EncHandle handle, EncOutputInfo * info);
 RetCode vpu_EncGiveCommand(EncHandle handle, CodecCommand cmd, void *parameter);
 
@@ -17,6 +17,8 @@
 #include <errno.h>
 #include <pthread.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <signal.h>
 
 #include "vpu_util.h"
 #include "vpu_io.h"
@@ -55,8 +57,10 @@ static int fd_share;
 
 #ifdef BUILD_FOR_ANDROID
 #define FN_SHARE "/mnt/shm/vpu"
+#define FN_CACHE_TUNE "/data/vpu_cache_tune"
 #else
 #define FN_SHARE "/dev/shm/vpu"
+#define FN_CACHE_TUNE "/var/cache/vpu_cache_tune"
 #endif
 
 // thumbnail
@@ -249,6 +253,10 @@ RetCode DownloadBitCodeTable(unsigned long *virtCodeBuf, Uint16 *bit_code)
 	return RETCODE_SUCCESS;
 }
 
+#if !defined(BUILD_FOR_ANDROID) && !defined(FIFO_MUTEX)
+static int ReclaimDeadInstances(void);
+#endif
+
 /*
  * GetCodecInstance() obtains an instance.
  * It stores a pointer to the allocated instance in *ppInst
@@ -257,9 +265,10 @@ RetCode DownloadBitCodeTable(unsigned long *virtCodeBuf, Uint16 *bit_code)
  */
 RetCode GetCodecInstance(CodecInst ** ppInst)
 {
-	int i;
+	int i, retry = 0;
 	CodecInst *pCodecInst;
 
+again:
 	for (i = 0; i < MAX_NUM_INSTANCE; ++i) {
 		pCodecInst = (CodecInst *) (&vpu_shared_mem->codecInstPool[i]);
 		if (!pCodecInst->inUse)
@@ -267,6 +276,15 @@ RetCode GetCodecInstance(CodecInst ** ppInst)
 	}
 
 	if (i == MAX_NUM_INSTANCE) {
+#if !defined(BUILD_FOR_ANDROID) && !defined(FIFO_MUTEX)
+		/*
+		 * A process killed outside the API mutex leaves its instances
+		 * in use without the mutex ever reporting EOWNERDEAD, look for
+		 * them before giving up.
+		 */
+		if (!retry++ && ReclaimDeadInstances())
+			goto again;
+#endif
 		*ppInst = 0;
 		return RETCODE_FAILURE;
 	}
@@ -275,6 +293,7 @@ RetCode GetCodecInstance(CodecInst ** ppInst)
 	memset(pCodecInst, 0, sizeof(CodecInst));
 	pCodecInst->instIndex = i;
 	pCodecInst->inUse = 1;
+	pCodecInst->ownerPid = getpid();
 	*ppInst = pCodecInst;
 	return RETCODE_SUCCESS;
 }
@@ -364,6 +383,7 @@ RetCode CheckDecInstanceValidity(DecHandle handle)
 void FreeCodecInstance(CodecInst * pCodecInst)
 {
 	pCodecInst->inUse = 0;
+	pCodecInst->ownerPid = 0;
 }
 
 #ifdef MEM_PROTECT
@@ -867,6 +887,151 @@ void GetParaSet(EncHandle handle, int paraSetType, EncParamSet * para)
 	IOClkGateSet(false);
 }
 
+/*
+ * The parameter sets only change when an encoder parameter changes, so the
+ * last one read back from the VPU is kept per instance and served again
+ * without an ENC_PARA_SET command until InvalidateParaSetCache() is called.
+ */
+int GetCachedParaSet(EncInfo *pEncInfo, int type, EncParamSet *para)
+{
+	EncHeaderCache *cache = &pEncInfo->headerCache[type];
+
+	if (!cache->valid)
+		return 0;
+
+	para->paraSet = cache->data;
+	para->size = cache->size;
+	pEncInfo->headerCmdSaved++;
+	return 1;
+}
+
+void PutCachedParaSet(EncInfo *pEncInfo, int type, EncParamSet *para)
+{
+	EncHeaderCache *cache = &pEncInfo->headerCache[type];
+
+	if (para->size <= 0 || para->size > sizeof(cache->data))
+		return;
+
+	/* the parameter buffer is accessed in 32-bit words */
+	memcpy(cache->data, para->paraSet, (para->size + 3) & ~3);
+	cache->size = para->size;
+	cache->valid = 1;
+}
+
+/*
+ * ENC_PUT_AVC/MP4_HEADER make the VPU write the header into the bitstream
+ * buffer. When the header goes to a fixed place, at the start of a linear
+ * bitstream buffer on mx6 or at the buffer given by the caller with dynamic
+ * allocation, its bytes are saved from there after the command and written
+ * back on repeat requests, with the write pointer set as ENCODE_HEADER would.
+ * Ring buffer mode writes at the current write pointer and is not cached.
+ */
+static PhysicalAddress EncHeaderStart(CodecInst *pCodecInst,
+				      EncHeaderParam *encHeaderParam)
+{
+	EncInfo *pEncInfo = &pCodecInst->CodecInfo.encInfo;
+
+	if (cpu_is_mx6x() && (pEncInfo->ringBufferEnable == 0))
+		return pEncInfo->streamBufStartAddr;
+	if (!cpu_is_mx6x() && (pEncInfo->dynamicAllocEnable == 1))
+		return encHeaderParam->buf;
+	return 0;
+}
+
+static int EncHeaderProfile(EncHeaderParam *encHeaderParam)
+{
+	/* only sent to the VPU with VOS/SPS headers before mx6 */
+	if (cpu_is_mx6x() || !(encHeaderParam->headerType == VOS_HEADER ||
+			       encHeaderParam->headerType == SPS_RBSP))
+		return 0;
+	return (encHeaderParam->userProfileLevelIndication & 0xFF) << 8 |
+	       (encHeaderParam->userProfileLevelEnable & 0x01);
+}
+
+/*
+ * map [addr, addr + size) of the bitstream buffer, 0 if it cannot be; only
+ * its physical address is known, so IOGetVirtMem() would not map it on Android
+ */
+static Uint8 *EncHeaderMap(vpu_mem_desc *mem, PhysicalAddress addr, int size)
+{
+	PhysicalAddress page = addr & ~(getpagesize() - 1);
+
+	memset(mem, 0, sizeof(vpu_mem_desc));
+	mem->phy_addr = page;
+	mem->size = addr - page + size;
+	if (IOMapPhyMem(mem) == -1)
+		return 0;
+	return (Uint8 *)mem->virt_uaddr + (addr - page);
+}
+
+int GetCachedHeader(EncHandle handle, EncHeaderParam *encHeaderParam)
+{
+	CodecInst *pCodecInst = handle;
+	EncInfo *pEncInfo = &pCodecInst->CodecInfo.encInfo;
+	EncHeaderCache *cache;
+	PhysicalAddress start;
+	vpu_mem_desc mem;
+	Uint8 *p;
+
+	start = EncHeaderStart(pCodecInst, encHeaderParam);
+	if (!start || encHeaderParam->headerType < 0 ||
+	    encHeaderParam->headerType >= ENC_HDR_NUM - ENC_HDR_PUT)
+		return 0;
+
+	cache = &pEncInfo->headerCache[ENC_HDR_PUT + encHeaderParam->headerType];
+	if (!cache->valid || cache->profile != EncHeaderProfile(encHeaderParam))
+		return 0;
+	if (!cpu_is_mx6x() && encHeaderParam->size < cache->size)
+		return 0;
+
+	p = EncHeaderMap(&mem, start, cache->size);
+	if (p == 0)
+		return 0;
+	memcpy(p, cache->data, cache->size);
+	IOUnmapPhyMem(&mem);
+
+	pCodecInst->ctxRegs[CTX_BIT_WR_PTR] = start + cache->size;
+	encHeaderParam->buf = start;
+	encHeaderParam->size = cache->size;
+	pEncInfo->headerCmdSaved++;
+	return 1;
+}
+
+void PutCachedHeader(EncHandle handle, EncHeaderParam *encHeaderParam)
+{
+	CodecInst *pCodecInst = handle;
+	EncInfo *pEncInfo = &pCodecInst->CodecInfo.encInfo;
+	EncHeaderCache *cache;
+	vpu_mem_desc mem;
+	Uint8 *p;
+
+	if (encHeaderParam->buf != EncHeaderStart(pCodecInst, encHeaderParam) ||
+	    !encHeaderParam->buf || encHeaderParam->headerType < 0 ||
+	    encHeaderParam->headerType >= ENC_HDR_NUM - ENC_HDR_PUT ||
+	    encHeaderParam->size <= 0 ||
+	    encHeaderParam->size > sizeof(cache->data))
+		return;
+
+	cache = &pEncInfo->headerCache[ENC_HDR_PUT + encHeaderParam->headerType];
+	p = EncHeaderMap(&mem, encHeaderParam->buf, encHeaderParam->size);
+	if (p == 0)
+		return;
+	memcpy(cache->data, p, encHeaderParam->size);
+	IOUnmapPhyMem(&mem);
+
+	cache->size = encHeaderParam->size;
+	cache->profile = EncHeaderProfile(encHeaderParam);
+	cache->valid = 1;
+}
+
+void InvalidateParaSetCache(EncInfo *pEncInfo)
+{
+	int i;
+
+	for (i = 0; i < ENC_HDR_NUM; i++)
+		pEncInfo->headerCache[i].valid = 0;
+}
+
 void SetParaSet(DecHandle handle, int paraSetType, DecParamSet * para)
 {
 	CodecInst *pCodecInst;
@@ -1036,11 +1201,75 @@ RetCode SetHecMode(EncHandle handle, int mode)
 	return RETCODE_SUCCESS;
 }
 
+/*
+ * Secondary AXI IRAM planner.
+ * Every use case is a line buffer that the VPU writes and reads back once per
+ * macroblock row, so the DDR traffic it saves per frame is estimated as
+ * size * mbNumY * accesses. Instances time-share the VPU and run one picture
+ * at a time, so each instance plans against the whole IRAM budget.
+ */
+enum {
+	IRAM_USE_ME = 0,
+	IRAM_USE_DBK,
+	IRAM_USE_BIT,
+	IRAM_USE_IP,
+	IRAM_USE_OVL,
+	IRAM_USE_NUM	/* no VC-1 bit-plane buffer, i.MX53/i.MX6 keep it off */
+};
+
+/* DDR accesses per macroblock row avoided by each use case */
+static const int iram_use_access[IRAM_USE_NUM] = {
+	3,	/* ME search window is reloaded while sliding */
+	2,	/* deblocking line buffer */
+	1,	/* BIT processor buffer */
+	2,	/* intra prediction AC/DC line buffer */
+	2	/* VC-1 overlap filter line buffer */
+};
+
+/*
+ * PlanIramUse() returns the bitmask of use cases that fits in the budget and
+ * saves the most DDR bandwidth. A use case with zero size is not a candidate.
+ * There are at most IRAM_USE_NUM use cases, so every combination is tried.
+ */
+static int PlanIramUse(const int *size, int mbNumY, int budget,
+		       int *pUsed, int *pSaved)
+{
+	int mask, i, used, saved, valid;
+	int bestMask = 0, bestUsed = 0, bestSaved = 0;
+
+	for (mask = 1; mask < (1 << IRAM_USE_NUM); mask++) {
+		used = saved = 0;
+		valid = 1;
+		for (i = 0; i < IRAM_USE_NUM; i++) {
+			if (!(mask & (1 << i)))
+				continue;
+			if (!size[i]) {
+				valid = 0;
+				break;
+			}
+			used += size[i];
+			saved += size[i] * mbNumY * iram_use_access[i];
+		}
+		if (!valid || used > budget)
+			continue;
+		if (saved > bestSaved || (saved == bestSaved && used < bestUsed)) {
+			bestMask = mask;
+			bestUsed = used;
+			bestSaved = saved;
+		}
+	}
+
+	*pUsed = bestUsed;
+	*pSaved = bestSaved;
+	return bestMask;
+}
+
 void SetDecSecondAXIIRAM(SecAxiUse *psecAxiIramInfo, SetIramParam *parm)
 {
 	iram_t iram;
-	int size, dbk_size, bitram_size, ipacdc_size, ovl_size, btp_size;
-	int mbNumX, mbNumY;
+	int size[IRAM_USE_NUM];
+	int mbNumX, mbNumY, plan;
+	PhysicalAddress addr;
 
 	if (!parm->width) {
 		err_msg("Width is zero when calling SetDecSecondAXIIRAM function\n");
@@ -1048,61 +1277,49 @@ void SetDecSecondAXIIRAM(SecAxiUse *psecAxiIramInfo, SetIramParam *parm)
 	}
 
 	memset(psecAxiIramInfo, 0, sizeof(SecAxiUse));
+	memset(size, 0, sizeof(size));
 
 	IOGetIramBase(&iram);
-	size = iram.end - iram.start + 1;
+	psecAxiIramInfo->iramSize = iram.end - iram.start + 1;
 
 	mbNumX = (parm->width + 15 ) / 16;
 	mbNumY = (parm->height + 15 ) / 16;
 
-	/* Setting internal iram usage per priority when iram isn't enough */
 	if ((parm->codecMode == VC1_DEC) && (parm->profile == 2))
-		dbk_size = (512 * mbNumX + 1023) & ~1023;
+		size[IRAM_USE_DBK] = (512 * mbNumX + 1023) & ~1023;
 	else
-		dbk_size = (256 * mbNumX + 1023) & ~1023;
+		size[IRAM_USE_DBK] = (256 * mbNumX + 1023) & ~1023;
+	size[IRAM_USE_BIT] = (128 * mbNumX + 1023) & ~1023;
+	size[IRAM_USE_IP] = (128 * mbNumX + 1023) & ~1023;
+	if (parm->codecMode == VC1_DEC)
+		size[IRAM_USE_OVL] = (80 * mbNumX + 1023) & ~1023;
 
-	if (size >= dbk_size) {
-		psecAxiIramInfo->useHostDbkEnable = 1;
-		psecAxiIramInfo->bufDbkYUse = iram.start;
-		psecAxiIramInfo->bufDbkCUse = iram.start + dbk_size / 2;
-		size -= dbk_size;
-	} else
-		goto out;
+	plan = PlanIramUse(size, mbNumY, psecAxiIramInfo->iramSize,
+			   &psecAxiIramInfo->iramUsed, &psecAxiIramInfo->bwSaved);
 
-	bitram_size = (128 * mbNumX + 1023) & ~1023;
-	if (size >= bitram_size) {
+	addr = iram.start;
+	if (plan & (1 << IRAM_USE_DBK)) {
+		psecAxiIramInfo->useHostDbkEnable = 1;
+		psecAxiIramInfo->bufDbkYUse = addr;
+		psecAxiIramInfo->bufDbkCUse = addr + size[IRAM_USE_DBK] / 2;
+		addr += size[IRAM_USE_DBK];
+	}
+	if (plan & (1 << IRAM_USE_BIT)) {
 		psecAxiIramInfo->useHostBitEnable = 1;
-		psecAxiIramInfo->bufBitUse = psecAxiIramInfo->bufDbkCUse + dbk_size / 2;
-		size -= bitram_size;
-	} else
-		goto out;
-
-	ipacdc_size = (128 * mbNumX + 1023) & ~1023;
-	if (size >= ipacdc_size) {
+		psecAxiIramInfo->bufBitUse = addr;
+		addr += size[IRAM_USE_BIT];
+	}
+	if (plan & (1 << IRAM_USE_IP)) {
 		psecAxiIramInfo->useHostIpEnable = 1;
-		psecAxiIramInfo->bufIpAcDcUse = psecAxiIramInfo->bufBitUse + bitram_size;
-		size -= ipacdc_size;
-	} else
-		goto out;
-
-	ovl_size = (80 * mbNumX + 1023) & ~1023;
-	if (parm->codecMode == VC1_DEC) {
-		if (size >= ovl_size) {
-			psecAxiIramInfo->useHostOvlEnable = 1;
-			psecAxiIramInfo->bufOvlUse = psecAxiIramInfo->bufIpAcDcUse + ipacdc_size;
-			size -= ovl_size;
-		} else
-			goto out;
-		if (cpu_is_mx6x()) {
-			btp_size = ((((mbNumX + 15) / 16) * mbNumY + 1) * 6 + 255) & ~255;
-			if (size >= btp_size) {
-				psecAxiIramInfo->useHostBtpEnable = 1;
-				psecAxiIramInfo->bufBtpUse = psecAxiIramInfo->bufOvlUse + ovl_size;
-				size -= btp_size;
-			}
-		}
+		psecAxiIramInfo->bufIpAcDcUse = addr;
+		addr += size[IRAM_USE_IP];
 	}
-out:
+	if (plan & (1 << IRAM_USE_OVL)) {
+		psecAxiIramInfo->useHostOvlEnable = 1;
+		psecAxiIramInfo->bufOvlUse = addr;
+		addr += size[IRAM_USE_OVL];
+	}
+
 	/* i.MX51 has no secondary AXI memory, but use on chip RAM
 	   Set the useHoseXXX as 1 to enable corresponding IRAM
 	   Set the useXXXX as 0 at the same time to use IRAM,
@@ -1117,6 +1334,12 @@ out:
 		psecAxiIramInfo->useBtpEnable = psecAxiIramInfo->useHostBtpEnable = 0;
 	}
 
+	dprintf(3, "dec iram plan: dbk %d bit %d ip %d ovl %d, used %d/%d, saved %d bytes/frame\n",
+		psecAxiIramInfo->useHostDbkEnable, psecAxiIramInfo->useHostBitEnable,
+		psecAxiIramInfo->useHostIpEnable, psecAxiIramInfo->useHostOvlEnable,
+		psecAxiIramInfo->iramUsed, psecAxiIramInfo->iramSize,
+		psecAxiIramInfo->bwSaved);
+
 	if (((parm->codecMode == VC1_DEC) && !psecAxiIramInfo->useHostOvlEnable) ||
 	    !psecAxiIramInfo->useHostIpEnable)
 		warn_msg("VPU iram is less than needed, some parts don't use iram\n");
@@ -1125,7 +1348,9 @@ out:
 void SetEncSecondAXIIRAM(SecAxiUse *psecAxiIramInfo, SetIramParam *parm)
 {
 	iram_t iram;
-	int size, dbk_size, bitram_size, ipacdc_size, mbNumX;
+	int size[IRAM_USE_NUM];
+	int mbNumX, mbNumY, plan;
+	PhysicalAddress addr;
 
 	if (!parm->width) {
 		err_msg("Width is zero when calling SetEncSecondAXIIRAM function\n");
@@ -1133,59 +1358,55 @@ void SetEncSecondAXIIRAM(SecAxiUse *psecAxiIramInfo, SetIramParam *parm)
 	}
 
 	memset(psecAxiIramInfo, 0, sizeof(SecAxiUse));
+	memset(size, 0, sizeof(size));
 
 	IOGetIramBase(&iram);
-	size = iram.end - iram.start + 1;
+	psecAxiIramInfo->iramSize = iram.end - iram.start + 1;
 
 	mbNumX = (parm->width + 15 ) / 16;
+	mbNumY = (parm->height + 15 ) / 16;
 
-	if (cpu_is_mx6x()) {
-		psecAxiIramInfo->searchRamSize = 0;
-		psecAxiIramInfo->searchRamAddr = 0;
-		goto set_dbk;
+	/* i.MX6 has no search ram, other chips fall back to DRAM for it */
+	if (!cpu_is_mx6x()) {
+		psecAxiIramInfo->searchRamSize = (parm->width * 36 + 2048 + 1023) & ~1023;
+		size[IRAM_USE_ME] = psecAxiIramInfo->searchRamSize;
 	}
 
-	/* Setting internal iram usage per priority when iram isn't enough */
-	psecAxiIramInfo->searchRamSize = (parm->width * 36 + 2048 + 1023) & ~1023;
-	if (size >= psecAxiIramInfo->searchRamSize) {
+	/* Only H.264BP and H.263P3 are considered */
+	size[IRAM_USE_DBK] = (128 * mbNumX + 1023) & ~1023;
+	size[IRAM_USE_BIT] = (128 * mbNumX + 1023) & ~1023;
+	size[IRAM_USE_IP] = (128 * mbNumX + 1023) & ~1023;
+
+	plan = PlanIramUse(size, mbNumY, psecAxiIramInfo->iramSize,
+			   &psecAxiIramInfo->iramUsed, &psecAxiIramInfo->bwSaved);
+
+	addr = iram.start;
+	if (plan & (1 << IRAM_USE_ME)) {
 		psecAxiIramInfo->useHostMeEnable = 1;
-		psecAxiIramInfo->searchRamAddr = iram.start;
-		size -= psecAxiIramInfo->searchRamSize;
-	} else {
+		psecAxiIramInfo->searchRamAddr = addr;
+		addr += size[IRAM_USE_ME];
+	} else if (size[IRAM_USE_ME])
 		err_msg("VPU iram is less than search ram size\n");
-		goto out;
-	}
-
-set_dbk:
-	/* Only H.264BP and H.263P3 are considered */
-	dbk_size = (128 * mbNumX + 1023) & ~1023;
-	if (size >= dbk_size) {
+	if (plan & (1 << IRAM_USE_DBK)) {
 		psecAxiIramInfo->useHostDbkEnable = 1;
-		psecAxiIramInfo->bufDbkYUse = iram.start + psecAxiIramInfo->searchRamSize;
-		psecAxiIramInfo->bufDbkCUse = psecAxiIramInfo->bufDbkYUse + dbk_size / 2;
-		size -= dbk_size;
-	} else
-		goto out;
-
-	bitram_size = (128 * mbNumX + 1023) & ~1023;
-	if (size >= bitram_size) {
+		psecAxiIramInfo->bufDbkYUse = addr;
+		psecAxiIramInfo->bufDbkCUse = addr + size[IRAM_USE_DBK] / 2;
+		addr += size[IRAM_USE_DBK];
+	}
+	if (plan & (1 << IRAM_USE_BIT)) {
 		psecAxiIramInfo->useHostBitEnable = 1;
-		psecAxiIramInfo->bufBitUse = psecAxiIramInfo->bufDbkCUse + dbk_size / 2;
-		size -= bitram_size;
-	} else
-		goto out;
-
-	ipacdc_size = (128 * mbNumX + 1023) & ~1023;
-	if (size >= ipacdc_size) {
+		psecAxiIramInfo->bufBitUse = addr;
+		addr += size[IRAM_USE_BIT];
+	}
+	if (plan & (1 << IRAM_USE_IP)) {
 		psecAxiIramInfo->useHostIpEnable = 1;
-		psecAxiIramInfo->bufIpAcDcUse = psecAxiIramInfo->bufBitUse + bitram_size;
-		size -= ipacdc_size;
+		psecAxiIramInfo->bufIpAcDcUse = addr;
+		addr += size[IRAM_USE_IP];
 	}
 
 	psecAxiIramInfo->useHostOvlEnable = 0; /* no need to enable ovl in encoder */
 	psecAxiIramInfo->useBtpEnable = 0;
 
-out:
 	/* i.MX51 has no secondary AXI memory, but use on chip RAM
 	   Set the useHoseXXX as 1 to enable corresponding IRAM
 	   Set the useXXXX as 0 at the same time to use IRAM,
@@ -1199,12 +1420,42 @@ out:
 		psecAxiIramInfo->useMeEnable = psecAxiIramInfo->useHostMeEnable;
 	}
 
+	dprintf(3, "enc iram plan: me %d dbk %d bit %d ip %d, used %d/%d, saved %d bytes/frame\n",
+		psecAxiIramInfo->useHostMeEnable, psecAxiIramInfo->useHostDbkEnable,
+		psecAxiIramInfo->useHostBitEnable, psecAxiIramInfo->useHostIpEnable,
+		psecAxiIramInfo->iramUsed, psecAxiIramInfo->iramSize,
+		psecAxiIramInfo->bwSaved);
+
 	if (!psecAxiIramInfo->useHostIpEnable)
 		warn_msg("VPU iram is less than needed, some parts don't use iram\n");
 }
 
-void SetMaverickCache(MaverickCacheConfig *pCacheConf, int mapType, int chromInterleave)
+/*
+ * Maverick cache candidates benchmarked in tuning mode. Candidate 0 is the
+ * default configuration; the others change the page merge mode, the split of
+ * the 48 buffer units between luma and chroma, or bypass the cache.
+ */
+static const struct {
+	int pageMerge;		/* -1 keeps the default of the map type */
+	int lumaBufferSize;
+	int bypass;
+} maverick_cache_cand[MAVERICK_CACHE_CAND_NUM] = {
+	{ -1, 32, 0 },
+	{  1, 32, 0 },
+	{  0, 32, 0 },
+	{ -1, 24, 0 },
+	{ -1, 40, 0 },
+	{ -1, 32, 1 }
+};
+
+void SetMaverickCacheCand(MaverickCacheConfig *pCacheConf, int mapType,
+			  int chromInterleave, int cand)
 {
+	int chromaBufferSize;
+
+	if (cand < 0 || cand >= MAVERICK_CACHE_CAND_NUM)
+		cand = 0;
+
 	if (mapType == LINEAR_FRAME_MAP) {
 		/* Set luma */
 		pCacheConf->luma.cfg.PageSizeX = 2;
@@ -1231,18 +1482,251 @@ void SetMaverickCache(MaverickCacheConfig *pCacheConf, int mapType, int chromInt
 		pCacheConf->PageMerge = 1;
 	}
 
-	pCacheConf->Bypass = 0; /* cache enable */
+	if (maverick_cache_cand[cand].pageMerge >= 0)
+		pCacheConf->PageMerge = maverick_cache_cand[cand].pageMerge;
+
+	pCacheConf->Bypass = maverick_cache_cand[cand].bypass;
 	pCacheConf->DualConf = 0;
-	pCacheConf->LumaBufferSize = 32;
+	pCacheConf->LumaBufferSize = maverick_cache_cand[cand].lumaBufferSize;
+	chromaBufferSize = 48 - maverick_cache_cand[cand].lumaBufferSize;
 	if (chromInterleave) {
 		pCacheConf->CbBufferSize = 0;
-		pCacheConf->CrBufferSize = 0x10;
+		pCacheConf->CrBufferSize = chromaBufferSize;
 	} else {
-		pCacheConf->CbBufferSize = 8;
-		pCacheConf->CrBufferSize = 8;
+		pCacheConf->CbBufferSize = chromaBufferSize / 2;
+		pCacheConf->CrBufferSize = chromaBufferSize / 2;
 	}
 }
 
+void SetMaverickCache(MaverickCacheConfig *pCacheConf, int mapType, int chromInterleave)
+{
+	SetMaverickCacheCand(pCacheConf, mapType, chromInterleave, 0);
+}
+
+/*
+ * Maverick cache tuning file, one text line per stream type:
+ *   <codecMode> <width> <height> <mapType> <chromaInterleave> <us0> ... <us5>
+ * usN is the measured decode time per frame in microseconds of candidate N,
+ * 0 if the candidate has not been benchmarked yet.
+ *
+ * Each benchmark run is reported as:
+ *   vpu cache tune: codec C WxH map M ci I cand N: F frames, T us/frame
+ */
+#define MAX_CACHE_TUNE_ENTRY	64
+
+typedef struct {
+	int codecMode;
+	int width;
+	int height;
+	int mapType;
+	int chromInterleave;
+	int usPerFrame[MAVERICK_CACHE_CAND_NUM];
+} CacheTuneEntry;
+
+static const char *cache_tune_file(void)
+{
+	char *file_env;
+
+	file_env = getenv("VPU_CACHE_TUNE_FILE");
+	return file_env ? file_env : FN_CACHE_TUNE;
+}
+
+/*
+ * Table of the tuning file, read once per process. In tuning mode it is read
+ * again when another process has changed the file.
+ */
+static CacheTuneEntry cache_tune[MAX_CACHE_TUNE_ENTRY];
+static int cache_tune_num = -1;
+static time_t cache_tune_mtime;
+static off_t cache_tune_size;
+static pthread_mutex_t cache_tune_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int read_cache_tune(FILE *fp, CacheTuneEntry *entry, int max)
+{
+	int i, num = 0;
+	CacheTuneEntry *e;
+
+	while (num < max) {
+		e = &entry[num];
+		if (fscanf(fp, "%d %d %d %d %d", &e->codecMode, &e->width,
+			   &e->height, &e->mapType, &e->chromInterleave) != 5)
+			break;
+		for (i = 0; i < MAVERICK_CACHE_CAND_NUM; i++)
+			if (fscanf(fp, "%d", &e->usPerFrame[i]) != 1)
+				break;
+		if (i != MAVERICK_CACHE_CAND_NUM)
+			break;
+		num++;
+	}
+
+	return num;
+}
+
+static void write_cache_tune(FILE *fp, CacheTuneEntry *entry, int num)
+{
+	int i, j;
+
+	for (i = 0; i < num; i++) {
+		fprintf(fp, "%d %d %d %d %d", entry[i].codecMode, entry[i].width,
+			entry[i].height, entry[i].mapType, entry[i].chromInterleave);
+		for (j = 0; j < MAVERICK_CACHE_CAND_NUM; j++)
+			fprintf(fp, " %d", entry[i].usPerFrame[j]);
+		fprintf(fp, "\n");
+	}
+}
+
+/* called with cache_tune_lock held */
+static void load_cache_tune(int reload)
+{
+	struct stat st;
+	FILE *fp;
+
+	if (cache_tune_num >= 0 && !reload)
+		return;
+
+	if (stat(cache_tune_file(), &st) < 0) {
+		cache_tune_num = 0;
+		return;
+	}
+	if (cache_tune_num >= 0 && st.st_mtime == cache_tune_mtime &&
+	    st.st_size == cache_tune_size)
+		return;
+
+	cache_tune_num = 0;
+	fp = fopen(cache_tune_file(), "r");
+	if (fp == NULL)
+		return;
+
+	flock(fileno(fp), LOCK_SH);
+	cache_tune_num = read_cache_tune(fp, cache_tune, MAX_CACHE_TUNE_ENTRY);
+	if (fstat(fileno(fp), &st) == 0) {
+		cache_tune_mtime = st.st_mtime;
+		cache_tune_size = st.st_size;
+	}
+	fclose(fp);
+}
+
+static CacheTuneEntry *find_cache_tune(CacheTuneEntry *entry, int num,
+		int codecMode, int width, int height, int mapType, int chromInterleave)
+{
+	int i;
+
+	for (i = 0; i < num; i++) {
+		if (entry[i].codecMode == codecMode && entry[i].width == width &&
+		    entry[i].height == height && entry[i].mapType == mapType &&
+		    entry[i].chromInterleave == chromInterleave)
+			return &entry[i];
+	}
+	return NULL;
+}
+
+/*
+ * GetMaverickCacheCand() returns the candidate to use for a stream. If
+ * *pTuning is set on input, it is the next candidate not benchmarked yet;
+ * otherwise, or once all candidates are benchmarked, it is the fastest one
+ * and *pTuning is cleared. The default configuration 0 is returned if the
+ * stream type has no record.
+ */
+int GetMaverickCacheCand(int codecMode, int width, int height, int mapType,
+			 int chromInterleave, int *pTuning)
+{
+	CacheTuneEntry *e;
+	int i, best = 0;
+
+	pthread_mutex_lock(&cache_tune_lock);
+	load_cache_tune(*pTuning);
+	e = find_cache_tune(cache_tune, cache_tune_num, codecMode, width, height,
+			    mapType, chromInterleave);
+	if (e == NULL)
+		goto out;
+
+	if (*pTuning) {
+		for (i = 0; i < MAVERICK_CACHE_CAND_NUM; i++)
+			if (!e->usPerFrame[i]) {
+				best = i;
+				goto out;
+			}
+		*pTuning = 0;
+	}
+
+	for (i = 1; i < MAVERICK_CACHE_CAND_NUM; i++) {
+		if (e->usPerFrame[i] &&
+		    (!e->usPerFrame[best] || e->usPerFrame[i] < e->usPerFrame[best]))
+			best = i;
+	}
+out:
+	pthread_mutex_unlock(&cache_tune_lock);
+	return best;
+}
+
+/*
+ * Record a benchmark run. The file is updated under an exclusive flock() so
+ * that concurrent decoders do not lose each other's results; callers must
+ * not hold the VPU lock.
+ */
+void PutMaverickCacheTime(int codecMode, int width, int height, int mapType,
+			  int chromInterleave, int cand, int frames, int usPerFrame)
+{
+	CacheTuneEntry entry[MAX_CACHE_TUNE_ENTRY];
+	CacheTuneEntry *e;
+	struct stat st;
+	FILE *fp;
+	int fd, num;
+
+	if (cand < 0 || cand >= MAVERICK_CACHE_CAND_NUM || usPerFrame <= 0)
+		return;
+
+	info_msg("vpu cache tune: codec %d %dx%d map %d ci %d cand %d: %d frames, %d us/frame\n",
+		 codecMode, width, height, mapType, chromInterleave, cand,
+		 frames, usPerFrame);
+
+	fd = open(cache_tune_file(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0 || (fp = fdopen(fd, "r+")) == NULL) {
+		warn_msg("Unable to write %s\n", cache_tune_file());
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+	flock(fd, LOCK_EX);
+
+	num = read_cache_tune(fp, entry, MAX_CACHE_TUNE_ENTRY);
+	e = find_cache_tune(entry, num, codecMode, width, height, mapType,
+			    chromInterleave);
+	if (e == NULL) {
+		if (num == MAX_CACHE_TUNE_ENTRY) {
+			warn_msg("vpu cache tune file is full\n");
+			fclose(fp);
+			return;
+		}
+		e = &entry[num++];
+		memset(e, 0, sizeof(CacheTuneEntry));
+		e->codecMode = codecMode;
+		e->width = width;
+		e->height = height;
+		e->mapType = mapType;
+		e->chromInterleave = chromInterleave;
+	}
+	e->usPerFrame[cand] = usPerFrame;
+
+	rewind(fp);
+	write_cache_tune(fp, entry, num);
+	fflush(fp);
+	if (ftruncate(fd, ftell(fp)) < 0)
+		warn_msg("Unable to truncate %s\n", cache_tune_file());
+
+	pthread_mutex_lock(&cache_tune_lock);
+	memcpy(cache_tune, entry, num * sizeof(CacheTuneEntry));
+	cache_tune_num = num;
+	if (fstat(fd, &st) == 0) {
+		cache_tune_mtime = st.st_mtime;
+		cache_tune_size = st.st_size;
+	}
+	pthread_mutex_unlock(&cache_tune_lock);
+
+	/* fclose() drops the flock */
+	fclose(fp);
+}
+
 static void *get_shared_buf(int size, int create) {
 	int ret;
 	void *buf;
@@ -1500,6 +1984,56 @@ void semaphore_post(semaphore_t *semap, int mutex)
 		pthread_mutex_unlock(&semap->reg_lock);
 }
 
+#if !defined(BUILD_FOR_ANDROID) && !defined(FIFO_MUTEX)
+/*
+ * ReclaimDeadInstances() frees the instances whose owner process has died.
+ * It is called with the API mutex held, right after a robust mutex reports
+ * EOWNERDEAD or when no instance is left, so the other sessions can continue
+ * without a full VPU reset. The VPU is only reset if the dead instance was
+ * the one running a frame. Returns the number of instances freed.
+ */
+static int ReclaimDeadInstances(void)
+{
+	int i, reclaimed = 0;
+	CodecInst *pCodecInst;
+	CodecInst **ppendingInst = (CodecInst **)(&vpu_shared_mem->pendingInst);
+	unsigned long instIndexSave;
+
+	for (i = 0; i < MAX_NUM_INSTANCE; ++i) {
+		pCodecInst = (CodecInst *) (&vpu_shared_mem->codecInstPool[i]);
+		if (!pCodecInst->inUse || pCodecInst->ownerPid <= 0)
+			continue;
+		if (kill(pCodecInst->ownerPid, 0) == 0 || errno != ESRCH)
+			continue;
+
+		warn_msg("reclaim instance %d of dead process %d\n",
+			 pCodecInst->instIndex, pCodecInst->ownerPid);
+
+		if (*ppendingInst == pCodecInst) {
+			*ppendingInst = 0;
+			IOClkGateSet(true);
+			if (cpu_is_mx6x() && VpuReadReg(BIT_BUSY_FLAG)) {
+				/* only reset the BPU/VCE, keep other contexts */
+				vpu_mx6_swreset(0);
+			}
+			/* BIT_RUN_INDEX must not refer to the reclaimed instance */
+			instIndexSave = VpuReadReg(BIT_RUN_INDEX);
+			if (instIndexSave == pCodecInst->instIndex)
+				VpuWriteReg(BIT_RUN_INDEX, MAX_NUM_INSTANCE);
+			IOClkGateSet(false);
+		}
+
+		FreeCodecInstance(pCodecInst);
+		reclaimed++;
+	}
+
+	if (reclaimed)
+		info_msg("%d instance(s) reclaimed from dead process\n", reclaimed);
+
+	return reclaimed;
+}
+#endif
+
 unsigned char semaphore_wait(semaphore_t *semap, int mutex)
 {
 	int ret = -1;
@@ -1532,13 +2066,19 @@ unsigned char semaphore_wait(semaphore_t *semap, int mutex)
 #ifndef BUILD_FOR_ANDROID
 		if (ret == EOWNERDEAD) {
 			pthread_mutex_consistent(&semap->api_lock);
+			ReclaimDeadInstances();
 			ret = 0;
 		}
 #endif
 	}
 #endif
-	else if (mutex == REG_MUTEX)
+	else if (mutex == REG_MUTEX) {
 		ret = pthread_mutex_timedlock(&semap->reg_lock, &ts);
+		if (ret == EOWNERDEAD) {
+			pthread_mutex_consistent(&semap->reg_lock);
+			ret = 0;
+		}
+	}
 	else
 		warn_msg("Not supported mutex\n");
 	if (ret) {
@@ -23,6 +23,10 @@
 
 #define MAX_FW_BINARY_LEN		200 * 1024
 
+#define MAVERICK_CACHE_CAND_NUM		6
+#define MAVERICK_CACHE_TUNE_SKIP	5	/* warm-up frames not timed */
+#define MAVERICK_CACHE_TUNE_FRAMES	60
+
 typedef enum {
 	INT_BIT_PIC_RUN = 3,
 	INT_BIT_BIT_BUF_EMPTY = 14,
@@ -280,6 +284,9 @@ typedef struct {
 	PhysicalAddress searchRamAddr;
 	int searchRamSize;
 
+	int iramSize;	/* IRAM budget seen by the planner */
+	int iramUsed;	/* IRAM bytes placed */
+	int bwSaved;	/* estimated DDR bytes saved per frame */
 } SecAxiUse;
 
 typedef struct CacheSizeCfg {
@@ -332,6 +339,34 @@ typedef struct {
 	int profile;
 } SetIramParam;
 
+/* Parameter sets kept by the encoder header cache */
+enum {
+	ENC_HDR_SPS = 0,
+	ENC_HDR_PPS,
+	ENC_HDR_VOS,
+	ENC_HDR_VO,
+	ENC_HDR_VOL,
+	ENC_HDR_PUT,		/* ENC_PUT_AVC/MP4_HEADER, one per headerType */
+	ENC_HDR_NUM = ENC_HDR_PUT + 4
+};
+
+#define ENC_HDR_CACHE_SIZE	256
+
+typedef struct {
+	int valid;
+	int size;
+	int profile;		/* userProfileLevel fields the header was made with */
+	Uint32 data[ENC_HDR_CACHE_SIZE / sizeof(Uint32)];
+} EncHeaderCache;
+
+/* Frames that can wait behind the one being encoded */
+#define ENC_QUEUE_DEPTH		2
+
+typedef struct {
+	EncParam param;
+	FrameBuffer srcFrame;	/* copy, param.sourceFrame points here */
+} EncQueueEntry;
+
 typedef struct {
 	unsigned subFrameSyncOn : 1;
 	unsigned sourceBufNumber : 7;
@@ -407,6 +442,14 @@ typedef struct {
 
 	int intraRefreshMode;
 
+	EncHeaderCache headerCache[ENC_HDR_NUM];
+	int headerCmdSaved;	/* header commands served from the cache */
+
+	EncQueueEntry encQueue[ENC_QUEUE_DEPTH];
+	int encQueueHead;
+	int encQueueCount;
+	int encQueueRunning;	/* the running frame was queued */
+	PhysicalAddress encOutWrPtr;	/* BIT_WR_PTR when the last frame was collected */
 } EncInfo;
 
 typedef struct {
@@ -538,11 +581,20 @@ typedef struct {
 	DecReportInfo decReportUserData;
 	int frame_delay;
 	int decoded_pictype[32];
+
+	int cacheTuneCand;	/* Maverick cache candidate, -1 if not tuning */
+	int cacheTuneSkip;	/* warm-up frames decoded */
+	int cacheTuneFrames;	/* timed frames */
+	Int64 cacheTuneTime;	/* accumulated decode time in us */
+	struct timeval cacheTuneStart;
+	struct timeval cacheTuneEnd;
+	int cacheTuneEnded;	/* cacheTuneEnd is set for the current frame */
 } DecInfo;
 
 typedef struct CodecInst {
 	int instIndex;
 	int inUse;
+	pid_t ownerPid; /* process that opened the instance */
 	int codecMode;
 	int codecModeAux;
 	vpu_mem_desc contextBufMem; /* For context buffer */
@@ -631,6 +683,11 @@ RetCode CheckEncOpenParam(EncOpenParam * pop);
 RetCode CheckEncParam(CodecInst * pCodecInst, EncParam * param);
 void EncodeHeader(EncHandle handle, EncHeaderParam * encHeaderParam);
 void GetParaSet(EncHandle handle, int paraSetType, EncParamSet * para);
+int GetCachedParaSet(EncInfo *pEncInfo, int type, EncParamSet *para);
+void PutCachedParaSet(EncInfo *pEncInfo, int type, EncParamSet *para);
+void InvalidateParaSetCache(EncInfo *pEncInfo);
+int GetCachedHeader(EncHandle handle, EncHeaderParam *encHeaderParam);
+void PutCachedHeader(EncHandle handle, EncHeaderParam *encHeaderParam);
 
 RetCode CheckDecInstanceValidity(DecHandle handle);
 RetCode CheckDecOpenParam(DecOpenParam * pop);
@@ -649,6 +706,12 @@ RetCode SetHecMode(EncHandle handle, int mode);
 void SetDecSecondAXIIRAM(SecAxiUse *psecAxiIramInfo, SetIramParam *parm);
 void SetEncSecondAXIIRAM(SecAxiUse *psecAxiIramInfo, SetIramParam *parm);
 void SetMaverickCache(MaverickCacheConfig *pCacheConf, int mapType, int chromInterleave);
+void SetMaverickCacheCand(MaverickCacheConfig *pCacheConf, int mapType,
+			  int chromInterleave, int cand);
+int GetMaverickCacheCand(int codecMode, int width, int height, int mapType,
+			 int chromInterleave, int *pTuning);
+void PutMaverickCacheTime(int codecMode, int width, int height, int mapType,
+			  int chromInterleave, int cand, int frames, int usPerFrame);
 
 shared_mem_t *vpu_semaphore_open(void);
 void semaphore_post(semaphore_t *semap, int mutex);